@@ -6,9 +6,28 @@
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
 #include <sys/mman.h>
 
 #include "spooky.h"
+#include "spooky_inline.h"
+#include "spooky_map.h"
+#include "spooky_bloom.h"
+#include "spooky_hll.h"
+#include "spooky_cdc.h"
+#include "spooky_merkle.h"
+#include "spooky_mgr.h"
+#include "spooky_service.h"
+#include "spooky_column.h"
+#include "spooky_partition.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "spooky_io.h"
+#endif
 
 static inline uint32_t
 xorshift32(uint32_t *const p_rng)
@@ -43,9 +62,2103 @@ randfill(void *const p_dst, uint64_t const p_nbytes, uint32_t p_seed)
 #define MAPSIZE UINT64_C(0x800000)
 #define NLOOPS (55555)
 
+#define MULTI_NMSGS 1024
+#define MULTI_NLOOPS 200
+
+static uint64_t
+elapsed_ns(struct timespec const*const p_start, struct timespec const*const p_end)
+{
+    return (p_end->tv_sec - p_start->tv_sec)*1000000000ull + (p_end->tv_nsec - p_start->tv_nsec);
+}
+
+// Hash a batch of 4-64 KiB messages one at a time and then through
+// spooky_hash128_multi with every kernel variant this CPU supports, and
+// report the aggregate rate of each.
+static int
+bench_multi(void)
+{
+    unsigned *buff = mmap(0, MAPSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(buff, MAPSIZE, rng);
+
+    static void const*msgs[MULTI_NMSGS];
+    static size_t lens[MULTI_NMSGS];
+    static uint64_t h1[MULTI_NMSGS];
+    static uint64_t h2[MULTI_NMSGS];
+
+    uint64_t total_data = 0;
+    for (int i = 0; i < MULTI_NMSGS; ++i) {
+        lens[i] = 0x1000 + xorshift32(&rng) % 0xf000;
+        msgs[i] = (unsigned char *)buff + xorshift32(&rng) % (MAPSIZE - lens[i]);
+        total_data += lens[i];
+    }
+    total_data *= MULTI_NLOOPS;
+
+    struct timespec start,end;
+    uint64_t carry_forward = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int j = 0; j < MULTI_NLOOPS; ++j) {
+        for (int i = 0; i < MULTI_NMSGS; ++i) {
+            h1[i] = h2[i] = carry_forward;
+            spooky_hash128(msgs[i], lens[i], &h1[i], &h2[i]);
+        }
+        carry_forward ^= h1[j % MULTI_NMSGS];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const single_ns = elapsed_ns(&start, &end);
+
+    printf("Total bytes %" PRIu64 "\n", total_data);
+    printf("spooky_hash128              %f GB/s\n", 1.0*total_data / single_ns);
+
+    for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+        if (!spooky_set_impl(impl)) {
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < MULTI_NLOOPS; ++j) {
+            for (int i = 0; i < MULTI_NMSGS; ++i) {
+                h1[i] = h2[i] = carry_forward;
+            }
+            spooky_hash128_multi(msgs, lens, MULTI_NMSGS, h1, h2);
+            carry_forward ^= h1[j % MULTI_NMSGS];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t const multi_ns = elapsed_ns(&start, &end);
+
+        printf("spooky_hash128_multi %-6s %f GB/s\n", spooky_impl_name(impl), 1.0*total_data / multi_ns);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    return 0;
+}
+
+#define KEYS_NKEYS 4096
+#define KEYS_NLOOPS 2000
+
+// Hash arrays of 8, 16 and 32 byte keys one spooky_hash64 call at a time and
+// then with spooky_hash64_keys under every supported kernel variant, and
+// report keys per second for each.
+static int
+bench_keys(void)
+{
+    static uint64_t keys[KEYS_NKEYS * 4];
+    static uint64_t out[KEYS_NKEYS];
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(keys, sizeof(keys), rng);
+
+    static size_t const widths[] = {8, 16, 32};
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w) {
+        size_t const width = widths[w];
+        unsigned char const*const lkeys = (unsigned char const*)keys;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < KEYS_NLOOPS; ++j) {
+            for (size_t i = 0; i < KEYS_NKEYS; ++i) {
+                out[i] = spooky_hash64(lkeys + i * width, width, carry_forward);
+            }
+            carry_forward ^= out[j % KEYS_NKEYS];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t const single_ns = elapsed_ns(&start, &end);
+
+        double const nkeys = 1.0 * KEYS_NKEYS * KEYS_NLOOPS;
+        printf("%2zu byte keys: spooky_hash64             %f Mkeys/s\n", width, nkeys * 1000.0 / single_ns);
+
+        for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+            if (!spooky_set_impl(impl)) {
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int j = 0; j < KEYS_NLOOPS; ++j) {
+                spooky_hash64_keys(lkeys, width, KEYS_NKEYS, carry_forward, out);
+                carry_forward ^= out[j % KEYS_NKEYS];
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            uint64_t const batch_ns = elapsed_ns(&start, &end);
+
+            printf("%2zu byte keys: spooky_hash64_keys %-6s %f Mkeys/s\n",
+                width, spooky_impl_name(impl), nkeys * 1000.0 / batch_ns);
+        }
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    return 0;
+}
+
+#define TREE_MAPSIZE (UINT64_C(256) << 20)
+#define TREE_NLOOPS 8
+
+// Hash one big buffer with spooky_hash128, then in tree mode with 1, 2, 4...
+// threads up to twice the number of online CPUs, and report the rate of each.
+static int
+bench_tree(void)
+{
+    unsigned *buff = mmap(0, TREE_MAPSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(buff, TREE_MAPSIZE, rng);
+
+    long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t const total_data = TREE_MAPSIZE * TREE_NLOOPS;
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int j = 0; j < TREE_NLOOPS; ++j) {
+        uint64_t h1 = carry_forward;
+        uint64_t h2 = carry_forward;
+        spooky_hash128(buff, TREE_MAPSIZE, &h1, &h2);
+        carry_forward = h1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("spooky_hash128                %f GB/s\n", 1.0*total_data / elapsed_ns(&start, &end));
+
+    for (unsigned nthreads = 1; nthreads <= 2 * ncpus; nthreads *= 2) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < TREE_NLOOPS; ++j) {
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            spooky_tree_hash128(buff, TREE_MAPSIZE, 0, nthreads, &h1, &h2);
+            carry_forward = h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("spooky_tree_hash128 %3u threads %f GB/s\n", nthreads, 1.0*total_data / elapsed_ns(&start, &end));
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    return 0;
+}
+
+#define IOV_MSGSIZE (UINT64_C(64) << 10)
+#define IOV_NLOOPS 20000
+
+// Hash a 64 KiB message held as fragments of various sizes three ways: copy
+// it into one buffer first, spooky_update per fragment, and
+// spooky_hash128_iov.
+static int
+bench_iov(void)
+{
+    static size_t const frag_sizes[] = {40, 64, 100, 1500, 4096, 9000};
+
+    unsigned char *const buff = malloc(2 * IOV_MSGSIZE);
+    unsigned char *const flat = buff + IOV_MSGSIZE;
+    struct iovec *const iov = malloc(IOV_MSGSIZE / frag_sizes[0] * sizeof(*iov) + sizeof(*iov));
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(buff, IOV_MSGSIZE, rng);
+
+    uint64_t const total_data = IOV_MSGSIZE * IOV_NLOOPS;
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t f = 0; f < sizeof(frag_sizes)/sizeof(frag_sizes[0]); ++f) {
+        int iovcnt = 0;
+        for (size_t off = 0; off < IOV_MSGSIZE; off += frag_sizes[f]) {
+            size_t const left = IOV_MSGSIZE - off;
+            iov[iovcnt].iov_base = buff + off;
+            iov[iovcnt].iov_len = left < frag_sizes[f] ? left : frag_sizes[f];
+            ++iovcnt;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < IOV_NLOOPS; ++j) {
+            size_t len = 0;
+            for (int i = 0; i < iovcnt; ++i) {
+                memcpy(flat + len, iov[i].iov_base, iov[i].iov_len);
+                len += iov[i].iov_len;
+            }
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            spooky_hash128(flat, len, &h1, &h2);
+            carry_forward = h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const copy_rate = 1.0*total_data / elapsed_ns(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < IOV_NLOOPS; ++j) {
+            spooky_context_t ctx;
+            spooky_init(&ctx, carry_forward, carry_forward);
+            for (int i = 0; i < iovcnt; ++i) {
+                spooky_update(&ctx, iov[i].iov_base, iov[i].iov_len);
+            }
+            uint64_t h2;
+            spooky_final(&ctx, &carry_forward, &h2);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const update_rate = 1.0*total_data / elapsed_ns(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < IOV_NLOOPS; ++j) {
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            spooky_hash128_iov(iov, iovcnt, &h1, &h2);
+            carry_forward = h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const iov_rate = 1.0*total_data / elapsed_ns(&start, &end);
+
+        printf("%5zu byte fragments: copy %f GB/s update %f GB/s iov %f GB/s\n",
+            frag_sizes[f], copy_rate, update_rate, iov_rate);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(iov);
+    free(buff);
+
+    return 0;
+}
+
+#define INLINE_NKEYS 4096
+#define INLINE_NLOOPS 2000
+
+// Hash every key of a given width, known at compile time wherever this is
+// inlined, through the library or through the SPOOKY_INLINE path.
+__attribute__((always_inline))
+static inline uint64_t
+inline_keys_run(unsigned char const*const keys, size_t const width, bool const use_inline)
+{
+    uint64_t carry_forward = 0;
+    for (int j = 0; j < INLINE_NLOOPS; ++j) {
+        for (size_t i = 0; i < INLINE_NKEYS; ++i) {
+            uint64_t h1 = j;
+            uint64_t h2 = j;
+            if (use_inline) {
+                spooky_hash128_inline(keys + i * width, width, &h1, &h2);
+            } else {
+                spooky_hash128(keys + i * width, width, &h1, &h2);
+            }
+            carry_forward ^= h1;
+        }
+    }
+    return carry_forward;
+}
+
+// Constant-length keys of the sizes hash tables use, hashed with the
+// library's spooky_hash128 and with the SPOOKY_INLINE build of it.
+static int
+bench_inline(void)
+{
+    static size_t const widths[] = {4, 8, 12, 16, 32, 64};
+
+    unsigned char *const keys = malloc(INLINE_NKEYS * 64);
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(keys, INLINE_NKEYS * 64, rng);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w) {
+        double rates[2];
+        for (int use_inline = 0; use_inline < 2; ++use_inline) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            // A case per width so every call sees a constant length
+            switch (widths[w]) {
+            case 4:  carry_forward += inline_keys_run(keys, 4, use_inline); break;
+            case 8:  carry_forward += inline_keys_run(keys, 8, use_inline); break;
+            case 12: carry_forward += inline_keys_run(keys, 12, use_inline); break;
+            case 16: carry_forward += inline_keys_run(keys, 16, use_inline); break;
+            case 32: carry_forward += inline_keys_run(keys, 32, use_inline); break;
+            case 64: carry_forward += inline_keys_run(keys, 64, use_inline); break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            rates[use_inline] = 1e3 * INLINE_NKEYS * INLINE_NLOOPS / elapsed_ns(&start, &end);
+        }
+        printf("%2zu byte keys: library %7.1f Mkeys/s inline %7.1f Mkeys/s\n", widths[w], rates[0], rates[1]);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(keys);
+
+    return 0;
+}
+
+#define STREAM_MSGSIZE (UINT64_C(1) << 20)
+#define STREAM_NLOOPS 20
+
+// Feed a 1 MiB message to spooky_update in pieces of random length, the way
+// scorrect's piecemeal_hash does, and report the cost of each update for a
+// range of maximum piece sizes.
+static int
+bench_stream(void)
+{
+    static unsigned const max_pieces[] = {1, 4, 8, 16, 40, 100, 200, 1000, 10000};
+
+    unsigned char *const buff = malloc(STREAM_MSGSIZE);
+    uint32_t *const pieces = malloc(STREAM_MSGSIZE * sizeof(*pieces));
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    randfill(buff, STREAM_MSGSIZE, rng);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t m = 0; m < sizeof(max_pieces)/sizeof(max_pieces[0]); ++m) {
+        // Lengths are drawn up front so the timing is only spooky_update
+        size_t npieces = 0;
+        for (size_t done = 0; done < STREAM_MSGSIZE; done += pieces[npieces++]) {
+            uint32_t len = 1 + xorshift32(&rng) % max_pieces[m];
+            if (len > STREAM_MSGSIZE - done) {
+                len = STREAM_MSGSIZE - done;
+            }
+            pieces[npieces] = len;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < STREAM_NLOOPS; ++j) {
+            spooky_context_t ctx;
+            spooky_init(&ctx, carry_forward, carry_forward);
+            unsigned char const*p = buff;
+            for (size_t i = 0; i < npieces; ++i) {
+                spooky_update(&ctx, p, pieces[i]);
+                p += pieces[i];
+            }
+            uint64_t h2;
+            spooky_final(&ctx, &carry_forward, &h2);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uint64_t const ns = elapsed_ns(&start, &end);
+        printf("pieces of 1-%-5u bytes: %6.2f ns/update %f GB/s\n", max_pieces[m],
+            1.0*ns / (npieces * STREAM_NLOOPS), 1.0*STREAM_MSGSIZE*STREAM_NLOOPS / ns);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(pieces);
+    free(buff);
+
+    return 0;
+}
+
+#define MAP_NPROBES (1 << 22)
+// Table for the out of cache run when the machine won't say how big its last
+// level cache is
+#define MAP_DEFAULT_LLC (64 << 20)
+
+// Look up MAP_NPROBES keys one at a time and with find_many, values summed so
+// none of it can be skipped
+static uint64_t
+map_probe_run(spooky_map_t const*const m, uint64_t const*const probes, uint64_t *const values,
+    bool *const found, double *const find_rate, double *const many_rate)
+{
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < MAP_NPROBES; ++i) {
+        uint64_t value = 0;
+        spooky_map_find(m, &probes[i], &value);
+        carry_forward += value;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *find_rate = 1e3 * MAP_NPROBES / elapsed_ns(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    carry_forward += spooky_map_find_many(m, probes, MAP_NPROBES, values, found);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *many_rate = 1e3 * MAP_NPROBES / elapsed_ns(&start, &end);
+
+    return carry_forward + values[MAP_NPROBES - 1];
+}
+
+// Lookups of 8 byte keys in a table that fits in L2 and one bigger than the
+// last level cache, at load factors up to the 7/8 where the map grows, for
+// keys that are there and keys that aren't.
+static int
+bench_map(void)
+{
+    static int const loads[] = {4, 6, 7}; // eighths
+
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0) {
+        llc = MAP_DEFAULT_LLC;
+    }
+    // 17 bytes a slot: the key, the value and its control byte
+    size_t big = 1 << 16;
+    while (big * 17 <= (size_t)llc) {
+        big *= 2;
+    }
+    size_t const capacities[] = {1 << 16, big};
+
+    uint64_t *const keys = malloc(big * sizeof(uint64_t));
+    uint64_t *const probes = malloc(MAP_NPROBES * sizeof(uint64_t));
+    uint64_t *const values = malloc(MAP_NPROBES * sizeof(uint64_t));
+    bool *const found = malloc(MAP_NPROBES * sizeof(bool));
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    if (rng == 0) {
+        rng = 0xdeadbeef;
+    }
+
+    uint64_t carry_forward = 0;
+    for (size_t c = 0; c < sizeof(capacities)/sizeof(capacities[0]); ++c) {
+        for (size_t l = 0; l < sizeof(loads)/sizeof(loads[0]); ++l) {
+            size_t const nkeys = capacities[c] / 8 * loads[l];
+            spooky_map_t *const m = spooky_map_new(sizeof(uint64_t), nkeys, rng);
+            for (size_t i = 0; i < nkeys; ++i) {
+                keys[i] = (uint64_t)xorshift32(&rng) << 32 | xorshift32(&rng);
+                spooky_map_insert(m, &keys[i], i);
+            }
+
+            double hit_find, hit_many, miss_find, miss_many;
+            for (size_t i = 0; i < MAP_NPROBES; ++i) {
+                probes[i] = keys[xorshift32(&rng) % nkeys];
+            }
+            carry_forward += map_probe_run(m, probes, values, found, &hit_find, &hit_many);
+            for (size_t i = 0; i < MAP_NPROBES; ++i) {
+                probes[i] = (uint64_t)xorshift32(&rng) << 32 | xorshift32(&rng);
+            }
+            carry_forward += map_probe_run(m, probes, values, found, &miss_find, &miss_many);
+
+            printf("%9zu slots (%5zu MiB) load %.3f: hit find %6.1f find_many %6.1f, "
+                "miss find %6.1f find_many %6.1f Mlookups/s\n",
+                spooky_map_capacity(m), spooky_map_capacity(m) * 17 >> 20, loads[l] / 8.0,
+                hit_find, hit_many, miss_find, miss_many);
+            spooky_map_free(m);
+        }
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(found);
+    free(values);
+    free(probes);
+    free(keys);
+
+    return 0;
+}
+
+#define BLOOM_NKEYS (1 << 23)
+#define BLOOM_NQUERIES (1 << 22)
+#define BLOOM_KEYSIZE 16
+
+// False positive rate against query rate for both kinds of filter, sized for
+// BLOOM_NKEYS 16 byte keys at a range of target rates. Half the queries are
+// for keys that were added, as in a dedup pass over mostly new data.
+static int
+bench_bloom(void)
+{
+    static double const rates[] = {0.1, 0.01, 0.001, 0.0001};
+
+    unsigned char *const keys = malloc((size_t)2 * BLOOM_NKEYS * BLOOM_KEYSIZE);
+    void const**const ptrs = malloc((size_t)2 * BLOOM_NKEYS * sizeof(*ptrs));
+    size_t *const lens = malloc((size_t)2 * BLOOM_NKEYS * sizeof(*lens));
+    void const**const queries = malloc(BLOOM_NQUERIES * sizeof(*queries));
+    bool *const out = malloc(BLOOM_NQUERIES * sizeof(*out));
+    unsigned rng = time(NULL) ^ getpid() * getpid();
+    randfill(keys, (size_t)2 * BLOOM_NKEYS * BLOOM_KEYSIZE, rng);
+    // Keys BLOOM_NKEYS and up are never added
+    for (size_t i = 0; i < 2 * BLOOM_NKEYS; ++i) {
+        ptrs[i] = keys + i * BLOOM_KEYSIZE;
+        lens[i] = BLOOM_KEYSIZE;
+    }
+    // Queries are copied out in order, so reading them doesn't miss the cache
+    unsigned char *const qkeys = malloc((size_t)BLOOM_NQUERIES * BLOOM_KEYSIZE);
+    for (size_t i = 0; i < BLOOM_NQUERIES; ++i) {
+        size_t const k = xorshift32(&rng) % BLOOM_NKEYS;
+        memcpy(qkeys + i * BLOOM_KEYSIZE, ptrs[i % 2 == 0 ? k : BLOOM_NKEYS + k], BLOOM_KEYSIZE);
+        queries[i] = qkeys + i * BLOOM_KEYSIZE;
+    }
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t r = 0; r < sizeof(rates)/sizeof(rates[0]); ++r) {
+        for (int blocked = 0; blocked < 2; ++blocked) {
+            spooky_bloom_t *const b = spooky_bloom_new(BLOOM_NKEYS, rates[r], blocked, rng);
+            spooky_bloom_add_many(b, ptrs, lens, BLOOM_NKEYS);
+
+            size_t false_positives = 0;
+            for (size_t i = BLOOM_NKEYS; i < 2 * BLOOM_NKEYS; ++i) {
+                false_positives += spooky_bloom_query(b, ptrs[i], BLOOM_KEYSIZE);
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t i = 0; i < BLOOM_NQUERIES; ++i) {
+                carry_forward += spooky_bloom_query(b, queries[i], BLOOM_KEYSIZE);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double const single_rate = 1e3 * BLOOM_NQUERIES / elapsed_ns(&start, &end);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            carry_forward += spooky_bloom_query_many(b, queries, lens, BLOOM_NQUERIES, out);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double const many_rate = 1e3 * BLOOM_NQUERIES / elapsed_ns(&start, &end);
+
+            printf("%-7s target %6.4f%%: %4.1f bits/key k %2u, false positives %6.4f%%, "
+                "query %6.1f query_many %6.1f Mqueries/s\n",
+                blocked ? "blocked" : "plain", 100 * rates[r],
+                (double)spooky_bloom_bits(b) / BLOOM_NKEYS, spooky_bloom_k(b),
+                100.0 * false_positives / BLOOM_NKEYS, single_rate, many_rate);
+            spooky_bloom_free(b);
+        }
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(out);
+    free(qkeys);
+    free(queries);
+    free(lens);
+    free(ptrs);
+    free(keys);
+
+    return 0;
+}
+
+#define HLL_NKEYS (1 << 24)
+#define HLL_NTRIALS 5
+#define HLL_NSKETCHES 64
+
+// Relative error of the estimate against the true count at a range of
+// precisions and counts, then add, merge and estimate throughput with every
+// kernel variant.
+static int
+bench_hll(void)
+{
+    static unsigned const precisions[] = {10, 12, 14, 16};
+
+    uint64_t *const keys = malloc(HLL_NKEYS * sizeof(uint64_t));
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    if (rng == 0) {
+        rng = 0xdeadbeef;
+    }
+    for (size_t i = 0; i < HLL_NKEYS; ++i) {
+        keys[i] = (uint64_t)xorshift32(&rng) << 32 | i;
+    }
+
+    for (size_t p = 0; p < sizeof(precisions)/sizeof(precisions[0]); ++p) {
+        printf("precision %2u, rms error (standard error %.2f%%):", precisions[p],
+            104 / sqrt((double)(1 << precisions[p])));
+        for (size_t n = 10; n <= HLL_NKEYS; n *= 10) {
+            double sq = 0;
+            for (int t = 0; t < HLL_NTRIALS; ++t) {
+                spooky_hll_t *const h = spooky_hll_new(precisions[p], xorshift32(&rng));
+                spooky_hll_add_many(h, keys, sizeof(uint64_t), n);
+                double const err = spooky_hll_estimate(h) / n - 1;
+                sq += err * err;
+                spooky_hll_free(h);
+            }
+            printf(" %zu: %.3f%%", n, 100 * sqrt(sq / HLL_NTRIALS));
+        }
+        printf("\n");
+    }
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    spooky_hll_t *sketches[HLL_NSKETCHES];
+    for (int i = 0; i < HLL_NSKETCHES; ++i) {
+        sketches[i] = spooky_hll_new(14, 0);
+        spooky_hll_add_many(sketches[i], keys + i * (HLL_NKEYS / HLL_NSKETCHES), sizeof(uint64_t),
+            HLL_NKEYS / HLL_NSKETCHES);
+    }
+
+    for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+        if (!spooky_set_impl(impl)) {
+            continue;
+        }
+
+        spooky_hll_t *const h = spooky_hll_new(14, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < HLL_NKEYS; ++i) {
+            spooky_hll_add(h, &keys[i], sizeof(uint64_t));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const add_rate = 1e3 * HLL_NKEYS / elapsed_ns(&start, &end);
+        spooky_hll_free(h);
+
+        spooky_hll_t *const many = spooky_hll_new(14, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spooky_hll_add_many(many, keys, sizeof(uint64_t), HLL_NKEYS);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const many_rate = 1e3 * HLL_NKEYS / elapsed_ns(&start, &end);
+        spooky_hll_free(many);
+
+        // Per-thread sketches folded into one total, and its estimate
+        spooky_hll_t *const total = spooky_hll_new(14, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < HLL_NSKETCHES; ++i) {
+            spooky_hll_merge(total, sketches[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const merge_ns = elapsed_ns(&start, &end) / HLL_NSKETCHES;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double estimate = 0;
+        for (int i = 0; i < 100; ++i) {
+            estimate += spooky_hll_estimate(total);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const estimate_ns = elapsed_ns(&start, &end) / 100;
+        carry_forward += estimate;
+        spooky_hll_free(total);
+
+        printf("%-7s add %6.1f add_many %6.1f Mkeys/s, merge %6.2f us estimate %6.2f us (precision 14)\n",
+            spooky_impl_name(impl), add_rate, many_rate, merge_ns / 1e3, estimate_ns / 1e3);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    for (int i = 0; i < HLL_NSKETCHES; ++i) {
+        spooky_hll_free(sketches[i]);
+    }
+    free(keys);
+
+    return 0;
+}
+
+#define CDC_DATASIZE (UINT64_C(256) << 20)
+#define CDC_FEEDSIZE (UINT64_C(1) << 20)
+
+struct cdc_counter {
+    uint64_t nchunks;
+    uint64_t carry_forward;
+};
+
+static void
+cdc_count(void *const arg, struct spooky_cdc_chunk const*const chunk)
+{
+    struct cdc_counter *const counter = arg;
+    ++counter->nchunks;
+    counter->carry_forward += chunk->h1;
+}
+
+// Synthetic backup data: spans of 16-272KiB, each either fresh random bytes
+// or, dup_percent of the time, a copy of an earlier span
+static void
+cdc_fill(uint8_t *const data, size_t const len, unsigned const dup_percent, uint32_t *const rng,
+    uint32_t *const fresh)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        size_t span = 16384 + xorshift32(rng) % 262144;
+        span = span < len - pos ? span : len - pos;
+        if (pos > span && xorshift32(rng) % 100 < dup_percent) {
+            size_t const from = xorshift32(rng) % (pos - span);
+            memcpy(data + pos, data + from, span);
+        } else {
+            // One xorshift sequence for all of them, so no two fresh spans
+            // overlap by accident
+            for (size_t i = 0; i < span; i += sizeof(uint32_t)) {
+                uint32_t const v = xorshift32(fresh);
+                memcpy(data + pos + i, &v, span - i < sizeof(v) ? span - i : sizeof(v));
+            }
+        }
+        pos += span;
+    }
+}
+
+// Fraction of the bytes in unique chunks, going by their fingerprints
+static double
+cdc_unique(struct spooky_cdc_chunk const*const chunks, size_t const n)
+{
+    spooky_map_t *const m = spooky_map_new(2 * sizeof(uint64_t), n, 0);
+    uint64_t unique = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t const key[2] = {chunks[i].h1, chunks[i].h2};
+        if (!spooky_map_find(m, key, NULL)) {
+            spooky_map_insert(m, key, i);
+            unique += chunks[i].len;
+        }
+        total += chunks[i].len;
+    }
+    spooky_map_free(m);
+    return (double)unique / total;
+}
+
+// Chunking and fingerprinting as two passes over the data, as one streaming
+// pass, and on whole buffers with more and more threads
+static int
+bench_cdc(void)
+{
+    static unsigned const dup_percents[] = {0, 50, 90};
+
+    uint8_t *const data = mmap(0, CDC_DATASIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    uint64_t *const cuts = malloc(CDC_DATASIZE / SPOOKY_CDC_MIN_SIZE * sizeof(uint64_t));
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    if (rng == 0) {
+        rng = 0xdeadbeef;
+    }
+    struct spooky_cdc_params const params = {
+        SPOOKY_CDC_MIN_SIZE, SPOOKY_CDC_AVG_SIZE, SPOOKY_CDC_MAX_SIZE, 0
+    };
+    uint32_t fresh = rng ^ 0x5bd1e995;
+    spooky_cdc_t c;
+    spooky_cdc_init(&c, &params);
+
+    long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t d = 0; d < sizeof(dup_percents)/sizeof(dup_percents[0]); ++d) {
+        cdc_fill(data, CDC_DATASIZE, dup_percents[d], &rng, &fresh);
+
+        size_t nchunks;
+        struct spooky_cdc_chunk *chunks = spooky_cdc_chunk_buffer(&params, data, CDC_DATASIZE, 1, &nchunks);
+        printf("%2u%% duplicate spans: %zu chunks, %.0f bytes on average, %.1f%% unique\n",
+            dup_percents[d], nchunks, (double)CDC_DATASIZE / nchunks, 100 * cdc_unique(chunks, nchunks));
+        free(chunks);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t ncuts = 0;
+        for (uint64_t pos = 0; pos < CDC_DATASIZE; ) {
+            pos += spooky_cdc_cut(&c, data + pos, CDC_DATASIZE - pos);
+            cuts[ncuts++] = pos;
+        }
+        for (size_t i = 0; i < ncuts; ++i) {
+            uint64_t const from = i == 0 ? 0 : cuts[i - 1];
+            uint64_t h1 = 0;
+            uint64_t h2 = 0;
+            spooky_hash128(data + from, cuts[i] - from, &h1, &h2);
+            carry_forward += h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("  two passes             %f GB/s\n", 1.0*CDC_DATASIZE / elapsed_ns(&start, &end));
+
+        struct cdc_counter counter = {0, 0};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t pos = 0; pos < CDC_DATASIZE; pos += CDC_FEEDSIZE) {
+            spooky_cdc_update(&c, data + pos, CDC_FEEDSIZE, cdc_count, &counter);
+        }
+        spooky_cdc_final(&c, cdc_count, &counter);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        carry_forward += counter.carry_forward;
+        printf("  spooky_cdc_update      %f GB/s\n", 1.0*CDC_DATASIZE / elapsed_ns(&start, &end));
+
+        for (unsigned nthreads = 1; nthreads <= 2 * ncpus; nthreads *= 2) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            chunks = spooky_cdc_chunk_buffer(&params, data, CDC_DATASIZE, nthreads, &nchunks);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            carry_forward += chunks[nchunks - 1].h1;
+            free(chunks);
+            printf("  chunk_buffer %3u threads %f GB/s\n", nthreads, 1.0*CDC_DATASIZE / elapsed_ns(&start, &end));
+        }
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(cuts);
+    munmap(data, CDC_DATASIZE);
+
+    return 0;
+}
+
+#define MERKLE_DATASIZE (UINT64_C(1) << 30)
+#define MERKLE_NLOOPS 4
+
+// The cost of keeping a whole-file hash up to date after writes of growing
+// size: rehashing the file against updating its Merkle tree
+static int
+bench_merkle(void)
+{
+    uint8_t *const data = mmap(0, MERKLE_DATASIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    if (rng == 0) {
+        rng = 0xdeadbeef;
+    }
+    randfill(data, MERKLE_DATASIZE, rng);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < MERKLE_NLOOPS; ++i) {
+        uint64_t h1 = carry_forward;
+        uint64_t h2 = carry_forward;
+        spooky_hash128(data, MERKLE_DATASIZE, &h1, &h2);
+        carry_forward = h1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double const full_us = elapsed_ns(&start, &end) / 1e3 / MERKLE_NLOOPS;
+    printf("spooky_hash128 of 1 GiB          %10.1f us\n", full_us);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    spooky_merkle_t *const m = spooky_merkle_new(data, MERKLE_DATASIZE, 0, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("spooky_merkle_new, 4 KiB blocks  %10.1f us\n", elapsed_ns(&start, &end) / 1e3);
+
+    for (uint64_t dirty = 4096; dirty <= MERKLE_DATASIZE / 4; dirty *= 16) {
+        // As many writes as make 1 GiB, within reason
+        uint64_t const nwrites = dirty >= (UINT64_C(1) << 20) ? MERKLE_DATASIZE / dirty : 1024;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < nwrites; ++i) {
+            uint64_t const off = xorshift32(&rng) % (MERKLE_DATASIZE / 4096 - dirty / 4096 + 1) * 4096;
+            spooky_merkle_update_range(m, data, off, dirty);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const us = elapsed_ns(&start, &end) / 1e3 / nwrites;
+        printf("update_range %9" PRIu64 " bytes   %10.1f us, %8.1fx faster than a rehash\n",
+            dirty, us, full_us / us);
+    }
+    uint64_t h1, h2;
+    spooky_merkle_root(m, &h1, &h2);
+    carry_forward += h1;
+
+    char path[] = "/tmp/sbench.merkle.XXXXXX";
+    int const fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool const saved = spooky_merkle_save(m, path);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const save_us = elapsed_ns(&start, &end) / 1e3;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spooky_merkle_t *const loaded = spooky_merkle_load(path);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (saved && loaded != NULL) {
+            printf("sidecar of %zu bytes, save %.1f us, load %.1f us\n",
+                (spooky_merkle_nblocks(m) + 2) * 16 + 12, save_us, elapsed_ns(&start, &end) / 1e3);
+        }
+        spooky_merkle_free(loaded);
+        unlink(path);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    spooky_merkle_free(m);
+    munmap(data, MERKLE_DATASIZE);
+
+    return 0;
+}
+
+#define COPY_MAX_SIZE (UINT64_C(256) << 20)
+#define COPY_TOTAL (UINT64_C(4) << 30)
+
+// Copy-and-hash against memcpy followed by spooky_hash128, from sizes that
+// stay in L1 to ones that are bound by memory bandwidth
+static int
+bench_copy(void)
+{
+    uint8_t *const src = mmap(0, COPY_MAX_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    uint8_t *const dst = mmap(0, COPY_MAX_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    randfill(src, COPY_MAX_SIZE, time(NULL) ^ getpid() * getpid());
+    memset(dst, 0, COPY_MAX_SIZE);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (uint64_t size = 4096; size <= COPY_MAX_SIZE; size *= 4) {
+        uint64_t const nloops = COPY_TOTAL / size;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < nloops; ++i) {
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            memcpy(dst, src, size);
+            spooky_hash128(src, size, &h1, &h2);
+            carry_forward = h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const separate = 1.0*size*nloops / elapsed_ns(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < nloops; ++i) {
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            spooky_copy_hash128(dst, src, size, &h1, &h2);
+            carry_forward = h1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const fused = 1.0*size*nloops / elapsed_ns(&start, &end);
+
+        printf("%9" PRIu64 " bytes: memcpy+spooky_hash128 %6.2f GB/s, spooky_copy_hash128 %6.2f GB/s%s\n",
+            size, separate, fused, size >= SPOOKY_COPY_NONTEMPORAL ? " (non-temporal)" : "");
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    munmap(dst, COPY_MAX_SIZE);
+    munmap(src, COPY_MAX_SIZE);
+
+    return 0;
+}
+
+#define WIDE_MAX_SIZE (UINT64_C(64) << 20)
+#define WIDE_TOTAL (UINT64_C(1) << 30)
+
+// spooky_hash256 against the usual way to a 256-bit hash, two
+// spooky_hash128 calls with different seeds
+static int
+bench_hash256(void)
+{
+    uint8_t *const buf = mmap(0, WIDE_MAX_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    randfill(buf, WIDE_MAX_SIZE, time(NULL) ^ getpid() * getpid());
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (uint64_t size = 16; size <= WIDE_MAX_SIZE; size *= 4) {
+        uint64_t const nloops = WIDE_TOTAL / size < 100 ? 100 : WIDE_TOTAL / size;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < nloops; ++i) {
+            uint64_t h1 = carry_forward;
+            uint64_t h2 = carry_forward;
+            uint64_t h3 = ~carry_forward;
+            uint64_t h4 = ~carry_forward;
+            spooky_hash128(buf, size, &h1, &h2);
+            spooky_hash128(buf, size, &h3, &h4);
+            carry_forward = h1 ^ h3;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const twice = 1.0*size*nloops / elapsed_ns(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < nloops; ++i) {
+            uint64_t h[4] = {carry_forward, carry_forward};
+            spooky_hash256(buf, size, h);
+            carry_forward = h[0] ^ h[2];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const wide = 1.0*size*nloops / elapsed_ns(&start, &end);
+
+        printf("%9" PRIu64 " bytes: 2x spooky_hash128 %6.2f GB/s, spooky_hash256 %6.2f GB/s (%.2fx)\n",
+            size, twice, wide, wide / twice);
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    munmap(buf, WIDE_MAX_SIZE);
+
+    return 0;
+}
+
+#define COLUMN_NROWS (1 << 20)
+#define COLUMN_NLOOPS 20
+
+// Row lengths like a column of URLs, of user ids (UUIDs and numeric ones)
+// and of short tags
+static size_t
+column_len(char const*const kind, uint32_t *const rng)
+{
+    uint32_t const x = xorshift32(rng);
+    if (strcmp(kind, "urls") == 0) {
+        // Mostly 30 to 150 bytes, with the odd very long query string
+        return x % 32 == 0 ? 200 + (x >> 8) % 800 : 30 + (x >> 8) % 64 + (x >> 16) % 64;
+    } else if (strcmp(kind, "ids") == 0) {
+        return x % 2 == 0 ? 36 : 6 + (x >> 8) % 7;
+    } else {
+        return 3 + (x >> 8) % 13;
+    }
+}
+
+// spooky_hash64_column against a spooky_hash64 call per row
+static int
+bench_column(void)
+{
+    static char const*const kinds[] = {"urls", "ids", "tags"};
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    uint32_t *const offsets = malloc((COLUMN_NROWS + 1) * sizeof(*offsets));
+    uint64_t *const out = malloc(COLUMN_NROWS * sizeof(*out));
+    uint8_t *const data = malloc((size_t)COLUMN_NROWS * 1000);
+    randfill(data, (size_t)COLUMN_NROWS * 1000, rng);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k) {
+        offsets[0] = 0;
+        for (size_t i = 0; i < COLUMN_NROWS; ++i) {
+            offsets[i + 1] = offsets[i] + column_len(kinds[k], &rng);
+        }
+        double const bytes = 1.0*offsets[COLUMN_NROWS]*COLUMN_NLOOPS;
+        double const rows = 1.0*COLUMN_NROWS*COLUMN_NLOOPS;
+        printf("%s, %.1f bytes a row\n", kinds[k], 1.0*offsets[COLUMN_NROWS] / COLUMN_NROWS);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < COLUMN_NLOOPS; ++j) {
+            for (size_t i = 0; i < COLUMN_NROWS; ++i) {
+                out[i] = spooky_hash64(data + offsets[i], offsets[i + 1] - offsets[i], carry_forward);
+            }
+            carry_forward += out[j];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t ns = elapsed_ns(&start, &end);
+        printf("  spooky_hash64 per row       %7.1f Mrows/s %6.2f GB/s\n",
+            1000*rows / ns, bytes / ns);
+
+        for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+            if (!spooky_set_impl(impl)) {
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int j = 0; j < COLUMN_NLOOPS; ++j) {
+                spooky_hash64_column(data, offsets, COLUMN_NROWS, carry_forward, out);
+                carry_forward += out[j];
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ns = elapsed_ns(&start, &end);
+            printf("  spooky_hash64_column %-6s %7.1f Mrows/s %6.2f GB/s\n",
+                spooky_impl_name(impl), 1000*rows / ns, bytes / ns);
+        }
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(data);
+    free(out);
+    free(offsets);
+
+    return 0;
+}
+
+#define PARTITION_NROWS (UINT64_C(1) << 25)
+#define PARTITION_WIDTH 16
+
+// Tuples a second partitioning 16-byte (key, payload) rows by fan-out,
+// spooky_partition against the textbook two passes of a spooky_hash64 call
+// per key and a plain store per row
+static int
+bench_partition(void)
+{
+    size_t const size = PARTITION_NROWS * PARTITION_WIDTH;
+    uint8_t *const rows = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    uint8_t *const out = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    randfill(rows, size, time(NULL) ^ getpid() * getpid());
+    memset(out, 0, size);
+    size_t *const starts = malloc(((1 << SPOOKY_PARTITION_MAX_BITS) + 1) * sizeof(*starts));
+    size_t *const cursor = malloc((1 << SPOOKY_PARTITION_MAX_BITS) * sizeof(*cursor));
+    long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    printf("%" PRIu64 " rows of %d bytes\n", PARTITION_NROWS, PARTITION_WIDTH);
+    for (unsigned bits = 2; bits <= SPOOKY_PARTITION_MAX_BITS; bits += 2) {
+        size_t const nparts = (size_t)1 << bits;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memset(cursor, 0, nparts * sizeof(*cursor));
+        for (size_t i = 0; i < PARTITION_NROWS; ++i) {
+            cursor[spooky_hash64(rows + i * PARTITION_WIDTH, 8, carry_forward) >> (64 - bits)]++;
+        }
+        size_t total = 0;
+        for (size_t p = 0; p < nparts; ++p) {
+            size_t const count = cursor[p];
+            cursor[p] = total;
+            total += count;
+        }
+        for (size_t i = 0; i < PARTITION_NROWS; ++i) {
+            uint8_t const*const row = rows + i * PARTITION_WIDTH;
+            size_t const p = spooky_hash64(row, 8, carry_forward) >> (64 - bits);
+            memcpy(out + cursor[p]++ * PARTITION_WIDTH, row, PARTITION_WIDTH);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const plain = 1000.0*PARTITION_NROWS / elapsed_ns(&start, &end);
+        carry_forward += out[0];
+
+        printf("%6zu partitions: plain %6.1f Mtuples/s", nparts, plain);
+        for (long nthreads = 1; ; nthreads = nthreads * 2 < ncpus ? nthreads * 2 : ncpus) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            spooky_partition(rows, PARTITION_WIDTH, 0, 8, PARTITION_NROWS, bits, carry_forward,
+                nthreads, out, starts);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            carry_forward += out[0];
+            printf(", %ld thread%s %6.1f Mtuples/s", nthreads, nthreads > 1 ? "s" : "",
+                1000.0*PARTITION_NROWS / elapsed_ns(&start, &end));
+            if (nthreads >= ncpus) {
+                break;
+            }
+        }
+        printf("\n");
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(cursor);
+    free(starts);
+    munmap(out, size);
+    munmap(rows, size);
+
+    return 0;
+}
+
+#define MGR_NSTREAMS 10000
+#define MGR_DATASIZE (UINT64_C(1) << 20)
+#define MGR_NPIECES 200000
+
+static void
+bench_mgr_done(void *const arg, spooky_context_t *const sc, void *const job)
+{
+    (void)sc;
+    (void)job;
+    ++*(uint64_t *)arg;
+}
+
+// Many streams each getting small pieces in turn, like connections: one
+// spooky_update per piece against the job manager mixing several streams'
+// blocks at once
+static int
+bench_mgr(void)
+{
+    static size_t const piece_sizes[] = {64, 128, 512, 1536};
+    uint8_t *const data = malloc(MGR_DATASIZE);
+    spooky_context_t *const streams = malloc(MGR_NSTREAMS * sizeof(*streams));
+    uint32_t *const order = malloc(MGR_NPIECES * sizeof(*order));
+    randfill(data, MGR_DATASIZE, time(NULL) ^ getpid() * getpid());
+    uint32_t rng = 0x1234567;
+    for (size_t i = 0; i < MGR_NPIECES; ++i) {
+        order[i] = xorshift32(&rng) % MGR_NSTREAMS;
+    }
+
+    enum spooky_impl const best = spooky_get_impl();
+    uint64_t carry_forward = 0;
+    struct timespec start,end;
+
+    for (size_t s = 0; s < sizeof(piece_sizes)/sizeof(piece_sizes[0]); ++s) {
+        size_t const piece = piece_sizes[s];
+        uint64_t const total = (uint64_t)piece * MGR_NPIECES;
+
+        for (size_t i = 0; i < MGR_NSTREAMS; ++i) {
+            spooky_init(&streams[i], i, i);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < MGR_NPIECES; ++i) {
+            spooky_update(&streams[order[i]], data + (i * 64) % (MGR_DATASIZE - piece), piece);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        for (size_t i = 0; i < MGR_NSTREAMS; i += 97) {
+            uint64_t h1, h2;
+            spooky_final(&streams[i], &h1, &h2);
+            carry_forward += h1;
+        }
+        printf("%5zu byte pieces: spooky_update          %6.2f GB/s\n",
+            piece, 1.0 * total / elapsed_ns(&start, &end));
+
+        for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+            if (!spooky_set_impl(impl)) {
+                continue;
+            }
+            for (size_t i = 0; i < MGR_NSTREAMS; ++i) {
+                spooky_init(&streams[i], i, i);
+            }
+            uint64_t ndone = 0;
+            spooky_mgr_t *const m = spooky_mgr_new(0, bench_mgr_done, &ndone);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t i = 0; i < MGR_NPIECES; ++i) {
+                spooky_mgr_submit(m, &streams[order[i]], data + (i * 64) % (MGR_DATASIZE - piece),
+                    piece, NULL);
+            }
+            spooky_mgr_flush(m);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            spooky_mgr_free(m);
+            for (size_t i = 0; i < MGR_NSTREAMS; i += 97) {
+                uint64_t h1, h2;
+                spooky_final(&streams[i], &h1, &h2);
+                carry_forward += h1;
+            }
+            printf("%5zu byte pieces: spooky_mgr_submit %-6s %6.2f GB/s\n",
+                piece, spooky_impl_name(impl), 1.0 * total / elapsed_ns(&start, &end));
+        }
+    }
+    spooky_set_impl(best);
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(order);
+    free(streams);
+    free(data);
+
+    return 0;
+}
+
+// The suite: every entry point over message sizes from 0 to SUITE_MAX_SIZE
+// at every alignment mod 8, timed with the TSC where there is one. Each
+// sample times enough back-to-back calls to dwarf the timer, each call
+// seeded with the previous one's hash so they can't overlap, and the
+// median and p99 of the samples are reported per call.
+#define SUITE_MAX_SIZE (UINT64_C(1) << 30)
+#define SUITE_NALIGNS 8
+#define SUITE_MIN_SAMPLES 3
+#define SUITE_MAX_SAMPLES 101
+// A sample is at least this long, and sampling a case stops after this
+// long once it has SUITE_MIN_SAMPLES
+#define SUITE_SAMPLE_NS 2000
+#define SUITE_CASE_NS 20000000
+// Messages per spooky_hash128_multi call and keys per spooky_hash64_keys
+// call, and the largest key width timed
+#define SUITE_MULTI_NMSGS 16
+#define SUITE_KEYS_NKEYS 256
+#define SUITE_KEYS_MAX_WIDTH 256
+// The largest messages the key-sized entry points are timed on
+#define SUITE_SMALL_MAX 4096
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SUITE_HAVE_TSC 1
+static inline uint64_t
+suite_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+#define SUITE_HAVE_TSC 0
+static inline uint64_t
+suite_ticks(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+}
+#endif
+
+// Hardware counters, with --counters on Linux
+enum suite_counter {
+    SUITE_CYCLES,
+    SUITE_INSTRUCTIONS,
+    SUITE_BRANCH_MISSES,
+    SUITE_L1D_MISSES,
+    SUITE_LLC_MISSES,
+    SUITE_NCOUNTERS,
+};
+
+enum suite_format {
+    SUITE_TABLE,
+    SUITE_CSV,
+    SUITE_JSON,
+};
+
+struct suite_case {
+    char const*api;
+    char const*impl;
+    uint8_t const*msg;
+    size_t size;
+    size_t align;
+    // Streaming piece size, or 0
+    size_t split;
+    // Messages or keys per call
+    size_t nmsgs;
+    void (*run)(struct suite_case const*c, uint64_t reps);
+    void const*msgs[SUITE_MULTI_NMSGS];
+    size_t lens[SUITE_MULTI_NMSGS];
+};
+
+struct suite {
+    enum suite_format format;
+    char const*only_api;
+    double ticks_per_ns;
+    size_t nreported;
+    uint64_t samples[SUITE_MAX_SAMPLES];
+    bool counters;
+    // -1 for a counter that couldn't be opened. The cycles counter leads
+    // the group, without it there are no counters at all.
+    int fds[SUITE_NCOUNTERS];
+};
+
+static uint64_t suite_sink;
+
+static void
+suite_run_hash128(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h1 = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        uint64_t h2 = h1;
+        spooky_hash128(c->msg, c->size, &h1, &h2);
+    }
+    suite_sink = h1;
+}
+
+static void
+suite_run_hash256(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h[4] = {suite_sink, suite_sink};
+    for (uint64_t i = 0; i < reps; ++i) {
+        h[1] = h[0];
+        spooky_hash256(c->msg, c->size, h);
+    }
+    suite_sink = h[0];
+}
+
+static void
+suite_run_hash64(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        h = spooky_hash64(c->msg, c->size, h);
+    }
+    suite_sink = h;
+}
+
+static void
+suite_run_inline128(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h1 = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        uint64_t h2 = h1;
+        spooky_hash128_inline(c->msg, c->size, &h1, &h2);
+    }
+    suite_sink = h1;
+}
+
+static void
+suite_run_stream(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h1 = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        spooky_context_t sc;
+        spooky_init(&sc, h1, h1);
+        for (size_t off = 0; off < c->size; off += c->split) {
+            spooky_update(&sc, c->msg + off, c->size - off < c->split ? c->size - off : c->split);
+        }
+        uint64_t h2;
+        spooky_final(&sc, &h1, &h2);
+    }
+    suite_sink = h1;
+}
+
+static void
+suite_run_multi(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h1[SUITE_MULTI_NMSGS];
+    uint64_t h2[SUITE_MULTI_NMSGS];
+    uint64_t seed = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        for (size_t j = 0; j < SUITE_MULTI_NMSGS; ++j) {
+            h1[j] = h2[j] = seed;
+        }
+        spooky_hash128_multi(c->msgs, c->lens, SUITE_MULTI_NMSGS, h1, h2);
+        seed = h1[SUITE_MULTI_NMSGS - 1];
+    }
+    suite_sink = seed;
+}
+
+static void
+suite_run_keys(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t out[SUITE_KEYS_NKEYS];
+    uint64_t seed = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        spooky_hash64_keys(c->msg, c->size, SUITE_KEYS_NKEYS, seed, out);
+        seed = out[SUITE_KEYS_NKEYS - 1];
+    }
+    suite_sink = seed;
+}
+
+static void
+suite_run_tree(struct suite_case const*const c, uint64_t const reps)
+{
+    uint64_t h1 = suite_sink;
+    for (uint64_t i = 0; i < reps; ++i) {
+        uint64_t h2 = h1;
+        spooky_tree_hash128(c->msg, c->size, 0, 0, &h1, &h2);
+    }
+    suite_sink = h1;
+}
+
+// Ticks of the suite clock per nanosecond
+static double
+suite_calibrate(void)
+{
+    struct timespec start,end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t const t0 = suite_ticks();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } while (elapsed_ns(&start, &end) < 50000000);
+    uint64_t const t1 = suite_ticks();
+    return (double)(t1 - t0) / elapsed_ns(&start, &end);
+}
+
+#ifdef __linux__
+// Open what we can of the counters, for this thread in user mode only, as
+// one group so they all count over the same stretch. Returns false, having
+// said why, if not even cycles can be counted.
+static bool
+suite_counters_open(struct suite *const s)
+{
+    static struct {
+        uint32_t type;
+        uint64_t config;
+    } const events[SUITE_NCOUNTERS] = {
+        [SUITE_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [SUITE_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [SUITE_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        [SUITE_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+            | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        [SUITE_LLC_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+            | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+
+    for (int i = 0; i < SUITE_NCOUNTERS; ++i) {
+        struct perf_event_attr attr = {
+            .size = sizeof(attr),
+            .type = events[i].type,
+            .config = events[i].config,
+            .disabled = i == SUITE_CYCLES,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+            .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+        };
+        int const group = i == SUITE_CYCLES ? -1 : s->fds[SUITE_CYCLES];
+        s->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+        if (s->fds[i] < 0 && i == SUITE_CYCLES) {
+            fprintf(stderr, "sbench: no hardware counters (%s), carrying on without them\n",
+                strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+suite_counters_start(struct suite const*const s)
+{
+    ioctl(s->fds[SUITE_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(s->fds[SUITE_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Read the counters into counts, scaled up for any time they weren't
+// scheduled. Those that aren't there or never ran are left at -1.
+static void
+suite_counters_stop(struct suite const*const s, double *const counts)
+{
+    ioctl(s->fds[SUITE_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int i = 0; i < SUITE_NCOUNTERS; ++i) {
+        uint64_t v[3];
+        if (s->fds[i] >= 0 && read(s->fds[i], v, sizeof(v)) == sizeof(v) && v[2] > 0) {
+            counts[i] = (double)v[0] * v[1] / v[2];
+        }
+    }
+}
+
+static void
+suite_counters_close(struct suite const*const s)
+{
+    for (int i = 0; i < SUITE_NCOUNTERS; ++i) {
+        if (s->fds[i] >= 0) {
+            close(s->fds[i]);
+        }
+    }
+}
+#else
+static bool
+suite_counters_open(struct suite *const s)
+{
+    (void)s;
+    fprintf(stderr, "sbench: hardware counters need Linux, carrying on without them\n");
+    return false;
+}
+
+static void
+suite_counters_start(struct suite const*const s)
+{
+    (void)s;
+}
+
+static void
+suite_counters_stop(struct suite const*const s, double *const counts)
+{
+    (void)s;
+    (void)counts;
+}
+
+static void
+suite_counters_close(struct suite const*const s)
+{
+    (void)s;
+}
+#endif
+
+// Counters that weren't counted are negative. This is built with
+// -ffast-math, so no NaNs.
+static double
+suite_ratio(double const a, double const b)
+{
+    return a < 0 || b <= 0 ? -1 : a / b;
+}
+
+// A counter's value, or nothing, as a CSV field or a JSON value
+static void
+suite_print_counter(enum suite_format const format, double const v)
+{
+    if (v < 0) {
+        printf(format == SUITE_JSON ? "null" : "");
+    } else {
+        printf("%.4f", v);
+    }
+}
+
+static int
+suite_compare(void const*const a, void const*const b)
+{
+    uint64_t const x = *(uint64_t const*)a;
+    uint64_t const y = *(uint64_t const*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+suite_measure(struct suite *const s, struct suite_case const*const c)
+{
+    if (s->only_api != NULL && strcmp(s->only_api, c->api) != 0) {
+        return;
+    }
+
+    // Enough calls per sample that the clock's overhead doesn't matter
+    uint64_t const min_ticks = SUITE_SAMPLE_NS * s->ticks_per_ns;
+    uint64_t reps = 1;
+    for (;;) {
+        uint64_t const t0 = suite_ticks();
+        c->run(c, reps);
+        uint64_t const ticks = suite_ticks() - t0;
+        if (ticks >= min_ticks) {
+            break;
+        }
+        reps = ticks == 0 ? reps * 16 : reps * 2 * min_ticks / ticks + 1;
+    }
+
+    double counts[SUITE_NCOUNTERS] = {-1, -1, -1, -1, -1};
+    if (s->counters) {
+        suite_counters_start(s);
+    }
+    size_t n = 0;
+    uint64_t total = 0;
+    while (n < SUITE_MAX_SAMPLES && (n < SUITE_MIN_SAMPLES || total < SUITE_CASE_NS * s->ticks_per_ns)) {
+        uint64_t const t0 = suite_ticks();
+        c->run(c, reps);
+        s->samples[n] = suite_ticks() - t0;
+        total += s->samples[n++];
+    }
+    if (s->counters) {
+        suite_counters_stop(s, counts);
+    }
+    qsort(s->samples, n, sizeof(s->samples[0]), suite_compare);
+
+    double const median_ns = s->samples[n / 2] / s->ticks_per_ns / reps;
+    double const p99_ns = s->samples[(n * 99 - 1) / 100] / s->ticks_per_ns / reps;
+    uint64_t const bytes = (uint64_t)c->size * c->nmsgs;
+    double const gbps = bytes / median_ns;
+    double const cpb = SUITE_HAVE_TSC && bytes > 0 ? median_ns * s->ticks_per_ns / bytes : 0;
+
+    // Counters are totals over every sample, so they're means per call.
+    // Cycles per byte from the counter is in core cycles, the TSC's runs at
+    // a fixed rate whatever the core's clock does.
+    double const calls = (double)reps * n;
+    double const derived[] = {
+        suite_ratio(counts[SUITE_INSTRUCTIONS], counts[SUITE_CYCLES]),
+        suite_ratio(counts[SUITE_CYCLES], calls * bytes),
+        suite_ratio(counts[SUITE_BRANCH_MISSES], calls),
+        suite_ratio(counts[SUITE_L1D_MISSES], calls),
+        suite_ratio(counts[SUITE_LLC_MISSES], calls),
+    };
+    size_t const nderived = sizeof(derived)/sizeof(derived[0]);
+
+    switch (s->format) {
+    case SUITE_TABLE:
+        if (s->nreported == 0) {
+            printf("%-10s %-7s %10s %5s %7s %5s %12s %12s %8s %8s", "api", "impl", "size", "align",
+                "split", "nmsgs", "median ns", "p99 ns", "cpb", "GB/s");
+            if (s->counters) {
+                printf(" %6s %8s %9s %9s %9s", "ipc", "core cpb", "br-miss", "L1d-miss", "LLC-miss");
+            }
+            printf("\n");
+        }
+        printf("%-10s %-7s %10zu %5zu %7zu %5zu %12.1f %12.1f %8.3f %8.3f", c->api, c->impl,
+            c->size, c->align, c->split, c->nmsgs, median_ns, p99_ns, cpb, gbps);
+        if (s->counters) {
+            printf(" %6.2f %8.3f %9.2f %9.2f %9.2f", derived[0], derived[1], derived[2], derived[3],
+                derived[4]);
+        }
+        printf("\n");
+        break;
+    case SUITE_CSV:
+        if (s->nreported == 0) {
+            printf("api,impl,size,align,split,nmsgs,samples,median_ns,p99_ns,cycles_per_byte,gb_per_s,"
+                "ipc,core_cycles_per_byte,branch_misses,l1d_misses,llc_misses\n");
+        }
+        printf("%s,%s,%zu,%zu,%zu,%zu,%zu,%.2f,%.2f,%.4f,%.4f", c->api, c->impl, c->size, c->align,
+            c->split, c->nmsgs, n, median_ns, p99_ns, cpb, gbps);
+        for (size_t i = 0; i < nderived; ++i) {
+            printf(",");
+            suite_print_counter(s->format, derived[i]);
+        }
+        printf("\n");
+        break;
+    case SUITE_JSON: {
+        static char const*const names[] = {
+            "ipc", "core_cycles_per_byte", "branch_misses", "l1d_misses", "llc_misses"
+        };
+        printf("%s\n    {\"api\": \"%s\", \"impl\": \"%s\", \"size\": %zu, \"align\": %zu, "
+            "\"split\": %zu, \"nmsgs\": %zu, \"samples\": %zu, \"median_ns\": %.2f, \"p99_ns\": %.2f, "
+            "\"cycles_per_byte\": %.4f, \"gb_per_s\": %.4f",
+            s->nreported == 0 ? "" : ",", c->api, c->impl, c->size, c->align, c->split, c->nmsgs, n,
+            median_ns, p99_ns, cpb, gbps);
+        for (size_t i = 0; i < nderived; ++i) {
+            printf(", \"%s\": ", names[i]);
+            suite_print_counter(s->format, derived[i]);
+        }
+        printf("}");
+        break;
+    }
+    }
+    fflush(stdout);
+    ++s->nreported;
+}
+
+// 0, 1, 2, 3, 4, 6, 8, 12, ... up to max, plus 191, the longest message
+// that takes the short path
+// Beyond SUITE_MAX_SIZE the buffer size would wrap and the size list overflow
+static bool
+suite_parse_size(char const *const arg, uint64_t *const out)
+{
+    char *end;
+    errno = 0;
+    uint64_t const v = strtoull(arg, &end, 0);
+    if (arg[0] == '-' || end == arg || *end != '\0' || errno != 0 || v > SUITE_MAX_SIZE) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+static size_t
+suite_sizes(size_t *const sizes, uint64_t const max)
+{
+    size_t n = 0;
+    sizes[n++] = 0;
+    for (uint64_t p = 1; p <= max; p *= 2) {
+        sizes[n++] = p;
+        if (p == 128) {
+            sizes[n++] = 191;
+        }
+        if (p >= 2 && p + p / 2 <= max) {
+            sizes[n++] = p + p / 2;
+        }
+    }
+    return n;
+}
+
+static int
+bench_suite(int const argc, char **const argv)
+{
+    struct suite s = {.format = SUITE_TABLE};
+    uint64_t max_size = SUITE_MAX_SIZE;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            s.format = SUITE_CSV;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            s.format = SUITE_JSON;
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            s.counters = true;
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc && suite_parse_size(argv[i + 1], &max_size)) {
+            ++i;
+        } else if (strcmp(argv[i], "--api") == 0 && i + 1 < argc) {
+            s.only_api = argv[++i];
+        } else {
+            fprintf(stderr, "usage: sbench suite [--csv | --json] [--counters] [--max-size BYTES] [--api NAME]\n"
+                "       BYTES is at most %" PRIu64 "\n", SUITE_MAX_SIZE);
+            return 1;
+        }
+    }
+
+    // Room for the largest message at any alignment, and for the batches
+    uint64_t bufsize = max_size + SUITE_NALIGNS;
+    if (bufsize < SUITE_KEYS_NKEYS * SUITE_KEYS_MAX_WIDTH + SUITE_NALIGNS) {
+        bufsize = SUITE_KEYS_NKEYS * SUITE_KEYS_MAX_WIDTH + SUITE_NALIGNS;
+    }
+    uint8_t *const buf = mmap(0, bufsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        fprintf(stderr, "can't map %" PRIu64 " bytes\n", bufsize);
+        return 1;
+    }
+    randfill(buf, bufsize, time(NULL) ^ getpid() * getpid());
+
+    if (s.counters) {
+        s.counters = suite_counters_open(&s);
+    }
+    s.ticks_per_ns = suite_calibrate();
+    switch (s.format) {
+    case SUITE_TABLE:
+        printf("%s %.3f GHz\n", SUITE_HAVE_TSC ? "TSC at" : "No TSC, clock at", s.ticks_per_ns);
+        break;
+    case SUITE_CSV:
+        break;
+    case SUITE_JSON:
+        printf("{\n  \"tsc_ghz\": %.4f,\n  \"results\": [", SUITE_HAVE_TSC ? s.ticks_per_ns : 0);
+        break;
+    }
+
+    static size_t const splits[] = {1, 8, 64, 4096, 1 << 20};
+    size_t sizes[100];
+    size_t const nsizes = suite_sizes(sizes, max_size);
+
+    enum spooky_impl const best = spooky_get_impl();
+    for (size_t z = 0; z < nsizes; ++z) {
+        size_t const size = sizes[z];
+        for (size_t align = 0; align < SUITE_NALIGNS; ++align) {
+            struct suite_case c = {
+                .impl = "generic",
+                .msg = buf + align,
+                .size = size,
+                .align = align,
+                .nmsgs = 1,
+            };
+
+            c.api = "hash128";
+            c.run = suite_run_hash128;
+            suite_measure(&s, &c);
+            c.api = "hash256";
+            c.run = suite_run_hash256;
+            suite_measure(&s, &c);
+            if (size <= SUITE_SMALL_MAX) {
+                c.api = "hash64";
+                c.run = suite_run_hash64;
+                suite_measure(&s, &c);
+                c.api = "inline128";
+                c.run = suite_run_inline128;
+                suite_measure(&s, &c);
+            }
+
+            c.api = "stream";
+            c.run = suite_run_stream;
+            for (size_t i = 0; i < sizeof(splits)/sizeof(splits[0]); ++i) {
+                // A byte at a time is only worth it for short messages
+                if (splits[i] < size && (splits[i] > 1 || size <= SUITE_SMALL_MAX)) {
+                    c.split = splits[i];
+                    suite_measure(&s, &c);
+                }
+            }
+            c.split = 0;
+
+            // The batch entry points, for every CPU variant
+            for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+                if (!spooky_set_impl(impl)) {
+                    continue;
+                }
+                c.impl = spooky_impl_name(impl);
+                if ((uint64_t)size * SUITE_MULTI_NMSGS + align <= bufsize) {
+                    c.api = "multi";
+                    c.run = suite_run_multi;
+                    c.nmsgs = SUITE_MULTI_NMSGS;
+                    for (size_t i = 0; i < SUITE_MULTI_NMSGS; ++i) {
+                        c.msgs[i] = buf + align + i * size;
+                        c.lens[i] = size;
+                    }
+                    suite_measure(&s, &c);
+                }
+                if (size > 0 && size <= SUITE_KEYS_MAX_WIDTH) {
+                    c.api = "keys";
+                    c.run = suite_run_keys;
+                    c.nmsgs = SUITE_KEYS_NKEYS;
+                    suite_measure(&s, &c);
+                }
+                if (size >= SPOOKY_TREE_CHUNK) {
+                    c.api = "tree";
+                    c.run = suite_run_tree;
+                    c.nmsgs = 1;
+                    suite_measure(&s, &c);
+                }
+                c.nmsgs = 1;
+            }
+            spooky_set_impl(best);
+        }
+    }
+
+    if (s.format == SUITE_JSON) {
+        printf("\n  ]\n}\n");
+    }
+    if (s.counters) {
+        suite_counters_close(&s);
+    }
+    munmap(buf, bufsize);
+    return 0;
+}
+
+#define SERVICE_DATASIZE (UINT64_C(64) << 20)
+#define SERVICE_NREQS 20000
+#define SERVICE_MAX_PENDING 64
+
+struct service_req {
+    spooky_request_t req;
+    uint64_t submit_ns;
+    uint64_t done_ns;
+};
+
+static uint64_t
+service_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void
+service_done(spooky_request_t *const req)
+{
+    struct service_req *const r = req->arg;
+    r->done_ns = service_now();
+}
+
+// The hashing service on a firehose of mixed sizes: mostly small requests, a
+// few up to 64 MiB, log-uniform within each class, submitted as fast as
+// backpressure allows. Requests that aren't split, the way a plain thread
+// pool would run them, against sliced streams and tree-mode big requests.
+static int
+bench_service(void)
+{
+    static struct {
+        char const*name;
+        size_t slice;
+        bool tree;
+    } const modes[] = {
+        {"whole", SIZE_MAX, false},
+        {"sliced", 0, false},
+        {"tree", 0, true},
+    };
+    static struct {
+        char const*name;
+        size_t min;
+        size_t max;
+    } const classes[] = {
+        {"<4K", 0, 4096},
+        {"4K-1M", 4096, 1 << 20},
+        {">=1M", 1 << 20, SERVICE_DATASIZE + 1},
+    };
+    size_t const nclasses = sizeof(classes)/sizeof(classes[0]);
+
+    uint8_t *const data = mmap(0, SERVICE_DATASIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    randfill(data, SERVICE_DATASIZE, time(NULL) ^ getpid() * getpid());
+    struct service_req *const reqs = calloc(SERVICE_NREQS, sizeof(*reqs));
+    uint64_t *const latencies = malloc(SERVICE_NREQS * sizeof(*latencies));
+
+    // The same requests for every mode: 90% from 64 bytes to 4 KiB, 9.5% up
+    // to 1 MiB and 0.5% up to 64 MiB
+    uint32_t rng = 0x5eed;
+    uint64_t total = 0;
+    for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+        uint32_t const pick = xorshift32(&rng) % 1000;
+        double const lo = pick < 900 ? 6 : pick < 995 ? 12 : 20;
+        double const hi = pick < 900 ? 12 : pick < 995 ? 20 : 26;
+        double const shift = lo + (hi - lo) * (xorshift32(&rng) % 10000) / 10000.0;
+        size_t const len = (size_t)exp2(shift);
+        reqs[i].req.buf = data + xorshift32(&rng) % (SERVICE_DATASIZE - len + 1);
+        reqs[i].req.len = len;
+        total += len;
+    }
+
+    uint64_t carry_forward = 0;
+    for (size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m) {
+        struct spooky_service_opts const opts = {
+            .max_pending = SERVICE_MAX_PENDING,
+            .slice = modes[m].slice,
+        };
+        spooky_service_t *const s = spooky_service_new(&opts);
+        uint64_t const start = service_now();
+        for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+            struct service_req *const r = &reqs[i];
+            r->req.h1 = i;
+            r->req.h2 = i;
+            r->req.tree = modes[m].tree && r->req.len >= (1 << 20);
+            r->req.done = service_done;
+            r->req.arg = r;
+            r->submit_ns = service_now();
+            spooky_service_submit(s, &r->req);
+        }
+        spooky_service_free(s);
+        uint64_t const end = service_now();
+
+        printf("%-6s %6.2f GB/s", modes[m].name, 1.0 * total / (end - start));
+        for (size_t c = 0; c < nclasses; ++c) {
+            size_t n = 0;
+            for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+                if (reqs[i].req.len >= classes[c].min && reqs[i].req.len < classes[c].max) {
+                    latencies[n++] = reqs[i].done_ns - reqs[i].submit_ns;
+                }
+                carry_forward += reqs[i].req.h1;
+            }
+            qsort(latencies, n, sizeof(*latencies), suite_compare);
+            printf(", %s p50 %8.1f us p99 %8.1f us", classes[c].name,
+                n ? latencies[n / 2] / 1e3 : 0.0, n ? latencies[(n * 99) / 100] / 1e3 : 0.0);
+        }
+        printf("\n");
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    free(latencies);
+    free(reqs);
+    munmap(data, SERVICE_DATASIZE);
+
+    return 0;
+}
+
+#ifdef __linux__
+#define FILES_NFILES 1000
+#define FILES_MIN_SHIFT 10
+#define FILES_MAX_SHIFT 20
+
+// The straightforward way: open, read() into one buffer, spooky_update, for
+// each file in turn.
+static uint64_t
+files_sync(char const*const*const paths, size_t const n, void *const buf, size_t const bufsize)
+{
+    uint64_t carry_forward = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int const fd = open(paths[i], O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        spooky_context_t ctx;
+        spooky_init(&ctx, 0, 0);
+        ssize_t got;
+        while ((got = read(fd, buf, bufsize)) > 0) {
+            spooky_update(&ctx, buf, got);
+        }
+        close(fd);
+        uint64_t h1, h2;
+        spooky_final(&ctx, &h1, &h2);
+        carry_forward ^= h1;
+    }
+    return carry_forward;
+}
+
+static void
+files_report(char const*const name, uint64_t const nbytes, uint64_t const ns)
+{
+    printf("%-20s %9.1f MB/s %9.0f files/s\n", name, 1e3*nbytes / ns, 1e9*FILES_NFILES / ns);
+}
+
+// Hash a corpus of files with sizes spread log-uniformly from 1 KiB to 1 MiB,
+// first with a plain read loop, then with spooky_hash_files on each engine.
+// The corpus lives in /dev/shm so this measures the submission and hashing
+// overhead, not the disk.
+static int
+bench_files(void)
+{
+    char dir[] = "/dev/shm/sbench.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    size_t const maxsize = (size_t)1 << FILES_MAX_SHIFT;
+    unsigned char *const buff = malloc(maxsize);
+    char (*const names)[64] = malloc(FILES_NFILES * sizeof(*names));
+    char const**const paths = malloc(FILES_NFILES * sizeof(*paths));
+    struct spooky_io_result *const results = malloc(FILES_NFILES * sizeof(*results));
+    uint32_t rng = time(NULL) ^ getpid() * getpid();
+    randfill(buff, maxsize, rng);
+
+    uint64_t nbytes = 0;
+    for (int i = 0; i < FILES_NFILES; ++i) {
+        int const shift = FILES_MIN_SHIFT + xorshift32(&rng) % (FILES_MAX_SHIFT - FILES_MIN_SHIFT);
+        size_t const size = ((size_t)1 << shift) + xorshift32(&rng) % ((size_t)1 << shift);
+        snprintf(names[i], sizeof(names[i]), "%s/%d", dir, i);
+        paths[i] = names[i];
+        FILE *const f = fopen(names[i], "w");
+        if (f != NULL) {
+            nbytes += fwrite(buff, 1, size < maxsize ? size : maxsize, f);
+            fclose(f);
+        }
+    }
+    printf("%d files, %" PRIu64 " bytes in %s\n", FILES_NFILES, nbytes, dir);
+
+    struct timespec start,end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t carry_forward = files_sync(paths, FILES_NFILES, buff, maxsize);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    files_report("read loop", nbytes, elapsed_ns(&start, &end));
+
+    struct {
+        char const*name;
+        enum spooky_io_engine engine;
+        unsigned queue_depth;
+    } const runs[] = {
+        {"pread", SPOOKY_IO_PREAD, 0},
+        {"io_uring qd 4", SPOOKY_IO_URING, 4},
+        {"io_uring qd 16", SPOOKY_IO_URING, 16},
+        {"io_uring qd 64", SPOOKY_IO_URING, 64},
+        {"io_uring qd 256", SPOOKY_IO_URING, 256},
+    };
+
+    for (size_t r = 0; r < sizeof(runs)/sizeof(runs[0]); ++r) {
+        struct spooky_io_opts const opts = {
+            .engine = runs[r].engine,
+            .queue_depth = runs[r].queue_depth,
+        };
+        struct spooky_io_stats stats;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int const used = spooky_hash_files(paths, FILES_NFILES, &opts, results, &stats);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (used != (int)runs[r].engine) {
+            printf("%-20s unavailable\n", runs[r].name);
+            continue;
+        }
+        files_report(runs[r].name, stats.bytes, elapsed_ns(&start, &end));
+        carry_forward ^= results[0].h1;
+    }
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    for (int i = 0; i < FILES_NFILES; ++i) {
+        unlink(names[i]);
+    }
+    rmdir(dir);
+    free(results);
+    free(paths);
+    free(names);
+    free(buff);
+
+    return 0;
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
+    if (argc == 1 || strcmp(argv[1], "suite") == 0) {
+        return bench_suite(argc > 1 ? argc - 2 : 0, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "multi") == 0) {
+        return bench_multi();
+    }
+    if (argc > 1 && strcmp(argv[1], "keys") == 0) {
+        return bench_keys();
+    }
+    if (argc > 1 && strcmp(argv[1], "tree") == 0) {
+        return bench_tree();
+    }
+    if (argc > 1 && strcmp(argv[1], "inline") == 0) {
+        return bench_inline();
+    }
+    if (argc > 1 && strcmp(argv[1], "stream") == 0) {
+        return bench_stream();
+    }
+    if (argc > 1 && strcmp(argv[1], "iov") == 0) {
+        return bench_iov();
+    }
+    if (argc > 1 && strcmp(argv[1], "map") == 0) {
+        return bench_map();
+    }
+    if (argc > 1 && strcmp(argv[1], "bloom") == 0) {
+        return bench_bloom();
+    }
+    if (argc > 1 && strcmp(argv[1], "hll") == 0) {
+        return bench_hll();
+    }
+    if (argc > 1 && strcmp(argv[1], "cdc") == 0) {
+        return bench_cdc();
+    }
+    if (argc > 1 && strcmp(argv[1], "merkle") == 0) {
+        return bench_merkle();
+    }
+    if (argc > 1 && strcmp(argv[1], "copy") == 0) {
+        return bench_copy();
+    }
+    if (argc > 1 && strcmp(argv[1], "hash256") == 0) {
+        return bench_hash256();
+    }
+    if (argc > 1 && strcmp(argv[1], "column") == 0) {
+        return bench_column();
+    }
+    if (argc > 1 && strcmp(argv[1], "partition") == 0) {
+        return bench_partition();
+    }
+    if (argc > 1 && strcmp(argv[1], "mgr") == 0) {
+        return bench_mgr();
+    }
+    if (argc > 1 && strcmp(argv[1], "service") == 0) {
+        return bench_service();
+    }
+#ifdef __linux__
+    if (argc > 1 && strcmp(argv[1], "files") == 0) {
+        return bench_files();
+    }
+#endif
+
     int offset = 0;
     if (argc > 1) {
         offset = strtol(argv[1], NULL, 0);
@@ -70,10 +2183,10 @@ main(int argc, char **argv)
     }
 
     for (int i = 0; i < NLOOPS; ++i) {
-        clock_gettime(CLOCK_REALTIME, &start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
         carry_forward = spooky_hash32((unsigned char *)buff + offset, MAPSIZE - offset, carry_forward);
-        clock_gettime(CLOCK_REALTIME, &end);
-        difference += (end.tv_sec - start.tv_sec)*1000000000ull + (end.tv_nsec - start.tv_nsec);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        difference += elapsed_ns(&start, &end);
     }
 
     uint64_t const total_data = (MAPSIZE - offset) * NLOOPS;
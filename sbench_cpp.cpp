@@ -0,0 +1,141 @@
+// Benchmarks for the C++ hashers: std::unordered_map throughput with
+// std::hash against spooky::hash and spooky::hashed_string keys.
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "spooky.hpp"
+
+static inline uint32_t
+xorshift32(uint32_t *const p_rng)
+{
+    uint32_t x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return *p_rng;
+}
+
+#define MAP_NKEYS (1 << 20)
+
+static double
+elapsed_ns(std::chrono::steady_clock::time_point const start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Insert every key, then look every key up as a Key and as a string_view
+// (which costs a std::string unless the hasher is transparent).
+template <class Key, class Hash, class Eq>
+static uint64_t
+bench_map(char const*const name, std::vector<std::string> const& keys)
+{
+    std::unordered_map<Key, uint32_t, Hash, Eq> map;
+    std::vector<Key> const probes(keys.begin(), keys.end());
+    uint64_t found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.emplace(Key(keys[i]), i);
+    }
+    double const insert_ns = elapsed_ns(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto const& k : probes) {
+        found += map.find(k)->second;
+    }
+    double const find_ns = elapsed_ns(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto const& k : keys) {
+        std::string_view const sv(k);
+#ifdef __cpp_lib_generic_unordered_lookup
+        if constexpr (std::is_same_v<Eq, std::equal_to<>>) {
+            found += map.find(sv)->second;
+        } else
+#endif
+        {
+            found += map.find(Key(sv))->second;
+        }
+    }
+    double const view_ns = elapsed_ns(start);
+
+    printf("%-28s insert %6.1f Mops/s find %6.1f Mops/s find(string_view) %6.1f Mops/s\n", name,
+        1e3 * keys.size() / insert_ns, 1e3 * keys.size() / find_ns, 1e3 * keys.size() / view_ns);
+    return found;
+}
+
+template <class Hash>
+static uint64_t
+bench_int_map(char const*const name, std::vector<uint64_t> const& keys)
+{
+    std::unordered_map<uint64_t, uint32_t, Hash> map;
+    uint64_t found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.emplace(keys[i], i);
+    }
+    double const insert_ns = elapsed_ns(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto const k : keys) {
+        found += map.find(k)->second;
+    }
+    double const find_ns = elapsed_ns(start);
+
+    printf("%-28s insert %6.1f Mops/s find %6.1f Mops/s\n", name,
+        1e3 * keys.size() / insert_ns, 1e3 * keys.size() / find_ns);
+    return found;
+}
+
+static int
+bench_maps(void)
+{
+    uint32_t rng = 0xdeadbeef;
+    std::vector<std::string> keys;
+    std::vector<uint64_t> ints;
+    keys.reserve(MAP_NKEYS);
+    ints.reserve(MAP_NKEYS);
+    for (int i = 0; i < MAP_NKEYS; ++i) {
+        // Identifier-ish keys of 8 to 40 characters, unique thanks to the
+        // number at the end
+        std::string k(8 + xorshift32(&rng) % 24, ' ');
+        for (auto& c : k) {
+            c = 'a' + xorshift32(&rng) % 26;
+        }
+        keys.push_back(k + std::to_string(i));
+        ints.push_back((uint64_t)xorshift32(&rng) << 32 | i);
+    }
+
+    uint64_t carry_forward = 0;
+    carry_forward += bench_map<std::string, std::hash<std::string>, std::equal_to<std::string>>(
+        "std::hash<std::string>", keys);
+    carry_forward += bench_map<std::string, spooky::hash<std::string>, std::equal_to<>>(
+        "spooky::hash<std::string>", keys);
+    carry_forward += bench_map<spooky::hashed_string, spooky::hash<spooky::hashed_string>, std::equal_to<>>(
+        "spooky::hashed_string", keys);
+    carry_forward += bench_int_map<std::hash<uint64_t>>("std::hash<uint64_t>", ints);
+    carry_forward += bench_int_map<spooky::hash<uint64_t>>("spooky::hash<uint64_t>", ints);
+    printf("Carry forward was %" PRIx64 "\n", carry_forward);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "map") == 0) {
+        return bench_maps();
+    }
+
+    printf("usage: %s map\n", argv[0]);
+    return 1;
+}
@@ -3,8 +3,24 @@
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "spooky.h"
+#include "spooky_inline.h"
+#include "spooky_map.h"
+#include "spooky_bloom.h"
+#include "spooky_hll.h"
+#include "spooky_cdc.h"
+#include "spooky_merkle.h"
+#include "spooky_mgr.h"
+#include "spooky_service.h"
+#include "spooky_column.h"
+#include "spooky_partition.h"
+#ifdef __linux__
+#include "spooky_io.h"
+#endif
 
 static inline uint32_t
 xorshift32(uint32_t *const p_rng)
@@ -295,6 +311,1483 @@ piecemeal_hash(void const*p_msg, size_t p_len, uint64_t *ph1, uint64_t *ph2)
     spooky_final(&ctxt, ph1, ph2);
 }
 
+// Feed messages to spooky_update in pieces of random length, from single
+// bytes up to several blocks, and compare with spooky_hash128.
+static void
+stream_hash_test(uint8_t const*const p_buffer)
+{
+    static size_t const max_piece[] = {1, 3, 8, 17, 95, 96, 200, 1000};
+
+    uint32_t rng = 0x5eed1e55;
+
+    for (size_t m = 0; m < sizeof(max_piece)/sizeof(max_piece[0]); ++m) {
+        for (size_t len = 0; len < 3000; len += 1 + len / 16) {
+            size_t const off = xorshift32(&rng) % 8;
+
+            spooky_context_t ctxt;
+            spooky_init(&ctxt, 123456789, 987654321);
+            for (size_t done = 0; done < len; ) {
+                size_t n = xorshift32(&rng) % (max_piece[m] + 1);
+                if (n > len - done) {
+                    n = len - done;
+                }
+                spooky_update(&ctxt, p_buffer + off + done, n);
+                done += n;
+            }
+            uint64_t seed1, seed2;
+            spooky_final(&ctxt, &seed1, &seed2);
+
+            uint64_t exp1 = 123456789;
+            uint64_t exp2 = 987654321;
+            spooky_hash128(p_buffer + off, len, &exp1, &exp2);
+
+            if (seed1 != exp1 || seed2 != exp2) {
+                printf("STREAM TEST FAILED WITH PIECES UP TO %zu NUMBYTES %zu!\n", max_piece[m], len);
+                abort();
+            }
+        }
+    }
+}
+
+// Stream messages in random pieces, round-tripping the context through a
+// checkpoint after every piece, and check the result is unaffected. Then
+// make sure damaged checkpoints are refused.
+static void
+checkpoint_test(uint8_t const*const p_buffer)
+{
+    uint8_t ckpt[SPOOKY_CONTEXT_EXPORT_MAX];
+    uint32_t rng = 0xc0ffee11;
+
+    for (size_t len = 0; len < 3000; len += 1 + len / 16) {
+        spooky_context_t ctxt;
+        spooky_init(&ctxt, 123456789, 987654321);
+        for (size_t done = 0; done < len; ) {
+            size_t n = xorshift32(&rng) % 300;
+            if (n > len - done) {
+                n = len - done;
+            }
+            spooky_update(&ctxt, p_buffer + done, n);
+            done += n;
+
+            size_t const ckpt_len = spooky_context_export(&ctxt, ckpt);
+            if (ckpt_len > SPOOKY_CONTEXT_EXPORT_MAX) {
+                printf("CHECKPOINT TEST FAILED, %zu BYTE CHECKPOINT!\n", ckpt_len);
+                abort();
+            }
+            // Resume in a context that has nothing in common with the old one
+            memset(&ctxt, 0xa5, sizeof(ctxt));
+            if (!spooky_context_import(&ctxt, ckpt, ckpt_len)
+                || spooky_context_import(&ctxt, ckpt, ckpt_len - 1)) {
+                printf("CHECKPOINT TEST FAILED TO IMPORT AT %zu BYTES!\n", done);
+                abort();
+            }
+        }
+        uint64_t seed1, seed2;
+        spooky_final(&ctxt, &seed1, &seed2);
+
+        uint64_t exp1 = 123456789;
+        uint64_t exp2 = 987654321;
+        spooky_hash128(p_buffer, len, &exp1, &exp2);
+
+        if (seed1 != exp1 || seed2 != exp2) {
+            printf("CHECKPOINT TEST FAILED WITH NUMBYTES %zu!\n", len);
+            abort();
+        }
+    }
+
+    spooky_context_t ctxt;
+    spooky_init(&ctxt, 1, 2);
+    spooky_update(&ctxt, p_buffer, 1000);
+    size_t const ckpt_len = spooky_context_export(&ctxt, ckpt);
+    for (int i = 0; i < 4; ++i) {
+        ckpt[i] ^= 0x80;
+        if (spooky_context_import(&ctxt, ckpt, ckpt_len)) {
+            printf("CHECKPOINT TEST ACCEPTED A BAD HEADER!\n");
+            abort();
+        }
+        ckpt[i] ^= 0x80;
+    }
+}
+
+// The SPOOKY_INLINE paths must agree with the library, both for lengths only
+// known at run time and for the constant lengths they're meant for.
+static void
+inline_hash_test(uint8_t const*const p_buffer)
+{
+    for (size_t len = 0; len < 2000; len += 1 + len / 64) {
+        for (int off = 0; off < 8; ++off) {
+            uint64_t seed1 = 123456789;
+            uint64_t seed2 = 987654321;
+            spooky_hash128_inline(p_buffer + off, len, &seed1, &seed2);
+
+            uint64_t exp1 = 123456789;
+            uint64_t exp2 = 987654321;
+            spooky_hash128(p_buffer + off, len, &exp1, &exp2);
+
+            if (seed1 != exp1 || seed2 != exp2) {
+                printf("INLINE TEST FAILED WITH UNALIGNMENT %d AND NUMBYTES %zu!\n", off, len);
+                abort();
+            }
+        }
+    }
+
+#define INLINE_CONST_TEST(len) \
+    do { \
+        uint64_t seed1 = 42, seed2 = 42, exp1 = 42, exp2 = 42; \
+        spooky_hash128_inline(p_buffer + 3, len, &seed1, &seed2); \
+        spooky_hash128(p_buffer + 3, len, &exp1, &exp2); \
+        if (seed1 != exp1 || seed2 != exp2) { \
+            printf("INLINE TEST FAILED WITH CONSTANT NUMBYTES %d!\n", len); \
+            abort(); \
+        } \
+    } while (0)
+
+    INLINE_CONST_TEST(0);
+    INLINE_CONST_TEST(4);
+    INLINE_CONST_TEST(8);
+    INLINE_CONST_TEST(12);
+    INLINE_CONST_TEST(16);
+    INLINE_CONST_TEST(20);
+    INLINE_CONST_TEST(32);
+    INLINE_CONST_TEST(64);
+    INLINE_CONST_TEST(191);
+    INLINE_CONST_TEST(192);
+    INLINE_CONST_TEST(1000);
+#undef INLINE_CONST_TEST
+}
+
+#define IOV_MAXFRAGS 512
+
+// Cut messages into fragments of random sizes, zero included, and check that
+// spooky_hash128_iov of the pieces matches spooky_hash128 of the whole.
+static void
+iov_hash_test(uint8_t const*const p_buffer)
+{
+    static size_t const max_frag[] = {1, 8, 95, 96, 97, 300, 5000};
+    struct iovec iov[IOV_MAXFRAGS];
+
+    uint32_t rng = 0xabad1dea;
+
+    for (size_t m = 0; m < sizeof(max_frag)/sizeof(max_frag[0]); ++m) {
+        for (size_t len = 0; len < 3000; len += 1 + len / 16) {
+            size_t const off = xorshift32(&rng) % 8;
+            size_t done = 0;
+            int iovcnt = 0;
+            while (done < len && iovcnt < IOV_MAXFRAGS - 1) {
+                size_t n = xorshift32(&rng) % (max_frag[m] + 1);
+                if (n > len - done) {
+                    n = len - done;
+                }
+                // Empty fragments get no buffer at all, as callers may pass them
+                iov[iovcnt].iov_base = n == 0 ? NULL : (void *)(p_buffer + off + done);
+                iov[iovcnt].iov_len = n;
+                ++iovcnt;
+                done += n;
+            }
+            iov[iovcnt].iov_base = len == done ? NULL : (void *)(p_buffer + off + done);
+            iov[iovcnt].iov_len = len - done;
+            ++iovcnt;
+
+            uint64_t seed1 = 123456789;
+            uint64_t seed2 = 987654321;
+            spooky_hash128_iov(iov, iovcnt, &seed1, &seed2);
+
+            uint64_t exp1 = 123456789;
+            uint64_t exp2 = 987654321;
+            spooky_hash128(p_buffer + off, len, &exp1, &exp2);
+
+            if (seed1 != exp1 || seed2 != exp2) {
+                printf("IOV TEST FAILED WITH %d FRAGMENTS NUMBYTES %zu!\n", iovcnt, len);
+                abort();
+            }
+        }
+    }
+}
+
+#define MULTI_MAXMSGS 200
+
+// Hash batches of messages with random lengths and alignments through
+// spooky_hash128_multi and compare every result to spooky_hash128.
+static void
+multi_hash_test(uint8_t const*const p_buffer)
+{
+    void const*msgs[MULTI_MAXMSGS] = {0};
+    size_t lens[MULTI_MAXMSGS] = {0};
+    uint64_t h1[MULTI_MAXMSGS];
+    uint64_t h2[MULTI_MAXMSGS];
+
+    uint32_t rng = 0xfeedf00d;
+
+    for (int n = 0; n < MULTI_MAXMSGS; n += 1 + n / 8) {
+        for (int i = 0; i < n; ++i) {
+            size_t const off = xorshift32(&rng) % SC_BUFSIZE;
+            size_t len = xorshift32(&rng) % (DATASIZE - off);
+            // Plenty of short messages, and plenty right around the switch
+            // to the long hash.
+            switch (xorshift32(&rng) % 4) {
+            case 0: len %= SC_BUFSIZE; break;
+            case 1: len = SC_BUFSIZE - 8 + len % 16; break;
+            default: break;
+            }
+            msgs[i] = p_buffer + off;
+            lens[i] = len;
+            h1[i] = xorshift32(&rng);
+            h2[i] = xorshift32(&rng);
+        }
+
+        uint64_t exp1[MULTI_MAXMSGS];
+        uint64_t exp2[MULTI_MAXMSGS];
+        for (int i = 0; i < n; ++i) {
+            exp1[i] = h1[i];
+            exp2[i] = h2[i];
+            spooky_hash128(msgs[i], lens[i], &exp1[i], &exp2[i]);
+        }
+
+        spooky_hash128_multi(msgs, lens, n, h1, h2);
+
+        for (int i = 0; i < n; ++i) {
+            if ((h1[i] != exp1[i]) || (h2[i] != exp2[i])) {
+                printf("MULTI TEST FAILED WITH BATCH %d MESSAGE %d NUMBYTES %zu!\n", n, i, lens[i]);
+                abort();
+            }
+        }
+    }
+}
+
+#define KEYS_MAXKEYS 100
+
+// Hash arrays of keys of every width up to 40 bytes, at every alignment, and
+// compare them against spooky_hash64 one key at a time.
+static void
+keys_hash_test(uint8_t const*const p_buffer)
+{
+    uint64_t out[KEYS_MAXKEYS];
+    uint32_t rng = 0xabad1dea;
+
+    for (size_t width = 0; width <= 40; ++width) {
+        for (size_t off = 0; off < 8; ++off) {
+            size_t const nkeys = xorshift32(&rng) % KEYS_MAXKEYS;
+            uint64_t const seed = xorshift32(&rng);
+            uint8_t const*const keys = p_buffer + off;
+
+            spooky_hash64_keys(keys, width, nkeys, seed, out);
+
+            for (size_t i = 0; i < nkeys; ++i) {
+                if (out[i] != spooky_hash64(keys + i * width, width, seed)) {
+                    printf("KEYS TEST FAILED WITH WIDTH %zu UNALIGNMENT %zu KEY %zu!\n", width, off, i);
+                    abort();
+                }
+            }
+        }
+    }
+}
+
+// Recompute the tree hash the long way, straight from its definition
+static void
+tree_hash_reference(uint8_t const*const p_msg, size_t const p_len, size_t const p_chunk,
+    uint64_t *const ph1, uint64_t *const ph2)
+{
+    size_t const nchunks = p_len == 0 ? 1 : (p_len - 1) / p_chunk + 1;
+    uint64_t *const words = malloc((2 * nchunks + 2) * sizeof(uint64_t));
+
+    for (size_t i = 0; i < nchunks; ++i) {
+        size_t const off = i * p_chunk;
+        size_t const clen = (p_len - off) < p_chunk ? (p_len - off) : p_chunk;
+        words[2*i] = *ph1;
+        words[2*i + 1] = *ph2;
+        spooky_hash128(p_msg + off, clen, &words[2*i], &words[2*i + 1]);
+    }
+    words[2 * nchunks] = p_len;
+    words[2 * nchunks + 1] = p_chunk;
+
+    spooky_hash128(words, (2 * nchunks + 2) * sizeof(uint64_t), ph1, ph2);
+    free(words);
+}
+
+// The tree hash must match its documented definition, whatever the number of
+// threads doing the work.
+static void
+tree_hash_test(uint8_t const*const p_buffer)
+{
+    static size_t const lens[] = {0, 1, 191, 192, 4095, 4096, 4097, 40000, DATASIZE - 7};
+    static size_t const chunks[] = {1, 96, 100, 4096, SPOOKY_TREE_CHUNK};
+    static unsigned const threads[] = {1, 2, 3, 8, 0};
+
+    for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); ++l) {
+        for (size_t c = 0; c < sizeof(chunks)/sizeof(chunks[0]); ++c) {
+            uint64_t exp1 = 123456789;
+            uint64_t exp2 = 987654321;
+            tree_hash_reference(p_buffer + 3, lens[l], chunks[c], &exp1, &exp2);
+
+            for (size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); ++t) {
+                uint64_t seed1 = 123456789;
+                uint64_t seed2 = 987654321;
+                spooky_tree_hash128(p_buffer + 3, lens[l], chunks[c], threads[t], &seed1, &seed2);
+                if ((seed1 != exp1) || (seed2 != exp2)) {
+                    printf("TREE TEST FAILED WITH NUMBYTES %zu CHUNK %zu THREADS %u!\n",
+                        lens[l], chunks[c], threads[t]);
+                    abort();
+                }
+            }
+        }
+    }
+
+    // A chunk size of 0 means the default
+    uint64_t seed1 = 1;
+    uint64_t seed2 = 2;
+    uint64_t exp1 = 1;
+    uint64_t exp2 = 2;
+    spooky_tree_hash128(p_buffer, DATASIZE, 0, 2, &seed1, &seed2);
+    tree_hash_reference(p_buffer, DATASIZE, SPOOKY_TREE_CHUNK, &exp1, &exp2);
+    if ((seed1 != exp1) || (seed2 != exp2)) {
+        printf("TREE TEST FAILED WITH DEFAULT CHUNK SIZE!\n");
+        abort();
+    }
+}
+
+#define MAP_NKEYS 5000
+
+// Key i of width bytes: i, then bytes of the buffer
+static void
+map_key(uint8_t *const key, uint8_t const*const p_buffer, size_t const width, uint32_t const i)
+{
+    memcpy(key, p_buffer + i % 1024, width);
+    memcpy(key, &i, width < 4 ? width : 4);
+}
+
+// The map against the obvious answers, through growth from the smallest
+// table, overwrites, erases that leave tombstones, and find_many, which
+// hashes with spooky_hash64_keys and so has to agree with the single key
+// hash of every CPU variant.
+static void
+map_test(uint8_t const*const p_buffer)
+{
+    static size_t const widths[] = {4, 8, 12, 16, 32, 40};
+    uint8_t *const keys = malloc(2 * MAP_NKEYS * 40);
+    uint64_t *const values = malloc(2 * MAP_NKEYS * sizeof(uint64_t));
+    bool *const found = malloc(2 * MAP_NKEYS * sizeof(bool));
+
+    for (size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w) {
+        size_t const width = widths[w];
+        // Keys MAP_NKEYS and up are never inserted
+        for (uint32_t i = 0; i < 2 * MAP_NKEYS; ++i) {
+            map_key(keys + i * width, p_buffer, width, i);
+        }
+
+        spooky_map_t *const m = spooky_map_new(width, 0, 42);
+        for (uint32_t i = 0; i < MAP_NKEYS; ++i) {
+            spooky_map_insert(m, keys + i * width, i);
+        }
+        for (uint32_t i = 0; i < MAP_NKEYS; i += 4) {
+            spooky_map_insert(m, keys + i * width, 3 * i);
+        }
+        for (uint32_t i = 1; i < MAP_NKEYS; i += 2) {
+            spooky_map_erase(m, keys + i * width);
+        }
+        if (spooky_map_size(m) != MAP_NKEYS / 2
+            || spooky_map_erase(m, keys + width) || spooky_map_erase(m, keys + MAP_NKEYS * width)) {
+            printf("MAP TEST FAILED WITH WIDTH %zu SIZE %zu!\n", width, spooky_map_size(m));
+            abort();
+        }
+
+        size_t const nfound = spooky_map_find_many(m, keys, 2 * MAP_NKEYS, values, found);
+        for (uint32_t i = 0; i < 2 * MAP_NKEYS; ++i) {
+            bool const expect_found = i < MAP_NKEYS && i % 2 == 0;
+            uint64_t const expect = i % 4 == 0 ? 3 * i : i;
+            uint64_t value = 0;
+            bool const one_found = spooky_map_find(m, keys + i * width, &value);
+            if (one_found != expect_found || found[i] != expect_found
+                || (expect_found && (value != expect || values[i] != expect))) {
+                printf("MAP TEST FAILED WITH WIDTH %zu KEY %u!\n", width, i);
+                abort();
+            }
+        }
+        if (nfound != spooky_map_size(m)) {
+            printf("MAP TEST FAILED WITH WIDTH %zu, FIND_MANY FOUND %zu!\n", width, nfound);
+            abort();
+        }
+        spooky_map_free(m);
+
+        // Churn a table held at 70% full, keys coming and going in batches
+        // leave tombstones that have to be rehashed away without growing it
+        spooky_map_t *const c = spooky_map_new(width, 896, 7);
+        size_t const capacity = spooky_map_capacity(c);
+        for (uint32_t i = 0; i < 700; ++i) {
+            spooky_map_insert(c, keys + i * width, i);
+        }
+        for (uint32_t lo = 0; lo + 800 <= 2 * MAP_NKEYS; lo += 100) {
+            for (uint32_t i = lo; i < lo + 100; ++i) {
+                spooky_map_erase(c, keys + i * width);
+            }
+            for (uint32_t i = lo + 700; i < lo + 800; ++i) {
+                spooky_map_insert(c, keys + i * width, i);
+            }
+            for (uint32_t i = lo + 100; i < lo + 800; i += 7) {
+                uint64_t value;
+                if (!spooky_map_find(c, keys + i * width, &value) || value != i
+                    || spooky_map_find(c, keys + (lo + i % 100) * width, NULL)) {
+                    printf("MAP TEST FAILED WITH WIDTH %zu CHURNING KEY %u!\n", width, i);
+                    abort();
+                }
+            }
+        }
+        if (spooky_map_capacity(c) != capacity || spooky_map_size(c) != 700) {
+            printf("MAP TEST FAILED WITH WIDTH %zu, TOMBSTONES GREW IT TO %zu!\n", width, spooky_map_capacity(c));
+            abort();
+        }
+        spooky_map_free(c);
+    }
+
+    free(keys);
+    free(values);
+    free(found);
+}
+
+#define BLOOM_NKEYS 20000
+
+// No false negatives, false positives near the rate asked for, and the
+// batched functions setting and testing the same bits as the single ones
+static void
+bloom_test(uint8_t const*const p_buffer)
+{
+    void const**const keys = malloc(2 * BLOOM_NKEYS * sizeof(*keys));
+    size_t *const lens = malloc(2 * BLOOM_NKEYS * sizeof(*lens));
+    bool *const out = malloc(2 * BLOOM_NKEYS * sizeof(*out));
+
+    // Keys BLOOM_NKEYS and up are never added: the same offsets, other lengths
+    for (size_t i = 0; i < BLOOM_NKEYS; ++i) {
+        keys[i] = p_buffer + i;
+        lens[i] = 1 + i % 250;
+        keys[BLOOM_NKEYS + i] = p_buffer + i;
+        lens[BLOOM_NKEYS + i] = 1 + (i + 125) % 250;
+    }
+
+    for (int blocked = 0; blocked < 2; ++blocked) {
+        spooky_bloom_t *const one = spooky_bloom_new(BLOOM_NKEYS, 0.01, blocked, 42);
+        spooky_bloom_t *const many = spooky_bloom_new(BLOOM_NKEYS, 0.01, blocked, 42);
+        for (size_t i = 0; i < BLOOM_NKEYS; ++i) {
+            spooky_bloom_add(one, keys[i], lens[i]);
+        }
+        spooky_bloom_add_many(many, keys, lens, BLOOM_NKEYS);
+
+        size_t const ntrue = spooky_bloom_query_many(many, keys, lens, 2 * BLOOM_NKEYS, out);
+        size_t false_positives = 0;
+        for (size_t i = 0; i < 2 * BLOOM_NKEYS; ++i) {
+            bool const q = spooky_bloom_query(one, keys[i], lens[i]);
+            if (q != out[i] || (i < BLOOM_NKEYS && !q)) {
+                printf("BLOOM TEST FAILED WITH BLOCKED %d KEY %zu!\n", blocked, i);
+                abort();
+            }
+            false_positives += i >= BLOOM_NKEYS && q;
+        }
+        if (ntrue != BLOOM_NKEYS + false_positives || false_positives > BLOOM_NKEYS / 50) {
+            printf("BLOOM TEST FAILED WITH BLOCKED %d, %zu FALSE POSITIVES!\n", blocked, false_positives);
+            abort();
+        }
+        spooky_bloom_free(one);
+        spooky_bloom_free(many);
+    }
+
+    if (spooky_bloom_new(1, 0, false, 0) != NULL || spooky_bloom_new(1, 1, true, 0) != NULL) {
+        printf("BLOOM TEST FAILED TO REJECT A RATE!\n");
+        abort();
+    }
+
+    free(keys);
+    free(lens);
+    free(out);
+}
+
+// A sketch fed keys [first, first+n) with spooky_hll_add_many
+static spooky_hll_t *
+hll_of_range(unsigned const p, uint64_t const first, size_t const n)
+{
+    uint64_t *const keys = malloc(n * sizeof(uint64_t));
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = first + i;
+    }
+    spooky_hll_t *const h = spooky_hll_new(p, 9);
+    spooky_hll_add_many(h, keys, sizeof(uint64_t), n);
+    free(keys);
+    return h;
+}
+
+// Two sketches merged must serialize to exactly what one sketch of the union
+// does, sparse or dense or a mix, and survive a trip through export/import.
+// The estimates use the SIMD kernels of the current CPU variant.
+static void
+hll_test(void)
+{
+    static size_t const sizes[][2] = {{100, 200}, {50, 100000}, {100000, 50}, {100000, 200000}};
+    uint8_t *const a_buf = malloc(SPOOKY_HLL_EXPORT_MAX(12));
+    uint8_t *const u_buf = malloc(SPOOKY_HLL_EXPORT_MAX(12));
+
+    for (size_t t = 0; t < sizeof(sizes)/sizeof(sizes[0]); ++t) {
+        // b's keys overlap the end of a's
+        size_t const na = sizes[t][0];
+        size_t const nb = sizes[t][1];
+        size_t const n = na - na / 2 + nb > na ? na - na / 2 + nb : na;
+        spooky_hll_t *const a = spooky_hll_new(12, 9);
+        for (uint64_t i = 0; i < na; ++i) {
+            spooky_hll_add(a, &i, sizeof(i));
+        }
+        spooky_hll_t *const b = hll_of_range(12, na - na / 2, nb);
+        spooky_hll_t *const u = spooky_hll_new(12, 9);
+        for (uint64_t i = 0; i < n; ++i) {
+            spooky_hll_add_hash(u, spooky_hash64(&i, sizeof(i), 9));
+        }
+
+        if (!spooky_hll_merge(a, b)) {
+            printf("HLL TEST FAILED TO MERGE %zu AND %zu!\n", na, nb);
+            abort();
+        }
+        size_t const a_len = spooky_hll_export(a, a_buf);
+        size_t const u_len = spooky_hll_export(u, u_buf);
+        if (a_len != u_len || memcmp(a_buf, u_buf, a_len) != 0 || a_len > SPOOKY_HLL_EXPORT_MAX(12)) {
+            printf("HLL TEST FAILED, MERGING %zu AND %zu ISN'T THE UNION!\n", na, nb);
+            abort();
+        }
+
+        // Sparse sketches are all but exact, dense ones within about four
+        // standard errors
+        double const e = spooky_hll_estimate(a);
+        double const tolerance = n < 1000 ? 0.01 : 0.07;
+        if (e < n * (1 - tolerance) || e > n * (1 + tolerance)) {
+            printf("HLL TEST FAILED WITH ESTIMATE %f FOR %zu KEYS!\n", e, n);
+            abort();
+        }
+        // and the same to the bit whichever kernel computed it
+        enum spooky_impl const current = spooky_get_impl();
+        for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+            if (spooky_set_impl(impl) && spooky_hll_estimate(a) != e) {
+                printf("HLL TEST FAILED, %s ESTIMATES %f FOR %zu KEYS, NOT %f!\n",
+                    spooky_impl_name(impl), spooky_hll_estimate(a), n, e);
+                abort();
+            }
+        }
+        spooky_set_impl(current);
+
+        spooky_hll_t *const c = spooky_hll_import(a_buf, a_len);
+        if (c == NULL || spooky_hll_export(c, u_buf) != a_len || memcmp(a_buf, u_buf, a_len) != 0
+            || spooky_hll_estimate(c) != e) {
+            printf("HLL TEST FAILED TO IMPORT %zu KEYS!\n", n);
+            abort();
+        }
+        if (a_buf[3] == 0) {
+            a_buf[12] = 60;
+            if (spooky_hll_import(a_buf, a_len - 1) != NULL || spooky_hll_import(a_buf, a_len) != NULL) {
+                printf("HLL TEST FAILED, IMPORTED A BROKEN SKETCH!\n");
+                abort();
+            }
+        }
+
+        spooky_hll_free(a);
+        spooky_hll_free(b);
+        spooky_hll_free(c);
+        spooky_hll_free(u);
+    }
+
+    spooky_hll_t *const empty = spooky_hll_new(12, 9);
+    spooky_hll_t *const other = spooky_hll_new(10, 9);
+    size_t const len = spooky_hll_export(empty, a_buf);
+    a_buf[0] = 'X';
+    if (spooky_hll_estimate(empty) != 0 || spooky_hll_merge(empty, other) || len != 12
+        || spooky_hll_import(a_buf, len) != NULL || spooky_hll_new(3, 0) != NULL) {
+        printf("HLL TEST FAILED ON BAD INPUT!\n");
+        abort();
+    }
+    spooky_hll_free(empty);
+    spooky_hll_free(other);
+
+    free(a_buf);
+    free(u_buf);
+}
+
+struct cdc_sink {
+    struct spooky_cdc_chunk *chunks;
+    size_t n;
+};
+
+static void
+cdc_collect(void *const arg, struct spooky_cdc_chunk const*const chunk)
+{
+    struct cdc_sink *const sink = arg;
+    sink->chunks[sink->n++] = *chunk;
+}
+
+#define CDC_DATASIZE (UINT64_C(13) << 20)
+
+// Streaming in uneven pieces and chunking the whole buffer on any number of
+// threads must give the same chunks. The buffer has a run of zeros longer
+// than a segment, where boundaries only come from max_size and the segments
+// can't fall into step, and a copied region whose chunks should mostly dedup.
+static void
+cdc_test(void)
+{
+    static unsigned const threads[] = {1, 2, 3, 0};
+    struct spooky_cdc_params const params = {1024, 4096, 16384, 7};
+    uint8_t *const data = malloc(CDC_DATASIZE);
+    randfill(data, CDC_DATASIZE, 5);
+    memset(data + (UINT64_C(3) << 20), 0, UINT64_C(5) << 20);
+    memcpy(data + (UINT64_C(11) << 20), data + (UINT64_C(1) << 20), UINT64_C(1) << 20);
+
+    spooky_cdc_t c;
+    struct cdc_sink sink = {malloc(CDC_DATASIZE / params.min_size * sizeof(*sink.chunks)), 0};
+    spooky_cdc_init(&c, &params);
+    uint32_t rng = 11;
+    size_t emitted = 0;
+    for (size_t pos = 0; pos < CDC_DATASIZE;) {
+        size_t n = xorshift32(&rng) % 20000;
+        n = n < CDC_DATASIZE - pos ? n : CDC_DATASIZE - pos;
+        emitted += spooky_cdc_update(&c, data + pos, n, cdc_collect, &sink);
+        pos += n;
+    }
+    emitted += spooky_cdc_final(&c, cdc_collect, &sink);
+
+    uint64_t pos = 0;
+    for (size_t i = 0; i < sink.n; ++i) {
+        struct spooky_cdc_chunk const*const chunk = &sink.chunks[i];
+        uint64_t h1 = params.seed;
+        uint64_t h2 = params.seed;
+        spooky_hash128(data + chunk->offset, chunk->len, &h1, &h2);
+        if (chunk->offset != pos || chunk->len > params.max_size
+            || (chunk->len < params.min_size && i != sink.n - 1) || h1 != chunk->h1 || h2 != chunk->h2) {
+            printf("CDC TEST FAILED WITH CHUNK %zu AT %" PRIu64 "!\n", i, pos);
+            abort();
+        }
+        pos += chunk->len;
+    }
+    if (pos != CDC_DATASIZE || emitted != sink.n) {
+        printf("CDC TEST FAILED, CHUNKS DON'T COVER THE STREAM!\n");
+        abort();
+    }
+
+    // Chunks wholly within the copy should match the original's, apart from
+    // the first few before the boundaries fall into step
+    size_t ncopied = 0;
+    size_t nmatched = 0;
+    for (size_t i = 0; i < sink.n; ++i) {
+        if (sink.chunks[i].offset < (UINT64_C(11) << 20)
+            || sink.chunks[i].offset + sink.chunks[i].len > (UINT64_C(12) << 20)) {
+            continue;
+        }
+        ++ncopied;
+        for (size_t j = 0; j < sink.n; ++j) {
+            if (sink.chunks[j].h1 == sink.chunks[i].h1 && sink.chunks[j].h2 == sink.chunks[i].h2
+                && sink.chunks[j].offset < (UINT64_C(2) << 20)) {
+                ++nmatched;
+                break;
+            }
+        }
+    }
+    if (ncopied < 100 || nmatched + 4 < ncopied) {
+        printf("CDC TEST FAILED, ONLY %zu OF %zu COPIED CHUNKS DEDUP!\n", nmatched, ncopied);
+        abort();
+    }
+
+    for (size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); ++t) {
+        size_t n;
+        struct spooky_cdc_chunk *const chunks = spooky_cdc_chunk_buffer(&params, data, CDC_DATASIZE,
+            threads[t], &n);
+        if (chunks == NULL || n != sink.n || memcmp(chunks, sink.chunks, n * sizeof(*chunks)) != 0) {
+            printf("CDC TEST FAILED WITH THREADS %u!\n", threads[t]);
+            abort();
+        }
+        free(chunks);
+    }
+
+    size_t n = 1;
+    struct spooky_cdc_params const bad = {4096, 2048, 16384, 7};
+    struct spooky_cdc_params const huge = {4096, SIZE_MAX, SIZE_MAX, 7};
+    struct spooky_cdc_chunk *const none = spooky_cdc_chunk_buffer(&params, data, 0, 2, &n);
+    if (spooky_cdc_init(&c, &bad) || spooky_cdc_chunk_buffer(&bad, data, 10, 1, &n) != NULL
+        || spooky_cdc_init(&c, &huge)
+        || none == NULL || n != 0) {
+        printf("CDC TEST FAILED ON BAD INPUT!\n");
+        abort();
+    }
+    free(none);
+
+    free(sink.chunks);
+    free(data);
+}
+
+#define MERKLE_DATASIZE 1000003
+
+// After any series of writes, updating just the written ranges must give the
+// same tree as building it again, and the sidecar must round trip and
+// refuse to load once damaged.
+static void
+merkle_test(void)
+{
+    static size_t const block_sizes[] = {4096, 1000, 1};
+    uint8_t *const data = malloc(MERKLE_DATASIZE);
+    randfill(data, MERKLE_DATASIZE, 3);
+    uint32_t rng = 17;
+
+    for (size_t s = 0; s < sizeof(block_sizes)/sizeof(block_sizes[0]); ++s) {
+        size_t const len = block_sizes[s] == 1 ? 4097 : MERKLE_DATASIZE;
+        spooky_merkle_t *const m = spooky_merkle_new(data, len, block_sizes[s], 5);
+
+        for (int w = 0; w < 50; ++w) {
+            size_t const off = xorshift32(&rng) % len;
+            size_t const n = xorshift32(&rng) % (w % 5 == 0 ? len - off + 1 : 10000 < len - off ? 10000 : len - off);
+            for (size_t i = 0; i < n; ++i) {
+                data[off + i] ^= 0x5a;
+            }
+            if (n > 0 && spooky_merkle_verify_range(m, data, off, n)) {
+                printf("MERKLE TEST FAILED TO NOTICE A WRITE AT %zu!\n", off);
+                abort();
+            }
+            spooky_merkle_update_range(m, data, off, n);
+            if (!spooky_merkle_verify_range(m, data, 0, len)) {
+                printf("MERKLE TEST FAILED TO VERIFY AFTER A WRITE AT %zu!\n", off);
+                abort();
+            }
+        }
+
+        spooky_merkle_t *const fresh = spooky_merkle_new(data, len, block_sizes[s], 5);
+        uint64_t h1, h2, e1, e2;
+        spooky_merkle_root(m, &h1, &h2);
+        spooky_merkle_root(fresh, &e1, &e2);
+        if (h1 != e1 || h2 != e2 || spooky_merkle_nblocks(m) != (len - 1) / block_sizes[s] + 1
+            || spooky_merkle_update_range(m, data, len, 1) || !spooky_merkle_update_range(m, data, len, 0)) {
+            printf("MERKLE TEST FAILED WITH BLOCK SIZE %zu!\n", block_sizes[s]);
+            abort();
+        }
+        spooky_merkle_free(fresh);
+        spooky_merkle_free(m);
+    }
+
+    spooky_merkle_t *const m = spooky_merkle_new(data, MERKLE_DATASIZE, 0, 5);
+    spooky_merkle_t *const empty = spooky_merkle_new(data, 0, 0, 5);
+    char path[] = "/tmp/scorrect.merkle.XXXXXX";
+    int const fd = mkstemp(path);
+    if (fd < 0 || !spooky_merkle_save(m, path)) {
+        printf("MERKLE TEST COULDN'T SAVE %s!\n", path);
+        abort();
+    }
+    close(fd);
+    spooky_merkle_t *const loaded = spooky_merkle_load(path);
+    uint64_t h1, h2, e1, e2;
+    spooky_merkle_root(m, &h1, &h2);
+    if (loaded == NULL) {
+        printf("MERKLE TEST COULDN'T LOAD %s!\n", path);
+        abort();
+    }
+    spooky_merkle_root(loaded, &e1, &e2);
+    if (h1 != e1 || h2 != e2 || spooky_merkle_len(loaded) != MERKLE_DATASIZE
+        || !spooky_merkle_verify_range(loaded, data, 0, MERKLE_DATASIZE)
+        || spooky_merkle_nblocks(empty) != 1) {
+        printf("MERKLE TEST FAILED, THE SIDECAR DIDN'T ROUND TRIP!\n");
+        abort();
+    }
+
+    // Flip a bit in one leaf hash
+    FILE *const f = fopen(path, "r+b");
+    fseek(f, 100, SEEK_SET);
+    int const c = fgetc(f);
+    fseek(f, 100, SEEK_SET);
+    fputc(c ^ 1, f);
+    fclose(f);
+    if (spooky_merkle_load(path) != NULL) {
+        printf("MERKLE TEST FAILED, LOADED A DAMAGED SIDECAR!\n");
+        abort();
+    }
+    unlink(path);
+
+    spooky_merkle_free(loaded);
+    spooky_merkle_free(empty);
+    spooky_merkle_free(m);
+    free(data);
+}
+
+#define COPY_NT_SIZE (SPOOKY_COPY_NONTEMPORAL + 1000)
+
+#define WIDE_NTRIALS 4096
+#define WIDE_MAX_LEN 1000
+
+// The first half of spooky_hash256 is spooky_hash128, streaming gives the
+// same as one shot, and flipping any input bit flips each of the 256 output
+// bits about half the time, the second half as much as the first.
+static void
+hash256_test(uint8_t const*const p_buffer)
+{
+    uint32_t rng = 31;
+    for (size_t len = 0; len < 3 * SC_BUFSIZE; ++len) {
+        for (size_t align = 0; align < 4; ++align) {
+            uint64_t e1 = len;
+            uint64_t e2 = ~len;
+            spooky_hash128(p_buffer + align, len, &e1, &e2);
+            uint64_t h[4] = {len, ~len};
+            spooky_hash256(p_buffer + align, len, h);
+
+            spooky_context_t sc;
+            spooky_init(&sc, len, ~len);
+            for (size_t off = 0; off < len; ) {
+                size_t const n = 1 + xorshift32(&rng) % (len - off < 200 ? len - off : 200);
+                spooky_update(&sc, p_buffer + align + off, n);
+                off += n;
+            }
+            uint64_t s[4];
+            spooky_final256(&sc, s);
+
+            if (h[0] != e1 || h[1] != e2 || memcmp(h, s, sizeof(h)) != 0) {
+                printf("HASH256 TEST FAILED WITH UNALIGNMENT %zu AND NUMBYTES %zu!\n", align, len);
+                abort();
+            }
+        }
+    }
+
+    static size_t const lens[] = {1, 8, 31, 191, 192, 300, WIDE_MAX_LEN};
+    for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); ++l) {
+        size_t const len = lens[l];
+        uint32_t flips[256] = {0};
+        uint8_t msg[WIDE_MAX_LEN];
+        for (int t = 0; t < WIDE_NTRIALS; ++t) {
+            __builtin_memcpy(msg, p_buffer + xorshift32(&rng) % (DATASIZE - len), len);
+            uint64_t h[4] = {t, t};
+            spooky_hash256(msg, len, h);
+            size_t const bit = xorshift32(&rng) % (len * 8);
+            msg[bit / 8] ^= 1 << (bit % 8);
+            uint64_t f[4] = {t, t};
+            spooky_hash256(msg, len, f);
+            for (int i = 0; i < 256; ++i) {
+                flips[i] += ((h[i / 64] ^ f[i / 64]) >> (i % 64)) & 1;
+            }
+        }
+        // Six standard deviations either way
+        for (int i = 0; i < 256; ++i) {
+            if (flips[i] < WIDE_NTRIALS * 45 / 100 || flips[i] > WIDE_NTRIALS * 55 / 100) {
+                printf("HASH256 TEST FAILED, OUTPUT BIT %d FLIPPED %u TIMES IN %d WITH NUMBYTES %zu!\n",
+                    i, flips[i], WIDE_NTRIALS, len);
+                abort();
+            }
+        }
+    }
+}
+
+// Copy-and-hash must copy exactly len bytes, whatever the alignment of
+// either side, and hash them as spooky_hash128 would, in one go or in pieces
+// mixed with plain updates. The big copies take the non-temporal path.
+static void
+copy_hash_test(uint8_t const*const p_buffer)
+{
+    static size_t const lens[] = {0, 1, 7, 95, 96, 191, 192, 193, 287, 288, 1000, 4096, DATASIZE - 8};
+    static size_t const max_piece[] = {1, 95, 200, 1000};
+    uint8_t *const dst = malloc(DATASIZE + 16);
+
+    for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); ++l) {
+        for (size_t sa = 0; sa < 8; ++sa) {
+            for (size_t da = 0; da < 8; ++da) {
+                memset(dst, 0xaa, lens[l] + 16);
+                uint64_t seed1 = 123456789;
+                uint64_t seed2 = 987654321;
+                spooky_copy_hash128(dst + da, p_buffer + sa, lens[l], &seed1, &seed2);
+
+                uint64_t exp1 = 123456789;
+                uint64_t exp2 = 987654321;
+                spooky_hash128(p_buffer + sa, lens[l], &exp1, &exp2);
+                // Nothing written either side of the copy
+                bool guards = true;
+                for (size_t i = 0; i < da; ++i) {
+                    guards &= dst[i] == 0xaa;
+                }
+                for (size_t i = da + lens[l]; i < lens[l] + 16; ++i) {
+                    guards &= dst[i] == 0xaa;
+                }
+                if (seed1 != exp1 || seed2 != exp2 || memcmp(dst + da, p_buffer + sa, lens[l]) != 0
+                    || !guards) {
+                    printf("COPY TEST FAILED WITH NUMBYTES %zu ALIGNMENTS %zu %zu!\n", lens[l], sa, da);
+                    abort();
+                }
+            }
+        }
+    }
+
+    uint32_t rng = 0xc0b1e5;
+    for (size_t m = 0; m < sizeof(max_piece)/sizeof(max_piece[0]); ++m) {
+        for (size_t len = 0; len < 3000; len += 1 + len / 16) {
+            size_t const off = xorshift32(&rng) % 8;
+            memset(dst, 0, len + 8);
+
+            spooky_context_t ctxt;
+            spooky_init(&ctxt, 123456789, 987654321);
+            for (size_t done = 0; done < len; ) {
+                size_t n = xorshift32(&rng) % (max_piece[m] + 1);
+                if (n > len - done) {
+                    n = len - done;
+                }
+                if (xorshift32(&rng) % 4 == 0) {
+                    spooky_update(&ctxt, p_buffer + done, n);
+                    memcpy(dst + off + done, p_buffer + done, n);
+                } else {
+                    spooky_update_copy(&ctxt, dst + off + done, p_buffer + done, n);
+                }
+                done += n;
+            }
+            uint64_t seed1, seed2;
+            spooky_final(&ctxt, &seed1, &seed2);
+
+            uint64_t exp1 = 123456789;
+            uint64_t exp2 = 987654321;
+            spooky_hash128(p_buffer, len, &exp1, &exp2);
+            if (seed1 != exp1 || seed2 != exp2 || memcmp(dst + off, p_buffer, len) != 0) {
+                printf("COPY TEST FAILED WITH PIECES UP TO %zu NUMBYTES %zu!\n", max_piece[m], len);
+                abort();
+            }
+        }
+    }
+    free(dst);
+
+    uint8_t *const big = malloc(COPY_NT_SIZE);
+    uint8_t *const big_dst = malloc(COPY_NT_SIZE + 8);
+    randfill(big, COPY_NT_SIZE, 21);
+    for (size_t da = 0; da < 8; da += 3) {
+        uint64_t exp1 = 1;
+        uint64_t exp2 = 2;
+        spooky_hash128(big, COPY_NT_SIZE, &exp1, &exp2);
+
+        uint64_t seed1 = 1;
+        uint64_t seed2 = 2;
+        memset(big_dst, 0, COPY_NT_SIZE + 8);
+        spooky_copy_hash128(big_dst + da, big, COPY_NT_SIZE, &seed1, &seed2);
+        bool ok = seed1 == exp1 && seed2 == exp2 && memcmp(big_dst + da, big, COPY_NT_SIZE) == 0;
+
+        spooky_context_t ctxt;
+        spooky_init(&ctxt, 1, 2);
+        memset(big_dst, 0, COPY_NT_SIZE + 8);
+        spooky_update_copy(&ctxt, big_dst + da, big, 100);
+        spooky_update_copy(&ctxt, big_dst + da + 100, big + 100, COPY_NT_SIZE - 100);
+        spooky_final(&ctxt, &seed1, &seed2);
+        ok &= seed1 == exp1 && seed2 == exp2 && memcmp(big_dst + da, big, COPY_NT_SIZE) == 0;
+        if (!ok) {
+            printf("COPY TEST FAILED WITH A BIG COPY AT ALIGNMENT %zu!\n", da);
+            abort();
+        }
+    }
+    free(big_dst);
+    free(big);
+}
+
+#define COLUMN_NROWS 3000
+
+// Column hashes must be spooky_hash64 of each row, whatever the mix of
+// lengths, for both offset widths, with nulls, and chained across columns.
+// The data is allocated to the byte, so a tail read past the last row would
+// be caught.
+static void
+column_test(uint8_t const*const p_buffer)
+{
+    uint32_t rng = 24;
+    uint32_t *const offsets = malloc((COLUMN_NROWS + 1) * sizeof(*offsets));
+    uint64_t *const offsets64 = malloc((COLUMN_NROWS + 1) * sizeof(*offsets64));
+    uint8_t *const validity = malloc((COLUMN_NROWS + 7) / 8);
+    uint64_t *const out = malloc(COLUMN_NROWS * sizeof(*out));
+
+    offsets[0] = 0;
+    for (size_t i = 0; i < COLUMN_NROWS; ++i) {
+        uint32_t const x = xorshift32(&rng);
+        // Mostly short rows, the odd long one, short ones at the very end
+        size_t const len = (x % 16 == 0 && i < COLUMN_NROWS - 10) ? x % 1000 : x % SC_BUFSIZE;
+        offsets[i + 1] = offsets[i] + len;
+    }
+    uint8_t *const data = malloc(offsets[COLUMN_NROWS]);
+    for (size_t i = 0; i < COLUMN_NROWS; ++i) {
+        size_t const len = offsets[i + 1] - offsets[i];
+        memcpy(data + offsets[i], p_buffer + xorshift32(&rng) % (DATASIZE - len), len);
+    }
+    for (size_t i = 0; i <= COLUMN_NROWS; ++i) {
+        offsets64[i] = offsets[i];
+    }
+    for (size_t i = 0; i < (COLUMN_NROWS + 7) / 8; ++i) {
+        validity[i] = xorshift32(&rng) | xorshift32(&rng);
+    }
+
+    uint64_t const seed = 0x123456789;
+    uint64_t const null_hash = spooky_hash64("", 0, seed ^ SPOOKY_COLUMN_NULL);
+    if (null_hash == spooky_hash64("", 0, seed)) {
+        printf("COLUMN TEST FAILED, A NULL HASHES AS AN EMPTY STRING!\n");
+        abort();
+    }
+
+    static size_t const nrows[] = {0, 1, 7, 300, COLUMN_NROWS};
+    for (size_t n = 0; n < sizeof(nrows)/sizeof(nrows[0]); ++n) {
+        for (int variant = 0; variant < 4; ++variant) {
+            bool const wide = variant & 1;
+            bool const nulls = variant & 2;
+            if (wide) {
+                if (nulls) {
+                    spooky_hash64_column64_nulls(data, offsets64, validity, nrows[n], seed, out);
+                } else {
+                    spooky_hash64_column64(data, offsets64, nrows[n], seed, out);
+                }
+            } else {
+                if (nulls) {
+                    spooky_hash64_column_nulls(data, offsets, validity, nrows[n], seed, out);
+                } else {
+                    spooky_hash64_column(data, offsets, nrows[n], seed, out);
+                }
+            }
+            for (size_t i = 0; i < nrows[n]; ++i) {
+                bool const is_null = nulls && ((validity[i / 8] >> (i % 8)) & 1) == 0;
+                uint64_t const expect = is_null ? null_hash
+                    : spooky_hash64(data + offsets[i], offsets[i + 1] - offsets[i], seed);
+                if (out[i] != expect) {
+                    printf("COLUMN TEST FAILED FOR ROW %zu OF %zu, LENGTH %u, VARIANT %d!\n",
+                        i, nrows[n], offsets[i + 1] - offsets[i], variant);
+                    abort();
+                }
+            }
+        }
+    }
+
+    // The same data again, but with rows in a different order and nulls
+    struct spooky_column const cols[2] = {
+        {.data = data, .offsets = offsets},
+        {.data = data, .offsets64 = offsets64 + 1, .validity = validity},
+    };
+    spooky_hash64_columns(cols, 2, COLUMN_NROWS - 1, seed, out);
+    for (size_t i = 0; i < COLUMN_NROWS - 1; ++i) {
+        uint64_t const first = spooky_hash64(data + offsets[i], offsets[i + 1] - offsets[i], seed);
+        bool const is_null = ((validity[i / 8] >> (i % 8)) & 1) == 0;
+        uint64_t const expect = is_null ? spooky_hash64("", 0, first ^ SPOOKY_COLUMN_NULL)
+            : spooky_hash64(data + offsets[i + 1], offsets[i + 2] - offsets[i + 1], first);
+        if (out[i] != expect) {
+            printf("COLUMN TEST FAILED FOR ROW %zu OF TWO COLUMNS!\n", i);
+            abort();
+        }
+    }
+
+    free(data);
+    free(out);
+    free(validity);
+    free(offsets64);
+    free(offsets);
+}
+
+#define MGR_NSTREAMS 37
+#define MGR_DATASIZE 200000
+
+struct mgr_sink {
+    spooky_context_t *streams;
+    size_t ndone;
+    bool wrong;
+};
+
+static void
+mgr_done(void *const arg, spooky_context_t *const sc, void *const job)
+{
+    struct mgr_sink *const sink = arg;
+    sink->wrong |= job != (void *)(sc - sink->streams);
+    ++sink->ndone;
+}
+
+// A callback that feeds another stream as soon as the first job is done
+struct mgr_chain {
+    spooky_mgr_t *m;
+    spooky_context_t *next;
+    uint8_t const*piece;
+    size_t ndone;
+};
+
+static void
+mgr_chain_done(void *const arg, spooky_context_t *const sc, void *const job)
+{
+    struct mgr_chain *const chain = arg;
+    (void)sc;
+    ++chain->ndone;
+    if (job == (void *)0) {
+        spooky_mgr_submit(chain->m, chain->next, chain->piece, 10, (void *)2);
+    }
+}
+
+// Streams fed through the manager in pieces of every size, interleaved with
+// each other, must finish exactly like the same pieces through spooky_update.
+static void
+mgr_test(void)
+{
+    uint8_t *const data = malloc(MGR_DATASIZE);
+    randfill(data, MGR_DATASIZE, 4);
+    spooky_context_t *const streams = malloc(MGR_NSTREAMS * sizeof(*streams));
+    spooky_context_t *const expect = malloc(MGR_NSTREAMS * sizeof(*expect));
+    for (size_t i = 0; i < MGR_NSTREAMS; ++i) {
+        spooky_init(&streams[i], i, ~i);
+        spooky_init(&expect[i], i, ~i);
+    }
+
+    struct mgr_sink sink = {streams, 0, false};
+    spooky_mgr_t *const m = spooky_mgr_new(0, mgr_done, &sink);
+    uint32_t rng = 23;
+    size_t nsubmitted = 0;
+    size_t ncompleted = 0;
+    for (int r = 0; r < 20000; ++r) {
+        size_t const i = xorshift32(&rng) % MGR_NSTREAMS;
+        uint32_t const kind = xorshift32(&rng) % 16;
+        size_t const len = xorshift32(&rng) % (kind == 0 ? 3000 : kind < 4 ? SC_BUFSIZE + 1 : 120);
+        size_t const off = xorshift32(&rng) % (MGR_DATASIZE - len);
+        ncompleted += spooky_mgr_submit(m, &streams[i], data + off, len, (void *)i);
+        spooky_update(&expect[i], data + off, len);
+        ++nsubmitted;
+
+        // Finish a stream now and then, which needs its jobs done first
+        if (r % 997 == 0) {
+            ncompleted += spooky_mgr_flush(m);
+            uint64_t h1, h2, e1, e2;
+            spooky_final(&streams[i], &h1, &h2);
+            spooky_final(&expect[i], &e1, &e2);
+            if (h1 != e1 || h2 != e2) {
+                printf("MGR TEST FAILED ON STREAM %zu AFTER %d PIECES!\n", i, r);
+                abort();
+            }
+        }
+    }
+    ncompleted += spooky_mgr_flush(m);
+
+    for (size_t i = 0; i < MGR_NSTREAMS; ++i) {
+        uint64_t h1, h2, e1, e2;
+        spooky_final(&streams[i], &h1, &h2);
+        spooky_final(&expect[i], &e1, &e2);
+        if (h1 != e1 || h2 != e2) {
+            printf("MGR TEST FAILED ON STREAM %zu!\n", i);
+            abort();
+        }
+    }
+    if (sink.wrong || sink.ndone != nsubmitted || ncompleted != nsubmitted
+            || spooky_mgr_pending(m) != 0) {
+        printf("MGR TEST FAILED, %zu OF %zu JOBS COMPLETED!\n", sink.ndone, nsubmitted);
+        abort();
+    }
+    spooky_mgr_free(m);
+
+    // With a time limit, a lone job is done by a poll once it's waited long
+    // enough, and a pending job by free
+    spooky_mgr_t *const slow = spooky_mgr_new(1000000, mgr_done, &sink);
+    sink.ndone = 0;
+    spooky_mgr_submit(slow, &streams[0], data, SC_BUFSIZE, (void *)0);
+    size_t const waiting = spooky_mgr_pending(slow);
+    struct timespec const pause = {0, 2000000};
+    nanosleep(&pause, NULL);
+    size_t const polled = spooky_mgr_poll(slow);
+    spooky_mgr_submit(slow, &streams[1], data, SC_BUFSIZE, (void *)1);
+    spooky_mgr_free(slow);
+    if (sink.ndone != 2 || (waiting == 1 && polled != 1)) {
+        printf("MGR TEST FAILED, A WAITING JOB WASN'T DONE!\n");
+        abort();
+    }
+
+    // A callback may submit to a stream whose job ran in the same group,
+    // behind its own
+    struct mgr_chain chain = {NULL, &streams[1], data + 1000, 0};
+    chain.m = spooky_mgr_new(0, mgr_chain_done, &chain);
+    spooky_init(&streams[0], 0, 0);
+    spooky_init(&streams[1], 1, 1);
+    spooky_init(&expect[1], 1, 1);
+    spooky_mgr_submit(chain.m, &streams[0], data, 300, (void *)0);
+    // Without a lane kernel the first job is done on the spot
+    if (chain.ndone > 0) {
+        spooky_update(&expect[1], data + 1000, 10);
+    }
+    spooky_mgr_submit(chain.m, &streams[1], data + 300, 250, (void *)1);
+    spooky_update(&expect[1], data + 300, 250);
+    if (chain.ndone == 0) {
+        spooky_update(&expect[1], data + 1000, 10);
+    }
+    spooky_mgr_free(chain.m);
+    uint64_t h1, h2, e1, e2;
+    spooky_final(&streams[1], &h1, &h2);
+    spooky_final(&expect[1], &e1, &e2);
+    if (chain.ndone != 3 || h1 != e1 || h2 != e2) {
+        printf("MGR TEST FAILED, A CALLBACK'S SUBMIT WENT WRONG!\n");
+        abort();
+    }
+
+    free(expect);
+    free(streams);
+    free(data);
+}
+
+#define SERVICE_DATASIZE (UINT64_C(7) << 19)
+#define SERVICE_NREQS 200
+
+static void
+service_done(spooky_request_t *const req)
+{
+    __atomic_add_fetch((size_t *)req->arg, 1, __ATOMIC_SEQ_CST);
+}
+
+// Every request the service hashes, whether short, sliced or split into a
+// tree's chunks, and however it's waited for, must hash as it would alone.
+static void
+service_test(void)
+{
+    static size_t const lens[] = {0, 1, 191, 192, 5000, 100000, 100001, SPOOKY_TREE_CHUNK + 1,
+        SERVICE_DATASIZE};
+    uint8_t *const data = malloc(SERVICE_DATASIZE);
+    randfill(data, SERVICE_DATASIZE, 5);
+    spooky_request_t *const reqs = calloc(SERVICE_NREQS, sizeof(*reqs));
+
+    struct spooky_service_opts const opts = {.nthreads = 3, .max_pending = 8, .slice = 100000};
+    spooky_service_t *const s = spooky_service_new(&opts);
+    size_t ncallbacks = 0;
+    uint32_t rng = 29;
+    for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+        spooky_request_t *const req = &reqs[i];
+        size_t const len = lens[xorshift32(&rng) % (sizeof(lens)/sizeof(lens[0]))];
+        req->buf = data + (SERVICE_DATASIZE - len) / 2;
+        req->len = len;
+        req->h1 = i;
+        req->h2 = ~i;
+        req->tree = i % 3 == 0;
+        req->done = i % 2 == 0 ? service_done : NULL;
+        req->arg = &ncallbacks;
+        if (i % 5 == 0) {
+            // Refused only while the service is full, which doesn't last
+            struct timespec const pause = {0, 50000};
+            while (!spooky_service_try_submit(s, req)) {
+                nanosleep(&pause, NULL);
+            }
+        } else {
+            spooky_service_submit(s, req);
+        }
+    }
+    for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+        if (reqs[i].done == NULL) {
+            spooky_service_wait(s, &reqs[i]);
+        }
+    }
+    spooky_service_free(s);
+
+    for (size_t i = 0; i < SERVICE_NREQS; ++i) {
+        spooky_request_t const*const req = &reqs[i];
+        uint64_t h1 = i;
+        uint64_t h2 = ~i;
+        if (req->tree) {
+            spooky_tree_hash128(req->buf, req->len, SPOOKY_TREE_CHUNK, 1, &h1, &h2);
+        } else {
+            spooky_hash128(req->buf, req->len, &h1, &h2);
+        }
+        if (h1 != req->h1 || h2 != req->h2 || (req->done == NULL && !spooky_request_is_done(req))) {
+            printf("SERVICE TEST FAILED ON REQUEST %zu OF %zu BYTES%s!\n", i, req->len,
+                req->tree ? " IN TREE MODE" : "");
+            abort();
+        }
+    }
+    if (ncallbacks != (SERVICE_NREQS + 1) / 2) {
+        printf("SERVICE TEST FAILED, %zu CALLBACKS!\n", ncallbacks);
+        abort();
+    }
+
+    free(reqs);
+    free(data);
+}
+
+#define PARTITION_NROWS 300000
+
+// Partitioning must put every row in the partition of its key's hash, once,
+// in input order within the partition, whatever the row width, the key's
+// place in the row, the alignment of out and the number of threads. Each
+// row carries its index in the 4 bytes after the key, or before it if
+// there's no room.
+static void
+partition_test(uint8_t const*const p_buffer)
+{
+    static struct {
+        size_t width;
+        size_t key_offset;
+        size_t key_width;
+        unsigned bits;
+        unsigned nthreads;
+        size_t out_align;
+    } const cases[] = {
+        {16, 0, 8, 1, 1, 0},
+        {16, 0, 8, 10, 4, 0},
+        {16, 4, 12, 6, 3, 1},
+        {24, 8, 8, 12, 2, 8},
+        {8, 0, 4, 4, 4, 3},
+        {100, 30, 50, 5, 4, 0},
+    };
+    uint32_t rng = 25;
+    uint64_t const seed = 0x9876;
+    uint8_t *const rows = malloc(PARTITION_NROWS * 100);
+    uint8_t *const out = malloc(PARTITION_NROWS * 100 + 64);
+    uint8_t *const seen = malloc(PARTITION_NROWS);
+    size_t *const starts = malloc(((1 << 12) + 1) * sizeof(*starts));
+
+    for (size_t c = 0; c < sizeof(cases)/sizeof(cases[0]); ++c) {
+        size_t const width = cases[c].width;
+        size_t const koff = cases[c].key_offset;
+        size_t const kwidth = cases[c].key_width;
+        unsigned const bits = cases[c].bits;
+        uint8_t *const dst = out + cases[c].out_align;
+
+        // Keys from a small range, so there are plenty of repeats
+        for (size_t i = 0; i < PARTITION_NROWS; ++i) {
+            uint8_t *const row = rows + i * width;
+            memset(row, 0xa5, width);
+            memcpy(row + koff, p_buffer + xorshift32(&rng) % 1000, kwidth);
+            uint32_t const id = i;
+            memcpy(row + (koff + kwidth + 4 <= width ? koff + kwidth : 0), &id, 4);
+        }
+
+        if (!spooky_partition(rows, width, koff, kwidth, PARTITION_NROWS, bits, seed,
+                cases[c].nthreads, dst, starts)) {
+            printf("PARTITION TEST FAILED, CASE %zu WAS REFUSED!\n", c);
+            abort();
+        }
+
+        memset(seen, 0, PARTITION_NROWS);
+        size_t const nparts = (size_t)1 << bits;
+        if (starts[0] != 0 || starts[nparts] != PARTITION_NROWS) {
+            printf("PARTITION TEST FAILED, CASE %zu STARTS DON'T COVER THE ROWS!\n", c);
+            abort();
+        }
+        for (size_t p = 0; p < nparts; ++p) {
+            uint32_t prev = 0;
+            for (size_t r = starts[p]; r < starts[p + 1]; ++r) {
+                uint8_t const*const row = dst + r * width;
+                uint32_t id;
+                memcpy(&id, row + (koff + kwidth + 4 <= width ? koff + kwidth : 0), 4);
+                bool const right = spooky_hash64(row + koff, kwidth, seed) >> (64 - bits) == p;
+                if (id >= PARTITION_NROWS || seen[id] || !right || (r > starts[p] && id < prev)
+                        || memcmp(row, rows + id * width, width) != 0) {
+                    printf("PARTITION TEST FAILED, CASE %zu ROW %zu OF PARTITION %zu!\n", c, r, p);
+                    abort();
+                }
+                seen[id] = 1;
+                prev = id;
+            }
+        }
+    }
+
+    if (spooky_partition(rows, 16, 0, 8, 100, 0, seed, 1, out, starts)
+            || spooky_partition(rows, 16, 0, 8, 100, SPOOKY_PARTITION_MAX_BITS + 1, seed, 1, out, starts)
+            || spooky_partition(rows, 16, 12, 8, 100, 4, seed, 1, out, starts)) {
+        printf("PARTITION TEST FAILED, BAD ARGUMENTS WERE ACCEPTED!\n");
+        abort();
+    }
+
+    free(starts);
+    free(seen);
+    free(out);
+    free(rows);
+}
+
+#ifdef __linux__
+#define FILES_NFILES 10
+
+// Write files of awkward sizes and hash them with both file engines, with
+// small buffers and a shallow queue so every file takes several reads.
+static void
+files_hash_test(uint8_t const*const p_buffer)
+{
+    static size_t const sizes[FILES_NFILES - 1] = {0, 1, 191, 192, 4095, 4096, 4097, 40000, DATASIZE - FILES_NFILES};
+
+    char dir[] = "/tmp/scorrect.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("FILES TEST COULDN'T MAKE A DIRECTORY!\n");
+        abort();
+    }
+
+    char paths[FILES_NFILES][64];
+    char const*path_ptrs[FILES_NFILES];
+    for (int i = 0; i < FILES_NFILES; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+        path_ptrs[i] = paths[i];
+        // The last one is never created
+        if (i == FILES_NFILES - 1) {
+            continue;
+        }
+        FILE *const f = fopen(paths[i], "w");
+        if (f == NULL || fwrite(p_buffer + i, 1, sizes[i], f) != sizes[i] || fclose(f) != 0) {
+            printf("FILES TEST COULDN'T WRITE %s!\n", paths[i]);
+            abort();
+        }
+    }
+
+    static enum spooky_io_engine const engines[] = {SPOOKY_IO_URING, SPOOKY_IO_PREAD};
+    static unsigned const threads[] = {1, 3};
+
+    for (size_t e = 0; e < sizeof(engines)/sizeof(engines[0]); ++e) {
+        for (size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); ++t) {
+            struct spooky_io_opts const opts = {
+                .engine = engines[e],
+                .queue_depth = 4,
+                .buffer_size = 4096,
+                .nthreads = threads[t],
+                .seed0 = 123456789,
+                .seed1 = 987654321,
+            };
+            struct spooky_io_result results[FILES_NFILES];
+            struct spooky_io_stats stats;
+            if (spooky_hash_files(path_ptrs, FILES_NFILES, &opts, results, &stats) < 0) {
+                printf("FILES TEST COULDN'T START ENGINE %d!\n", (int)engines[e]);
+                abort();
+            }
+
+            uint64_t total = 0;
+            for (int i = 0; i < FILES_NFILES - 1; ++i) {
+                uint64_t seed1 = 123456789;
+                uint64_t seed2 = 987654321;
+                spooky_hash128(p_buffer + i, sizes[i], &seed1, &seed2);
+                if (results[i].err != 0 || results[i].h1 != seed1 || results[i].h2 != seed2) {
+                    printf("FILES TEST FAILED WITH ENGINE %d THREADS %u NUMBYTES %zu!\n",
+                        (int)engines[e], threads[t], sizes[i]);
+                    abort();
+                }
+                total += sizes[i];
+            }
+            if (results[FILES_NFILES - 1].err != ENOENT || stats.bytes != total) {
+                printf("FILES TEST FAILED WITH ENGINE %d THREADS %u!\n", (int)engines[e], threads[t]);
+                abort();
+            }
+        }
+    }
+
+    for (int i = 0; i < FILES_NFILES - 1; ++i) {
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+}
+
+// procfs files have an st_size of 0 but aren't empty. Both engines have to
+// read them to the end.
+static void
+files_procfs_test(void)
+{
+    char const*const path = "/proc/version";
+    uint8_t data[4096];
+    FILE *const f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    size_t const len = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    spooky_hash128(data, len, &h1, &h2);
+
+    static enum spooky_io_engine const engines[] = {SPOOKY_IO_URING, SPOOKY_IO_PREAD};
+    for (size_t e = 0; e < sizeof(engines)/sizeof(engines[0]); ++e) {
+        struct spooky_io_opts const opts = {
+            .engine = engines[e],
+            .queue_depth = 4,
+            .buffer_size = 16,
+            .nthreads = 1,
+        };
+        struct spooky_io_result result;
+        if (spooky_hash_files(&path, 1, &opts, &result, NULL) < 0) {
+            printf("PROCFS TEST COULDN'T START ENGINE %d!\n", (int)engines[e]);
+            abort();
+        }
+        if (len == 0 || result.err != 0 || result.h1 != h1 || result.h2 != h2) {
+            printf("PROCFS TEST FAILED WITH ENGINE %d!\n", (int)engines[e]);
+            abort();
+        }
+    }
+}
+#endif
+
 int
 main(void)
 {
@@ -390,6 +1883,39 @@ main(void)
         }
     }
 
+    // The batch entry points have a kernel per CPU variant, check all of
+    // the ones this machine can run.
+    for (int impl = 0; impl < SPOOKY_IMPL_COUNT; ++impl) {
+        if (!spooky_set_impl(impl)) {
+            printf("Skipping %s, not supported\n", spooky_impl_name(impl));
+            continue;
+        }
+        printf("Testing %s\n", spooky_impl_name(impl));
+        multi_hash_test(buffer);
+        keys_hash_test(buffer);
+        map_test(buffer);
+        bloom_test(buffer);
+        hll_test();
+        cdc_test();
+        merkle_test();
+        mgr_test();
+        column_test(buffer);
+    }
+
+    inline_hash_test(buffer);
+    stream_hash_test(buffer);
+    copy_hash_test(buffer);
+    hash256_test(buffer);
+    checkpoint_test(buffer);
+    iov_hash_test(buffer);
+    tree_hash_test(buffer);
+    partition_test(buffer);
+    service_test();
+#ifdef __linux__
+    files_hash_test(buffer);
+    files_procfs_test();
+#endif
+
     free(buffer);
     free(hashbuf);
 
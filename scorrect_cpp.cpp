@@ -0,0 +1,237 @@
+// Checks that the C++ headers agree with the C library
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "spooky.hpp"
+#include "spooky_map.hpp"
+
+using namespace std::literals;
+
+static inline uint32_t
+xorshift32(uint32_t *const p_rng)
+{
+    uint32_t x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return *p_rng;
+}
+
+#define DATASIZE 0x10000 // 64k
+
+// Compile time hashes of short and long literals, and the sort of dispatch
+// they're for.
+static_assert(spooky::hash64("GET"sv, 0) != spooky::hash64("PUT"sv, 0));
+static_assert(spooky::hash32("metric.name", 7) == uint32_t(spooky::hash64("metric.name", 7)));
+
+static constexpr std::string_view long_literal =
+    "A 128-bit noncryptographic hash, for checksums and table lookup. "
+    "Originally created by Bob Jenkins, this literal is long enough to take "
+    "the long path, which kicks in at two blocks of ninety-six bytes each.";
+static_assert(long_literal.size() >= SC_BUFSIZE);
+
+static int
+verb_number(std::string_view const verb)
+{
+    switch (spooky::hash64(verb, 0)) {
+    case spooky::hash64("GET", 0):
+        return 1;
+    case spooky::hash64("PUT", 0):
+        return 2;
+    case spooky::hash64("DELETE", 0):
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+// Evaluated by the compiler, compared with the library at run time
+static void
+constexpr_test(void)
+{
+    constexpr uint64_t short_hash = spooky::hash64("metric.name"sv, 42);
+    constexpr uint64_t long_hash = spooky::hash64(long_literal, 42);
+    constexpr spooky::hash128_t long_hash128 = spooky::hash128(long_literal, 1, 2);
+
+    uint64_t h1 = 1;
+    uint64_t h2 = 2;
+    spooky_hash128(long_literal.data(), long_literal.size(), &h1, &h2);
+
+    if (short_hash != spooky_hash64("metric.name", 11, 42)
+        || long_hash != spooky_hash64(long_literal.data(), long_literal.size(), 42)
+        || long_hash128.h1 != h1 || long_hash128.h2 != h2) {
+        printf("CONSTEXPR TEST FAILED!\n");
+        abort();
+    }
+
+    if (verb_number("GET") != 1 || verb_number("PUT") != 2 || verb_number("DELETE") != 3
+        || verb_number("POST") != 0) {
+        printf("CONSTEXPR TEST FAILED TO DISPATCH!\n");
+        abort();
+    }
+}
+
+// Every length scorrect covers, through the constexpr code run at run time
+static void
+length_test(char const*const buffer)
+{
+    uint32_t rng = 0xdeadbeef;
+
+    for (size_t len = 0; len <= DATASIZE; len = len < 2 * SC_BUFSIZE ? len + 1 : len + 97) {
+        size_t const off = xorshift32(&rng) % 8;
+        std::string_view const msg(buffer + off, len);
+
+        uint64_t const seed = xorshift32(&rng);
+        uint64_t h1 = 123456789;
+        uint64_t h2 = 987654321;
+        spooky_hash128(msg.data(), msg.size(), &h1, &h2);
+        spooky::hash128_t const h = spooky::hash128(msg, 123456789, 987654321);
+
+        if (h.h1 != h1 || h.h2 != h2 || spooky::hash64(msg, seed) != spooky_hash64(msg.data(), msg.size(), seed)) {
+            printf("CONSTEXPR TEST FAILED WITH NUMBYTES %zu!\n", len);
+            abort();
+        }
+    }
+    for (size_t len = DATASIZE - SC_BUFSIZE; len < DATASIZE; ++len) {
+        std::string_view const msg(buffer, len);
+        uint64_t h1 = 123456789;
+        uint64_t h2 = 987654321;
+        spooky_hash128(msg.data(), msg.size(), &h1, &h2);
+        spooky::hash128_t const h = spooky::hash128(msg, 123456789, 987654321);
+
+        if (h.h1 != h1 || h.h2 != h2) {
+            printf("CONSTEXPR TEST FAILED WITH NUMBYTES %zu!\n", len);
+            abort();
+        }
+    }
+}
+
+// spooky::hash agrees with spooky_hash64 on the bytes it's meant to hash, and
+// works as the hasher of standard containers, with transparent lookups where
+// the standard library has them.
+static void
+hasher_test(void)
+{
+    std::string const s = "spooky";
+    uint64_t const expect = spooky_hash64(s.data(), s.size(), 5);
+    if (spooky::hash<std::string>(5)(s) != expect
+        || spooky::hash<std::string>(5)(std::string_view(s)) != expect
+        || spooky::hash<std::string>(5)("spooky") != expect
+        || spooky::hash<std::string_view>(5)(s) != expect
+        || spooky::hash<char const*>(5)("spooky") != expect) {
+        printf("HASHER TEST FAILED FOR STRINGS!\n");
+        abort();
+    }
+
+    uint32_t const i = 0x12345678;
+    std::vector<uint32_t> const v = {1, 2, 3, 4};
+    std::array<uint16_t, 3> const a = {{7, 8, 9}};
+    if (spooky::hash<uint32_t>()(i) != spooky_hash64(&i, sizeof(i), 0)
+        || spooky::hash<std::vector<uint32_t>>(9)(v) != spooky_hash64(v.data(), 16, 9)
+        || spooky::hash<std::array<uint16_t, 3>>()(a) != spooky_hash64(a.data(), 6, 0)) {
+        printf("HASHER TEST FAILED FOR INTEGERS AND RANGES!\n");
+        abort();
+    }
+
+    // Members are hashed first, then their hashes
+    auto const p = std::make_pair(std::string("key"), 42);
+    uint64_t const parts[2] = {spooky::hash<std::string>(3)(p.first), spooky::hash<int>(3)(p.second)};
+    if (spooky::hash<std::pair<std::string, int>>(3)(p) != spooky_hash64(parts, sizeof(parts), 3)
+        || spooky::hash<std::tuple<std::string, int>>(3)(std::make_tuple(p.first, p.second))
+            != spooky_hash64(parts, sizeof(parts), 3)
+        || spooky::hash<std::tuple<>>()(std::tuple<>()) != spooky_hash64(parts, 0, 0)) {
+        printf("HASHER TEST FAILED FOR PAIRS AND TUPLES!\n");
+        abort();
+    }
+
+    spooky::hashed_string const hs("spooky");
+    if (hs.hash() != spooky_hash64("spooky", 6, 0)
+        || spooky::hash<spooky::hashed_string>()(hs) != spooky::hash<spooky::hashed_string>()("spooky"sv)
+        || hs != spooky::hashed_string(std::string("spooky")) || hs != "spooky"sv || hs == "spook"sv) {
+        printf("HASHER TEST FAILED FOR HASHED STRINGS!\n");
+        abort();
+    }
+
+    std::unordered_map<std::string, int, spooky::hash<std::string>, std::equal_to<>> map;
+    std::unordered_set<spooky::hashed_string, spooky::hash<spooky::hashed_string>, std::equal_to<>> set;
+    for (int n = 0; n < 1000; ++n) {
+        map.emplace(std::to_string(n), n);
+        set.emplace(std::to_string(n));
+    }
+    for (int n = 0; n < 1000; ++n) {
+        std::string const key = std::to_string(n);
+        if (map.at(key) != n || set.count(spooky::hashed_string(key)) != 1) {
+            printf("HASHER TEST FAILED TO FIND %d!\n", n);
+            abort();
+        }
+#ifdef __cpp_lib_generic_unordered_lookup
+        if (map.find(std::string_view(key))->second != n || map.find(key.c_str())->second != n
+            || set.find(std::string_view(key)) == set.end()) {
+            printf("HASHER TEST FAILED TO FIND %d BY STRING VIEW!\n", n);
+            abort();
+        }
+#endif
+    }
+}
+
+// flat_map is the C map underneath, keyed by the bytes of the key
+struct map_key {
+    uint32_t id;
+    uint32_t check;
+};
+
+static void
+flat_map_test(void)
+{
+    spooky::flat_map<map_key> map;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        map.insert({i, ~i}, i);
+    }
+    map.insert({7, ~7u}, 70);
+    if (map.size() != 1000 || !map.erase({8, ~8u}) || map.erase({8, ~8u}) || map.contains({8, ~8u})
+        || map.find({7, ~7u}) != 70u || map.find({9, ~9u}) != 9u || map.find({9, 9}).has_value()) {
+        printf("FLAT MAP TEST FAILED!\n");
+        abort();
+    }
+
+    map_key const keys[3] = {{1, ~1u}, {8, ~8u}, {999, ~999u}};
+    uint64_t values[3];
+    bool found[3];
+    if (map.find_many(keys, 3, values, found) != 2 || !found[0] || found[1] || !found[2]
+        || values[0] != 1 || values[2] != 999) {
+        printf("FLAT MAP TEST FAILED IN FIND_MANY!\n");
+        abort();
+    }
+}
+
+int
+main(void)
+{
+    printf("STARTING C++ TEST!!\n");
+
+    char *const buffer = static_cast<char *>(malloc(DATASIZE + 8));
+    uint32_t rng = 0xdeadbeef;
+    for (size_t i = 0; i < DATASIZE + 8; ++i) {
+        buffer[i] = xorshift32(&rng);
+    }
+
+    constexpr_test();
+    length_test(buffer);
+    hasher_test();
+    flat_map_test();
+
+    free(buffer);
+
+    printf("TEST PASSED!\n");
+    return 0;
+}
@@ -4,320 +4,215 @@
 
 #include <memory.h>
 #include <stdbool.h>
-#include "spooky.h"
+#include "spooky_internal.h"
+#include "spooky_inline.h"
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
 
-__attribute__((pure, always_inline))
-static inline uint64_t
-rd64(uint8_t const*const ptr)
+static void
+spooky_short(void const*const message, size_t const length, uint64_t *hash1, uint64_t *hash2)
 {
-    uint64_t o;
-    __builtin_memcpy(&o, ptr, 8);
-    return o;
+    spooky_inline_short(message, length, hash1, hash2);
 }
 
-__attribute__((pure, always_inline))
-static inline uint32_t
-rd32(uint8_t const*const ptr)
+static void
+spooky_short256(void const*const message, size_t const length, uint64_t *const hash)
 {
-    uint32_t o;
-    __builtin_memcpy(&o, ptr, 4);
-    return o;
+    spooky_inline_short_hash(message, length, hash, true);
 }
 
-__attribute__((const, always_inline))
-static inline uint64_t
-rol64(uint64_t const x, unsigned const k)
+void
+spooky_hash128(void const*const message, size_t const length,
+    uint64_t *const hash1, uint64_t *const hash2)
 {
-    return (x << k) | (x >> (64 - k));
+    if (length < SC_BUFSIZE) {
+        spooky_short(message, length, hash1, hash2);
+        return;
+    }
+
+    spooky_inline_long(message, length, hash1, hash2);
 }
 
-static void
-spooky_short(void const*const message, size_t const length, uint64_t *hash1, uint64_t *hash2)
+void
+spooky_hash128_iov(struct iovec const*const iov, int const iovcnt,
+    uint64_t *const hash1, uint64_t *const hash2)
 {
-    size_t block_leftover = length % 32;
-
-    uint64_t a = *hash1;
-    uint64_t b = *hash1;
-    uint64_t c = SC_CONST;
-    uint64_t d = SC_CONST;
-
-    size_t nbytes_processed = 0;
-
-    if (length > 15) {
-
-        size_t const blocks_of_32 = length / 32;
-
-        nbytes_processed = blocks_of_32 * 32;
-
-        if (((uintptr_t)message & 0x7) == 0) {
-            // Aligned cases
-            uint64_t const*datap = message;
-            for (size_t i = 0; i < blocks_of_32; ++i) {
-
-                c += datap[0];
-                d += datap[1];
-                c = rol64(c,50);  c += d;  a ^= c;
-                d = rol64(d,52);  d += a;  b ^= d;
-                a = rol64(a,30);  a += b;  c ^= a;
-                b = rol64(b,41);  b += c;  d ^= b;
-                c = rol64(c,54);  c += d;  a ^= c;
-                d = rol64(d,48);  d += a;  b ^= d;
-                a = rol64(a,38);  a += b;  c ^= a;
-                b = rol64(b,37);  b += c;  d ^= b;
-                c = rol64(c,62);  c += d;  a ^= c;
-                d = rol64(d,34);  d += a;  b ^= d;
-                a = rol64(a, 5);  a += b;  c ^= a;
-                b = rol64(b,36);  b += c;  d ^= b;
-                a += datap[2];
-                b += datap[3];
-
-                datap += 4;
-            }
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        length += iov[i].iov_len;
+    }
+
+    // Only the bytes that straddle a fragment boundary go through here, whole
+    // blocks inside a fragment are hashed where they lie.
+    uint64_t stitch[2*SC_NUMVARS];
+    size_t fill = 0;
 
-            //Handle the case of 16+ remaining bytes.
-            if (block_leftover >= 16) {
-                c += datap[0];
-                d += datap[1];
-                c = rol64(c,50);  c += d;  a ^= c;
-                d = rol64(d,52);  d += a;  b ^= d;
-                a = rol64(a,30);  a += b;  c ^= a;
-                b = rol64(b,41);  b += c;  d ^= b;
-                c = rol64(c,54);  c += d;  a ^= c;
-                d = rol64(d,48);  d += a;  b ^= d;
-                a = rol64(a,38);  a += b;  c ^= a;
-                b = rol64(b,37);  b += c;  d ^= b;
-                c = rol64(c,62);  c += d;  a ^= c;
-                d = rol64(d,34);  d += a;  b ^= d;
-                a = rol64(a, 5);  a += b;  c ^= a;
-                b = rol64(b,36);  b += c;  d ^= b;
-
-                nbytes_processed += 16;
-
-                block_leftover -= 16;
+    if (length < SC_BUFSIZE) {
+        for (int i = 0; i < iovcnt; ++i) {
+            // An empty fragment may have a NULL base, which memcpy must not see
+            if (iov[i].iov_len == 0) {
+                continue;
             }
+            __builtin_memcpy((uint8_t *)stitch + fill, iov[i].iov_base, iov[i].iov_len);
+            fill += iov[i].iov_len;
+        }
+        spooky_short(stitch, length, hash1, hash2);
+        return;
+    }
 
-        } else {
-
-            // Data is unaligned, use rd64 macro (on armv8 (64-bit) & x86_64
-            // this will compile to a regular load.
-            uint8_t const*datap = message;
-            for (size_t i = 0; i < blocks_of_32; ++i) {
-
-                c += rd64(datap);
-                d += rd64(datap + 8);
-                c = rol64(c,50);  c += d;  a ^= c;
-                d = rol64(d,52);  d += a;  b ^= d;
-                a = rol64(a,30);  a += b;  c ^= a;
-                b = rol64(b,41);  b += c;  d ^= b;
-                c = rol64(c,54);  c += d;  a ^= c;
-                d = rol64(d,48);  d += a;  b ^= d;
-                a = rol64(a,38);  a += b;  c ^= a;
-                b = rol64(b,37);  b += c;  d ^= b;
-                c = rol64(c,62);  c += d;  a ^= c;
-                d = rol64(d,34);  d += a;  b ^= d;
-                a = rol64(a, 5);  a += b;  c ^= a;
-                b = rol64(b,36);  b += c;  d ^= b;
-                a += rd64(datap + 16);
-                b += rd64(datap + 24);
-
-                datap += 32;
+    uint64_t const seed0 = *hash1;
+    uint64_t const seed1 = *hash2;
+    uint64_t h[SC_NUMVARS] = {
+        seed0, seed1, SC_CONST, seed0, seed1, SC_CONST,
+        seed0, seed1, SC_CONST, seed0, seed1, SC_CONST,
+    };
+
+    // Blocks are mixed in message order, whether they lie inside one fragment
+    // or had to be stitched together, so this matches spooky_hash128.
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        uint8_t const*frag = iov[i].iov_base;
+        size_t frag_left = iov[i].iov_len;
+
+        // Gather small fragments two blocks at a time. Mixing a block right
+        // after copying it in would stall on store forwarding; with two
+        // blocks queued the older one's stores have usually landed.
+        if (fill > 0) {
+            size_t const boundary = (fill + SC_BLOCKSIZE - 1) / SC_BLOCKSIZE * SC_BLOCKSIZE;
+            size_t const cap = frag_left >= boundary - fill + SC_BLOCKSIZE ? boundary : SC_BUFSIZE;
+            size_t const take = frag_left < cap - fill ? frag_left : cap - fill;
+            __builtin_memcpy((uint8_t *)stitch + fill, frag, take);
+            fill += take;
+            frag += take;
+            frag_left -= take;
+            if (fill < cap) {
+                continue;
             }
 
-            // More than 16 bytes remaining
-            if (block_leftover >= 16) {
-
-                c += rd64(datap);
-                d += rd64(datap + 8);
-                c = rol64(c,50);  c += d;  a ^= c;
-                d = rol64(d,52);  d += a;  b ^= d;
-                a = rol64(a,30);  a += b;  c ^= a;
-                b = rol64(b,41);  b += c;  d ^= b;
-                c = rol64(c,54);  c += d;  a ^= c;
-                d = rol64(d,48);  d += a;  b ^= d;
-                a = rol64(a,38);  a += b;  c ^= a;
-                b = rol64(b,37);  b += c;  d ^= b;
-                c = rol64(c,62);  c += d;  a ^= c;
-                d = rol64(d,34);  d += a;  b ^= d;
-                a = rol64(a, 5);  a += b;  c ^= a;
-                b = rol64(b,36);  b += c;  d ^= b;
-
-                nbytes_processed += 16;
-
-                block_leftover -= 16;
+            for (size_t off = 0; off < fill; off += SC_BLOCKSIZE) {
+                spooky_inline_mix(h, (uint8_t const*)stitch + off);
             }
+            fill = 0;
+        }
 
+        for (; frag_left >= SC_BLOCKSIZE; frag_left -= SC_BLOCKSIZE) {
+            spooky_inline_mix(h, frag);
+            frag += SC_BLOCKSIZE;
         }
+
+        __builtin_memcpy(stitch, frag, frag_left);
+        fill = frag_left;
+    }
+
+    // Up to a block and a bit can still be queued. A full block is mixed as
+    // usual, whatever follows it is the final partial block.
+    uint8_t const*last = (uint8_t const*)stitch;
+    if (fill >= SC_BLOCKSIZE) {
+        spooky_inline_mix(h, last);
+        last += SC_BLOCKSIZE;
+        fill -= SC_BLOCKSIZE;
     }
+    spooky_inline_end(h, last, fill);
 
-    // Handle the last 0..15 bytes, and and also add in the length
-    d += ((uint64_t)length) << 56;
-
-    uint8_t const*r = (uint8_t const*)message + nbytes_processed;
-    switch (block_leftover)
-    {
-        case 15:
-            d += ((uint64_t)r[14]) << 48;
-        case 14:
-            d += ((uint64_t)r[13]) << 40;
-        case 13:
-            d += ((uint64_t)r[12]) << 32;
-        case 12:
-            d += (uint64_t)rd32(r + 8);
-            c += rd64(r);
-            break;
-        case 11:
-            d += ((uint64_t)r[10]) << 16;
-        case 10:
-            d += ((uint64_t)r[9]) << 8;
-        case 9:
-            d += (uint64_t)r[8];
-        case 8:
-            c += rd64(r);
-            break;
-        case 7:
-            c += ((uint64_t)r[6]) << 48;
-        case 6:
-            c += ((uint64_t)r[5]) << 40;
-        case 5:
-            c += ((uint64_t)r[4]) << 32;
-        case 4:
-            c += (uint64_t)rd32(r);
-            break;
-        case 3:
-            c += ((uint64_t)r[2]) << 16;
-        case 2:
-            c += ((uint64_t)r[1]) << 8;
-        case 1:
-            c += (uint64_t)r[0];
-            break;
-        case 0:
-            c += SC_CONST;
-            d += SC_CONST;
-        default:
-            break;
-    }
-
-    d ^= c;  c = rol64(c,15);  d += c;
-    a ^= d;  d = rol64(d,52);  a += d;
-    b ^= a;  a = rol64(a,26);  b += a;
-    c ^= b;  b = rol64(b,51);  c += b;
-    d ^= c;  c = rol64(c,28);  d += c;
-    a ^= d;  d = rol64(d, 9);  a += d;
-    b ^= a;  a = rol64(a,47);  b += a;
-    c ^= b;  b = rol64(b,54);  c += b;
-    d ^= c;  c = rol64(c,32);  d += c;
-    a ^= d;  d = rol64(d,25);  a += d;
-    b ^= a;  a = rol64(a,63);  b += a;
-    *hash1 = a;
-    *hash2 = b;
+    *hash1 = h[0];
+    *hash2 = h[1];
 }
 
-void
-spooky_hash128(void const*const message, size_t const length,
-    uint64_t *const hash1, uint64_t *const hash2)
+// Number of messages spooky_hash128_multi sorts by length before handing
+// them to the lane kernels. Bigger windows waste fewer lanes on uneven
+// lengths, smaller ones use less stack.
+#define SC_MULTI_WINDOW 64
+
+static void
+spooky_multi_lanes(spooky_long_lanes_fn const kernel, size_t const nlanes,
+    void const*const*const msgs, size_t const*const lens, size_t const n,
+    uint64_t *const h1, uint64_t *const h2)
 {
-    if (length < SC_BUFSIZE) {
-        spooky_short(message, length, hash1, hash2);
-        return;
-    }
+    size_t idx[SC_MULTI_WINDOW];
+
+    size_t i = 0;
+    while (i < n) {
+        // Short messages don't go through the block mix at all. Collect the
+        // long ones sorted by block count so that neighbouring lanes finish
+        // at about the same time.
+        size_t nidx = 0;
+        for (; i < n && nidx < SC_MULTI_WINDOW; ++i) {
+            if (lens[i] < SC_BUFSIZE) {
+                spooky_short(msgs[i], lens[i], &h1[i], &h2[i]);
+                continue;
+            }
+            size_t j = nidx++;
+            while (j > 0 && lens[idx[j-1]] / SC_BLOCKSIZE > lens[i] / SC_BLOCKSIZE) {
+                idx[j] = idx[j-1];
+                --j;
+            }
+            idx[j] = i;
+        }
 
-    uint64_t const seed0 = *hash1;
-    uint64_t const seed1 = *hash2;
+        for (size_t g = 0; g < nidx; g += nlanes) {
+            uint8_t const*lmsgs[SC_MAX_LANES];
+            size_t llens[SC_MAX_LANES];
+            uint64_t lh1[SC_MAX_LANES];
+            uint64_t lh2[SC_MAX_LANES];
+
+            // A short final group repeats its first message in the spare
+            // lanes, it costs nothing extra and the results are dropped.
+            for (size_t l = 0; l < nlanes; ++l) {
+                size_t const k = idx[(g + l < nidx) ? g + l : g];
+                lmsgs[l] = msgs[k];
+                llens[l] = lens[k];
+                lh1[l] = h1[k];
+                lh2[l] = h2[k];
+            }
 
-    uint64_t h0 = seed0;
-    uint64_t h1 = seed1;
-    uint64_t h2 = SC_CONST;
-    uint64_t h3 = seed0;
-    uint64_t h4 = seed1;
-    uint64_t h5 = SC_CONST;
-    uint64_t h6 = seed0;
-    uint64_t h7 = seed1;
-    uint64_t h8 = SC_CONST;
-    uint64_t h9 = seed0;
-    uint64_t h10 = seed1;
-    uint64_t h11 = SC_CONST;
-
-    size_t const num_blocks = length / SC_BLOCKSIZE;
-    size_t const nbytes_processed = num_blocks * SC_BLOCKSIZE;
-    size_t const block_leftover = length - nbytes_processed;
+            kernel(lmsgs, llens, lh1, lh2);
 
-    // Handle blocks
-    if (((uintptr_t)message & 0x7) == 0) {
+            for (size_t l = 0; l < nlanes && g + l < nidx; ++l) {
+                h1[idx[g + l]] = lh1[l];
+                h2[idx[g + l]] = lh2[l];
+            }
+        }
+    }
+}
 
-        uint64_t const*datap = message;
-        for (size_t i = 0; i < num_blocks; ++i) {
+void
+spooky_hash128_multi(void const*const*const msgs, size_t const*const lens, size_t const n,
+    uint64_t *const h1, uint64_t *const h2)
+{
+    struct spooky_ops const*const ops = spooky_current_ops();
+    if (ops->long_lanes != NULL) {
+        spooky_multi_lanes(ops->long_lanes, ops->nlanes, msgs, lens, n, h1, h2);
+        return;
+    }
 
-            h0 += datap[0];    h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-            h1 += datap[1];    h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-            h2 += datap[2];    h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-            h3 += datap[3];    h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-            h4 += datap[4];    h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-            h5 += datap[5];    h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-            h6 += datap[6];    h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-            h7 += datap[7];    h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-            h8 += datap[8];    h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-            h9 += datap[9];    h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-            h10 += datap[10];  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-            h11 += datap[11];  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
-
-            datap += SC_NUMVARS;
-        }
-    } else {
+    for (size_t i = 0; i < n; ++i) {
+        spooky_hash128(msgs[i], lens[i], &h1[i], &h2[i]);
+    }
+}
 
-        uint8_t const*datap = message;
-        for (size_t i = 0; i < num_blocks; ++i) {
-            h0 +=  rd64(datap +  0);  h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-            h1 +=  rd64(datap +  8);  h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-            h2 +=  rd64(datap + 16);  h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-            h3 +=  rd64(datap + 24);  h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-            h4 +=  rd64(datap + 32);  h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-            h5 +=  rd64(datap + 40);  h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-            h6 +=  rd64(datap + 48);  h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-            h7 +=  rd64(datap + 56);  h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-            h8 +=  rd64(datap + 64);  h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-            h9 +=  rd64(datap + 72);  h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-            h10 += rd64(datap + 80);  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-            h11 += rd64(datap + 88);  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
-            datap += SC_BLOCKSIZE;
-        }
+void
+spooky_hash64_keys(void const*const keys, size_t const key_width, size_t const nkeys,
+    uint64_t const seed, uint64_t *const out)
+{
+    uint8_t const*const lkeys = keys;
+    size_t done = 0;
+
+    // The SIMD kernels only know 8, 16 and 32 byte keys. Other widths, and
+    // the keys left over after the last whole vector, go one at a time.
+    struct spooky_ops const*const ops = spooky_current_ops();
+    if (ops->short_keys != NULL) {
+        done = ops->short_keys(lkeys, key_width, nkeys, seed, out);
     }
 
-    // Handle any leftover bytes that can't make a full block
-    uint64_t last_block[SC_NUMVARS];
-    __builtin_memcpy(last_block, (uint8_t const*)message + nbytes_processed, block_leftover);
-    __builtin_memset(((uint8_t *)last_block) + block_leftover, 0, SC_BLOCKSIZE - block_leftover);
-    ((uint8_t *)last_block)[SC_BLOCKSIZE-1] = block_leftover;
-
-    h0  += last_block[0];
-    h1  += last_block[1];
-    h2  += last_block[2];
-    h3  += last_block[3];
-    h4  += last_block[4];
-    h5  += last_block[5];
-    h6  += last_block[6];
-    h7  += last_block[7];
-    h8  += last_block[8];
-    h9  += last_block[9];
-    h10 += last_block[10];
-    h11 += last_block[11];
-
-    for (int i = 0; i < 3; ++i) {
-        h11+= h1;    h2 ^= h11;   h1 = rol64(h1,44);
-        h0 += h2;    h3 ^= h0;    h2 = rol64(h2,15);
-        h1 += h3;    h4 ^= h1;    h3 = rol64(h3,34);
-        h2 += h4;    h5 ^= h2;    h4 = rol64(h4,21);
-        h3 += h5;    h6 ^= h3;    h5 = rol64(h5,38);
-        h4 += h6;    h7 ^= h4;    h6 = rol64(h6,33);
-        h5 += h7;    h8 ^= h5;    h7 = rol64(h7,10);
-        h6 += h8;    h9 ^= h6;    h8 = rol64(h8,13);
-        h7 += h9;    h10^= h7;    h9 = rol64(h9,38);
-        h8 += h10;   h11^= h8;    h10= rol64(h10,53);
-        h9 += h11;   h0 ^= h9;    h11= rol64(h11,42);
-        h10+= h0;    h1 ^= h10;   h0 = rol64(h0,54);
-    }
-
-    *hash1 = h0;
-    *hash2 = h1;
+    for (size_t i = done; i < nkeys; ++i) {
+        uint64_t h1 = seed;
+        uint64_t h2 = seed;
+        spooky_hash128(lkeys + i * key_width, key_width, &h1, &h2);
+        out[i] = h1;
+    }
 }
 
 // init spooky state
@@ -325,6 +220,7 @@ void
 spooky_init(spooky_context_t *const sc, uint64_t const seed0, uint64_t const seed1)
 {
     sc->m_partial = 0;
+    sc->m_head = 0;
     sc->m_use_short = true;
 
     sc->s0 = seed0;
@@ -341,241 +237,436 @@ spooky_init(spooky_context_t *const sc, uint64_t const seed0, uint64_t const see
     sc->s11 = SC_CONST;
 }
 
-void
-spooky_update(spooky_context_t *const sc, void const*msg, size_t msglen)
+// m_unhashed is a ring of two blocks starting at m_head (0 or SC_BLOCKSIZE),
+// so a block never has to be shifted down after the one before it is mixed.
+// A block is only mixed once the ring is full, by which time the stores that
+// filled it have long since landed and the loads don't stall.
+__attribute__((always_inline))
+static inline void
+ring_append(spooky_context_t *const sc, unsigned char const*const msg, size_t const msglen)
 {
-    if (sc->m_use_short) {
-        size_t new_partial;
-        if (__builtin_add_overflow(sc->m_partial, msglen, &new_partial)) {
-            // The new msglen overflows a size_t, which is fine.
-        } else {
-            if (new_partial < SC_BUFSIZE) {
-                // The new data isn't enough to switch from using the short
-                // hash to the long hash
-                __builtin_memcpy((unsigned char *)sc->m_unhashed + sc->m_partial, msg, msglen);
-                sc->m_partial += msglen;
-                return;
-            }
+    size_t pos = sc->m_head + sc->m_partial;
+    if (pos >= SC_BUFSIZE) {
+        pos -= SC_BUFSIZE;
+    }
+    size_t const room = SC_BUFSIZE - pos;
+    unsigned char *const dst = (unsigned char *)sc->m_unhashed + pos;
+    if (msglen <= 16 && msglen <= room) {
+        // Overlapping head and tail copies, rather than a call to memcpy
+        // that has to branch on the length anyway.
+        if (msglen >= 8) {
+            uint64_t const head = spooky_inline_rd64(msg);
+            uint64_t const tail = spooky_inline_rd64(msg + msglen - 8);
+            __builtin_memcpy(dst, &head, 8);
+            __builtin_memcpy(dst + msglen - 8, &tail, 8);
+        } else if (msglen >= 4) {
+            uint32_t const head = spooky_inline_rd32(msg);
+            uint32_t const tail = spooky_inline_rd32(msg + msglen - 4);
+            __builtin_memcpy(dst, &head, 4);
+            __builtin_memcpy(dst + msglen - 4, &tail, 4);
+        } else if (msglen > 0) {
+            dst[0] = msg[0];
+            dst[msglen / 2] = msg[msglen / 2];
+            dst[msglen - 1] = msg[msglen - 1];
         }
+    } else if (msglen <= room) {
+        __builtin_memcpy(dst, msg, msglen);
+    } else {
+        __builtin_memcpy(dst, msg, room);
+        __builtin_memcpy(sc->m_unhashed, msg + room, msglen - room);
+    }
+    sc->m_partial += msglen;
+}
 
-        sc->m_use_short = false;
+__attribute__((always_inline))
+static inline void
+update_store(spooky_context_t *const sc, uint64_t const*const h)
+{
+    sc->s0 = h[0];
+    sc->s1 = h[1];
+    sc->s2 = h[2];
+    sc->s3 = h[3];
+    sc->s4 = h[4];
+    sc->s5 = h[5];
+    sc->s6 = h[6];
+    sc->s7 = h[7];
+    sc->s8 = h[8];
+    sc->s9 = h[9];
+    sc->s10 = h[10];
+    sc->s11 = h[11];
+}
+
+void
+spooky_update(spooky_context_t *const sc, void const*msg, size_t msglen)
+{
+    // The common case for small appends: no state to load, nothing to mix.
+    // In short mode this also keeps the total under SC_BUFSIZE.
+    if (msglen < (size_t)(SC_BUFSIZE - sc->m_partial)) {
+        ring_append(sc, msg, msglen);
+        return;
     }
 
     // We've gone beyond a small buffer, we can operate on blocks now
+    sc->m_use_short = false;
 
     unsigned char const*lmsg = msg;
 
-    uint64_t h0 = sc->s0;
-    uint64_t h1 = sc->s1;
-    uint64_t h2 = sc->s2;
-    uint64_t h3 = sc->s3;
-    uint64_t h4 = sc->s4;
-    uint64_t h5 = sc->s5;
-    uint64_t h6 = sc->s6;
-    uint64_t h7 = sc->s7;
-    uint64_t h8 = sc->s8;
-    uint64_t h9 = sc->s9;
-    uint64_t h10 = sc->s10;
-    uint64_t h11 = sc->s11;
-
-    bool mixed = false;
-    // The first time the amount of data goes over SC_BUFSIZE, we can have more
-    // than SC_BLOCKSIZE data in our partial buffer
-    if (sc->m_partial >= SC_BLOCKSIZE) {
-        uint64_t const* datap = sc->m_unhashed;
-        h0 += datap[0];    h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-        h1 += datap[1];    h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-        h2 += datap[2];    h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-        h3 += datap[3];    h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-        h4 += datap[4];    h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-        h5 += datap[5];    h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-        h6 += datap[6];    h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-        h7 += datap[7];    h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-        h8 += datap[8];    h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-        h9 += datap[9];    h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-        h10 += datap[10];  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-        h11 += datap[11];  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
+    uint64_t h[SC_NUMVARS] = {
+        sc->s0, sc->s1, sc->s2, sc->s3, sc->s4, sc->s5,
+        sc->s6, sc->s7, sc->s8, sc->s9, sc->s10, sc->s11,
+    };
 
+    // Mix the full blocks at the head of the ring, oldest first
+    while (sc->m_partial >= SC_BLOCKSIZE) {
+        spooky_inline_mix(h, (uint8_t const*)sc->m_unhashed + sc->m_head);
+        sc->m_head ^= SC_BLOCKSIZE;
         sc->m_partial -= SC_BLOCKSIZE;
+    }
 
-        __builtin_memcpy(sc->m_unhashed, (unsigned char *)sc->m_unhashed + SC_BLOCKSIZE, sc->m_partial);
-
-        mixed = true;
+    if (msglen < (size_t)(SC_BUFSIZE - sc->m_partial)) {
+        ring_append(sc, lmsg, msglen);
+        update_store(sc, h);
+        return;
     }
 
-    // Empty the partial buffer ASAP so we can hash the data directly without
-    // copying.
+    // Enough data to go round the ring: complete the block at its head and
+    // hash the rest of msg where it lies.
     if (sc->m_partial > 0) {
         size_t const fillamt = SC_BLOCKSIZE - sc->m_partial;
-        if (msglen < fillamt) {
-            // Not enough data to do a block
-            __builtin_memcpy((unsigned char *)sc->m_unhashed + sc->m_partial, lmsg, msglen);
-            sc->m_partial += msglen;
-
-            if (mixed) {
-                sc->s0 = h0;
-                sc->s1 = h1;
-                sc->s2 = h2;
-                sc->s3 = h3;
-                sc->s4 = h4;
-                sc->s5 = h5;
-                sc->s6 = h6;
-                sc->s7 = h7;
-                sc->s8 = h8;
-                sc->s9 = h9;
-                sc->s10 = h10;
-                sc->s11 = h11;
-            }
-            return;
-        } else {
-            __builtin_memcpy((unsigned char *)sc->m_unhashed + sc->m_partial, lmsg, fillamt);
-
-            uint64_t const* datap = sc->m_unhashed;
-            h0 += datap[0];    h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-            h1 += datap[1];    h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-            h2 += datap[2];    h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-            h3 += datap[3];    h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-            h4 += datap[4];    h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-            h5 += datap[5];    h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-            h6 += datap[6];    h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-            h7 += datap[7];    h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-            h8 += datap[8];    h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-            h9 += datap[9];    h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-            h10 += datap[10];  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-            h11 += datap[11];  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
-
-            sc->m_partial = 0;
-
-            msglen -= fillamt;
-            lmsg += fillamt;
-        }
+        __builtin_memcpy((unsigned char *)sc->m_unhashed + sc->m_head + sc->m_partial, lmsg, fillamt);
+        spooky_inline_mix(h, (uint8_t const*)sc->m_unhashed + sc->m_head);
+
+        msglen -= fillamt;
+        lmsg += fillamt;
     }
 
-    size_t const num_blocks = msglen / SC_BLOCKSIZE;
     size_t const leftover = msglen % SC_BLOCKSIZE;
 
     // Handle blocks
-    if (((uintptr_t)lmsg & 0x7) == 0) {
+    unsigned char const*const end = lmsg + (msglen - leftover);
+    for (; lmsg < end; lmsg += SC_BLOCKSIZE) {
+        spooky_inline_mix(h, lmsg);
+    }
 
-        uint64_t const*datap = (void *)lmsg;
-        for (size_t i = 0; i < num_blocks; ++i) {
+    // Stash any remainder to be hashed later
+    sc->m_head = 0;
+    sc->m_partial = leftover;
+    __builtin_memcpy(sc->m_unhashed, lmsg, leftover);
+
+    // Copy the contents back in to the state
+    update_store(sc, h);
+}
+
+// Store a word of a copy, bypassing the cache if nt
+__attribute__((always_inline))
+static inline uint64_t
+copy_word(uint8_t *const dst, uint8_t const*const src, bool const nt)
+{
+    uint64_t const v = spooky_inline_rd64(src);
+#if defined(__x86_64__)
+    if (nt) {
+        _mm_stream_si64((long long *)(void *)dst, (long long)v);
+        return v;
+    }
+#endif
+    (void)nt;
+    __builtin_memcpy(dst, &v, 8);
+    return v;
+}
 
-            h0 += datap[0];    h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-            h1 += datap[1];    h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-            h2 += datap[2];    h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-            h3 += datap[3];    h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-            h4 += datap[4];    h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-            h5 += datap[5];    h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-            h6 += datap[6];    h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-            h7 += datap[7];    h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-            h8 += datap[8];    h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-            h9 += datap[9];    h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-            h10 += datap[10];  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-            h11 += datap[11];  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
-
-            datap += SC_NUMVARS;
+// One block of the long hash, with state h, also stored to dst. Each word
+// is loaded once and goes to both, so the copy costs no extra reads. With
+// nt the stores bypass the cache, for x86-64 and a dst aligned to 8.
+__attribute__((always_inline))
+static inline void
+copy_mix_block(uint64_t *const h, uint8_t *const dst, uint8_t const*const src, bool const nt)
+{
+    spooky_inline_mix_word(h,  0, copy_word(dst +  0, src +  0, nt));
+    spooky_inline_mix_word(h,  1, copy_word(dst +  8, src +  8, nt));
+    spooky_inline_mix_word(h,  2, copy_word(dst + 16, src + 16, nt));
+    spooky_inline_mix_word(h,  3, copy_word(dst + 24, src + 24, nt));
+    spooky_inline_mix_word(h,  4, copy_word(dst + 32, src + 32, nt));
+    spooky_inline_mix_word(h,  5, copy_word(dst + 40, src + 40, nt));
+    spooky_inline_mix_word(h,  6, copy_word(dst + 48, src + 48, nt));
+    spooky_inline_mix_word(h,  7, copy_word(dst + 56, src + 56, nt));
+    spooky_inline_mix_word(h,  8, copy_word(dst + 64, src + 64, nt));
+    spooky_inline_mix_word(h,  9, copy_word(dst + 72, src + 72, nt));
+    spooky_inline_mix_word(h, 10, copy_word(dst + 80, src + 80, nt));
+    spooky_inline_mix_word(h, 11, copy_word(dst + 88, src + 88, nt));
+}
+
+// The blocks of a copy, kept apart from the ring handling so the state
+// stays in registers through the loop
+static void
+copy_mix_blocks(uint64_t *const state, uint8_t *dst, uint8_t const*src, size_t const num_blocks)
+{
+    uint64_t h[SC_NUMVARS];
+    __builtin_memcpy(h, state, sizeof(h));
+
+    bool const nt = num_blocks * SC_BLOCKSIZE >= SPOOKY_COPY_NONTEMPORAL && ((uintptr_t)dst & 0x7) == 0;
+    if (nt) {
+        for (size_t i = 0; i < num_blocks; ++i) {
+            copy_mix_block(h, dst, src, true);
+            dst += SC_BLOCKSIZE;
+            src += SC_BLOCKSIZE;
         }
+#if defined(__x86_64__)
+        // Streaming stores are weakly ordered, make them visible before
+        // anything the caller does next
+        _mm_sfence();
+#endif
     } else {
-
-        uint8_t const*datap = lmsg;
         for (size_t i = 0; i < num_blocks; ++i) {
-            h0 +=  rd64(datap +  0);  h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
-            h1 +=  rd64(datap +  8);  h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
-            h2 +=  rd64(datap + 16);  h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
-            h3 +=  rd64(datap + 24);  h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
-            h4 +=  rd64(datap + 32);  h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
-            h5 +=  rd64(datap + 40);  h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
-            h6 +=  rd64(datap + 48);  h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
-            h7 +=  rd64(datap + 56);  h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
-            h8 +=  rd64(datap + 64);  h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
-            h9 +=  rd64(datap + 72);  h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
-            h10 += rd64(datap + 80);  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
-            h11 += rd64(datap + 88);  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
-            datap += SC_BLOCKSIZE;
+            copy_mix_block(h, dst, src, false);
+            dst += SC_BLOCKSIZE;
+            src += SC_BLOCKSIZE;
         }
     }
 
-    // Stash any remainder to be hashed later
-    if (leftover != 0) {
-        __builtin_memcpy(sc->m_unhashed, lmsg + (num_blocks * SC_BLOCKSIZE), leftover);
-        sc->m_partial = leftover;
+    __builtin_memcpy(state, h, sizeof(h));
+}
+
+void
+spooky_update_copy(spooky_context_t *const sc, void *const dst, void const*const src, size_t len)
+{
+    uint8_t *ldst = dst;
+    uint8_t const*lsrc = src;
+
+    // Small pieces go through the ring as usual, they're in cache anyway.
+    // Otherwise top the ring up to a block boundary the same way, and the
+    // rest is whole blocks, copied and mixed in one go, and a tail.
+    size_t const fill = len < (size_t)(SC_BUFSIZE - sc->m_partial)
+        ? len : (SC_BLOCKSIZE - sc->m_partial % SC_BLOCKSIZE) % SC_BLOCKSIZE;
+    __builtin_memcpy(ldst, lsrc, fill);
+    spooky_update(sc, lsrc, fill);
+    if (fill == len) {
+        return;
+    }
+    ldst += fill;
+    lsrc += fill;
+    len -= fill;
+
+    sc->m_use_short = false;
+    uint64_t state[SC_NUMVARS] = {
+        sc->s0, sc->s1, sc->s2, sc->s3, sc->s4, sc->s5,
+        sc->s6, sc->s7, sc->s8, sc->s9, sc->s10, sc->s11,
+    };
+
+    // The ring now holds zero, one or two whole blocks, oldest at m_head
+    while (sc->m_partial >= SC_BLOCKSIZE) {
+        uint64_t scratch[SC_NUMVARS];
+        copy_mix_block(state, (uint8_t *)scratch, (uint8_t const*)sc->m_unhashed + sc->m_head, false);
+        sc->m_head ^= SC_BLOCKSIZE;
+        sc->m_partial -= SC_BLOCKSIZE;
     }
 
-    // Copy the contents back in to the state
-    sc->s0 = h0;
-    sc->s1 = h1;
-    sc->s2 = h2;
-    sc->s3 = h3;
-    sc->s4 = h4;
-    sc->s5 = h5;
-    sc->s6 = h6;
-    sc->s7 = h7;
-    sc->s8 = h8;
-    sc->s9 = h9;
-    sc->s10 = h10;
-    sc->s11 = h11;
+    size_t const num_blocks = len / SC_BLOCKSIZE;
+    size_t const leftover = len % SC_BLOCKSIZE;
+    copy_mix_blocks(state, ldst, lsrc, num_blocks);
+
+    sc->m_head = 0;
+    sc->m_partial = leftover;
+    __builtin_memcpy(sc->m_unhashed, lsrc + num_blocks * SC_BLOCKSIZE, leftover);
+    __builtin_memcpy(ldst + num_blocks * SC_BLOCKSIZE, lsrc + num_blocks * SC_BLOCKSIZE, leftover);
+
+    sc->s0 = state[0];
+    sc->s1 = state[1];
+    sc->s2 = state[2];
+    sc->s3 = state[3];
+    sc->s4 = state[4];
+    sc->s5 = state[5];
+    sc->s6 = state[6];
+    sc->s7 = state[7];
+    sc->s8 = state[8];
+    sc->s9 = state[9];
+    sc->s10 = state[10];
+    sc->s11 = state[11];
 }
 
 void
-spooky_final(spooky_context_t const*const sc, uint64_t *hash0, uint64_t *hash1)
+spooky_copy_hash128(void *const dst, void const*const src, size_t const len,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    if (len < SC_BUFSIZE) {
+        __builtin_memcpy(dst, src, len);
+        spooky_short(src, len, hash1, hash2);
+        return;
+    }
+
+    spooky_context_t sc;
+    spooky_init(&sc, *hash1, *hash2);
+    spooky_update_copy(&sc, dst, src, len);
+    spooky_final(&sc, hash1, hash2);
+}
+
+// The result goes to hash[0..1], and with wide to hash[2..3] as well
+__attribute__((always_inline))
+static inline void
+final_hash(spooky_context_t const*const sc, uint64_t *const hash, bool const wide)
 {
     if (sc->m_use_short) {
-        *hash0 = sc->s0;
-        *hash1 = sc->s1;
-        spooky_short(sc->m_unhashed, sc->m_partial, hash0, hash1);
+        hash[0] = sc->s0;
+        hash[1] = sc->s1;
+        spooky_inline_short_hash(sc->m_unhashed, sc->m_partial, hash, wide);
         return;
     }
 
     // Make a local copy of the state, we cannot modify the internal state
-    uint64_t h0 = sc->s0;
-    uint64_t h1 = sc->s1;
-    uint64_t h2 = sc->s2;
-    uint64_t h3 = sc->s3;
-    uint64_t h4 = sc->s4;
-    uint64_t h5 = sc->s5;
-    uint64_t h6 = sc->s6;
-    uint64_t h7 = sc->s7;
-    uint64_t h8 = sc->s8;
-    uint64_t h9 = sc->s9;
-    uint64_t h10 = sc->s10;
-    uint64_t h11 = sc->s11;
-
-    uint64_t last_block[SC_NUMVARS];
-
-    size_t const leftover = sc->m_partial;
-    __builtin_memcpy(last_block, sc->m_unhashed, leftover);
-    __builtin_memset((uint8_t *)last_block + leftover, 0, SC_BLOCKSIZE - leftover);
-    ((uint8_t *)last_block)[SC_BLOCKSIZE-1] = leftover;
-
-    h0  += last_block[0];
-    h1  += last_block[1];
-    h2  += last_block[2];
-    h3  += last_block[3];
-    h4  += last_block[4];
-    h5  += last_block[5];
-    h6  += last_block[6];
-    h7  += last_block[7];
-    h8  += last_block[8];
-    h9  += last_block[9];
-    h10 += last_block[10];
-    h11 += last_block[11];
-
-    for (int i = 0; i < 3; ++i) {
-        h11+= h1;    h2 ^= h11;   h1 = rol64(h1,44);
-        h0 += h2;    h3 ^= h0;    h2 = rol64(h2,15);
-        h1 += h3;    h4 ^= h1;    h3 = rol64(h3,34);
-        h2 += h4;    h5 ^= h2;    h4 = rol64(h4,21);
-        h3 += h5;    h6 ^= h3;    h5 = rol64(h5,38);
-        h4 += h6;    h7 ^= h4;    h6 = rol64(h6,33);
-        h5 += h7;    h8 ^= h5;    h7 = rol64(h7,10);
-        h6 += h8;    h9 ^= h6;    h8 = rol64(h8,13);
-        h7 += h9;    h10^= h7;    h9 = rol64(h9,38);
-        h8 += h10;   h11^= h8;    h10= rol64(h10,53);
-        h9 += h11;   h0 ^= h9;    h11= rol64(h11,42);
-        h10+= h0;    h1 ^= h10;   h0 = rol64(h0,54);
-    }
-
-    *hash0 = h0;
-    *hash1 = h1;
+    uint64_t h[SC_NUMVARS] = {
+        sc->s0, sc->s1, sc->s2, sc->s3, sc->s4, sc->s5,
+        sc->s6, sc->s7, sc->s8, sc->s9, sc->s10, sc->s11,
+    };
+
+    // The ring can hold up to two full blocks, they're mixed as usual and
+    // whatever follows them is the final partial block.
+    size_t head = sc->m_head;
+    size_t leftover = sc->m_partial;
+    while (leftover >= SC_BLOCKSIZE) {
+        spooky_inline_mix(h, (uint8_t const*)sc->m_unhashed + head);
+        head ^= SC_BLOCKSIZE;
+        leftover -= SC_BLOCKSIZE;
+    }
+
+    spooky_inline_end(h, (uint8_t const*)sc->m_unhashed + head, leftover);
+    hash[0] = h[0];
+    hash[1] = h[1];
+
+    // The wide hash's second half comes from one more round of the end mix
+    if (wide) {
+        spooky_inline_end_round(h);
+        hash[2] = h[0];
+        hash[3] = h[1];
+    }
 }
 
+void
+spooky_final(spooky_context_t const*const sc, uint64_t *hash0, uint64_t *hash1)
+{
+    uint64_t hash[2];
+    final_hash(sc, hash, false);
+    *hash0 = hash[0];
+    *hash1 = hash[1];
+}
+
+void
+spooky_final256(spooky_context_t const*const sc, uint64_t *const hash)
+{
+    final_hash(sc, hash, true);
+}
+
+void
+spooky_hash256(void const*const message, size_t const length, uint64_t *const hash)
+{
+    if (length < SC_BUFSIZE) {
+        spooky_short256(message, length, hash);
+        return;
+    }
+
+    spooky_context_t sc;
+    spooky_init(&sc, hash[0], hash[1]);
+    spooky_update(&sc, message, length);
+    spooky_final256(&sc, hash);
+}
+
+
+// Checkpoint flags
+#define SC_CKPT_SHORT 0x1
+
+static void
+put_le64(uint8_t *const dst, uint64_t const v)
+{
+    for (int i = 0; i < 8; ++i) {
+        dst[i] = v >> (8 * i);
+    }
+}
+
+static uint64_t
+get_le64(uint8_t const*const src)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v |= (uint64_t)src[i] << (8 * i);
+    }
+    return v;
+}
+
+size_t
+spooky_context_export(spooky_context_t const*const sc, void *const buf)
+{
+    uint8_t *out = buf;
+    uint64_t const state[SC_NUMVARS] = {
+        sc->s0, sc->s1, sc->s2, sc->s3, sc->s4, sc->s5,
+        sc->s6, sc->s7, sc->s8, sc->s9, sc->s10, sc->s11,
+    };
+    // In short mode only the seeds matter, the rest of the state is
+    // untouched since spooky_init.
+    int const nwords = sc->m_use_short ? 2 : SC_NUMVARS;
+
+    out[0] = 'S';
+    out[1] = SPOOKY_CONTEXT_VERSION;
+    out[2] = sc->m_use_short ? SC_CKPT_SHORT : 0;
+    out[3] = sc->m_partial;
+    out += 4;
+
+    for (int i = 0; i < nwords; ++i) {
+        put_le64(out, state[i]);
+        out += 8;
+    }
+
+    // Unwrap the ring so the unhashed bytes are stored oldest first
+    size_t const first = sc->m_partial < SC_BUFSIZE - sc->m_head ? sc->m_partial : SC_BUFSIZE - sc->m_head;
+    __builtin_memcpy(out, (uint8_t const*)sc->m_unhashed + sc->m_head, first);
+    __builtin_memcpy(out + first, sc->m_unhashed, sc->m_partial - first);
+    out += sc->m_partial;
+
+    return out - (uint8_t *)buf;
+}
+
+bool
+spooky_context_import(spooky_context_t *const sc, void const*const buf, size_t const len)
+{
+    uint8_t const*in = buf;
+
+    if (len < 4 || in[0] != 'S' || in[1] != SPOOKY_CONTEXT_VERSION || (in[2] & ~SC_CKPT_SHORT) != 0) {
+        return false;
+    }
+
+    bool const use_short = in[2] & SC_CKPT_SHORT;
+    size_t const partial = in[3];
+    size_t const nwords = use_short ? 2 : SC_NUMVARS;
+    // spooky_update never leaves a full ring behind, and a short context
+    // switches to long before it reaches SC_BUFSIZE.
+    if (partial >= SC_BUFSIZE || len != 4 + 8 * nwords + partial) {
+        return false;
+    }
+    in += 4;
+
+    uint64_t state[SC_NUMVARS];
+    for (size_t i = 0; i < nwords; ++i) {
+        state[i] = get_le64(in);
+        in += 8;
+    }
+
+    if (use_short) {
+        spooky_init(sc, state[0], state[1]);
+    } else {
+        sc->m_use_short = false;
+        sc->s0 = state[0];
+        sc->s1 = state[1];
+        sc->s2 = state[2];
+        sc->s3 = state[3];
+        sc->s4 = state[4];
+        sc->s5 = state[5];
+        sc->s6 = state[6];
+        sc->s7 = state[7];
+        sc->s8 = state[8];
+        sc->s9 = state[9];
+        sc->s10 = state[10];
+        sc->s11 = state[11];
+    }
+    sc->m_head = 0;
+    sc->m_partial = partial;
+    __builtin_memcpy(sc->m_unhashed, in, partial);
+
+    return true;
+}
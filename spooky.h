@@ -7,20 +7,62 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 
 #define SC_CONST UINT64_C(0xdeadbeefdeadbeef)
 #define SC_NUMVARS 12
 #define SC_BLOCKSIZE (SC_NUMVARS*8)
 #define SC_BUFSIZE (2*SC_BLOCKSIZE)
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void spooky_hash128(void const*p_msg, size_t p_len, uint64_t *ph1, uint64_t *ph2);
 
+// 256 bits, for when 128 aren't enough, e.g. fingerprints of tens of billions
+// of chunks. hash[0] and hash[1] are the seeds on entry, as for
+// spooky_hash128, and on exit hash[0..1] is what spooky_hash128 gives.
+// hash[2..3] come from one more round of the final mix over the whole state,
+// the 12 words of the long hash or the 4 of the short one, so the data is
+// still only read once.
+void spooky_hash256(void const*p_msg, size_t p_len, uint64_t *hash);
+
+// Hash the concatenation of iov[0..iovcnt) without copying it anywhere first,
+// the result is the same as spooky_hash128 of the joined bytes. Only blocks
+// that straddle two fragments are copied.
+void spooky_hash128_iov(struct iovec const*iov, int iovcnt, uint64_t *ph1, uint64_t *ph2);
+
+// Hash n independent messages. ph1[i] and ph2[i] are the seeds for msgs[i] on
+// entry and its hash on exit, the same values spooky_hash128 would give. Long
+// messages are spread across SIMD lanes by the AVX2 and AVX-512 variants.
+void spooky_hash128_multi(void const*const*msgs, size_t const*lens, size_t n,
+    uint64_t *ph1, uint64_t *ph2);
+
+// Hash nkeys keys of key_width bytes each, stored back to back, into out.
+// out[i] is spooky_hash64 of key i. The AVX2 and AVX-512 variants hash 8, 16
+// and 32 byte keys several at a time in SIMD lanes.
+void spooky_hash64_keys(void const*keys, size_t key_width, size_t nkeys,
+    uint64_t seed, uint64_t *out);
+
+// Define SPOOKY_INLINE before including this header to have spooky_hash64
+// and spooky_hash32 hash in line rather than call spooky_hash128, and to get
+// spooky_hash128_inline. Neither needs the library, and a key length known
+// at compile time turns them into straight-line code.
+#ifdef SPOOKY_INLINE
+#include "spooky_inline.h"
+#endif
+
 static inline uint64_t
 spooky_hash64(void const*p_msg, size_t const p_len, uint64_t const p_seed)
 {
     uint64_t hash1 = p_seed;
     uint64_t hash2 = p_seed;
+#ifdef SPOOKY_INLINE
+    spooky_hash128_inline(p_msg, p_len, &hash1, &hash2);
+#else
     spooky_hash128(p_msg, p_len, &hash1, &hash2);
+#endif
     return hash1;
 }
 static inline uint32_t
@@ -29,8 +71,37 @@ spooky_hash32(void const*p_msg, size_t const p_len, uint32_t const p_seed)
     return (uint32_t)spooky_hash64(p_msg, p_len, (uint64_t)p_seed);
 }
 
+// Tree mode, for buffers big enough to be worth hashing on several cores.
+// msg is cut into chunk_size byte chunks (the last may be shorter, an empty
+// msg is a single empty chunk) and every chunk is hashed with spooky_hash128
+// and the caller's seeds. The result is spooky_hash128, again with the
+// caller's seeds, of the chunk hashes as 64-bit words h1, h2 in chunk order,
+// followed by the words len and chunk_size. It depends on the data, seeds and
+// chunk_size only, never on nthreads. nthreads of 0 uses every online CPU,
+// chunk_size of 0 uses SPOOKY_TREE_CHUNK.
+#define SPOOKY_TREE_CHUNK (UINT64_C(1) << 20)
+void spooky_tree_hash128(void const*msg, size_t len, size_t chunk_size,
+    unsigned nthreads, uint64_t *ph1, uint64_t *ph2);
+
+// Kernel variants for the batch entry points. The library picks the best one
+// the CPU supports at load time, SPOOKY_IMPL=scalar|avx2|avx512 in the
+// environment or spooky_set_impl() overrides it, e.g. for benchmarking.
+enum spooky_impl {
+    SPOOKY_IMPL_SCALAR,
+    SPOOKY_IMPL_AVX2,
+    SPOOKY_IMPL_AVX512,
+    SPOOKY_IMPL_COUNT,
+};
+
+bool spooky_impl_supported(enum spooky_impl impl);
+char const* spooky_impl_name(enum spooky_impl impl);
+enum spooky_impl spooky_get_impl(void);
+// Returns false, and changes nothing, if the CPU can't run impl
+bool spooky_set_impl(enum spooky_impl impl);
+
 struct spooky_context {
     int m_partial;
+    int m_head;
     bool m_use_short;
     uint64_t s0;
     uint64_t s1;
@@ -45,7 +116,7 @@ struct spooky_context {
     uint64_t s10;
     uint64_t s11;
     // We need to store up to 2*SC_NUMVARS initially to correctly hash short
-    // messages.
+    // messages. After that it's a ring of two blocks starting at m_head.
     uint64_t m_unhashed[2*SC_NUMVARS];
 };
 
@@ -54,3 +125,32 @@ typedef struct spooky_context spooky_context_t;
 void spooky_init(spooky_context_t *sc, uint64_t seed0, uint64_t seed1);
 void spooky_update(spooky_context_t *sc, void const*msg, size_t msglen);
 void spooky_final(spooky_context_t const*sc, uint64_t *hash0, uint64_t *hash1);
+// spooky_hash256 of everything given to spooky_update, into hash[0..3]
+void spooky_final256(spooky_context_t const*sc, uint64_t *hash);
+
+// Copy len bytes from src to dst and hash them on the way, reading src once
+// instead of once for memcpy and again for the hash. The hash is the same as
+// spooky_hash128 of src, or spooky_update with src. src and dst must not
+// overlap. Runs of blocks of at least SPOOKY_COPY_NONTEMPORAL bytes going to
+// a dst aligned to 8 use non-temporal stores on x86-64, so a copy bigger
+// than the cache doesn't evict everything else on its way through.
+#define SPOOKY_COPY_NONTEMPORAL (UINT64_C(32) << 20)
+void spooky_copy_hash128(void *dst, void const*src, size_t len, uint64_t *ph1, uint64_t *ph2);
+void spooky_update_copy(spooky_context_t *sc, void *dst, void const*src, size_t len);
+
+// Checkpoints of a context, e.g. to resume hashing a partial upload after a
+// restart without rehashing what came before. The format is a 4 byte header
+// ('S', version, flags, number of unhashed bytes), the live state words as
+// little-endian uint64s (2 of them for a context still in short mode, 12
+// otherwise) and then the unhashed bytes, so it's the same on every host.
+// export writes at most SPOOKY_CONTEXT_EXPORT_MAX bytes to buf and returns
+// how many. import returns false, leaving sc alone, if buf isn't a checkpoint
+// this version understands.
+#define SPOOKY_CONTEXT_VERSION 1
+#define SPOOKY_CONTEXT_EXPORT_MAX (4 + SC_BLOCKSIZE + SC_BUFSIZE)
+size_t spooky_context_export(spooky_context_t const*sc, void *buf);
+bool spooky_context_import(spooky_context_t *sc, void const*buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
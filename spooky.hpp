@@ -0,0 +1,428 @@
+#pragma once
+// Spooky Hash
+// constexpr versions of spooky_hash128/64/32 for C++17, so identifiers can be
+// hashed at compile time and used as case labels or in static_asserts:
+//
+//     switch (spooky::hash64(verb, 0)) {
+//     case spooky::hash64("GET", 0): ...
+//
+// Words are assembled from bytes little-endian, where the C library loads
+// them natively, so the two agree on little-endian hosts (which is all of
+// them the library is built for). At run time prefer the C functions, this
+// version trades speed for being evaluable by the compiler.
+//
+// spooky::hash<T> is a drop-in for std::hash built on spooky_hash64, with
+// hashed_string for keys that should only ever be hashed once.
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "spooky.h"
+
+namespace spooky {
+
+struct hash128_t {
+    std::uint64_t h1;
+    std::uint64_t h2;
+};
+
+namespace detail {
+
+constexpr std::uint64_t
+rol64(std::uint64_t const x, unsigned const k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+constexpr std::uint64_t
+rd(std::string_view const s, std::size_t const pos, std::size_t const nbytes)
+{
+    std::uint64_t o = 0;
+    for (std::size_t i = 0; i < nbytes; ++i) {
+        o |= std::uint64_t(static_cast<unsigned char>(s[pos + i])) << (8 * i);
+    }
+    return o;
+}
+
+constexpr std::uint64_t
+rd64(std::string_view const s, std::size_t const pos)
+{
+    return rd(s, pos, 8);
+}
+
+constexpr hash128_t
+hash_short(std::string_view const msg, std::uint64_t const seed1)
+{
+    std::size_t const length = msg.size();
+    std::size_t block_leftover = length % 32;
+
+    // Both start from the first seed, as in the C spooky_short
+    std::uint64_t a = seed1;
+    std::uint64_t b = seed1;
+    std::uint64_t c = SC_CONST;
+    std::uint64_t d = SC_CONST;
+
+    std::size_t pos = 0;
+
+    if (length > 15) {
+        std::size_t const blocks_of_32 = length / 32;
+        for (std::size_t i = 0; i < blocks_of_32; ++i) {
+            c += rd64(msg, pos);
+            d += rd64(msg, pos + 8);
+            c = rol64(c,50);  c += d;  a ^= c;
+            d = rol64(d,52);  d += a;  b ^= d;
+            a = rol64(a,30);  a += b;  c ^= a;
+            b = rol64(b,41);  b += c;  d ^= b;
+            c = rol64(c,54);  c += d;  a ^= c;
+            d = rol64(d,48);  d += a;  b ^= d;
+            a = rol64(a,38);  a += b;  c ^= a;
+            b = rol64(b,37);  b += c;  d ^= b;
+            c = rol64(c,62);  c += d;  a ^= c;
+            d = rol64(d,34);  d += a;  b ^= d;
+            a = rol64(a, 5);  a += b;  c ^= a;
+            b = rol64(b,36);  b += c;  d ^= b;
+            a += rd64(msg, pos + 16);
+            b += rd64(msg, pos + 24);
+            pos += 32;
+        }
+
+        if (block_leftover >= 16) {
+            c += rd64(msg, pos);
+            d += rd64(msg, pos + 8);
+            c = rol64(c,50);  c += d;  a ^= c;
+            d = rol64(d,52);  d += a;  b ^= d;
+            a = rol64(a,30);  a += b;  c ^= a;
+            b = rol64(b,41);  b += c;  d ^= b;
+            c = rol64(c,54);  c += d;  a ^= c;
+            d = rol64(d,48);  d += a;  b ^= d;
+            a = rol64(a,38);  a += b;  c ^= a;
+            b = rol64(b,37);  b += c;  d ^= b;
+            c = rol64(c,62);  c += d;  a ^= c;
+            d = rol64(d,34);  d += a;  b ^= d;
+            a = rol64(a, 5);  a += b;  c ^= a;
+            b = rol64(b,36);  b += c;  d ^= b;
+            pos += 16;
+            block_leftover -= 16;
+        }
+    }
+
+    // The last 0..15 bytes: the first 8 go in c, the rest in the low bytes of
+    // d, which is what the C tail switch adds up to.
+    d += std::uint64_t(length) << 56;
+    if (block_leftover == 0) {
+        c += SC_CONST;
+        d += SC_CONST;
+    } else if (block_leftover <= 8) {
+        c += rd(msg, pos, block_leftover);
+    } else {
+        c += rd64(msg, pos);
+        d += rd(msg, pos + 8, block_leftover - 8);
+    }
+
+    d ^= c;  c = rol64(c,15);  d += c;
+    a ^= d;  d = rol64(d,52);  a += d;
+    b ^= a;  a = rol64(a,26);  b += a;
+    c ^= b;  b = rol64(b,51);  c += b;
+    d ^= c;  c = rol64(c,28);  d += c;
+    a ^= d;  d = rol64(d, 9);  a += d;
+    b ^= a;  a = rol64(a,47);  b += a;
+    c ^= b;  b = rol64(b,54);  c += b;
+    d ^= c;  c = rol64(c,32);  d += c;
+    a ^= d;  d = rol64(d,25);  a += d;
+    b ^= a;  a = rol64(a,63);  b += a;
+
+    return {a, b};
+}
+
+constexpr hash128_t
+hash_long(std::string_view const msg, std::uint64_t const seed0, std::uint64_t const seed1)
+{
+    std::uint64_t h0 = seed0;
+    std::uint64_t h1 = seed1;
+    std::uint64_t h2 = SC_CONST;
+    std::uint64_t h3 = seed0;
+    std::uint64_t h4 = seed1;
+    std::uint64_t h5 = SC_CONST;
+    std::uint64_t h6 = seed0;
+    std::uint64_t h7 = seed1;
+    std::uint64_t h8 = SC_CONST;
+    std::uint64_t h9 = seed0;
+    std::uint64_t h10 = seed1;
+    std::uint64_t h11 = SC_CONST;
+
+    std::size_t const num_blocks = msg.size() / SC_BLOCKSIZE;
+    std::size_t const block_leftover = msg.size() - num_blocks * SC_BLOCKSIZE;
+
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < num_blocks; ++i) {
+        h0 +=  rd64(msg, pos +  0);  h2  ^= h10; h11 ^= h0;   h0  = rol64(h0,11);    h11 += h1;
+        h1 +=  rd64(msg, pos +  8);  h3  ^= h11; h0  ^= h1;   h1  = rol64(h1,32);    h0  += h2;
+        h2 +=  rd64(msg, pos + 16);  h4  ^= h0;  h1  ^= h2;   h2  = rol64(h2,43);    h1  += h3;
+        h3 +=  rd64(msg, pos + 24);  h5  ^= h1;  h2  ^= h3;   h3  = rol64(h3,31);    h2  += h4;
+        h4 +=  rd64(msg, pos + 32);  h6  ^= h2;  h3  ^= h4;   h4  = rol64(h4,17);    h3  += h5;
+        h5 +=  rd64(msg, pos + 40);  h7  ^= h3;  h4  ^= h5;   h5  = rol64(h5,28);    h4  += h6;
+        h6 +=  rd64(msg, pos + 48);  h8  ^= h4;  h5  ^= h6;   h6  = rol64(h6,39);    h5  += h7;
+        h7 +=  rd64(msg, pos + 56);  h9  ^= h5;  h6  ^= h7;   h7  = rol64(h7,57);    h6  += h8;
+        h8 +=  rd64(msg, pos + 64);  h10 ^= h6;  h7  ^= h8;   h8  = rol64(h8,55);    h7  += h9;
+        h9 +=  rd64(msg, pos + 72);  h11 ^= h7;  h8  ^= h9;   h9  = rol64(h9,54);    h8  += h10;
+        h10 += rd64(msg, pos + 80);  h0  ^= h8;  h9  ^= h10;  h10 = rol64(h10,22);   h9  += h11;
+        h11 += rd64(msg, pos + 88);  h1  ^= h9;  h10 ^= h11;  h11 = rol64(h11,46);   h10 += h0;
+        pos += SC_BLOCKSIZE;
+    }
+
+    // The zero padded last block, with its length in the top byte
+    std::uint64_t last_block[SC_NUMVARS] = {};
+    for (std::size_t i = 0; i < block_leftover; ++i) {
+        last_block[i / 8] |= std::uint64_t(static_cast<unsigned char>(msg[pos + i])) << (8 * (i % 8));
+    }
+    last_block[SC_NUMVARS - 1] |= std::uint64_t(block_leftover) << 56;
+
+    h0  += last_block[0];
+    h1  += last_block[1];
+    h2  += last_block[2];
+    h3  += last_block[3];
+    h4  += last_block[4];
+    h5  += last_block[5];
+    h6  += last_block[6];
+    h7  += last_block[7];
+    h8  += last_block[8];
+    h9  += last_block[9];
+    h10 += last_block[10];
+    h11 += last_block[11];
+
+    for (int i = 0; i < 3; ++i) {
+        h11+= h1;    h2 ^= h11;   h1 = rol64(h1,44);
+        h0 += h2;    h3 ^= h0;    h2 = rol64(h2,15);
+        h1 += h3;    h4 ^= h1;    h3 = rol64(h3,34);
+        h2 += h4;    h5 ^= h2;    h4 = rol64(h4,21);
+        h3 += h5;    h6 ^= h3;    h5 = rol64(h5,38);
+        h4 += h6;    h7 ^= h4;    h6 = rol64(h6,33);
+        h5 += h7;    h8 ^= h5;    h7 = rol64(h7,10);
+        h6 += h8;    h9 ^= h6;    h8 = rol64(h8,13);
+        h7 += h9;    h10^= h7;    h9 = rol64(h9,38);
+        h8 += h10;   h11^= h8;    h10= rol64(h10,53);
+        h9 += h11;   h0 ^= h9;    h11= rol64(h11,42);
+        h10+= h0;    h1 ^= h10;   h0 = rol64(h0,54);
+    }
+
+    return {h0, h1};
+}
+
+} // namespace detail
+
+// spooky_hash128 with seeds seed1 and seed2
+constexpr hash128_t
+hash128(std::string_view const msg, std::uint64_t const seed1, std::uint64_t const seed2)
+{
+    if (msg.size() < SC_BUFSIZE) {
+        return detail::hash_short(msg, seed1);
+    }
+    return detail::hash_long(msg, seed1, seed2);
+}
+
+constexpr std::uint64_t
+hash64(std::string_view const msg, std::uint64_t const seed)
+{
+    return hash128(msg, seed, seed).h1;
+}
+
+constexpr std::uint32_t
+hash32(std::string_view const msg, std::uint32_t const seed)
+{
+    return static_cast<std::uint32_t>(hash64(msg, seed));
+}
+
+// Hashers for unordered containers, all spooky_hash64 underneath (so they
+// need the library, or SPOOKY_INLINE). Each takes an optional seed. Strings
+// hash their characters, so hash<std::string> is transparent and finds keys
+// from a std::string_view or char const* without building a std::string.
+// Integers, enums and contiguous ranges of types without padding hash their
+// bytes, pairs and tuples hash the hashes of their members.
+template <class T, class Enable = void>
+struct hash;
+
+namespace detail {
+
+struct seeded {
+    std::uint64_t seed;
+    constexpr explicit seeded(std::uint64_t const s = 0) noexcept : seed(s) {}
+};
+
+template <class R, class = void>
+struct is_byte_range : std::false_type {};
+
+template <class R>
+struct is_byte_range<R, std::void_t<decltype(std::data(std::declval<R const&>())),
+        decltype(std::size(std::declval<R const&>()))>>
+    : std::bool_constant<std::has_unique_object_representations_v<
+        std::remove_cv_t<std::remove_pointer_t<decltype(std::data(std::declval<R const&>()))>>>> {};
+
+struct string_hash : seeded {
+    using seeded::seeded;
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view const s) const noexcept
+    {
+        return spooky_hash64(s.data(), s.size(), seed);
+    }
+    std::size_t operator()(std::string const& s) const noexcept
+    {
+        return spooky_hash64(s.data(), s.size(), seed);
+    }
+    std::size_t operator()(char const*const s) const noexcept
+    {
+        return operator()(std::string_view(s));
+    }
+};
+
+template <class Tuple, std::size_t... I>
+std::size_t
+hash_members(Tuple const& t, std::uint64_t const seed, std::index_sequence<I...>) noexcept
+{
+    std::uint64_t const parts[] = {
+        0, hash<std::remove_cv_t<std::tuple_element_t<I, Tuple>>>(seed)(std::get<I>(t))...
+    };
+    // Skip the placeholder that keeps an empty tuple from declaring an empty array
+    return spooky_hash64(parts + 1, sizeof(parts) - sizeof(parts[0]), seed);
+}
+
+} // namespace detail
+
+template <>
+struct hash<std::string> : detail::string_hash {
+    using string_hash::string_hash;
+};
+
+template <>
+struct hash<std::string_view> : detail::string_hash {
+    using string_hash::string_hash;
+};
+
+template <>
+struct hash<char const*> : detail::string_hash {
+    using string_hash::string_hash;
+};
+
+template <class T>
+struct hash<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>> : detail::seeded {
+    using seeded::seeded;
+
+    std::size_t operator()(T const v) const noexcept
+    {
+        return spooky_hash64(&v, sizeof(v), seed);
+    }
+};
+
+template <class R>
+struct hash<R, std::enable_if_t<detail::is_byte_range<R>::value>> : detail::seeded {
+    using seeded::seeded;
+
+    std::size_t operator()(R const& r) const noexcept
+    {
+        return spooky_hash64(std::data(r), std::size(r) * sizeof(*std::data(r)), seed);
+    }
+};
+
+template <class A, class B>
+struct hash<std::pair<A, B>> : detail::seeded {
+    using seeded::seeded;
+
+    std::size_t operator()(std::pair<A, B> const& p) const noexcept
+    {
+        return detail::hash_members(p, seed, std::index_sequence_for<A, B>());
+    }
+};
+
+template <class... Ts>
+struct hash<std::tuple<Ts...>> : detail::seeded {
+    using seeded::seeded;
+
+    std::size_t operator()(std::tuple<Ts...> const& t) const noexcept
+    {
+        return detail::hash_members(t, seed, std::index_sequence_for<Ts...>());
+    }
+};
+
+// A string that carries its spooky_hash64 (seed 0), so a container never
+// hashes it again, e.g. when it grows. It compares equal to a std::string_view
+// with the same characters, and hash<hashed_string> is transparent, hashing
+// anything that isn't a hashed_string the same way hash<std::string> does.
+class hashed_string {
+public:
+    hashed_string() : m_hash(spooky_hash64("", 0, 0)) {}
+    explicit hashed_string(std::string s)
+        : m_str(std::move(s)), m_hash(spooky_hash64(m_str.data(), m_str.size(), 0)) {}
+    explicit hashed_string(std::string_view const s) : hashed_string(std::string(s)) {}
+    explicit hashed_string(char const*const s) : hashed_string(std::string(s)) {}
+
+    std::string const& str() const noexcept { return m_str; }
+    std::uint64_t hash() const noexcept { return m_hash; }
+    operator std::string_view() const noexcept { return m_str; }
+
+    friend bool operator==(hashed_string const& a, hashed_string const& b) noexcept
+    {
+        return a.m_hash == b.m_hash && a.m_str == b.m_str;
+    }
+    friend bool operator!=(hashed_string const& a, hashed_string const& b) noexcept
+    {
+        return !(a == b);
+    }
+    friend bool operator==(hashed_string const& a, std::string_view const b) noexcept
+    {
+        return a.m_str == b;
+    }
+    friend bool operator==(std::string_view const a, hashed_string const& b) noexcept
+    {
+        return a == b.m_str;
+    }
+    friend bool operator!=(hashed_string const& a, std::string_view const b) noexcept
+    {
+        return !(a == b);
+    }
+    friend bool operator!=(std::string_view const a, hashed_string const& b) noexcept
+    {
+        return !(a == b);
+    }
+
+private:
+    std::string m_str;
+    std::uint64_t m_hash;
+};
+
+template <>
+struct hash<hashed_string> : detail::string_hash {
+    hash() noexcept = default;
+    using string_hash::operator();
+
+    std::size_t operator()(hashed_string const& s) const noexcept
+    {
+        return s.hash();
+    }
+};
+
+} // namespace spooky
+
+// std::__is_fast_hash is a libstdc++ internal, not part of the standard, so
+// it's only specialized when building against libstdc++, and may need
+// revisiting if a GCC release changes it. libstdc++ only keeps hash codes in
+// the nodes of unordered containers whose hasher isn't "fast", otherwise
+// walking a bucket rehashes every key it passes and growing the table
+// rehashes them all. Hashing a string (rather than loading a hashed_string's
+// hash) is not fast. Other standard libraries decide for themselves whether
+// to cache, see the README.
+#if defined(__GLIBCXX__)
+namespace std {
+template <>
+struct __is_fast_hash<spooky::hash<std::string>> : std::false_type {};
+template <>
+struct __is_fast_hash<spooky::hash<std::string_view>> : std::false_type {};
+template <>
+struct __is_fast_hash<spooky::hash<char const*>> : std::false_type {};
+} // namespace std
+#endif
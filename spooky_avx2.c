@@ -0,0 +1,467 @@
+// Spooky Hash
+// AVX2 kernels, four messages at a time with one message per 64-bit lane.
+// This file is built with -mavx2, nothing in it may be called before the CPU
+// has been checked for AVX2 support.
+
+#include <immintrin.h>
+#include "spooky_internal.h"
+
+#define NLANES 4
+
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+static uint64_t const zero_block[SC_NUMVARS];
+
+__attribute__((const, always_inline))
+static inline v4u64
+rol64x4(v4u64 const x, unsigned const k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// Load 4 words starting at byte `off` of every lane's block and transpose
+// them, so that lane i of out[k] is word k of lane i's data.
+__attribute__((always_inline))
+static inline void
+load4x4(uint8_t const*const p[NLANES], size_t const off, v4u64 *const out)
+{
+    __m256i const r0 = _mm256_loadu_si256((__m256i const*)(p[0] + off));
+    __m256i const r1 = _mm256_loadu_si256((__m256i const*)(p[1] + off));
+    __m256i const r2 = _mm256_loadu_si256((__m256i const*)(p[2] + off));
+    __m256i const r3 = _mm256_loadu_si256((__m256i const*)(p[3] + off));
+
+    __m256i const t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i const t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i const t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i const t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    out[0] = (v4u64)_mm256_permute2x128_si256(t0, t2, 0x20);
+    out[1] = (v4u64)_mm256_permute2x128_si256(t1, t3, 0x20);
+    out[2] = (v4u64)_mm256_permute2x128_si256(t0, t2, 0x31);
+    out[3] = (v4u64)_mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+__attribute__((always_inline))
+static inline void
+load_block(uint8_t const*const p[NLANES], v4u64 *const d)
+{
+    load4x4(p,  0, d);
+    load4x4(p, 32, d + 4);
+    load4x4(p, 64, d + 8);
+}
+
+__attribute__((always_inline))
+static inline void
+mix(v4u64 const*const d, v4u64 *const h)
+{
+    h[0] += d[0];    h[2]  ^= h[10]; h[11] ^= h[0];   h[0]  = rol64x4(h[0],11);    h[11] += h[1];
+    h[1] += d[1];    h[3]  ^= h[11]; h[0]  ^= h[1];   h[1]  = rol64x4(h[1],32);    h[0]  += h[2];
+    h[2] += d[2];    h[4]  ^= h[0];  h[1]  ^= h[2];   h[2]  = rol64x4(h[2],43);    h[1]  += h[3];
+    h[3] += d[3];    h[5]  ^= h[1];  h[2]  ^= h[3];   h[3]  = rol64x4(h[3],31);    h[2]  += h[4];
+    h[4] += d[4];    h[6]  ^= h[2];  h[3]  ^= h[4];   h[4]  = rol64x4(h[4],17);    h[3]  += h[5];
+    h[5] += d[5];    h[7]  ^= h[3];  h[4]  ^= h[5];   h[5]  = rol64x4(h[5],28);    h[4]  += h[6];
+    h[6] += d[6];    h[8]  ^= h[4];  h[5]  ^= h[6];   h[6]  = rol64x4(h[6],39);    h[5]  += h[7];
+    h[7] += d[7];    h[9]  ^= h[5];  h[6]  ^= h[7];   h[7]  = rol64x4(h[7],57);    h[6]  += h[8];
+    h[8] += d[8];    h[10] ^= h[6];  h[7]  ^= h[8];   h[8]  = rol64x4(h[8],55);    h[7]  += h[9];
+    h[9] += d[9];    h[11] ^= h[7];  h[8]  ^= h[9];   h[9]  = rol64x4(h[9],54);    h[8]  += h[10];
+    h[10] += d[10];  h[0]  ^= h[8];  h[9]  ^= h[10];  h[10] = rol64x4(h[10],22);   h[9]  += h[11];
+    h[11] += d[11];  h[1]  ^= h[9];  h[10] ^= h[11];  h[11] = rol64x4(h[11],46);   h[10] += h[0];
+}
+
+__attribute__((always_inline))
+static inline void
+end(v4u64 const*const d, v4u64 *const h)
+{
+    for (int i = 0; i < SC_NUMVARS; ++i) {
+        h[i] += d[i];
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        h[11]+= h[1];    h[2] ^= h[11];   h[1] = rol64x4(h[1],44);
+        h[0] += h[2];    h[3] ^= h[0];    h[2] = rol64x4(h[2],15);
+        h[1] += h[3];    h[4] ^= h[1];    h[3] = rol64x4(h[3],34);
+        h[2] += h[4];    h[5] ^= h[2];    h[4] = rol64x4(h[4],21);
+        h[3] += h[5];    h[6] ^= h[3];    h[5] = rol64x4(h[5],38);
+        h[4] += h[6];    h[7] ^= h[4];    h[6] = rol64x4(h[6],33);
+        h[5] += h[7];    h[8] ^= h[5];    h[7] = rol64x4(h[7],10);
+        h[6] += h[8];    h[9] ^= h[6];    h[8] = rol64x4(h[8],13);
+        h[7] += h[9];    h[10]^= h[7];    h[9] = rol64x4(h[9],38);
+        h[8] += h[10];   h[11]^= h[8];    h[10]= rol64x4(h[10],53);
+        h[9] += h[11];   h[0] ^= h[9];    h[11]= rol64x4(h[11],42);
+        h[10]+= h[0];    h[1] ^= h[10];   h[0] = rol64x4(h[0],54);
+    }
+}
+
+void
+spooky_long_x4_avx2(uint8_t const*const*const msgs, size_t const*const lens,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    v4u64 const seed0 = (v4u64)_mm256_loadu_si256((__m256i const*)hash1);
+    v4u64 const seed1 = (v4u64)_mm256_loadu_si256((__m256i const*)hash2);
+    v4u64 const sc_const = {SC_CONST, SC_CONST, SC_CONST, SC_CONST};
+
+    v4u64 h[SC_NUMVARS] = {
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+    };
+
+    uint8_t const*p[NLANES];
+    size_t num_blocks[NLANES];
+    size_t min_blocks = SIZE_MAX;
+    size_t max_blocks = 0;
+    for (int i = 0; i < NLANES; ++i) {
+        p[i] = msgs[i];
+        num_blocks[i] = lens[i] / SC_BLOCKSIZE;
+        min_blocks = num_blocks[i] < min_blocks ? num_blocks[i] : min_blocks;
+        max_blocks = num_blocks[i] > max_blocks ? num_blocks[i] : max_blocks;
+    }
+
+    v4u64 d[SC_NUMVARS];
+
+    // Every lane still has whole blocks left
+    for (size_t b = 0; b < min_blocks; ++b) {
+        load_block(p, d);
+        mix(d, h);
+        for (int i = 0; i < NLANES; ++i) {
+            p[i] += SC_BLOCKSIZE;
+        }
+    }
+
+    // Some lanes have run out of blocks. Keep them reading from a harmless
+    // buffer and merge only the live lanes back in.
+    for (size_t b = min_blocks; b < max_blocks; ++b) {
+        uint64_t live[NLANES];
+        for (int i = 0; i < NLANES; ++i) {
+            live[i] = (b < num_blocks[i]) ? UINT64_MAX : 0;
+            if (!live[i]) {
+                p[i] = (uint8_t const*)zero_block;
+            }
+        }
+        v4u64 const mask = (v4u64)_mm256_loadu_si256((__m256i const*)live);
+
+        v4u64 nh[SC_NUMVARS];
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            nh[i] = h[i];
+        }
+
+        load_block(p, d);
+        mix(d, nh);
+
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            h[i] = (nh[i] & mask) | (h[i] & ~mask);
+        }
+        for (int i = 0; i < NLANES; ++i) {
+            p[i] += live[i] ? SC_BLOCKSIZE : 0;
+        }
+    }
+
+    // Pad each lane's leftover bytes into a final block
+    uint64_t last_block[NLANES][SC_NUMVARS];
+    uint8_t const*lp[NLANES];
+    for (int i = 0; i < NLANES; ++i) {
+        size_t const leftover = lens[i] - num_blocks[i] * SC_BLOCKSIZE;
+        uint8_t const*const src = (uint8_t const*)msgs[i] + num_blocks[i] * SC_BLOCKSIZE;
+        __builtin_memcpy(last_block[i], src, leftover);
+        __builtin_memset((uint8_t *)last_block[i] + leftover, 0, SC_BLOCKSIZE - leftover);
+        ((uint8_t *)last_block[i])[SC_BLOCKSIZE-1] = leftover;
+        lp[i] = (uint8_t const*)last_block[i];
+    }
+
+    load_block(lp, d);
+    end(d, h);
+
+    _mm256_storeu_si256((__m256i *)hash1, (__m256i)h[0]);
+    _mm256_storeu_si256((__m256i *)hash2, (__m256i)h[1]);
+}
+
+void
+spooky_mix_x4_avx2(uint64_t *const*const states, uint8_t const*const*const blocks,
+    size_t const*const nblocks)
+{
+    // The states are 12 consecutive words each, just like a block
+    uint8_t const*sp[NLANES];
+    for (int i = 0; i < NLANES; ++i) {
+        sp[i] = (uint8_t const*)states[i];
+    }
+    v4u64 h[SC_NUMVARS];
+    load_block(sp, h);
+
+    size_t min_blocks = SIZE_MAX;
+    size_t max_blocks = 0;
+    for (int i = 0; i < NLANES; ++i) {
+        min_blocks = nblocks[i] < min_blocks ? nblocks[i] : min_blocks;
+        max_blocks = nblocks[i] > max_blocks ? nblocks[i] : max_blocks;
+    }
+
+    v4u64 d[SC_NUMVARS];
+
+    for (size_t b = 0; b < min_blocks; ++b) {
+        load_block(blocks + b * NLANES, d);
+        mix(d, h);
+    }
+
+    for (size_t b = min_blocks; b < max_blocks; ++b) {
+        uint8_t const*p[NLANES];
+        uint64_t live[NLANES];
+        for (int i = 0; i < NLANES; ++i) {
+            live[i] = (b < nblocks[i]) ? UINT64_MAX : 0;
+            p[i] = live[i] ? blocks[b * NLANES + i] : (uint8_t const*)zero_block;
+        }
+        v4u64 const mask = (v4u64)_mm256_loadu_si256((__m256i const*)live);
+
+        v4u64 nh[SC_NUMVARS];
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            nh[i] = h[i];
+        }
+
+        load_block(p, d);
+        mix(d, nh);
+
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            h[i] = (nh[i] & mask) | (h[i] & ~mask);
+        }
+    }
+
+    uint64_t spill[SC_NUMVARS][NLANES];
+    for (int k = 0; k < SC_NUMVARS; ++k) {
+        _mm256_storeu_si256((__m256i *)spill[k], (__m256i)h[k]);
+    }
+    for (int i = 0; i < NLANES; ++i) {
+        for (int k = 0; k < SC_NUMVARS; ++k) {
+            states[i][k] = spill[k][i];
+        }
+    }
+}
+
+// Load `nlanes` consecutive keys of `width` bytes so that lane i of w[k] is
+// word k of key i.
+__attribute__((always_inline))
+static inline void
+load_keys(uint8_t const*const p, size_t const width, v4u64 *const w)
+{
+    if (width == 8) {
+        w[0] = (v4u64)_mm256_loadu_si256((__m256i const*)p);
+    } else if (width == 16) {
+        __m256i const r0 = _mm256_loadu_si256((__m256i const*)p);
+        __m256i const r1 = _mm256_loadu_si256((__m256i const*)(p + 32));
+        // Keys come out in the order 0, 2, 1, 3
+        w[0] = (v4u64)_mm256_permute4x64_epi64(_mm256_unpacklo_epi64(r0, r1), 0xd8);
+        w[1] = (v4u64)_mm256_permute4x64_epi64(_mm256_unpackhi_epi64(r0, r1), 0xd8);
+    } else {
+        uint8_t const*const q[NLANES] = {p, p + 32, p + 64, p + 96};
+        load4x4(q, 0, w);
+    }
+}
+
+// spooky_short for one key per lane. `width` is a constant after inlining,
+// which leaves only the mix rounds that key length actually needs.
+__attribute__((always_inline))
+static inline size_t
+short_keys(uint8_t const*const keys, size_t const width, size_t const nkeys,
+    uint64_t const p_seed, uint64_t *const out)
+{
+    v4u64 const sc_const = {SC_CONST, SC_CONST, SC_CONST, SC_CONST};
+    v4u64 const seed = {p_seed, p_seed, p_seed, p_seed};
+    size_t const nvec = nkeys - nkeys % NLANES;
+
+    for (size_t i = 0; i < nvec; i += NLANES) {
+        v4u64 w[4];
+        load_keys(keys + i * width, width, w);
+
+        v4u64 a = seed;
+        v4u64 b = seed;
+        v4u64 c = sc_const;
+        v4u64 d = sc_const;
+
+        if (width >= 16) {
+            c += w[0];
+            d += w[1];
+            c = rol64x4(c,50);  c += d;  a ^= c;
+            d = rol64x4(d,52);  d += a;  b ^= d;
+            a = rol64x4(a,30);  a += b;  c ^= a;
+            b = rol64x4(b,41);  b += c;  d ^= b;
+            c = rol64x4(c,54);  c += d;  a ^= c;
+            d = rol64x4(d,48);  d += a;  b ^= d;
+            a = rol64x4(a,38);  a += b;  c ^= a;
+            b = rol64x4(b,37);  b += c;  d ^= b;
+            c = rol64x4(c,62);  c += d;  a ^= c;
+            d = rol64x4(d,34);  d += a;  b ^= d;
+            a = rol64x4(a, 5);  a += b;  c ^= a;
+            b = rol64x4(b,36);  b += c;  d ^= b;
+        }
+        if (width == 32) {
+            a += w[2];
+            b += w[3];
+        }
+
+        d += ((uint64_t)width) << 56;
+        if (width == 8) {
+            c += w[0];
+        } else {
+            c += sc_const;
+            d += sc_const;
+        }
+
+        d ^= c;  c = rol64x4(c,15);  d += c;
+        a ^= d;  d = rol64x4(d,52);  a += d;
+        b ^= a;  a = rol64x4(a,26);  b += a;
+        c ^= b;  b = rol64x4(b,51);  c += b;
+        d ^= c;  c = rol64x4(c,28);  d += c;
+        a ^= d;  d = rol64x4(d, 9);  a += d;
+        b ^= a;  a = rol64x4(a,47);  b += a;
+        c ^= b;  b = rol64x4(b,54);  c += b;
+        d ^= c;  c = rol64x4(c,32);  d += c;
+        a ^= d;  d = rol64x4(d,25);  a += d;
+        b ^= a;  a = rol64x4(a,63);  b += a;
+
+        _mm256_storeu_si256((__m256i *)(out + i), (__m256i)a);
+    }
+
+    return nvec;
+}
+
+size_t
+spooky_short_keys_x4_avx2(uint8_t const*const keys, size_t const key_width, size_t const nkeys,
+    uint64_t const seed, uint64_t *const out)
+{
+    switch (key_width) {
+        case 8:
+            return short_keys(keys, 8, nkeys, seed, out);
+        case 16:
+            return short_keys(keys, 16, nkeys, seed, out);
+        case 32:
+            return short_keys(keys, 32, nkeys, seed, out);
+        default:
+            return 0;
+    }
+}
+
+// Load words 0 and 1 at byte `off` of every lane's row, for the last half
+// block, which may be all that's left of the row
+__attribute__((always_inline))
+static inline void
+load2(uint8_t const*const p[NLANES], size_t const off, v4u64 *const out)
+{
+    __m256i const r02 = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)(p[0] + off))),
+        _mm_loadu_si128((__m128i const*)(p[2] + off)), 1);
+    __m256i const r13 = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)(p[1] + off))),
+        _mm_loadu_si128((__m128i const*)(p[3] + off)), 1);
+    out[0] = (v4u64)_mm256_unpacklo_epi64(r02, r13);
+    out[1] = (v4u64)_mm256_unpackhi_epi64(r02, r13);
+}
+
+// The short hash's mix of 16 bytes into c and d
+__attribute__((always_inline))
+static inline void
+short_mix(v4u64 *const a, v4u64 *const b, v4u64 *const c, v4u64 *const d)
+{
+    *c = rol64x4(*c,50);  *c += *d;  *a ^= *c;
+    *d = rol64x4(*d,52);  *d += *a;  *b ^= *d;
+    *a = rol64x4(*a,30);  *a += *b;  *c ^= *a;
+    *b = rol64x4(*b,41);  *b += *c;  *d ^= *b;
+    *c = rol64x4(*c,54);  *c += *d;  *a ^= *c;
+    *d = rol64x4(*d,48);  *d += *a;  *b ^= *d;
+    *a = rol64x4(*a,38);  *a += *b;  *c ^= *a;
+    *b = rol64x4(*b,37);  *b += *c;  *d ^= *b;
+    *c = rol64x4(*c,62);  *c += *d;  *a ^= *c;
+    *d = rol64x4(*d,34);  *d += *a;  *b ^= *d;
+    *a = rol64x4(*a, 5);  *a += *b;  *c ^= *a;
+    *b = rol64x4(*b,36);  *b += *c;  *d ^= *b;
+}
+
+void
+spooky_short_rows_x4_avx2(uint8_t const*const*const rows, uint64_t const*const tail_c,
+    uint64_t const*const tail_d, size_t const k, size_t const n, uint64_t *const hashes)
+{
+    v4u64 const sc_const = {SC_CONST, SC_CONST, SC_CONST, SC_CONST};
+
+    for (size_t i = 0; i < n; i += NLANES) {
+        uint8_t const*const*const p = rows + i;
+        v4u64 a = (v4u64)_mm256_loadu_si256((__m256i const*)(hashes + i));
+        v4u64 b = a;
+        v4u64 c = sc_const;
+        v4u64 d = sc_const;
+
+        size_t off = 0;
+        for (size_t j = 0; j < k / 2; ++j, off += 32) {
+            v4u64 w[4];
+            load4x4(p, off, w);
+            c += w[0];
+            d += w[1];
+            short_mix(&a, &b, &c, &d);
+            a += w[2];
+            b += w[3];
+        }
+        if (k & 1) {
+            v4u64 w[2];
+            load2(p, off, w);
+            c += w[0];
+            d += w[1];
+            short_mix(&a, &b, &c, &d);
+        }
+
+        c += (v4u64)_mm256_loadu_si256((__m256i const*)(tail_c + i));
+        d += (v4u64)_mm256_loadu_si256((__m256i const*)(tail_d + i));
+
+        d ^= c;  c = rol64x4(c,15);  d += c;
+        a ^= d;  d = rol64x4(d,52);  a += d;
+        b ^= a;  a = rol64x4(a,26);  b += a;
+        c ^= b;  b = rol64x4(b,51);  c += b;
+        d ^= c;  c = rol64x4(c,28);  d += c;
+        a ^= d;  d = rol64x4(d, 9);  a += d;
+        b ^= a;  a = rol64x4(a,47);  b += a;
+        c ^= b;  b = rol64x4(b,54);  c += b;
+        d ^= c;  c = rol64x4(c,32);  d += c;
+        a ^= d;  d = rol64x4(d,25);  a += d;
+        b ^= a;  a = rol64x4(a,63);  b += a;
+
+        _mm256_storeu_si256((__m256i *)(hashes + i), (__m256i)a);
+    }
+}
+
+size_t
+spooky_hll_merge_avx2(uint8_t *const dst, uint8_t const*const src, size_t const n)
+{
+    size_t const nvec = n - n % 32;
+
+    for (size_t i = 0; i < nvec; i += 32) {
+        __m256i const a = _mm256_loadu_si256((__m256i const*)(dst + i));
+        __m256i const b = _mm256_loadu_si256((__m256i const*)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_max_epu8(a, b));
+    }
+
+    return nvec;
+}
+
+size_t
+spooky_hll_stats_avx2(uint8_t const*const regs, size_t const n, uint32_t *const counts)
+{
+    size_t const nvec = n - n % 32;
+    // Four tables, so that runs of equal ranks do not all wait on the same
+    // counter
+    uint32_t t[4][SC_HLL_RANKS] = {{0}};
+
+    for (size_t i = 0; i < nvec; i += 32) {
+        __m256i const v = _mm256_loadu_si256((__m256i const*)(regs + i));
+        uint64_t w[4] = {
+            (uint64_t)_mm256_extract_epi64(v, 0), (uint64_t)_mm256_extract_epi64(v, 1),
+            (uint64_t)_mm256_extract_epi64(v, 2), (uint64_t)_mm256_extract_epi64(v, 3),
+        };
+        for (int b = 0; b < 8; ++b) {
+            ++t[0][w[0] & 0xff];  w[0] >>= 8;
+            ++t[1][w[1] & 0xff];  w[1] >>= 8;
+            ++t[2][w[2] & 0xff];  w[2] >>= 8;
+            ++t[3][w[3] & 0xff];  w[3] >>= 8;
+        }
+    }
+
+    for (int k = 0; k < SC_HLL_RANKS; ++k) {
+        counts[k] += t[0][k] + t[1][k] + t[2][k] + t[3][k];
+    }
+
+    return nvec;
+}
@@ -0,0 +1,510 @@
+// Spooky Hash
+// AVX-512 kernels, eight messages at a time with one message per 64-bit lane.
+// This file is built with -mavx512f, nothing in it may be called before the
+// CPU has been checked for AVX-512F support.
+
+#include <immintrin.h>
+#include "spooky_internal.h"
+
+#define NLANES 8
+
+typedef uint64_t v8u64 __attribute__((vector_size(64)));
+
+static uint64_t const zero_block[SC_NUMVARS];
+
+__attribute__((const, always_inline))
+static inline v8u64
+rol64x8(v8u64 const x, unsigned const k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// Load words 0..7 of every lane's block and transpose them, so that lane i of
+// out[k] is word k of lane i's data.
+__attribute__((always_inline))
+static inline void
+load8x8(uint8_t const*const p[NLANES], v8u64 *const out)
+{
+    __m512i const r0 = _mm512_loadu_si512(p[0]);
+    __m512i const r1 = _mm512_loadu_si512(p[1]);
+    __m512i const r2 = _mm512_loadu_si512(p[2]);
+    __m512i const r3 = _mm512_loadu_si512(p[3]);
+    __m512i const r4 = _mm512_loadu_si512(p[4]);
+    __m512i const r5 = _mm512_loadu_si512(p[5]);
+    __m512i const r6 = _mm512_loadu_si512(p[6]);
+    __m512i const r7 = _mm512_loadu_si512(p[7]);
+
+    // Pairs of rows interleaved: words {0,2,4,6} and {1,3,5,7}
+    __m512i const t0 = _mm512_unpacklo_epi64(r0, r1);
+    __m512i const t1 = _mm512_unpackhi_epi64(r0, r1);
+    __m512i const t2 = _mm512_unpacklo_epi64(r2, r3);
+    __m512i const t3 = _mm512_unpackhi_epi64(r2, r3);
+    __m512i const t4 = _mm512_unpacklo_epi64(r4, r5);
+    __m512i const t5 = _mm512_unpackhi_epi64(r4, r5);
+    __m512i const t6 = _mm512_unpacklo_epi64(r6, r7);
+    __m512i const t7 = _mm512_unpackhi_epi64(r6, r7);
+
+    // Rows 0..3 and 4..7 of words {0,4}, {2,6}, {1,5} and {3,7}
+    __m512i const u0 = _mm512_shuffle_i64x2(t0, t2, 0x88);
+    __m512i const u1 = _mm512_shuffle_i64x2(t0, t2, 0xdd);
+    __m512i const u2 = _mm512_shuffle_i64x2(t1, t3, 0x88);
+    __m512i const u3 = _mm512_shuffle_i64x2(t1, t3, 0xdd);
+    __m512i const u4 = _mm512_shuffle_i64x2(t4, t6, 0x88);
+    __m512i const u5 = _mm512_shuffle_i64x2(t4, t6, 0xdd);
+    __m512i const u6 = _mm512_shuffle_i64x2(t5, t7, 0x88);
+    __m512i const u7 = _mm512_shuffle_i64x2(t5, t7, 0xdd);
+
+    out[0] = (v8u64)_mm512_shuffle_i64x2(u0, u4, 0x88);
+    out[4] = (v8u64)_mm512_shuffle_i64x2(u0, u4, 0xdd);
+    out[2] = (v8u64)_mm512_shuffle_i64x2(u1, u5, 0x88);
+    out[6] = (v8u64)_mm512_shuffle_i64x2(u1, u5, 0xdd);
+    out[1] = (v8u64)_mm512_shuffle_i64x2(u2, u6, 0x88);
+    out[5] = (v8u64)_mm512_shuffle_i64x2(u2, u6, 0xdd);
+    out[3] = (v8u64)_mm512_shuffle_i64x2(u3, u7, 0x88);
+    out[7] = (v8u64)_mm512_shuffle_i64x2(u3, u7, 0xdd);
+}
+
+// Transpose 4 words starting at byte `off` of lanes [first, first+4) into the
+// lower or upper half of out[0..3].
+__attribute__((always_inline))
+static inline void
+load4x4(uint8_t const*const p[NLANES], int const first, size_t const off, __m256i *const out)
+{
+    __m256i const r0 = _mm256_loadu_si256((__m256i const*)(p[first + 0] + off));
+    __m256i const r1 = _mm256_loadu_si256((__m256i const*)(p[first + 1] + off));
+    __m256i const r2 = _mm256_loadu_si256((__m256i const*)(p[first + 2] + off));
+    __m256i const r3 = _mm256_loadu_si256((__m256i const*)(p[first + 3] + off));
+
+    __m256i const t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i const t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i const t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i const t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    out[0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+    out[1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+    out[2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+    out[3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+__attribute__((always_inline))
+static inline void
+load_block(uint8_t const*const p[NLANES], v8u64 *const d)
+{
+    load8x8(p, d);
+
+    // Words 8..11 don't fill a zmm load, do them as two 4x4 transposes so we
+    // never read past the end of a block.
+    __m256i lo[4];
+    __m256i hi[4];
+    load4x4(p, 0, 64, lo);
+    load4x4(p, 4, 64, hi);
+    for (int k = 0; k < 4; ++k) {
+        d[8 + k] = (v8u64)_mm512_inserti64x4(_mm512_castsi256_si512(lo[k]), hi[k], 1);
+    }
+}
+
+__attribute__((always_inline))
+static inline void
+mix(v8u64 const*const d, v8u64 *const h)
+{
+    h[0] += d[0];    h[2]  ^= h[10]; h[11] ^= h[0];   h[0]  = rol64x8(h[0],11);    h[11] += h[1];
+    h[1] += d[1];    h[3]  ^= h[11]; h[0]  ^= h[1];   h[1]  = rol64x8(h[1],32);    h[0]  += h[2];
+    h[2] += d[2];    h[4]  ^= h[0];  h[1]  ^= h[2];   h[2]  = rol64x8(h[2],43);    h[1]  += h[3];
+    h[3] += d[3];    h[5]  ^= h[1];  h[2]  ^= h[3];   h[3]  = rol64x8(h[3],31);    h[2]  += h[4];
+    h[4] += d[4];    h[6]  ^= h[2];  h[3]  ^= h[4];   h[4]  = rol64x8(h[4],17);    h[3]  += h[5];
+    h[5] += d[5];    h[7]  ^= h[3];  h[4]  ^= h[5];   h[5]  = rol64x8(h[5],28);    h[4]  += h[6];
+    h[6] += d[6];    h[8]  ^= h[4];  h[5]  ^= h[6];   h[6]  = rol64x8(h[6],39);    h[5]  += h[7];
+    h[7] += d[7];    h[9]  ^= h[5];  h[6]  ^= h[7];   h[7]  = rol64x8(h[7],57);    h[6]  += h[8];
+    h[8] += d[8];    h[10] ^= h[6];  h[7]  ^= h[8];   h[8]  = rol64x8(h[8],55);    h[7]  += h[9];
+    h[9] += d[9];    h[11] ^= h[7];  h[8]  ^= h[9];   h[9]  = rol64x8(h[9],54);    h[8]  += h[10];
+    h[10] += d[10];  h[0]  ^= h[8];  h[9]  ^= h[10];  h[10] = rol64x8(h[10],22);   h[9]  += h[11];
+    h[11] += d[11];  h[1]  ^= h[9];  h[10] ^= h[11];  h[11] = rol64x8(h[11],46);   h[10] += h[0];
+}
+
+__attribute__((always_inline))
+static inline void
+end(v8u64 const*const d, v8u64 *const h)
+{
+    for (int i = 0; i < SC_NUMVARS; ++i) {
+        h[i] += d[i];
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        h[11]+= h[1];    h[2] ^= h[11];   h[1] = rol64x8(h[1],44);
+        h[0] += h[2];    h[3] ^= h[0];    h[2] = rol64x8(h[2],15);
+        h[1] += h[3];    h[4] ^= h[1];    h[3] = rol64x8(h[3],34);
+        h[2] += h[4];    h[5] ^= h[2];    h[4] = rol64x8(h[4],21);
+        h[3] += h[5];    h[6] ^= h[3];    h[5] = rol64x8(h[5],38);
+        h[4] += h[6];    h[7] ^= h[4];    h[6] = rol64x8(h[6],33);
+        h[5] += h[7];    h[8] ^= h[5];    h[7] = rol64x8(h[7],10);
+        h[6] += h[8];    h[9] ^= h[6];    h[8] = rol64x8(h[8],13);
+        h[7] += h[9];    h[10]^= h[7];    h[9] = rol64x8(h[9],38);
+        h[8] += h[10];   h[11]^= h[8];    h[10]= rol64x8(h[10],53);
+        h[9] += h[11];   h[0] ^= h[9];    h[11]= rol64x8(h[11],42);
+        h[10]+= h[0];    h[1] ^= h[10];   h[0] = rol64x8(h[0],54);
+    }
+}
+
+void
+spooky_long_x8_avx512(uint8_t const*const*const msgs, size_t const*const lens,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    v8u64 const seed0 = (v8u64)_mm512_loadu_si512(hash1);
+    v8u64 const seed1 = (v8u64)_mm512_loadu_si512(hash2);
+    v8u64 const sc_const = (v8u64)_mm512_set1_epi64(SC_CONST);
+
+    v8u64 h[SC_NUMVARS] = {
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+        seed0, seed1, sc_const,
+    };
+
+    uint8_t const*p[NLANES];
+    size_t num_blocks[NLANES];
+    size_t min_blocks = SIZE_MAX;
+    size_t max_blocks = 0;
+    for (int i = 0; i < NLANES; ++i) {
+        p[i] = msgs[i];
+        num_blocks[i] = lens[i] / SC_BLOCKSIZE;
+        min_blocks = num_blocks[i] < min_blocks ? num_blocks[i] : min_blocks;
+        max_blocks = num_blocks[i] > max_blocks ? num_blocks[i] : max_blocks;
+    }
+
+    v8u64 d[SC_NUMVARS];
+
+    // Every lane still has whole blocks left
+    for (size_t b = 0; b < min_blocks; ++b) {
+        load_block(p, d);
+        mix(d, h);
+        for (int i = 0; i < NLANES; ++i) {
+            p[i] += SC_BLOCKSIZE;
+        }
+    }
+
+    // Some lanes have run out of blocks. Keep them reading from a harmless
+    // buffer and merge only the live lanes back in.
+    for (size_t b = min_blocks; b < max_blocks; ++b) {
+        __mmask8 live = 0;
+        for (int i = 0; i < NLANES; ++i) {
+            if (b < num_blocks[i]) {
+                live |= 1u << i;
+            } else {
+                p[i] = (uint8_t const*)zero_block;
+            }
+        }
+
+        v8u64 nh[SC_NUMVARS];
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            nh[i] = h[i];
+        }
+
+        load_block(p, d);
+        mix(d, nh);
+
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            h[i] = (v8u64)_mm512_mask_mov_epi64((__m512i)h[i], live, (__m512i)nh[i]);
+        }
+        for (int i = 0; i < NLANES; ++i) {
+            p[i] += ((live >> i) & 1) ? SC_BLOCKSIZE : 0;
+        }
+    }
+
+    // Pad each lane's leftover bytes into a final block
+    uint64_t last_block[NLANES][SC_NUMVARS];
+    uint8_t const*lp[NLANES];
+    for (int i = 0; i < NLANES; ++i) {
+        size_t const leftover = lens[i] - num_blocks[i] * SC_BLOCKSIZE;
+        uint8_t const*const src = (uint8_t const*)msgs[i] + num_blocks[i] * SC_BLOCKSIZE;
+        __builtin_memcpy(last_block[i], src, leftover);
+        __builtin_memset((uint8_t *)last_block[i] + leftover, 0, SC_BLOCKSIZE - leftover);
+        ((uint8_t *)last_block[i])[SC_BLOCKSIZE-1] = leftover;
+        lp[i] = (uint8_t const*)last_block[i];
+    }
+
+    load_block(lp, d);
+    end(d, h);
+
+    _mm512_storeu_si512(hash1, (__m512i)h[0]);
+    _mm512_storeu_si512(hash2, (__m512i)h[1]);
+}
+
+void
+spooky_mix_x8_avx512(uint64_t *const*const states, uint8_t const*const*const blocks,
+    size_t const*const nblocks)
+{
+    // The states are 12 consecutive words each, just like a block
+    uint8_t const*sp[NLANES];
+    for (int i = 0; i < NLANES; ++i) {
+        sp[i] = (uint8_t const*)states[i];
+    }
+    v8u64 h[SC_NUMVARS];
+    load_block(sp, h);
+
+    size_t min_blocks = SIZE_MAX;
+    size_t max_blocks = 0;
+    for (int i = 0; i < NLANES; ++i) {
+        min_blocks = nblocks[i] < min_blocks ? nblocks[i] : min_blocks;
+        max_blocks = nblocks[i] > max_blocks ? nblocks[i] : max_blocks;
+    }
+
+    v8u64 d[SC_NUMVARS];
+
+    for (size_t b = 0; b < min_blocks; ++b) {
+        load_block(blocks + b * NLANES, d);
+        mix(d, h);
+    }
+
+    for (size_t b = min_blocks; b < max_blocks; ++b) {
+        uint8_t const*p[NLANES];
+        __mmask8 live = 0;
+        for (int i = 0; i < NLANES; ++i) {
+            if (b < nblocks[i]) {
+                live |= 1u << i;
+                p[i] = blocks[b * NLANES + i];
+            } else {
+                p[i] = (uint8_t const*)zero_block;
+            }
+        }
+
+        v8u64 nh[SC_NUMVARS];
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            nh[i] = h[i];
+        }
+
+        load_block(p, d);
+        mix(d, nh);
+
+        for (int i = 0; i < SC_NUMVARS; ++i) {
+            h[i] = (v8u64)_mm512_mask_mov_epi64((__m512i)h[i], live, (__m512i)nh[i]);
+        }
+    }
+
+    uint64_t spill[SC_NUMVARS][NLANES];
+    for (int k = 0; k < SC_NUMVARS; ++k) {
+        _mm512_storeu_si512(spill[k], (__m512i)h[k]);
+    }
+    for (int i = 0; i < NLANES; ++i) {
+        for (int k = 0; k < SC_NUMVARS; ++k) {
+            states[i][k] = spill[k][i];
+        }
+    }
+}
+
+// Load `nlanes` consecutive keys of `width` bytes so that lane i of w[k] is
+// word k of key i.
+__attribute__((always_inline))
+static inline void
+load_keys(uint8_t const*const p, size_t const width, v8u64 *const w)
+{
+    if (width == 8) {
+        w[0] = (v8u64)_mm512_loadu_si512(p);
+    } else if (width == 16) {
+        __m512i const r0 = _mm512_loadu_si512(p);
+        __m512i const r1 = _mm512_loadu_si512(p + 64);
+        __m512i const even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+        __m512i const odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+        w[0] = (v8u64)_mm512_permutex2var_epi64(r0, even, r1);
+        w[1] = (v8u64)_mm512_permutex2var_epi64(r0, odd, r1);
+    } else {
+        __m512i const r0 = _mm512_loadu_si512(p);
+        __m512i const r1 = _mm512_loadu_si512(p + 64);
+        __m512i const r2 = _mm512_loadu_si512(p + 128);
+        __m512i const r3 = _mm512_loadu_si512(p + 192);
+        // Words {0,1} and {2,3} of four keys from each pair of loads
+        __m512i const w01 = _mm512_set_epi64(13, 9, 5, 1, 12, 8, 4, 0);
+        __m512i const w23 = _mm512_set_epi64(15, 11, 7, 3, 14, 10, 6, 2);
+        __m512i const t0 = _mm512_permutex2var_epi64(r0, w01, r1);
+        __m512i const t1 = _mm512_permutex2var_epi64(r0, w23, r1);
+        __m512i const t2 = _mm512_permutex2var_epi64(r2, w01, r3);
+        __m512i const t3 = _mm512_permutex2var_epi64(r2, w23, r3);
+        w[0] = (v8u64)_mm512_shuffle_i64x2(t0, t2, 0x44);
+        w[1] = (v8u64)_mm512_shuffle_i64x2(t0, t2, 0xee);
+        w[2] = (v8u64)_mm512_shuffle_i64x2(t1, t3, 0x44);
+        w[3] = (v8u64)_mm512_shuffle_i64x2(t1, t3, 0xee);
+    }
+}
+
+// spooky_short for one key per lane. `width` is a constant after inlining,
+// which leaves only the mix rounds that key length actually needs.
+__attribute__((always_inline))
+static inline size_t
+short_keys(uint8_t const*const keys, size_t const width, size_t const nkeys,
+    uint64_t const p_seed, uint64_t *const out)
+{
+    v8u64 const sc_const = {SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST};
+    v8u64 const seed = {p_seed, p_seed, p_seed, p_seed, p_seed, p_seed, p_seed, p_seed};
+    size_t const nvec = nkeys - nkeys % NLANES;
+
+    for (size_t i = 0; i < nvec; i += NLANES) {
+        v8u64 w[4];
+        load_keys(keys + i * width, width, w);
+
+        v8u64 a = seed;
+        v8u64 b = seed;
+        v8u64 c = sc_const;
+        v8u64 d = sc_const;
+
+        if (width >= 16) {
+            c += w[0];
+            d += w[1];
+            c = rol64x8(c,50);  c += d;  a ^= c;
+            d = rol64x8(d,52);  d += a;  b ^= d;
+            a = rol64x8(a,30);  a += b;  c ^= a;
+            b = rol64x8(b,41);  b += c;  d ^= b;
+            c = rol64x8(c,54);  c += d;  a ^= c;
+            d = rol64x8(d,48);  d += a;  b ^= d;
+            a = rol64x8(a,38);  a += b;  c ^= a;
+            b = rol64x8(b,37);  b += c;  d ^= b;
+            c = rol64x8(c,62);  c += d;  a ^= c;
+            d = rol64x8(d,34);  d += a;  b ^= d;
+            a = rol64x8(a, 5);  a += b;  c ^= a;
+            b = rol64x8(b,36);  b += c;  d ^= b;
+        }
+        if (width == 32) {
+            a += w[2];
+            b += w[3];
+        }
+
+        d += ((uint64_t)width) << 56;
+        if (width == 8) {
+            c += w[0];
+        } else {
+            c += sc_const;
+            d += sc_const;
+        }
+
+        d ^= c;  c = rol64x8(c,15);  d += c;
+        a ^= d;  d = rol64x8(d,52);  a += d;
+        b ^= a;  a = rol64x8(a,26);  b += a;
+        c ^= b;  b = rol64x8(b,51);  c += b;
+        d ^= c;  c = rol64x8(c,28);  d += c;
+        a ^= d;  d = rol64x8(d, 9);  a += d;
+        b ^= a;  a = rol64x8(a,47);  b += a;
+        c ^= b;  b = rol64x8(b,54);  c += b;
+        d ^= c;  c = rol64x8(c,32);  d += c;
+        a ^= d;  d = rol64x8(d,25);  a += d;
+        b ^= a;  a = rol64x8(a,63);  b += a;
+
+        _mm512_storeu_si512(out + i, (__m512i)a);
+    }
+
+    return nvec;
+}
+
+size_t
+spooky_short_keys_x8_avx512(uint8_t const*const keys, size_t const key_width, size_t const nkeys,
+    uint64_t const seed, uint64_t *const out)
+{
+    switch (key_width) {
+        case 8:
+            return short_keys(keys, 8, nkeys, seed, out);
+        case 16:
+            return short_keys(keys, 16, nkeys, seed, out);
+        case 32:
+            return short_keys(keys, 32, nkeys, seed, out);
+        default:
+            return 0;
+    }
+}
+
+// Load words 0 and 1 at byte `off` of every lane's row, for the last half
+// block, which may be all that's left of the row
+__attribute__((always_inline))
+static inline void
+load2(uint8_t const*const p[NLANES], size_t const off, v8u64 *const out)
+{
+    __m512i even = _mm512_castsi128_si512(_mm_loadu_si128((__m128i const*)(p[0] + off)));
+    __m512i odd = _mm512_castsi128_si512(_mm_loadu_si128((__m128i const*)(p[1] + off)));
+    even = _mm512_inserti32x4(even, _mm_loadu_si128((__m128i const*)(p[2] + off)), 1);
+    odd = _mm512_inserti32x4(odd, _mm_loadu_si128((__m128i const*)(p[3] + off)), 1);
+    even = _mm512_inserti32x4(even, _mm_loadu_si128((__m128i const*)(p[4] + off)), 2);
+    odd = _mm512_inserti32x4(odd, _mm_loadu_si128((__m128i const*)(p[5] + off)), 2);
+    even = _mm512_inserti32x4(even, _mm_loadu_si128((__m128i const*)(p[6] + off)), 3);
+    odd = _mm512_inserti32x4(odd, _mm_loadu_si128((__m128i const*)(p[7] + off)), 3);
+    out[0] = (v8u64)_mm512_unpacklo_epi64(even, odd);
+    out[1] = (v8u64)_mm512_unpackhi_epi64(even, odd);
+}
+
+// Load words 0..3 at byte `off` of every lane's row
+__attribute__((always_inline))
+static inline void
+load4(uint8_t const*const p[NLANES], size_t const off, v8u64 *const out)
+{
+    __m256i lo[4];
+    __m256i hi[4];
+    load4x4(p, 0, off, lo);
+    load4x4(p, 4, off, hi);
+    for (int j = 0; j < 4; ++j) {
+        out[j] = (v8u64)_mm512_inserti64x4(_mm512_castsi256_si512(lo[j]), hi[j], 1);
+    }
+}
+
+// The short hash's mix of 16 bytes into c and d
+__attribute__((always_inline))
+static inline void
+short_mix(v8u64 *const a, v8u64 *const b, v8u64 *const c, v8u64 *const d)
+{
+    *c = rol64x8(*c,50);  *c += *d;  *a ^= *c;
+    *d = rol64x8(*d,52);  *d += *a;  *b ^= *d;
+    *a = rol64x8(*a,30);  *a += *b;  *c ^= *a;
+    *b = rol64x8(*b,41);  *b += *c;  *d ^= *b;
+    *c = rol64x8(*c,54);  *c += *d;  *a ^= *c;
+    *d = rol64x8(*d,48);  *d += *a;  *b ^= *d;
+    *a = rol64x8(*a,38);  *a += *b;  *c ^= *a;
+    *b = rol64x8(*b,37);  *b += *c;  *d ^= *b;
+    *c = rol64x8(*c,62);  *c += *d;  *a ^= *c;
+    *d = rol64x8(*d,34);  *d += *a;  *b ^= *d;
+    *a = rol64x8(*a, 5);  *a += *b;  *c ^= *a;
+    *b = rol64x8(*b,36);  *b += *c;  *d ^= *b;
+}
+
+void
+spooky_short_rows_x8_avx512(uint8_t const*const*const rows, uint64_t const*const tail_c,
+    uint64_t const*const tail_d, size_t const k, size_t const n, uint64_t *const hashes)
+{
+    v8u64 const sc_const = {SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST, SC_CONST};
+
+    for (size_t i = 0; i < n; i += NLANES) {
+        uint8_t const*const*const p = rows + i;
+        v8u64 a = (v8u64)_mm512_loadu_si512(hashes + i);
+        v8u64 b = a;
+        v8u64 c = sc_const;
+        v8u64 d = sc_const;
+
+        size_t off = 0;
+        for (size_t j = 0; j < k / 2; ++j, off += 32) {
+            v8u64 w[4];
+            load4(p, off, w);
+            c += w[0];
+            d += w[1];
+            short_mix(&a, &b, &c, &d);
+            a += w[2];
+            b += w[3];
+        }
+        if (k & 1) {
+            v8u64 w[2];
+            load2(p, off, w);
+            c += w[0];
+            d += w[1];
+            short_mix(&a, &b, &c, &d);
+        }
+
+        c += (v8u64)_mm512_loadu_si512(tail_c + i);
+        d += (v8u64)_mm512_loadu_si512(tail_d + i);
+
+        d ^= c;  c = rol64x8(c,15);  d += c;
+        a ^= d;  d = rol64x8(d,52);  a += d;
+        b ^= a;  a = rol64x8(a,26);  b += a;
+        c ^= b;  b = rol64x8(b,51);  c += b;
+        d ^= c;  c = rol64x8(c,28);  d += c;
+        a ^= d;  d = rol64x8(d, 9);  a += d;
+        b ^= a;  a = rol64x8(a,47);  b += a;
+        c ^= b;  b = rol64x8(b,54);  c += b;
+        d ^= c;  c = rol64x8(c,32);  d += c;
+        a ^= d;  d = rol64x8(d,25);  a += d;
+        b ^= a;  a = rol64x8(a,63);  b += a;
+
+        _mm512_storeu_si512(hashes + i, (__m512i)a);
+    }
+}
@@ -0,0 +1,246 @@
+// Spooky Hash
+// Bloom filters probed by enhanced double hashing of one spooky_hash128: probe
+// i is at x_i, where x_0 = h1, y_0 = h2, x_{i+1} = x_i + y_i and
+// y_{i+1} = y_i + i. That behaves as k independent hashes without paying for
+// them. Positions are reduced to the filter size with a multiply and shift
+// rather than a division.
+//
+// The blocked variant picks a 512-bit line with the high bits of h1. Double
+// hashing modulo 512 repeats itself too often, so the bits within the line
+// are 9-bit slices of h2 and then of the low bits of h1 instead. That allows
+// 11 probes, which is about the optimum for a blocked filter anyway.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spooky_bloom.h"
+
+#define SC_BLOOM_LINE_BITS 512
+#define SC_BLOOM_MAX_K 32
+#define SC_BLOOM_LINE_MAX_K 11
+// Keys the batch functions hash, prefetch and then probe at a time
+#define SC_BLOOM_BATCH 16
+
+struct spooky_bloom {
+    uint64_t *words;
+    size_t nbits;
+    size_t nlines;
+    unsigned k;
+    bool blocked;
+    uint64_t seed;
+};
+
+// x scaled from [0, 2^64) to [0, n)
+static inline size_t
+bloom_reduce(uint64_t const x, size_t const n)
+{
+    __extension__ typedef unsigned __int128 u128;
+    return (size_t)(((u128)x * n) >> 64);
+}
+
+static inline void
+bloom_set(uint64_t *const words, size_t const bit)
+{
+    words[bit / 64] |= UINT64_C(1) << (bit % 64);
+}
+
+static inline bool
+bloom_test(uint64_t const*const words, size_t const bit)
+{
+    return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+// Probe i within a line, for i < SC_BLOOM_LINE_MAX_K
+static inline unsigned
+bloom_line_bit(uint64_t const h1, uint64_t const h2, unsigned const i)
+{
+    return (i < 7 ? h2 >> (9 * i) : h1 >> (9 * (i - 7))) % SC_BLOOM_LINE_BITS;
+}
+
+static inline void
+bloom_add_hashed(spooky_bloom_t *const b, uint64_t const h1, uint64_t const h2)
+{
+    if (b->blocked) {
+        uint64_t *const line = b->words + bloom_reduce(h1, b->nlines) * (SC_BLOOM_LINE_BITS / 64);
+        for (unsigned i = 0; i < b->k; ++i) {
+            bloom_set(line, bloom_line_bit(h1, h2, i));
+        }
+    } else {
+        uint64_t x = h1;
+        uint64_t y = h2;
+        for (unsigned i = 0; i < b->k; ++i) {
+            bloom_set(b->words, bloom_reduce(x, b->nbits));
+            x += y;
+            y += i;
+        }
+    }
+}
+
+static inline bool
+bloom_query_hashed(spooky_bloom_t const*const b, uint64_t const h1, uint64_t const h2)
+{
+    if (b->blocked) {
+        uint64_t const*const line = b->words + bloom_reduce(h1, b->nlines) * (SC_BLOOM_LINE_BITS / 64);
+        for (unsigned i = 0; i < b->k; ++i) {
+            if (!bloom_test(line, bloom_line_bit(h1, h2, i))) {
+                return false;
+            }
+        }
+    } else {
+        uint64_t x = h1;
+        uint64_t y = h2;
+        for (unsigned i = 0; i < b->k; ++i) {
+            if (!bloom_test(b->words, bloom_reduce(x, b->nbits))) {
+                return false;
+            }
+            x += y;
+            y += i;
+        }
+    }
+    return true;
+}
+
+static inline void
+bloom_prefetch(spooky_bloom_t const*const b, uint64_t const h1, uint64_t const h2)
+{
+    if (b->blocked) {
+        __builtin_prefetch(b->words + bloom_reduce(h1, b->nlines) * (SC_BLOOM_LINE_BITS / 64));
+    } else {
+        uint64_t x = h1;
+        uint64_t y = h2;
+        for (unsigned i = 0; i < b->k; ++i) {
+            __builtin_prefetch(b->words + bloom_reduce(x, b->nbits) / 64);
+            x += y;
+            y += i;
+        }
+    }
+}
+
+spooky_bloom_t *
+spooky_bloom_new(size_t nkeys, double const fp_rate, bool const blocked, uint64_t const seed)
+{
+    if (!(fp_rate > 0 && fp_rate < 1)) {
+        return NULL;
+    }
+    if (nkeys == 0) {
+        nkeys = 1;
+    }
+
+    // The usual optimum, m = -n ln(p) / ln(2)^2 bits and k = m/n ln(2)
+    double const bits = -(double)nkeys * log(fp_rate) / (M_LN2 * M_LN2);
+    if (bits >= (double)(SIZE_MAX / 2)) {
+        return NULL;
+    }
+    size_t const nlines = (size_t)ceil(bits / SC_BLOOM_LINE_BITS);
+    double const k = round(bits / nkeys * M_LN2);
+
+    spooky_bloom_t *const b = malloc(sizeof(*b));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->nlines = nlines;
+    b->nbits = nlines * SC_BLOOM_LINE_BITS;
+    unsigned const max_k = blocked ? SC_BLOOM_LINE_MAX_K : SC_BLOOM_MAX_K;
+    b->k = k < 1 ? 1 : k > max_k ? max_k : (unsigned)k;
+    b->blocked = blocked;
+    b->seed = seed;
+    b->words = aligned_alloc(64, b->nbits / 8);
+    if (b->words == NULL) {
+        free(b);
+        return NULL;
+    }
+    memset(b->words, 0, b->nbits / 8);
+    return b;
+}
+
+void
+spooky_bloom_free(spooky_bloom_t *const b)
+{
+    if (b != NULL) {
+        free(b->words);
+        free(b);
+    }
+}
+
+size_t
+spooky_bloom_bits(spooky_bloom_t const*const b)
+{
+    return b->nbits;
+}
+
+unsigned
+spooky_bloom_k(spooky_bloom_t const*const b)
+{
+    return b->k;
+}
+
+void
+spooky_bloom_add(spooky_bloom_t *const b, void const*const key, size_t const len)
+{
+    uint64_t h1 = b->seed;
+    uint64_t h2 = b->seed;
+    spooky_hash128(key, len, &h1, &h2);
+    bloom_add_hashed(b, h1, h2);
+}
+
+bool
+spooky_bloom_query(spooky_bloom_t const*const b, void const*const key, size_t const len)
+{
+    uint64_t h1 = b->seed;
+    uint64_t h2 = b->seed;
+    spooky_hash128(key, len, &h1, &h2);
+    return bloom_query_hashed(b, h1, h2);
+}
+
+// Hash count keys and prefetch what they'll probe
+static void
+bloom_hash_batch(spooky_bloom_t const*const b, void const*const*const keys, size_t const*const lens,
+    size_t const count, uint64_t *const h1, uint64_t *const h2)
+{
+    for (size_t i = 0; i < count; ++i) {
+        h1[i] = b->seed;
+        h2[i] = b->seed;
+    }
+    spooky_hash128_multi(keys, lens, count, h1, h2);
+    for (size_t i = 0; i < count; ++i) {
+        bloom_prefetch(b, h1[i], h2[i]);
+    }
+}
+
+void
+spooky_bloom_add_many(spooky_bloom_t *const b, void const*const*const keys, size_t const*const lens,
+    size_t const n)
+{
+    for (size_t first = 0; first < n; first += SC_BLOOM_BATCH) {
+        size_t const left = n - first;
+        size_t const count = left < SC_BLOOM_BATCH ? left : SC_BLOOM_BATCH;
+        uint64_t h1[SC_BLOOM_BATCH];
+        uint64_t h2[SC_BLOOM_BATCH];
+
+        bloom_hash_batch(b, keys + first, lens + first, count, h1, h2);
+        for (size_t i = 0; i < count; ++i) {
+            bloom_add_hashed(b, h1[i], h2[i]);
+        }
+    }
+}
+
+size_t
+spooky_bloom_query_many(spooky_bloom_t const*const b, void const*const*const keys,
+    size_t const*const lens, size_t const n, bool *const out)
+{
+    size_t ntrue = 0;
+
+    for (size_t first = 0; first < n; first += SC_BLOOM_BATCH) {
+        size_t const left = n - first;
+        size_t const count = left < SC_BLOOM_BATCH ? left : SC_BLOOM_BATCH;
+        uint64_t h1[SC_BLOOM_BATCH];
+        uint64_t h2[SC_BLOOM_BATCH];
+
+        bloom_hash_batch(b, keys + first, lens + first, count, h1, h2);
+        for (size_t i = 0; i < count; ++i) {
+            out[first + i] = bloom_query_hashed(b, h1[i], h2[i]);
+            ntrue += out[first + i];
+        }
+    }
+    return ntrue;
+}
@@ -0,0 +1,40 @@
+#pragma once
+// Spooky Hash
+// Bloom filters that derive all k probes for a key from one spooky_hash128,
+// by double hashing its two 64-bit halves, rather than hashing the key k
+// times. The blocked variant puts all of a key's probes in one 64-byte cache
+// line: one miss per lookup instead of k, for a higher false positive rate at
+// the same size (1.2% for 1%, 0.17% for 0.1%).
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct spooky_bloom spooky_bloom_t;
+
+// A filter sized for nkeys keys at a false positive rate of fp_rate (between
+// 0 and 1), blocked or not. Returns NULL for impossible sizes or if it can't
+// be allocated.
+spooky_bloom_t *spooky_bloom_new(size_t nkeys, double fp_rate, bool blocked, uint64_t seed);
+void spooky_bloom_free(spooky_bloom_t *b);
+
+size_t spooky_bloom_bits(spooky_bloom_t const*b);
+unsigned spooky_bloom_k(spooky_bloom_t const*b);
+
+void spooky_bloom_add(spooky_bloom_t *b, void const*key, size_t len);
+// false if key was never added, true if it probably was
+bool spooky_bloom_query(spooky_bloom_t const*b, void const*key, size_t len);
+
+// Batched forms for n keys. Keys are hashed together with
+// spooky_hash128_multi and the lines they probe prefetched before any of
+// them is touched, so the misses of a filter bigger than the cache overlap.
+void spooky_bloom_add_many(spooky_bloom_t *b, void const*const*keys, size_t const*lens, size_t n);
+// out[i] is spooky_bloom_query of key i. Returns how many were true.
+size_t spooky_bloom_query_many(spooky_bloom_t const*b, void const*const*keys, size_t const*lens,
+    size_t n, bool *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,373 @@
+// Spooky Hash
+// FastCDC style chunking. The gear hash is fp = (fp << 1) + gear[byte], so
+// bit k of fp depends on the last k+1 bytes only and the top bits see a
+// 64-byte window; that's what the masks test. The first min_size bytes of a
+// chunk are skipped without hashing, bytes up to avg_size are tested against
+// a mask of log2(avg)+2 bits and the rest against one of log2(avg)-2 bits,
+// and a chunk is cut at max_size regardless. Since fp starts at zero on every
+// chunk, where a chunk ends depends only on where it starts, which is what
+// lets segments of a buffer be chunked independently and stitched together.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spooky_cdc.h"
+
+// Bits more and fewer than log2(avg_size) in the two masks, FastCDC's
+// normalization level 2
+#define SC_CDC_NORMALIZE 2
+// Chunks a buffer worker scans before fingerprinting them together
+#define SC_CDC_BATCH 16
+// Smallest segment, in bytes and in max-size chunks, worth a thread. Every
+// segment after the first costs a few chunks chunked twice.
+#define SC_CDC_SEGMENT (UINT64_C(4) << 20)
+#define SC_CDC_SEGMENT_CHUNKS 16
+
+bool
+spooky_cdc_init(spooky_cdc_t *const c, struct spooky_cdc_params const*const params)
+{
+    if (params->avg_size < 64 || params->avg_size > SPOOKY_CDC_MAX_AVG || params->min_size == 0 || params->min_size > params->avg_size
+            || params->max_size < params->avg_size) {
+        return false;
+    }
+
+    unsigned const bits = 63 - __builtin_clzll(params->avg_size);
+    for (unsigned i = 0; i < 256; ++i) {
+        uint64_t const byte = i;
+        c->gear[i] = spooky_hash64(&byte, sizeof(byte), params->seed);
+    }
+    c->mask_small = ~UINT64_C(0) << (64 - (bits + SC_CDC_NORMALIZE));
+    c->mask_large = ~UINT64_C(0) << (64 - (bits - SC_CDC_NORMALIZE));
+    c->min_size = params->min_size;
+    c->avg_size = (size_t)1 << bits;
+    c->max_size = params->max_size;
+    c->seed = params->seed;
+    c->offset = 0;
+    c->chunk_len = 0;
+    c->fp = 0;
+    spooky_init(&c->sc, c->seed, c->seed);
+    return true;
+}
+
+// Scan data for the end of a chunk that already has chunk_len bytes and gear
+// hash *fp. Returns how many bytes of data belong to the chunk and sets *cut
+// if the chunk ends with them.
+static size_t
+cdc_scan(spooky_cdc_t const*const c, uint8_t const*const data, size_t const len,
+    size_t const chunk_len, uint64_t *const fp, bool *const cut)
+{
+    uint64_t h = *fp;
+    size_t i = 0;
+
+    if (chunk_len < c->min_size) {
+        size_t const skip = c->min_size - chunk_len;
+        i = skip < len ? skip : len;
+    }
+
+    size_t const small_end = chunk_len < c->avg_size ? c->avg_size - chunk_len : 0;
+    size_t const stop_small = small_end < len ? small_end : len;
+    for (; i < stop_small; ++i) {
+        h = (h << 1) + c->gear[data[i]];
+        if ((h & c->mask_small) == 0) {
+            *fp = h;
+            *cut = true;
+            return i + 1;
+        }
+    }
+
+    size_t const large_end = c->max_size - chunk_len;
+    size_t const stop_large = large_end < len ? large_end : len;
+    for (; i < stop_large; ++i) {
+        h = (h << 1) + c->gear[data[i]];
+        if ((h & c->mask_large) == 0) {
+            *fp = h;
+            *cut = true;
+            return i + 1;
+        }
+    }
+
+    *fp = h;
+    *cut = chunk_len + i == c->max_size;
+    return i;
+}
+
+// Emit the chunk in progress and start the next one
+static void
+cdc_emit(spooky_cdc_t *const c, spooky_cdc_emit_fn *const emit, void *const arg)
+{
+    struct spooky_cdc_chunk chunk = {
+        .offset = c->offset,
+        .len = c->chunk_len,
+    };
+    spooky_final(&c->sc, &chunk.h1, &chunk.h2);
+    emit(arg, &chunk);
+
+    c->offset += c->chunk_len;
+    c->chunk_len = 0;
+    c->fp = 0;
+    spooky_init(&c->sc, c->seed, c->seed);
+}
+
+size_t
+spooky_cdc_update(spooky_cdc_t *const c, void const*const data, size_t len,
+    spooky_cdc_emit_fn *const emit, void *const arg)
+{
+    uint8_t const*p = data;
+    size_t nchunks = 0;
+
+    while (len > 0) {
+        bool cut;
+        size_t const n = cdc_scan(c, p, len, c->chunk_len, &c->fp, &cut);
+        // Hash what was just scanned while it's still in L1
+        spooky_update(&c->sc, p, n);
+        c->chunk_len += n;
+        p += n;
+        len -= n;
+        if (cut) {
+            cdc_emit(c, emit, arg);
+            ++nchunks;
+        }
+    }
+    return nchunks;
+}
+
+size_t
+spooky_cdc_final(spooky_cdc_t *const c, spooky_cdc_emit_fn *const emit, void *const arg)
+{
+    size_t nchunks = 0;
+    if (c->chunk_len > 0) {
+        cdc_emit(c, emit, arg);
+        nchunks = 1;
+    }
+    c->offset = 0;
+    return nchunks;
+}
+
+size_t
+spooky_cdc_cut(spooky_cdc_t const*const c, void const*const data, size_t const len)
+{
+    uint64_t fp = 0;
+    bool cut;
+    return cdc_scan(c, data, len, 0, &fp, &cut);
+}
+
+struct cdc_list {
+    struct spooky_cdc_chunk *chunks;
+    size_t n;
+    size_t cap;
+};
+
+static bool
+cdc_list_reserve(struct cdc_list *const l, size_t const more)
+{
+    if (l->n + more <= l->cap) {
+        return true;
+    }
+    size_t cap = l->cap == 0 ? 64 : l->cap;
+    while (cap < l->n + more) {
+        cap *= 2;
+    }
+    struct spooky_cdc_chunk *const chunks = realloc(l->chunks, cap * sizeof(*chunks));
+    if (chunks == NULL) {
+        return false;
+    }
+    l->chunks = chunks;
+    l->cap = cap;
+    return true;
+}
+
+struct cdc_job {
+    spooky_cdc_t const*c;
+    uint8_t const*data;
+    size_t len;
+    size_t segment;
+    size_t nsegments;
+    struct cdc_list *lists;
+    size_t next;
+    bool failed;
+};
+
+// Chunk from segment's start as though a chunk began there, until a chunk
+// reaches the next segment, fingerprinting SC_CDC_BATCH chunks at a time.
+static bool
+cdc_chunk_segment(struct cdc_job const*const job, size_t const segment, struct cdc_list *const l)
+{
+    size_t pos = segment * job->segment;
+    size_t const end = segment + 1 == job->nsegments ? job->len : pos + job->segment;
+
+    while (pos < end) {
+        if (!cdc_list_reserve(l, SC_CDC_BATCH)) {
+            return false;
+        }
+        struct spooky_cdc_chunk *const batch = l->chunks + l->n;
+        void const*msgs[SC_CDC_BATCH];
+        size_t lens[SC_CDC_BATCH];
+        uint64_t h1[SC_CDC_BATCH];
+        uint64_t h2[SC_CDC_BATCH];
+        size_t count = 0;
+
+        for (; count < SC_CDC_BATCH && pos < end; ++count) {
+            size_t const n = spooky_cdc_cut(job->c, job->data + pos, job->len - pos);
+            msgs[count] = job->data + pos;
+            lens[count] = n;
+            h1[count] = job->c->seed;
+            h2[count] = job->c->seed;
+            batch[count].offset = pos;
+            batch[count].len = n;
+            pos += n;
+        }
+        spooky_hash128_multi(msgs, lens, count, h1, h2);
+        for (size_t i = 0; i < count; ++i) {
+            batch[i].h1 = h1[i];
+            batch[i].h2 = h2[i];
+        }
+        l->n += count;
+    }
+    return true;
+}
+
+static void *
+cdc_worker(void *const arg)
+{
+    struct cdc_job *const job = arg;
+
+    for (;;) {
+        size_t const segment = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (segment >= job->nsegments) {
+            break;
+        }
+        if (!cdc_chunk_segment(job, segment, &job->lists[segment])) {
+            __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// Follow the true boundaries from offset 0. Where they meet a boundary a
+// segment found, the rest of that segment's chunks are right as they are;
+// until they do, chunks are redone here.
+static bool
+cdc_stitch(struct cdc_job const*const job, struct cdc_list *const out)
+{
+    uint64_t pos = 0;
+
+    for (size_t s = 0; s < job->nsegments; ++s) {
+        struct cdc_list const*const l = &job->lists[s];
+        uint64_t const end = l->chunks[l->n - 1].offset + l->chunks[l->n - 1].len;
+        size_t j = 0;
+
+        while (pos < end) {
+            while (j < l->n && l->chunks[j].offset < pos) {
+                ++j;
+            }
+            if (j < l->n && l->chunks[j].offset == pos) {
+                if (!cdc_list_reserve(out, l->n - j)) {
+                    return false;
+                }
+                memcpy(out->chunks + out->n, l->chunks + j, (l->n - j) * sizeof(*l->chunks));
+                out->n += l->n - j;
+                pos = end;
+                break;
+            }
+
+            if (!cdc_list_reserve(out, 1)) {
+                return false;
+            }
+            struct spooky_cdc_chunk *const chunk = &out->chunks[out->n++];
+            chunk->offset = pos;
+            chunk->len = spooky_cdc_cut(job->c, job->data + pos, job->len - pos);
+            chunk->h1 = job->c->seed;
+            chunk->h2 = job->c->seed;
+            spooky_hash128(job->data + pos, chunk->len, &chunk->h1, &chunk->h2);
+            pos += chunk->len;
+        }
+    }
+    return true;
+}
+
+struct spooky_cdc_chunk *
+spooky_cdc_chunk_buffer(struct spooky_cdc_params const*const params, void const*const data,
+    size_t const len, unsigned nthreads, size_t *const nchunks)
+{
+    spooky_cdc_t *const c = malloc(sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    if (!spooky_cdc_init(c, params)) {
+        free(c);
+        return NULL;
+    }
+    if (nthreads == 0) {
+        long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+
+    size_t segment = SC_CDC_SEGMENT;
+    if (c->max_size > segment / SC_CDC_SEGMENT_CHUNKS) {
+        segment = c->max_size * SC_CDC_SEGMENT_CHUNKS;
+    }
+    if (nthreads == 1 || len <= segment) {
+        segment = len;
+    }
+
+    struct cdc_job job = {
+        .c = c,
+        .data = data,
+        .len = len,
+        .segment = segment,
+        .nsegments = len == 0 ? 0 : (len - 1) / segment + 1,
+        .lists = NULL,
+        .next = 0,
+        .failed = false,
+    };
+    if (nthreads > job.nsegments) {
+        nthreads = job.nsegments;
+    }
+
+    struct cdc_list out = {NULL, 0, 0};
+    bool ok = true;
+    if (job.nsegments == 1) {
+        // Nothing to stitch, chunk straight into the result
+        ok = cdc_chunk_segment(&job, 0, &out);
+    } else if (job.nsegments > 1) {
+        job.lists = calloc(job.nsegments, sizeof(*job.lists));
+        ok = job.lists != NULL;
+    }
+
+    if (job.lists != NULL) {
+        pthread_t *const threads = malloc((nthreads - 1) * sizeof(pthread_t));
+        unsigned nstarted = 0;
+        if (threads != NULL) {
+            for (; nstarted < nthreads - 1; ++nstarted) {
+                if (pthread_create(&threads[nstarted], NULL, cdc_worker, &job) != 0) {
+                    break;
+                }
+            }
+        }
+        cdc_worker(&job);
+        for (unsigned i = 0; i < nstarted; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+
+        ok = !job.failed && cdc_stitch(&job, &out);
+        for (size_t s = 0; s < job.nsegments; ++s) {
+            free(job.lists[s].chunks);
+        }
+        free(job.lists);
+    }
+    free(c);
+
+    // An empty buffer is no chunks, but still a valid array
+    if (ok && out.chunks == NULL) {
+        out.chunks = malloc(sizeof(*out.chunks));
+        ok = out.chunks != NULL;
+    }
+    if (!ok) {
+        free(out.chunks);
+        return NULL;
+    }
+    *nchunks = out.n;
+    return out.chunks;
+}
@@ -0,0 +1,88 @@
+#pragma once
+// Spooky Hash
+// Content-defined chunking for deduplication, in the style of FastCDC. A gear
+// hash rolls over the data and a chunk ends where its top bits are all zero,
+// with a stricter mask before the average size and a looser one after it, so
+// sizes bunch up around the average. Every chunk comes with its
+// spooky_hash128, computed while the bytes the boundary scan just passed over
+// are still in cache, so the data is only read from memory once.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOKY_CDC_MIN_SIZE 2048
+#define SPOOKY_CDC_AVG_SIZE 8192
+#define SPOOKY_CDC_MAX_SIZE 65536
+
+// Largest avg_size, the bigger of the two masks needs log2(avg_size)+2 bits
+#define SPOOKY_CDC_MAX_AVG (SIZE_MAX >> 2)
+
+// Boundaries depend on the data, the sizes and the seed only. avg_size is
+// rounded down to a power of two, and must be at least 64 and at most
+// SPOOKY_CDC_MAX_AVG. min_size must be at least 1 and no more than avg_size,
+// max_size at least avg_size. The seed picks the gear table and seeds both
+// halves of the fingerprints.
+struct spooky_cdc_params {
+    size_t min_size;
+    size_t avg_size;
+    size_t max_size;
+    uint64_t seed;
+};
+
+struct spooky_cdc_chunk {
+    uint64_t offset;
+    uint64_t len;
+    uint64_t h1;
+    uint64_t h2;
+};
+
+typedef void spooky_cdc_emit_fn(void *arg, struct spooky_cdc_chunk const*chunk);
+
+struct spooky_cdc {
+    uint64_t gear[256];
+    uint64_t mask_small;
+    uint64_t mask_large;
+    size_t min_size;
+    size_t avg_size;
+    size_t max_size;
+    uint64_t seed;
+    // The chunk in progress: where it started, how much of it we've seen and
+    // the gear hash so far
+    uint64_t offset;
+    size_t chunk_len;
+    uint64_t fp;
+    spooky_context_t sc;
+};
+
+typedef struct spooky_cdc spooky_cdc_t;
+
+// Returns false if params are out of range
+bool spooky_cdc_init(spooky_cdc_t *c, struct spooky_cdc_params const*params);
+// Feed the next len bytes of the stream. emit is called, with arg, for every
+// chunk they complete. Returns how many that was. The split into updates has
+// no effect on the chunks.
+size_t spooky_cdc_update(spooky_cdc_t *c, void const*data, size_t len,
+    spooky_cdc_emit_fn *emit, void *arg);
+// Emit whatever is left as the last chunk, if anything is, and start over
+// with a new stream at offset 0. Returns how many chunks were emitted.
+size_t spooky_cdc_final(spooky_cdc_t *c, spooky_cdc_emit_fn *emit, void *arg);
+// Boundaries without fingerprints: the length of the chunk starting at data,
+// or len if it doesn't end within len bytes.
+size_t spooky_cdc_cut(spooky_cdc_t const*c, void const*data, size_t len);
+
+// Chunk and fingerprint a whole buffer on nthreads threads (0 for every
+// online CPU). Each thread takes a segment of the buffer and chunks it as
+// though a chunk started there. The segments' boundaries fall into step with
+// the true ones within a few chunks, and only those few are redone. The
+// result is what spooky_cdc_update and spooky_cdc_final would emit, in a
+// malloc'ed array of *nchunks chunks for the caller to free, or NULL if
+// params are out of range or memory ran out.
+struct spooky_cdc_chunk *spooky_cdc_chunk_buffer(struct spooky_cdc_params const*params,
+    void const*data, size_t len, unsigned nthreads, size_t *nchunks);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,235 @@
+// Spooky Hash
+// Column hashing. A batch of rows is counting-sorted into length classes,
+// and each class is padded out to whole vectors with copies of its first row
+// and handed to the CPU variant's row kernel. Variants without one hash row
+// by row.
+
+#include <stddef.h>
+#include "spooky_internal.h"
+#include "spooky_column.h"
+
+// Rows sorted at a time, few enough to keep the batch's arrays in L1
+#define SC_COLUMN_BATCH 256
+// Short rows by length / 16
+#define SC_COLUMN_CLASSES (SC_BUFSIZE / 16)
+#define SC_COLUMN_LONG 0xff
+// Room for padding every class out to a whole vector
+#define SC_COLUMN_SLOTS (SC_COLUMN_BATCH + SC_COLUMN_CLASSES * (SC_MAX_LANES - 1))
+
+__attribute__((always_inline))
+static inline uint64_t
+column_offset(struct spooky_column const*const col, size_t const i)
+{
+    return col->offsets64 != NULL ? col->offsets64[i] : col->offsets[i];
+}
+
+__attribute__((always_inline))
+static inline bool
+column_is_null(struct spooky_column const*const col, size_t const i)
+{
+    return col->validity != NULL && ((col->validity[i / 8] >> (i % 8)) & 1) == 0;
+}
+
+static uint64_t
+column_null_hash(uint64_t const seed)
+{
+    return spooky_hash64("", 0, seed ^ SPOOKY_COLUMN_NULL);
+}
+
+// The low n bytes of a word, for n up to 8
+static uint64_t const column_mask[9] = {
+    0, 0xff, 0xffff, 0xffffff, 0xffffffff, 0xffffffffff, 0xffffffffffff, 0xffffffffffffff,
+    0xffffffffffffffff,
+};
+
+// What the short hash adds to c and d for a row's last len % 16 bytes and
+// its length, the bytes past the end of the row counting as zero. Rows not
+// near the end of the data are read 16 bytes at a time and masked, without
+// branching on the length, which is as good as random.
+__attribute__((always_inline))
+static inline void
+column_tail(uint8_t const*const row, size_t const len, uint8_t const*const end,
+    uint64_t *const c, uint64_t *const d)
+{
+    size_t const r = len % 16;
+    uint8_t const*const t = row + len - r;
+    uint64_t w[2] = {0, 0};
+
+    if (end - t >= 16) {
+        __builtin_memcpy(w, t, 16);
+        w[0] &= column_mask[r < 8 ? r : 8];
+        w[1] &= column_mask[r > 8 ? r - 8 : 0];
+    } else {
+        __builtin_memcpy(w, t, r);
+    }
+    // No tail at all adds SC_CONST to both
+    uint64_t const none = r == 0 ? SC_CONST : 0;
+    *c = w[0] + none;
+    *d = w[1] + none + ((uint64_t)len << 56);
+}
+
+// Rows [first, first + n) of col. With chained, out holds each row's seed.
+static void
+column_batch(struct spooky_column const*const col, uint8_t const*const end, size_t const first,
+    size_t const n, uint64_t const seed, bool const chained, struct spooky_ops const*const ops,
+    uint64_t *const out)
+{
+    uint8_t cls[SC_COLUMN_BATCH];
+    size_t count[SC_COLUMN_CLASSES] = {0};
+    size_t pos[SC_COLUMN_CLASSES];
+
+    void const*lmsgs[SC_COLUMN_BATCH];
+    size_t llens[SC_COLUMN_BATCH];
+    uint64_t lh1[SC_COLUMN_BATCH];
+    uint64_t lh2[SC_COLUMN_BATCH];
+    size_t lrows[SC_COLUMN_BATCH];
+    size_t nlong = 0;
+
+    for (size_t j = 0; j < n; ++j) {
+        size_t const i = first + j;
+        uint64_t const s = chained ? out[i] : seed;
+        cls[j] = SC_COLUMN_LONG;
+        if (column_is_null(col, i)) {
+            out[i] = column_null_hash(s);
+            continue;
+        }
+        uint64_t const start = column_offset(col, i);
+        size_t const len = column_offset(col, i + 1) - start;
+        if (len >= SC_BUFSIZE) {
+            lmsgs[nlong] = col->data + start;
+            llens[nlong] = len;
+            lh1[nlong] = s;
+            lh2[nlong] = s;
+            lrows[nlong++] = i;
+            continue;
+        }
+        cls[j] = len / 16;
+        count[cls[j]]++;
+    }
+
+    size_t const nlanes = ops->nlanes;
+    size_t nslots = 0;
+    for (size_t k = 0; k < SC_COLUMN_CLASSES; ++k) {
+        pos[k] = nslots;
+        nslots += (count[k] + nlanes - 1) / nlanes * nlanes;
+    }
+
+    uint8_t const*rows[SC_COLUMN_SLOTS];
+    uint64_t tail_c[SC_COLUMN_SLOTS];
+    uint64_t tail_d[SC_COLUMN_SLOTS];
+    uint64_t hashes[SC_COLUMN_SLOTS];
+    size_t slot_row[SC_COLUMN_SLOTS];
+
+    for (size_t j = 0; j < n; ++j) {
+        if (cls[j] == SC_COLUMN_LONG) {
+            continue;
+        }
+        size_t const i = first + j;
+        size_t const slot = pos[cls[j]]++;
+        uint64_t const start = column_offset(col, i);
+        size_t const len = column_offset(col, i + 1) - start;
+        rows[slot] = col->data + start;
+        column_tail(rows[slot], len, end, &tail_c[slot], &tail_d[slot]);
+        hashes[slot] = chained ? out[i] : seed;
+        slot_row[slot] = i;
+    }
+
+    // pos[k] is now the end of class k's rows, the padding runs up to the
+    // next multiple of nlanes
+    for (size_t k = 0; k < SC_COLUMN_CLASSES; ++k) {
+        if (count[k] == 0) {
+            continue;
+        }
+        size_t const base = pos[k] - count[k];
+        size_t const padded = (count[k] + nlanes - 1) / nlanes * nlanes;
+        for (size_t slot = pos[k]; slot < base + padded; ++slot) {
+            rows[slot] = rows[base];
+            tail_c[slot] = tail_c[base];
+            tail_d[slot] = tail_d[base];
+            hashes[slot] = hashes[base];
+            slot_row[slot] = SIZE_MAX;
+        }
+        ops->short_rows(rows + base, tail_c + base, tail_d + base, k, padded, hashes + base);
+    }
+
+    for (size_t slot = 0; slot < nslots; ++slot) {
+        if (slot_row[slot] != SIZE_MAX) {
+            out[slot_row[slot]] = hashes[slot];
+        }
+    }
+
+    if (nlong > 0) {
+        spooky_hash128_multi(lmsgs, llens, nlong, lh1, lh2);
+        for (size_t l = 0; l < nlong; ++l) {
+            out[lrows[l]] = lh1[l];
+        }
+    }
+}
+
+static void
+column_hash(struct spooky_column const*const col, size_t const nrows, uint64_t const seed,
+    bool const chained, uint64_t *const out)
+{
+    struct spooky_ops const*const ops = spooky_current_ops();
+
+    if (ops->short_rows == NULL) {
+        for (size_t i = 0; i < nrows; ++i) {
+            uint64_t const s = chained ? out[i] : seed;
+            if (column_is_null(col, i)) {
+                out[i] = column_null_hash(s);
+                continue;
+            }
+            uint64_t const start = column_offset(col, i);
+            out[i] = spooky_hash64(col->data + start, column_offset(col, i + 1) - start, s);
+        }
+        return;
+    }
+
+    uint8_t const*const end = col->data + column_offset(col, nrows);
+    for (size_t first = 0; first < nrows; first += SC_COLUMN_BATCH) {
+        size_t const left = nrows - first;
+        size_t const count = left < SC_COLUMN_BATCH ? left : SC_COLUMN_BATCH;
+        column_batch(col, end, first, count, seed, chained, ops, out);
+    }
+}
+
+void
+spooky_hash64_column(uint8_t const*const data, uint32_t const*const offsets, size_t const nrows,
+    uint64_t const seed, uint64_t *const out)
+{
+    struct spooky_column const col = {.data = data, .offsets = offsets};
+    column_hash(&col, nrows, seed, false, out);
+}
+
+void
+spooky_hash64_column64(uint8_t const*const data, uint64_t const*const offsets, size_t const nrows,
+    uint64_t const seed, uint64_t *const out)
+{
+    struct spooky_column const col = {.data = data, .offsets64 = offsets};
+    column_hash(&col, nrows, seed, false, out);
+}
+
+void
+spooky_hash64_column_nulls(uint8_t const*const data, uint32_t const*const offsets,
+    uint8_t const*const validity, size_t const nrows, uint64_t const seed, uint64_t *const out)
+{
+    struct spooky_column const col = {.data = data, .offsets = offsets, .validity = validity};
+    column_hash(&col, nrows, seed, false, out);
+}
+
+void
+spooky_hash64_column64_nulls(uint8_t const*const data, uint64_t const*const offsets,
+    uint8_t const*const validity, size_t const nrows, uint64_t const seed, uint64_t *const out)
+{
+    struct spooky_column const col = {.data = data, .offsets64 = offsets, .validity = validity};
+    column_hash(&col, nrows, seed, false, out);
+}
+
+void
+spooky_hash64_columns(struct spooky_column const*const cols, size_t const ncols,
+    size_t const nrows, uint64_t const seed, uint64_t *const out)
+{
+    for (size_t c = 0; c < ncols; ++c) {
+        column_hash(&cols[c], nrows, seed, c > 0, out);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+// Spooky Hash
+// spooky_hash64 of every row of a variable-length string column, stored
+// Arrow style as one data buffer and an array of nrows + 1 offsets into it,
+// row i being data[offsets[i]..offsets[i+1]). Rows are sorted into classes
+// of the same length / 16, which take the same mix rounds, and each class is
+// hashed several rows at a time in SIMD lanes. Rows of SC_BUFSIZE bytes or
+// more go to spooky_hash128_multi.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A null row hashes as the empty string would with the seed xored with this,
+// so it differs from an empty one, and from one missing a column when
+// several are combined
+#define SPOOKY_COLUMN_NULL UINT64_C(0x6c6c756e6c6c756e)
+
+struct spooky_column {
+    uint8_t const*data;
+    // Exactly one of these, with nrows + 1 entries
+    uint32_t const*offsets;
+    uint64_t const*offsets64;
+    // Arrow validity bitmap, bit i % 8 of byte i / 8 clear if row i is null,
+    // or NULL if no row is
+    uint8_t const*validity;
+};
+
+// out[i] is spooky_hash64 of row i with seed, or the null hash for a null row
+void spooky_hash64_column(uint8_t const*data, uint32_t const*offsets, size_t nrows,
+    uint64_t seed, uint64_t *out);
+void spooky_hash64_column64(uint8_t const*data, uint64_t const*offsets, size_t nrows,
+    uint64_t seed, uint64_t *out);
+void spooky_hash64_column_nulls(uint8_t const*data, uint32_t const*offsets,
+    uint8_t const*validity, size_t nrows, uint64_t seed, uint64_t *out);
+void spooky_hash64_column64_nulls(uint8_t const*data, uint64_t const*offsets,
+    uint8_t const*validity, size_t nrows, uint64_t seed, uint64_t *out);
+
+// Hash of each row across ncols columns, for group-by and join keys. The
+// first column is hashed with seed, and each later one with the row's hash
+// so far as its seed, so out[i] depends on every column and on their order.
+void spooky_hash64_columns(struct spooky_column const*cols, size_t ncols, size_t nrows,
+    uint64_t seed, uint64_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,113 @@
+// Spooky Hash
+// Picks which set of kernels the library uses. The best variant the CPU
+// supports is chosen when the library is loaded, SPOOKY_IMPL=scalar|avx2|avx512
+// in the environment or spooky_set_impl() can force a specific one.
+
+#include <stdlib.h>
+#include <string.h>
+#include "spooky_internal.h"
+
+static struct spooky_ops const impls[SPOOKY_IMPL_COUNT] = {
+    [SPOOKY_IMPL_SCALAR] = {
+        .name = "scalar",
+    },
+#ifdef SC_HAVE_X86
+    [SPOOKY_IMPL_AVX2] = {
+        .name = "avx2",
+        .long_lanes = spooky_long_x4_avx2,
+        .nlanes = 4,
+        .mix_lanes = spooky_mix_x4_avx2,
+        .short_keys = spooky_short_keys_x4_avx2,
+        .short_rows = spooky_short_rows_x4_avx2,
+        .hll_merge = spooky_hll_merge_avx2,
+        .hll_stats = spooky_hll_stats_avx2,
+    },
+    [SPOOKY_IMPL_AVX512] = {
+        .name = "avx512",
+        .long_lanes = spooky_long_x8_avx512,
+        .nlanes = 8,
+        .mix_lanes = spooky_mix_x8_avx512,
+        .short_keys = spooky_short_keys_x8_avx512,
+        .short_rows = spooky_short_rows_x8_avx512,
+        // Byte maxima need AVX-512BW, every AVX-512 CPU has AVX2
+        .hll_merge = spooky_hll_merge_avx2,
+        .hll_stats = spooky_hll_stats_avx2,
+    },
+#else
+    [SPOOKY_IMPL_AVX2] = {
+        .name = "avx2",
+    },
+    [SPOOKY_IMPL_AVX512] = {
+        .name = "avx512",
+    },
+#endif
+};
+
+struct spooky_ops const*spooky_active_ops = &impls[SPOOKY_IMPL_SCALAR];
+
+bool
+spooky_impl_supported(enum spooky_impl const impl)
+{
+    switch (impl) {
+        case SPOOKY_IMPL_SCALAR:
+            return true;
+#ifdef SC_HAVE_X86
+        case SPOOKY_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case SPOOKY_IMPL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+char const*
+spooky_impl_name(enum spooky_impl const impl)
+{
+    if ((unsigned)impl >= SPOOKY_IMPL_COUNT) {
+        return NULL;
+    }
+    return impls[impl].name;
+}
+
+enum spooky_impl
+spooky_get_impl(void)
+{
+    return (enum spooky_impl)(__atomic_load_n(&spooky_active_ops, __ATOMIC_RELAXED) - impls);
+}
+
+bool
+spooky_set_impl(enum spooky_impl const impl)
+{
+    if (!spooky_impl_supported(impl)) {
+        return false;
+    }
+    __atomic_store_n(&spooky_active_ops, &impls[impl], __ATOMIC_RELAXED);
+    return true;
+}
+
+__attribute__((constructor))
+static void
+spooky_dispatch_init(void)
+{
+#ifdef SC_HAVE_X86
+    // Required before __builtin_cpu_supports when running as a constructor
+    __builtin_cpu_init();
+#endif
+
+    char const*const forced = getenv("SPOOKY_IMPL");
+    if (forced != NULL) {
+        for (int i = 0; i < SPOOKY_IMPL_COUNT; ++i) {
+            if (strcmp(forced, impls[i].name) == 0 && spooky_set_impl(i)) {
+                return;
+            }
+        }
+    }
+
+    for (int i = SPOOKY_IMPL_COUNT - 1; i >= 0; --i) {
+        if (spooky_set_impl(i)) {
+            return;
+        }
+    }
+}
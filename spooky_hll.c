@@ -0,0 +1,538 @@
+// Spooky Hash
+// HyperLogLog++ sketches. A hash h goes to register h >> (64 - p), with rank
+// one more than the number of leading zeros in the bits after the index.
+// Sparse sketches keep the same thing at precision 25: entries are the 25-bit
+// index above the 6-bit rank of the 39 bits after it, sorted, at most one per
+// index. That is enough to work out the dense register of any entry, so a
+// sparse sketch can turn dense, or merge into a dense one, without losing
+// anything. New sparse entries collect in a small unsorted buffer and are
+// merged into the list a batch at a time.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spooky_hll.h"
+#include "spooky_internal.h"
+
+#define SC_HLL_SPARSE_P 25
+#define SC_HLL_TMP 256
+#define SC_HLL_FLAG_SPARSE 0x1
+#define SC_HLL_HEADER 12
+
+struct spooky_hll {
+    unsigned p;
+    uint64_t seed;
+    // Registers, NULL while the sketch is sparse
+    uint8_t *regs;
+    // Sorted sparse entries, and somewhere to merge them into, both with
+    // room for cap entries
+    uint32_t *list;
+    uint32_t *scratch;
+    size_t nlist;
+    size_t cap;
+    size_t ntmp;
+    uint32_t tmp[SC_HLL_TMP];
+};
+
+static inline size_t
+hll_nregs(unsigned const p)
+{
+    return (size_t)1 << p;
+}
+
+// Rank of a full register: every bit after the index was zero
+static inline unsigned
+hll_full(unsigned const p)
+{
+    return 64 - p + 1;
+}
+
+// Sparse lists longer than this take more memory than the registers
+static inline size_t
+hll_sparse_max(unsigned const p)
+{
+    return hll_nregs(p) / sizeof(uint32_t);
+}
+
+static inline uint32_t
+hll_sparse_entry(uint64_t const h)
+{
+    unsigned const rank = __builtin_clzll((h << SC_HLL_SPARSE_P) | (UINT64_C(1) << (SC_HLL_SPARSE_P - 1))) + 1;
+    return (uint32_t)(h >> (64 - SC_HLL_SPARSE_P)) << 6 | rank;
+}
+
+// The register, and its rank, that a sparse entry stands for at precision p
+static inline size_t
+hll_entry_reg(unsigned const p, uint32_t const e, unsigned *const rank)
+{
+    uint32_t const index = e >> 6;
+    unsigned const shift = SC_HLL_SPARSE_P - p;
+    uint32_t const low = index & ((UINT32_C(1) << shift) - 1);
+    *rank = low != 0 ? __builtin_clz(low) - (32 - shift) + 1 : shift + (e & 63);
+    return index >> shift;
+}
+
+static inline void
+hll_apply_entries(uint8_t *const regs, unsigned const p, uint32_t const*const entries, size_t const n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        unsigned rank;
+        size_t const r = hll_entry_reg(p, entries[i], &rank);
+        if (regs[r] < rank) {
+            regs[r] = rank;
+        }
+    }
+}
+
+static int
+hll_cmp_entry(void const*const a, void const*const b)
+{
+    uint32_t const x = *(uint32_t const*)a;
+    uint32_t const y = *(uint32_t const*)b;
+    return (x > y) - (x < y);
+}
+
+// Merge two sorted entry lists, keeping the highest rank for an index that's
+// in both (or twice in one), and return the length of the result
+static size_t
+hll_merge_lists(uint32_t const*const a, size_t const na, uint32_t const*const b, size_t const nb,
+    uint32_t *const out)
+{
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    while (i < na || j < nb) {
+        uint32_t const e = j == nb || (i < na && a[i] < b[j]) ? a[i++] : b[j++];
+        // Same index sorts by rank, so the later entry is the one to keep
+        if (n > 0 && out[n - 1] >> 6 == e >> 6) {
+            out[n - 1] = e;
+        } else {
+            out[n++] = e;
+        }
+    }
+    return n;
+}
+
+static bool
+hll_reserve(spooky_hll_t *const h, size_t const need)
+{
+    if (need <= h->cap) {
+        return true;
+    }
+    size_t const cap = need > 2 * h->cap ? need : 2 * h->cap;
+    uint32_t *const list = realloc(h->list, cap * sizeof(uint32_t));
+    if (list == NULL) {
+        return false;
+    }
+    h->list = list;
+    uint32_t *const scratch = realloc(h->scratch, cap * sizeof(uint32_t));
+    if (scratch == NULL) {
+        return false;
+    }
+    h->scratch = scratch;
+    h->cap = cap;
+    return true;
+}
+
+// Turn a sparse sketch dense. If there's no memory for the registers it just
+// stays sparse, which is bigger but no less correct.
+static bool
+hll_to_dense(spooky_hll_t *const h)
+{
+    size_t const m = hll_nregs(h->p);
+    uint8_t *const regs = aligned_alloc(64, m < 64 ? 64 : m);
+    if (regs == NULL) {
+        return false;
+    }
+    memset(regs, 0, m);
+    hll_apply_entries(regs, h->p, h->list, h->nlist);
+    hll_apply_entries(regs, h->p, h->tmp, h->ntmp);
+
+    free(h->list);
+    free(h->scratch);
+    h->list = NULL;
+    h->scratch = NULL;
+    h->nlist = 0;
+    h->cap = 0;
+    h->ntmp = 0;
+    h->regs = regs;
+    return true;
+}
+
+// Merge the buffered entries into the sorted list
+static bool
+hll_flush(spooky_hll_t *const h)
+{
+    if (h->regs != NULL || h->ntmp == 0) {
+        return true;
+    }
+    if (!hll_reserve(h, h->nlist + h->ntmp)) {
+        return false;
+    }
+
+    qsort(h->tmp, h->ntmp, sizeof(uint32_t), hll_cmp_entry);
+    h->nlist = hll_merge_lists(h->list, h->nlist, h->tmp, h->ntmp, h->scratch);
+    h->ntmp = 0;
+    uint32_t *const t = h->list;
+    h->list = h->scratch;
+    h->scratch = t;
+
+    if (h->nlist > hll_sparse_max(h->p)) {
+        hll_to_dense(h);
+    }
+    return true;
+}
+
+spooky_hll_t *
+spooky_hll_new(unsigned const precision, uint64_t const seed)
+{
+    if (precision < SPOOKY_HLL_MIN_PRECISION || precision > SPOOKY_HLL_MAX_PRECISION) {
+        return NULL;
+    }
+
+    spooky_hll_t *const h = malloc(sizeof(*h));
+    if (h == NULL) {
+        return NULL;
+    }
+    h->p = precision;
+    h->seed = seed;
+    h->regs = NULL;
+    h->list = NULL;
+    h->scratch = NULL;
+    h->nlist = 0;
+    h->cap = 0;
+    h->ntmp = 0;
+    return h;
+}
+
+void
+spooky_hll_free(spooky_hll_t *const h)
+{
+    if (h != NULL) {
+        free(h->regs);
+        free(h->list);
+        free(h->scratch);
+        free(h);
+    }
+}
+
+bool
+spooky_hll_add_hash(spooky_hll_t *const h, uint64_t const hash)
+{
+    if (h->regs != NULL) {
+        unsigned const rank = __builtin_clzll((hash << h->p) | (UINT64_C(1) << (h->p - 1))) + 1;
+        uint8_t *const reg = &h->regs[hash >> (64 - h->p)];
+        if (*reg < rank) {
+            *reg = rank;
+        }
+        return true;
+    }
+
+    if (h->ntmp == SC_HLL_TMP && !hll_flush(h)) {
+        return false;
+    }
+    if (h->regs != NULL) {
+        return spooky_hll_add_hash(h, hash);
+    }
+    h->tmp[h->ntmp++] = hll_sparse_entry(hash);
+    return true;
+}
+
+bool
+spooky_hll_add(spooky_hll_t *const h, void const*const key, size_t const len)
+{
+    return spooky_hll_add_hash(h, spooky_hash64(key, len, h->seed));
+}
+
+bool
+spooky_hll_add_many(spooky_hll_t *const h, void const*const keys, size_t const key_width,
+    size_t const nkeys)
+{
+    uint8_t const*const lkeys = keys;
+    uint64_t hashes[SC_HLL_TMP];
+
+    for (size_t first = 0; first < nkeys; first += SC_HLL_TMP) {
+        size_t const left = nkeys - first;
+        size_t const count = left < SC_HLL_TMP ? left : SC_HLL_TMP;
+        spooky_hash64_keys(lkeys + first * key_width, key_width, count, h->seed, hashes);
+        for (size_t i = 0; i < count; ++i) {
+            if (!spooky_hll_add_hash(h, hashes[i])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Ertl, "New cardinality estimation algorithms for HyperLogLog sketches"
+// (2017): the contributions of empty and of full registers, as series that
+// converge in a few dozen terms.
+static double
+hll_sigma(double x)
+{
+    if (x == 1) {
+        return INFINITY;
+    }
+    double y = 1;
+    double z = x;
+    double z_prev;
+    do {
+        x *= x;
+        z_prev = z;
+        z += x * y;
+        y += y;
+    } while (z != z_prev);
+    return z;
+}
+
+static double
+hll_tau(double x)
+{
+    if (x == 0 || x == 1) {
+        return 0;
+    }
+    double y = 1;
+    double z = 1 - x;
+    double z_prev;
+    do {
+        x = sqrt(x);
+        z_prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != z_prev);
+    return z / 3;
+}
+
+// Ertl's improved estimator over the histogram of register ranks, summed
+// from the highest rank down in a fixed order
+static double
+hll_estimate_dense(spooky_hll_t const*const h)
+{
+    size_t const m = hll_nregs(h->p);
+    unsigned const full = hll_full(h->p);
+    uint32_t counts[SC_HLL_RANKS] = {0};
+    size_t done = 0;
+
+    struct spooky_ops const*const ops = spooky_current_ops();
+    if (ops->hll_stats != NULL) {
+        done = ops->hll_stats(h->regs, m, counts);
+    }
+    for (size_t i = done; i < m; ++i) {
+        ++counts[h->regs[i]];
+    }
+
+    if (counts[0] == m) {
+        return 0;
+    }
+    double z = m * hll_tau(1 - (double)counts[full] / m);
+    for (unsigned k = full - 1; k >= 1; --k) {
+        z = 0.5 * (z + counts[k]);
+    }
+    z += m * hll_sigma((double)counts[0] / m);
+    return m / (2 * M_LN2) * m / z;
+}
+
+double
+spooky_hll_estimate(spooky_hll_t const*const h)
+{
+    if (h->regs != NULL) {
+        return hll_estimate_dense(h);
+    }
+
+    // Linear counting over the 2^25 sparse indexes, of the list and the
+    // buffered entries together
+    uint32_t tmp[SC_HLL_TMP];
+    memcpy(tmp, h->tmp, h->ntmp * sizeof(uint32_t));
+    qsort(tmp, h->ntmp, sizeof(uint32_t), hll_cmp_entry);
+    size_t distinct = 0;
+    size_t i = 0;
+    size_t j = 0;
+    uint32_t prev = UINT32_MAX;
+    while (i < h->nlist || j < h->ntmp) {
+        uint32_t const e = j == h->ntmp || (i < h->nlist && h->list[i] < tmp[j]) ? h->list[i++] : tmp[j++];
+        distinct += e >> 6 != prev;
+        prev = e >> 6;
+    }
+
+    double const m = (double)(UINT32_C(1) << SC_HLL_SPARSE_P);
+    return m * log(m / (m - distinct));
+}
+
+bool
+spooky_hll_merge(spooky_hll_t *const dst, spooky_hll_t *const src)
+{
+    if (dst->p != src->p || dst->seed != src->seed || !hll_flush(dst) || !hll_flush(src)) {
+        return false;
+    }
+
+    if (src->regs == NULL) {
+        if (dst->regs != NULL) {
+            hll_apply_entries(dst->regs, dst->p, src->list, src->nlist);
+            return true;
+        }
+        if (!hll_reserve(dst, dst->nlist + src->nlist)) {
+            return false;
+        }
+        dst->nlist = hll_merge_lists(dst->list, dst->nlist, src->list, src->nlist, dst->scratch);
+        uint32_t *const t = dst->list;
+        dst->list = dst->scratch;
+        dst->scratch = t;
+        if (dst->nlist > hll_sparse_max(dst->p)) {
+            hll_to_dense(dst);
+        }
+        return true;
+    }
+
+    if (dst->regs == NULL && !hll_to_dense(dst)) {
+        return false;
+    }
+    size_t const m = hll_nregs(dst->p);
+    size_t done = 0;
+    struct spooky_ops const*const ops = spooky_current_ops();
+    if (ops->hll_merge != NULL) {
+        done = ops->hll_merge(dst->regs, src->regs, m);
+    }
+    // An unconditional store, which the compiler can vectorize
+    for (size_t i = done; i < m; ++i) {
+        dst->regs[i] = dst->regs[i] < src->regs[i] ? src->regs[i] : dst->regs[i];
+    }
+    return true;
+}
+
+static size_t
+leb128_size(uint32_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+size_t
+spooky_hll_export(spooky_hll_t *const h, void *const buf)
+{
+    uint8_t *out = buf;
+    size_t const m = hll_nregs(h->p);
+
+    // If the buffered entries can't be merged in, the registers are written
+    // instead, from the list and the buffer both
+    bool sparse = h->regs == NULL && hll_flush(h) && h->regs == NULL && h->ntmp == 0;
+    if (sparse) {
+        size_t size = 0;
+        uint32_t prev = 0;
+        for (size_t i = 0; i < h->nlist; ++i) {
+            size += leb128_size(h->list[i] - prev);
+            prev = h->list[i];
+        }
+        sparse = size < m;
+    }
+
+    out[0] = 'H';
+    out[1] = SPOOKY_HLL_VERSION;
+    out[2] = h->p;
+    out[3] = sparse ? SC_HLL_FLAG_SPARSE : 0;
+    for (int i = 0; i < 8; ++i) {
+        out[4 + i] = h->seed >> (8 * i);
+    }
+    out += SC_HLL_HEADER;
+
+    if (sparse) {
+        uint32_t prev = 0;
+        for (size_t i = 0; i < h->nlist; ++i) {
+            uint32_t v = h->list[i] - prev;
+            prev = h->list[i];
+            while (v >= 0x80) {
+                *out++ = (v & 0x7F) | 0x80;
+                v >>= 7;
+            }
+            *out++ = v;
+        }
+    } else if (h->regs != NULL) {
+        memcpy(out, h->regs, m);
+        out += m;
+    } else {
+        memset(out, 0, m);
+        hll_apply_entries(out, h->p, h->list, h->nlist);
+        hll_apply_entries(out, h->p, h->tmp, h->ntmp);
+        out += m;
+    }
+
+    return out - (uint8_t *)buf;
+}
+
+spooky_hll_t *
+spooky_hll_import(void const*const buf, size_t const len)
+{
+    uint8_t const*in = buf;
+
+    if (len < SC_HLL_HEADER || in[0] != 'H' || in[1] != SPOOKY_HLL_VERSION
+        || in[2] < SPOOKY_HLL_MIN_PRECISION || in[2] > SPOOKY_HLL_MAX_PRECISION
+        || (in[3] & ~SC_HLL_FLAG_SPARSE) != 0) {
+        return NULL;
+    }
+    unsigned const p = in[2];
+    size_t const m = hll_nregs(p);
+    bool const sparse = in[3] & SC_HLL_FLAG_SPARSE;
+    if (!sparse && len != SC_HLL_HEADER + m) {
+        return NULL;
+    }
+    uint64_t seed = 0;
+    for (int i = 0; i < 8; ++i) {
+        seed |= (uint64_t)in[4 + i] << (8 * i);
+    }
+    uint8_t const*const end = in + len;
+    in += SC_HLL_HEADER;
+
+    spooky_hll_t *const h = spooky_hll_new(p, seed);
+    if (h == NULL) {
+        return NULL;
+    }
+
+    if (!sparse) {
+        for (size_t i = 0; i < m; ++i) {
+            if (in[i] > hll_full(p)) {
+                spooky_hll_free(h);
+                return NULL;
+            }
+        }
+        h->regs = aligned_alloc(64, m < 64 ? 64 : m);
+        if (h->regs == NULL) {
+            spooky_hll_free(h);
+            return NULL;
+        }
+        memcpy(h->regs, in, m);
+        return h;
+    }
+
+    // Entries must be strictly increasing, with one per index and a rank
+    // that fits the bits after it
+    uint64_t prev = 0;
+    while (in < end) {
+        uint64_t v = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (in == end || shift > 28) {
+                spooky_hll_free(h);
+                return NULL;
+            }
+            v |= (uint64_t)(*in & 0x7F) << shift;
+            if ((*in++ & 0x80) == 0) {
+                break;
+            }
+        }
+        uint64_t const e = prev + v;
+        unsigned const rank = e & 63;
+        if (e > UINT32_MAX >> 1 || rank == 0 || rank > 64 - SC_HLL_SPARSE_P + 1
+            || (h->nlist > 0 && e >> 6 == prev >> 6) || !hll_reserve(h, h->nlist + 1)) {
+            spooky_hll_free(h);
+            return NULL;
+        }
+        h->list[h->nlist++] = e;
+        prev = e;
+    }
+    if (h->nlist > hll_sparse_max(p)) {
+        hll_to_dense(h);
+    }
+    return h;
+}
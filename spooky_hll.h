@@ -0,0 +1,58 @@
+#pragma once
+// Spooky Hash
+// HyperLogLog++ distinct counting on spooky_hash64. A sketch starts sparse,
+// as a sorted list of (index, rank) pairs at 25 bits of precision, which is
+// near exact for small counts, and turns into 2^precision one-byte registers
+// once the list would be as big. Estimates use Ertl's improved estimator,
+// which needs no bias tables, and merging and estimating go through the SIMD
+// kernels of the current CPU variant.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOKY_HLL_MIN_PRECISION 4
+#define SPOOKY_HLL_MAX_PRECISION 18
+
+typedef struct spooky_hll spooky_hll_t;
+
+// A sketch with 2^precision registers, for a relative error of about
+// 1.04/sqrt(2^precision) (0.8% at 14). NULL if precision is out of range or
+// it can't be allocated.
+spooky_hll_t *spooky_hll_new(unsigned precision, uint64_t seed);
+void spooky_hll_free(spooky_hll_t *h);
+
+// The adds return false if a sparse sketch needed memory it couldn't get,
+// in which case the key wasn't added (add_many may have added some).
+bool spooky_hll_add(spooky_hll_t *h, void const*key, size_t len);
+// Add a key by its spooky_hash64 with the sketch's seed
+bool spooky_hll_add_hash(spooky_hll_t *h, uint64_t hash);
+// Add nkeys keys of key_width bytes stored back to back, hashed with
+// spooky_hash64_keys
+bool spooky_hll_add_many(spooky_hll_t *h, void const*keys, size_t key_width, size_t nkeys);
+
+// Estimated number of distinct keys added
+double spooky_hll_estimate(spooky_hll_t const*h);
+
+// Add src's keys to dst, as if they'd been added to dst directly. Returns
+// false, changing nothing, if the two differ in precision or seed, or if dst
+// needed memory it couldn't get. Merge and export may fold recent additions
+// into a sparse sketch's list first, hence the non-const pointers.
+bool spooky_hll_merge(spooky_hll_t *dst, spooky_hll_t *src);
+
+// Serialized sketches are a header ('H', version, precision, flags) and the
+// seed as a little-endian uint64, then either the registers, one byte each,
+// or the sparse list as LEB128 deltas between its sorted 32-bit entries,
+// whichever is smaller. export writes at most SPOOKY_HLL_EXPORT_MAX(precision)
+// bytes and returns how many. import returns a new sketch, or NULL if buf
+// isn't a valid sketch of this version.
+#define SPOOKY_HLL_VERSION 1
+#define SPOOKY_HLL_EXPORT_MAX(precision) (12 + ((size_t)1 << (precision)))
+size_t spooky_hll_export(spooky_hll_t *h, void *buf);
+spooky_hll_t *spooky_hll_import(void const*buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
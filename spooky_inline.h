@@ -0,0 +1,303 @@
+#pragma once
+// Spooky Hash
+// The mix, end and short hash code, the one copy of it. spooky.c builds
+// spooky_hash128 and the streaming functions out of these, and spooky.h
+// inlines them into callers when SPOOKY_INLINE is defined. Called with a
+// length the compiler can see, the choice of path, the block loops and the
+// tail switch all fold away and a small key hashes in straight-line mix
+// code. Loads go through memcpy, which is an ordinary load wherever
+// unaligned loads are cheap, so there's no alignment test either.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__attribute__((pure, always_inline))
+static inline uint64_t
+spooky_inline_rd64(uint8_t const*const ptr)
+{
+    uint64_t o;
+    __builtin_memcpy(&o, ptr, 8);
+    return o;
+}
+
+__attribute__((pure, always_inline))
+static inline uint32_t
+spooky_inline_rd32(uint8_t const*const ptr)
+{
+    uint32_t o;
+    __builtin_memcpy(&o, ptr, 4);
+    return o;
+}
+
+__attribute__((const, always_inline))
+static inline uint64_t
+spooky_inline_rol64(uint64_t const x, unsigned const k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// hash[0] is the seed (the second seed of the short hash has never been
+// used) and the result goes to hash[0..1], and with wide to hash[2..3] as
+// well
+__attribute__((always_inline))
+static inline void
+spooky_inline_short_hash(void const*const message, size_t const length, uint64_t *const hash,
+    bool const wide)
+{
+    size_t block_leftover = length % 32;
+
+    uint64_t a = hash[0];
+    uint64_t b = hash[0];
+    uint64_t c = SC_CONST;
+    uint64_t d = SC_CONST;
+
+    uint8_t const*datap = (uint8_t const*)message;
+
+    if (length > 15) {
+
+        size_t const blocks_of_32 = length / 32;
+
+        for (size_t i = 0; i < blocks_of_32; ++i) {
+
+            c += spooky_inline_rd64(datap);
+            d += spooky_inline_rd64(datap + 8);
+            c = spooky_inline_rol64(c,50);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,52);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a,30);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,41);  b += c;  d ^= b;
+            c = spooky_inline_rol64(c,54);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,48);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a,38);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,37);  b += c;  d ^= b;
+            c = spooky_inline_rol64(c,62);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,34);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a, 5);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,36);  b += c;  d ^= b;
+            a += spooky_inline_rd64(datap + 16);
+            b += spooky_inline_rd64(datap + 24);
+
+            datap += 32;
+        }
+
+        // More than 16 bytes remaining
+        if (block_leftover >= 16) {
+
+            c += spooky_inline_rd64(datap);
+            d += spooky_inline_rd64(datap + 8);
+            c = spooky_inline_rol64(c,50);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,52);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a,30);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,41);  b += c;  d ^= b;
+            c = spooky_inline_rol64(c,54);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,48);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a,38);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,37);  b += c;  d ^= b;
+            c = spooky_inline_rol64(c,62);  c += d;  a ^= c;
+            d = spooky_inline_rol64(d,34);  d += a;  b ^= d;
+            a = spooky_inline_rol64(a, 5);  a += b;  c ^= a;
+            b = spooky_inline_rol64(b,36);  b += c;  d ^= b;
+
+            datap += 16;
+
+            block_leftover -= 16;
+        }
+    }
+
+    // Handle the last 0..15 bytes, and and also add in the length
+    d += ((uint64_t)length) << 56;
+
+    uint8_t const*r = datap;
+    switch (block_leftover)
+    {
+        case 15:
+            d += ((uint64_t)r[14]) << 48;
+            __attribute__((fallthrough));
+        case 14:
+            d += ((uint64_t)r[13]) << 40;
+            __attribute__((fallthrough));
+        case 13:
+            d += ((uint64_t)r[12]) << 32;
+            __attribute__((fallthrough));
+        case 12:
+            d += (uint64_t)spooky_inline_rd32(r + 8);
+            c += spooky_inline_rd64(r);
+            break;
+        case 11:
+            d += ((uint64_t)r[10]) << 16;
+            __attribute__((fallthrough));
+        case 10:
+            d += ((uint64_t)r[9]) << 8;
+            __attribute__((fallthrough));
+        case 9:
+            d += (uint64_t)r[8];
+            __attribute__((fallthrough));
+        case 8:
+            c += spooky_inline_rd64(r);
+            break;
+        case 7:
+            c += ((uint64_t)r[6]) << 48;
+            __attribute__((fallthrough));
+        case 6:
+            c += ((uint64_t)r[5]) << 40;
+            __attribute__((fallthrough));
+        case 5:
+            c += ((uint64_t)r[4]) << 32;
+            __attribute__((fallthrough));
+        case 4:
+            c += (uint64_t)spooky_inline_rd32(r);
+            break;
+        case 3:
+            c += ((uint64_t)r[2]) << 16;
+            __attribute__((fallthrough));
+        case 2:
+            c += ((uint64_t)r[1]) << 8;
+            __attribute__((fallthrough));
+        case 1:
+            c += (uint64_t)r[0];
+            break;
+        case 0:
+            c += SC_CONST;
+            d += SC_CONST;
+            break;
+        default:
+            break;
+    }
+
+    // The wide hash's second half comes from one more round of the end mix
+    for (int i = 0; i < (wide ? 2 : 1); ++i) {
+        d ^= c;  c = spooky_inline_rol64(c,15);  d += c;
+        a ^= d;  d = spooky_inline_rol64(d,52);  a += d;
+        b ^= a;  a = spooky_inline_rol64(a,26);  b += a;
+        c ^= b;  b = spooky_inline_rol64(b,51);  c += b;
+        d ^= c;  c = spooky_inline_rol64(c,28);  d += c;
+        a ^= d;  d = spooky_inline_rol64(d, 9);  a += d;
+        b ^= a;  a = spooky_inline_rol64(a,47);  b += a;
+        c ^= b;  b = spooky_inline_rol64(b,54);  c += b;
+        d ^= c;  c = spooky_inline_rol64(c,32);  d += c;
+        a ^= d;  d = spooky_inline_rol64(d,25);  a += d;
+        b ^= a;  a = spooky_inline_rol64(a,63);  b += a;
+        hash[2*i] = a;
+        hash[2*i + 1] = b;
+    }
+}
+
+__attribute__((always_inline))
+static inline void
+spooky_inline_short(void const*const message, size_t const length,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    uint64_t hash[2] = {*hash1, *hash2};
+    spooky_inline_short_hash(message, length, hash, false);
+    *hash1 = hash[0];
+    *hash2 = hash[1];
+}
+
+// Word k of a block of the long hash into the 12 words of state h. Each
+// word is mixed as soon as it's loaded, which keeps register pressure down,
+// and with k a constant every index and rotation folds.
+__attribute__((always_inline))
+static inline void
+spooky_inline_mix_word(uint64_t *const h, int const k, uint64_t const w)
+{
+    static unsigned const rot[SC_NUMVARS] = {11, 32, 43, 31, 17, 28, 39, 57, 55, 54, 22, 46};
+    h[k] += w;
+    h[(k + 2) % SC_NUMVARS] ^= h[(k + 10) % SC_NUMVARS];
+    h[(k + 11) % SC_NUMVARS] ^= h[k];
+    h[k] = spooky_inline_rol64(h[k], rot[k]);
+    h[(k + 11) % SC_NUMVARS] += h[(k + 1) % SC_NUMVARS];
+}
+
+// One block of the long hash at data into the 12 words of state h
+__attribute__((always_inline))
+static inline void
+spooky_inline_mix(uint64_t *const h, uint8_t const*const data)
+{
+    spooky_inline_mix_word(h,  0, spooky_inline_rd64(data +  0));
+    spooky_inline_mix_word(h,  1, spooky_inline_rd64(data +  8));
+    spooky_inline_mix_word(h,  2, spooky_inline_rd64(data + 16));
+    spooky_inline_mix_word(h,  3, spooky_inline_rd64(data + 24));
+    spooky_inline_mix_word(h,  4, spooky_inline_rd64(data + 32));
+    spooky_inline_mix_word(h,  5, spooky_inline_rd64(data + 40));
+    spooky_inline_mix_word(h,  6, spooky_inline_rd64(data + 48));
+    spooky_inline_mix_word(h,  7, spooky_inline_rd64(data + 56));
+    spooky_inline_mix_word(h,  8, spooky_inline_rd64(data + 64));
+    spooky_inline_mix_word(h,  9, spooky_inline_rd64(data + 72));
+    spooky_inline_mix_word(h, 10, spooky_inline_rd64(data + 80));
+    spooky_inline_mix_word(h, 11, spooky_inline_rd64(data + 88));
+}
+
+// One round of the long hash's end mix. The result is h[0..1] after three.
+__attribute__((always_inline))
+static inline void
+spooky_inline_end_round(uint64_t *const h)
+{
+    h[11]+= h[1];    h[2] ^= h[11];   h[1] = spooky_inline_rol64(h[1],44);
+    h[0] += h[2];    h[3] ^= h[0];    h[2] = spooky_inline_rol64(h[2],15);
+    h[1] += h[3];    h[4] ^= h[1];    h[3] = spooky_inline_rol64(h[3],34);
+    h[2] += h[4];    h[5] ^= h[2];    h[4] = spooky_inline_rol64(h[4],21);
+    h[3] += h[5];    h[6] ^= h[3];    h[5] = spooky_inline_rol64(h[5],38);
+    h[4] += h[6];    h[7] ^= h[4];    h[6] = spooky_inline_rol64(h[6],33);
+    h[5] += h[7];    h[8] ^= h[5];    h[7] = spooky_inline_rol64(h[7],10);
+    h[6] += h[8];    h[9] ^= h[6];    h[8] = spooky_inline_rol64(h[8],13);
+    h[7] += h[9];    h[10]^= h[7];    h[9] = spooky_inline_rol64(h[9],38);
+    h[8] += h[10];   h[11]^= h[8];    h[10]= spooky_inline_rol64(h[10],53);
+    h[9] += h[11];   h[0] ^= h[9];    h[11]= spooky_inline_rol64(h[11],42);
+    h[10]+= h[0];    h[1] ^= h[10];   h[0] = spooky_inline_rol64(h[0],54);
+}
+
+// Finish the long hash with the last leftover (< SC_BLOCKSIZE) bytes at
+// data. The result is h[0..1].
+__attribute__((always_inline))
+static inline void
+spooky_inline_end(uint64_t *const h, uint8_t const*const data, size_t const leftover)
+{
+    uint64_t last_block[SC_NUMVARS];
+    __builtin_memcpy(last_block, data, leftover);
+    __builtin_memset(((uint8_t *)last_block) + leftover, 0, SC_BLOCKSIZE - leftover);
+    ((uint8_t *)last_block)[SC_BLOCKSIZE-1] = leftover;
+
+    for (int i = 0; i < SC_NUMVARS; ++i) {
+        h[i] += last_block[i];
+    }
+    for (int i = 0; i < 3; ++i) {
+        spooky_inline_end_round(h);
+    }
+}
+
+// Not forced inline like the short path, a long message is worth a call, but
+// the compiler can still inline it where that pays.
+static inline void
+spooky_inline_long(void const*const message, size_t const length,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    uint64_t const seed0 = *hash1;
+    uint64_t const seed1 = *hash2;
+    uint64_t h[SC_NUMVARS] = {
+        seed0, seed1, SC_CONST, seed0, seed1, SC_CONST,
+        seed0, seed1, SC_CONST, seed0, seed1, SC_CONST,
+    };
+
+    uint8_t const*datap = (uint8_t const*)message;
+    uint8_t const*const end = datap + length / SC_BLOCKSIZE * SC_BLOCKSIZE;
+    for (; datap < end; datap += SC_BLOCKSIZE) {
+        spooky_inline_mix(h, datap);
+    }
+    spooky_inline_end(h, datap, length % SC_BLOCKSIZE);
+
+    *hash1 = h[0];
+    *hash2 = h[1];
+}
+
+// Same result as spooky_hash128
+__attribute__((always_inline))
+static inline void
+spooky_hash128_inline(void const*const message, size_t const length,
+    uint64_t *const hash1, uint64_t *const hash2)
+{
+    if (length < SC_BUFSIZE) {
+        spooky_inline_short(message, length, hash1, hash2);
+    } else {
+        spooky_inline_long(message, length, hash1, hash2);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+// Spooky Hash
+// Interfaces shared between the translation units of libspooky. Nothing in
+// here is part of the public API.
+
+#include "spooky.h"
+
+// Widest lane count of any kernel below
+#define SC_MAX_LANES 8
+
+// Hash a fixed number of long messages (each at least SC_BUFSIZE bytes) side
+// by side, one message per vector lane. hash1/hash2 hold the seeds on entry
+// and the results on exit, exactly like spooky_hash128.
+typedef void (*spooky_long_lanes_fn)(uint8_t const*const*msgs, size_t const*lens,
+    uint64_t *hash1, uint64_t *hash2);
+
+// Advance the long-hash state of one stream per lane over whole blocks,
+// without finishing it. states[i] is lane i's 12 state words, updated in
+// place, and lane i's b'th block starts at blocks[b*nlanes + i] for
+// b < nblocks[i]. Lanes with fewer blocks are left alone once theirs run out.
+typedef void (*spooky_mix_lanes_fn)(uint64_t *const*states, uint8_t const*const*blocks,
+    size_t const*nblocks);
+
+// Hash whole vectors' worth of fixed-width keys with the short hash, and
+// return how many keys were done. Widths the kernel doesn't specialize
+// return 0, the caller finishes whatever is left.
+typedef size_t (*spooky_short_keys_fn)(uint8_t const*keys, size_t key_width,
+    size_t nkeys, uint64_t seed, uint64_t *out);
+
+// Hash whole vectors' worth of variable-length rows, each shorter than
+// SC_BUFSIZE, with the short hash, one row per lane. Every row has
+// len / 16 == k, so they all take the same mix rounds. rows[i] is row i's
+// first byte, and tail_c[i] and tail_d[i] are what its last len % 16 bytes
+// and its length add to c and d, worked out by the caller. hashes[i] is the
+// seed on entry and spooky_hash64 of the row on exit. n is a multiple of
+// nlanes.
+typedef void (*spooky_short_rows_fn)(uint8_t const*const*rows, uint64_t const*tail_c,
+    uint64_t const*tail_d, size_t k, size_t n, uint64_t *hashes);
+
+// HyperLogLog registers, one byte each. merge leaves the larger of each pair
+// in dst. stats adds the number of registers at each rank to counts, which
+// has SC_HLL_RANKS entries: integer counts come out the same in any order, so
+// the estimate does not depend on the kernel. Both do whole vectors' worth
+// and return how many registers that was.
+#define SC_HLL_RANKS 66
+typedef size_t (*spooky_hll_merge_fn)(uint8_t *dst, uint8_t const*src, size_t n);
+typedef size_t (*spooky_hll_stats_fn)(uint8_t const*regs, size_t n, uint32_t *counts);
+
+// One set of kernels. A NULL kernel means the variant has nothing better
+// than the generic code for that job.
+struct spooky_ops {
+    char const*name;
+    spooky_long_lanes_fn long_lanes;
+    size_t nlanes;
+    spooky_mix_lanes_fn mix_lanes;
+    spooky_short_keys_fn short_keys;
+    spooky_short_rows_fn short_rows;
+    spooky_hll_merge_fn hll_merge;
+    spooky_hll_stats_fn hll_stats;
+};
+
+// The kernels in use, see spooky_dispatch.c
+extern struct spooky_ops const*spooky_active_ops;
+
+__attribute__((always_inline))
+static inline struct spooky_ops const*
+spooky_current_ops(void)
+{
+    return __atomic_load_n(&spooky_active_ops, __ATOMIC_RELAXED);
+}
+
+#if defined(__x86_64__)
+#define SC_HAVE_X86 1
+void spooky_long_x4_avx2(uint8_t const*const*msgs, size_t const*lens,
+    uint64_t *hash1, uint64_t *hash2);
+void spooky_long_x8_avx512(uint8_t const*const*msgs, size_t const*lens,
+    uint64_t *hash1, uint64_t *hash2);
+void spooky_mix_x4_avx2(uint64_t *const*states, uint8_t const*const*blocks, size_t const*nblocks);
+void spooky_mix_x8_avx512(uint64_t *const*states, uint8_t const*const*blocks, size_t const*nblocks);
+size_t spooky_short_keys_x4_avx2(uint8_t const*keys, size_t key_width,
+    size_t nkeys, uint64_t seed, uint64_t *out);
+size_t spooky_short_keys_x8_avx512(uint8_t const*keys, size_t key_width,
+    size_t nkeys, uint64_t seed, uint64_t *out);
+void spooky_short_rows_x4_avx2(uint8_t const*const*rows, uint64_t const*tail_c,
+    uint64_t const*tail_d, size_t k, size_t n, uint64_t *hashes);
+void spooky_short_rows_x8_avx512(uint8_t const*const*rows, uint64_t const*tail_c,
+    uint64_t const*tail_d, size_t k, size_t n, uint64_t *hashes);
+size_t spooky_hll_merge_avx2(uint8_t *dst, uint8_t const*src, size_t n);
+size_t spooky_hll_stats_avx2(uint8_t const*regs, size_t n, uint32_t *counts);
+#endif
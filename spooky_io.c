@@ -0,0 +1,784 @@
+// Spooky Hash
+// File hashing engines. The io_uring engine keeps a fixed pool of registered
+// buffers busy with reads from many files at once and hashes each buffer as
+// soon as its file's earlier data has been hashed. The pread engine is a
+// plain thread pool for kernels (or sandboxes) without io_uring.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "spooky_io.h"
+
+// Reads one file may have in flight at once. They have to be hashed in
+// order, so a file only gets a few and the rest of the queue goes to other
+// files.
+#define SC_IO_MAX_PER_FILE 8
+
+struct io_shared {
+    char const*const*paths;
+    size_t n;
+    size_t next;
+    struct spooky_io_opts opts;
+    struct spooky_io_result *results;
+    pthread_mutex_t lock;
+    struct spooky_io_stats stats;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void
+add_stats(struct io_shared *const sh, struct spooky_io_stats const*const st)
+{
+    pthread_mutex_lock(&sh->lock);
+    sh->stats.bytes += st->bytes;
+    sh->stats.io_ns += st->io_ns;
+    sh->stats.hash_ns += st->hash_ns;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+static void
+hash_update(spooky_context_t *const sc, void const*const buf, size_t const len,
+    struct spooky_io_stats *const st)
+{
+    uint64_t const t0 = now_ns();
+    spooky_update(sc, buf, len);
+    st->hash_ns += now_ns() - t0;
+    st->bytes += len;
+}
+
+// --- pread engine ---------------------------------------------------------
+
+static int
+pread_file(char const*const path, uint8_t *const buf, size_t const bufsize,
+    struct spooky_io_opts const*const opts, struct spooky_io_result *const res,
+    struct spooky_io_stats *const st)
+{
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        int const err = errno;
+        close(fd);
+        return err;
+    }
+    // Pipes and sockets have no offsets to read at
+    bool const stream = S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    spooky_context_t sc;
+    spooky_init(&sc, opts->seed0, opts->seed1);
+
+    off_t off = 0;
+    for (;;) {
+        uint64_t const t0 = now_ns();
+        ssize_t const got = stream ? read(fd, buf, bufsize) : pread(fd, buf, bufsize, off);
+        st->io_ns += now_ns() - t0;
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int const err = errno;
+            close(fd);
+            return err;
+        }
+        if (got == 0) {
+            break;
+        }
+        hash_update(&sc, buf, got, st);
+        off += got;
+    }
+
+    close(fd);
+    spooky_final(&sc, &res->h1, &res->h2);
+    return 0;
+}
+
+static void *
+pread_worker(void *const arg)
+{
+    struct io_shared *const sh = arg;
+    struct spooky_io_stats st = {0};
+    size_t const bufsize = sh->opts.buffer_size;
+
+    uint8_t *buf = NULL;
+    if (posix_memalign((void **)&buf, 4096, bufsize) != 0) {
+        buf = NULL;
+    }
+
+    for (;;) {
+        size_t const i = __atomic_fetch_add(&sh->next, 1, __ATOMIC_RELAXED);
+        if (i >= sh->n) {
+            break;
+        }
+        struct spooky_io_result *const res = &sh->results[i];
+        res->err = buf ? pread_file(sh->paths[i], buf, bufsize, &sh->opts, res, &st) : ENOMEM;
+    }
+
+    free(buf);
+    add_stats(sh, &st);
+    return NULL;
+}
+
+// --- io_uring engine ------------------------------------------------------
+
+// The bits of a ring we need, mapped by hand so there's no liburing
+// dependency.
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static int
+uring_setup(struct uring *const r, unsigned const entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int const fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return errno;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool const single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && r->cq_ring_size > r->sq_ring_size) {
+        r->sq_ring_size = r->cq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+    if (single_mmap) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            goto fail_sq;
+        }
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        goto fail_cq;
+    }
+
+    uint8_t *const sq = r->sq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    uint8_t *const cq = r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+
+fail_cq:
+    if (!single_mmap) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+fail_sq:
+    munmap(r->sq_ring, r->sq_ring_size);
+fail:;
+    int const err = errno;
+    close(fd);
+    return err;
+}
+
+static void
+uring_teardown(struct uring *const r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+
+// Queue a read. The caller never has more reads outstanding than the ring has
+// entries, so there is always room.
+static void
+uring_queue_read(struct uring *const r, int const fd, bool const fixed, unsigned const buf_index,
+    void *const buf, size_t const len, uint64_t const off, uint64_t const user_data)
+{
+    // buffer_size is clamped to SPOOKY_IO_MAX_BUFFER_SIZE, so this always fits
+    assert(len <= UINT32_MAX);
+    unsigned const tail = *r->sq_tail + r->sq_pending;
+    unsigned const idx = tail & r->sq_mask;
+    struct io_uring_sqe *const sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->buf_index = fixed ? buf_index : 0;
+    sqe->user_data = user_data;
+
+    r->sq_array[idx] = idx;
+    ++r->sq_pending;
+}
+
+// Submit whatever is queued and wait for at least one completion. Entries
+// a failed call left behind go in again.
+static int
+uring_submit_and_wait(struct uring *const r)
+{
+    unsigned const tail = *r->sq_tail + r->sq_pending;
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    unsigned to_submit = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    r->sq_pending = 0;
+
+    for (;;) {
+        int const ret = syscall(__NR_io_uring_enter, r->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return errno;
+        }
+        // Interrupted after submitting, only the wait is left to do
+        to_submit = 0;
+    }
+}
+
+struct uring_file {
+    size_t index;
+    int fd;
+    int err;
+    bool active;
+    bool eof;
+    // Read at the file position, for pipes and sockets
+    bool stream;
+    // st_size, only a guide to how far ahead to read. The file ends at the
+    // first read that returns nothing.
+    uint64_t size;
+    uint64_t next_off;
+    spooky_context_t sc;
+    // Buffers holding this file's reads, oldest first
+    unsigned fifo[SC_IO_MAX_PER_FILE];
+    unsigned fifo_head;
+    unsigned fifo_count;
+};
+
+struct uring_buf {
+    struct uring_file *file;
+    uint64_t off;
+    unsigned len;
+    unsigned filled;
+    bool done;
+    bool cancelled;
+};
+
+struct uring_engine {
+    struct io_shared *sh;
+    struct uring ring;
+    bool fixed;
+    unsigned depth;
+    size_t bufsize;
+    uint8_t *mem;
+    struct uring_buf *bufs;
+    unsigned *free_bufs;
+    unsigned nfree_bufs;
+    struct uring_file *files;
+    struct uring_file **free_files;
+    unsigned nfree_files;
+    unsigned nactive;
+    // Reads queued and not yet reaped
+    unsigned inflight;
+    struct spooky_io_stats st;
+};
+
+static void
+uring_finish_file(struct uring_engine *const e, struct uring_file *const f)
+{
+    struct spooky_io_result *const res = &e->sh->results[f->index];
+    res->err = f->err;
+    if (f->err == 0) {
+        spooky_final(&f->sc, &res->h1, &res->h2);
+    }
+    close(f->fd);
+    f->active = false;
+    e->free_files[e->nfree_files++] = f;
+    --e->nactive;
+}
+
+// Reads go ahead as far as st_size. Past it, where the file may have
+// grown, or have said it was empty like procfs files do, they go one at a
+// time.
+static bool
+uring_file_wants_read(struct uring_engine const*const e, struct uring_file const*const f)
+{
+    if (!f->active || f->err != 0 || f->eof || f->fifo_count == SC_IO_MAX_PER_FILE) {
+        return false;
+    }
+    if (f->fifo_count == 0) {
+        return true;
+    }
+    unsigned const last = f->fifo[(f->fifo_head + f->fifo_count - 1) % SC_IO_MAX_PER_FILE];
+    return !f->stream && e->bufs[last].off < f->size;
+}
+
+// Open the next file from the shared list. Returns false once there are none
+// left.
+static bool
+uring_open_next(struct uring_engine *const e)
+{
+    struct io_shared *const sh = e->sh;
+    size_t const i = __atomic_fetch_add(&sh->next, 1, __ATOMIC_RELAXED);
+    if (i >= sh->n) {
+        return false;
+    }
+
+    struct spooky_io_result *const res = &sh->results[i];
+    int const fd = open(sh->paths[i], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        res->err = errno;
+        return true;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        res->err = errno;
+        close(fd);
+        return true;
+    }
+
+    struct uring_file *const f = e->free_files[--e->nfree_files];
+    ++e->nactive;
+    f->index = i;
+    f->fd = fd;
+    f->err = 0;
+    f->active = true;
+    f->eof = false;
+    f->stream = S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode);
+    f->size = S_ISREG(sb.st_mode) ? sb.st_size : 0;
+    f->next_off = 0;
+    f->fifo_head = 0;
+    f->fifo_count = 0;
+    spooky_init(&f->sc, sh->opts.seed0, sh->opts.seed1);
+    return true;
+}
+
+static void
+uring_queue_buf(struct uring_engine *const e, unsigned const b)
+{
+    struct uring_buf *const ub = &e->bufs[b];
+    uint64_t const off = ub->file->stream ? (uint64_t)-1 : ub->off + ub->filled;
+    uring_queue_read(&e->ring, ub->file->fd, e->fixed, b, e->mem + b * e->bufsize + ub->filled,
+        ub->len - ub->filled, off, b);
+    ++e->inflight;
+}
+
+static void
+uring_start_read(struct uring_engine *const e, struct uring_file *const f)
+{
+    unsigned const b = e->free_bufs[--e->nfree_bufs];
+    struct uring_buf *const ub = &e->bufs[b];
+    uint64_t const left = f->next_off < f->size ? f->size - f->next_off : e->bufsize;
+
+    ub->file = f;
+    ub->off = f->next_off;
+    ub->len = left < e->bufsize ? left : e->bufsize;
+    ub->filled = 0;
+    ub->done = false;
+    ub->cancelled = false;
+
+    f->next_off += ub->len;
+    f->fifo[(f->fifo_head + f->fifo_count) % SC_IO_MAX_PER_FILE] = b;
+    ++f->fifo_count;
+
+    uring_queue_buf(e, b);
+}
+
+// Hash every finished read at the front of a file's queue, and retire the
+// file once nothing more is coming.
+static void
+uring_drain_file(struct uring_engine *const e, struct uring_file *const f)
+{
+    while (f->fifo_count > 0) {
+        unsigned const b = f->fifo[f->fifo_head];
+        struct uring_buf *const ub = &e->bufs[b];
+        if (!ub->done) {
+            break;
+        }
+        if (f->err == 0) {
+            hash_update(&f->sc, e->mem + b * e->bufsize, ub->filled, &e->st);
+        }
+        f->fifo_head = (f->fifo_head + 1) % SC_IO_MAX_PER_FILE;
+        --f->fifo_count;
+        e->free_bufs[e->nfree_bufs++] = b;
+    }
+
+    if ((f->err != 0 || f->eof) && f->fifo_count == 0) {
+        uring_finish_file(e, f);
+    }
+}
+
+static void
+uring_complete(struct uring_engine *const e, unsigned const b, int const res)
+{
+    struct uring_buf *const ub = &e->bufs[b];
+    struct uring_file *const f = ub->file;
+
+    if (res == -EAGAIN || res == -EINTR) {
+        uring_queue_buf(e, b);
+        return;
+    }
+    if (res < 0) {
+        if (f->err == 0) {
+            f->err = -res;
+        }
+        ub->done = true;
+    } else if (res == 0) {
+        f->eof = true;
+        ub->done = true;
+    } else {
+        ub->filled += res;
+        if (ub->filled < ub->len && !f->eof) {
+            uring_queue_buf(e, b);
+            return;
+        }
+        ub->done = true;
+    }
+
+    uring_drain_file(e, f);
+}
+
+// Cancel every read still in flight and wait for all of them to come back,
+// so the kernel is done with the buffers. Returns false if the ring stops
+// answering first.
+static bool
+uring_quiesce(struct uring_engine *const e)
+{
+    struct uring *const r = &e->ring;
+    unsigned const entries = r->sq_mask + 1;
+
+    while (e->inflight > 0) {
+        for (unsigned b = 0; b < e->depth; ++b) {
+            struct uring_buf *const ub = &e->bufs[b];
+            unsigned const used = *r->sq_tail + r->sq_pending - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+            if (used == entries) {
+                break;
+            }
+            if (ub->file == NULL || ub->done || ub->cancelled) {
+                continue;
+            }
+            unsigned const idx = (*r->sq_tail + r->sq_pending) & r->sq_mask;
+            struct io_uring_sqe *const sqe = &r->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = b;
+            sqe->user_data = UINT64_MAX;
+            r->sq_array[idx] = idx;
+            ++r->sq_pending;
+            ub->cancelled = true;
+        }
+
+        if (uring_submit_and_wait(r) != 0) {
+            return false;
+        }
+
+        unsigned head = *r->cq_head;
+        unsigned const tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            uint64_t const user_data = r->cqes[head & r->cq_mask].user_data;
+            if (user_data != UINT64_MAX) {
+                e->bufs[user_data].done = true;
+                --e->inflight;
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+static void
+uring_engine_fini(struct uring_engine *const e)
+{
+    // Reads may still be in flight if the ring failed. Their buffers can't
+    // be freed under the kernel, so they're leaked if it won't give them
+    // back.
+    bool const idle = uring_quiesce(e);
+    uring_teardown(&e->ring);
+    free(e->bufs);
+    free(e->free_bufs);
+    free(e->files);
+    free(e->free_files);
+    if (idle) {
+        free(e->mem);
+    }
+}
+
+static int
+uring_engine_init(struct uring_engine *const e, struct io_shared *const sh)
+{
+    memset(e, 0, sizeof(*e));
+    e->sh = sh;
+    e->depth = sh->opts.queue_depth;
+    e->bufsize = sh->opts.buffer_size;
+
+    int err = uring_setup(&e->ring, e->depth);
+    if (err != 0) {
+        return err;
+    }
+
+    e->bufs = calloc(e->depth, sizeof(*e->bufs));
+    e->free_bufs = calloc(e->depth, sizeof(*e->free_bufs));
+    e->files = calloc(e->depth, sizeof(*e->files));
+    e->free_files = calloc(e->depth, sizeof(*e->free_files));
+    if (e->bufsize > SIZE_MAX / e->depth
+            || posix_memalign((void **)&e->mem, 4096, e->depth * e->bufsize) != 0) {
+        e->mem = NULL;
+    }
+    if (!e->bufs || !e->free_bufs || !e->files || !e->free_files || !e->mem) {
+        err = ENOMEM;
+        goto fail;
+    }
+
+    struct iovec *const iov = calloc(e->depth, sizeof(*iov));
+    if (iov == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    for (unsigned i = 0; i < e->depth; ++i) {
+        iov[i].iov_base = e->mem + i * e->bufsize;
+        iov[i].iov_len = e->bufsize;
+        e->free_bufs[i] = e->depth - 1 - i;
+        e->free_files[i] = &e->files[e->depth - 1 - i];
+    }
+    e->nfree_bufs = e->depth;
+    e->nfree_files = e->depth;
+
+    // Fixed buffers save the kernel mapping them on every read, but count
+    // against RLIMIT_MEMLOCK. Plain reads into the same memory work too.
+    e->fixed = syscall(__NR_io_uring_register, e->ring.fd, IORING_REGISTER_BUFFERS, iov, e->depth) == 0;
+    free(iov);
+
+    return 0;
+
+fail:
+    uring_engine_fini(e);
+    return err;
+}
+
+// Hand free buffers out round robin to the open files that can use them
+static void
+uring_distribute(struct uring_engine *const e, unsigned *const rr)
+{
+    unsigned idle = 0;
+    while (e->nfree_bufs > 0 && idle < e->depth) {
+        struct uring_file *const f = &e->files[*rr];
+        *rr = (*rr + 1) % e->depth;
+        if (uring_file_wants_read(e, f)) {
+            uring_start_read(e, f);
+            idle = 0;
+        } else {
+            ++idle;
+        }
+    }
+}
+
+static int
+uring_engine_run(struct uring_engine *const e)
+{
+    bool more_files = true;
+    unsigned rr = 0;
+
+    for (;;) {
+        // Open more files only when the ones already open can't keep every
+        // buffer busy.
+        uring_distribute(e, &rr);
+        while (e->nfree_bufs > 0 && e->nfree_files > 0 && more_files) {
+            more_files = uring_open_next(e);
+            uring_distribute(e, &rr);
+        }
+
+        if (e->nactive == 0 && !more_files) {
+            return 0;
+        }
+
+        uint64_t const t0 = now_ns();
+        int const err = uring_submit_and_wait(&e->ring);
+        e->st.io_ns += now_ns() - t0;
+        if (err != 0) {
+            // Nothing in flight can be trusted now, fail the open files
+            for (unsigned i = 0; i < e->depth; ++i) {
+                struct uring_file *const f = &e->files[i];
+                if (f->active) {
+                    f->err = err;
+                    uring_finish_file(e, f);
+                }
+            }
+            return err;
+        }
+
+        unsigned head = *e->ring.cq_head;
+        unsigned const tail = __atomic_load_n(e->ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe const*const cqe = &e->ring.cqes[head & e->ring.cq_mask];
+            unsigned const b = cqe->user_data;
+            int const res = cqe->res;
+            // Let the kernel reuse the entry before we (maybe) queue more
+            __atomic_store_n(e->ring.cq_head, head + 1, __ATOMIC_RELEASE);
+            --e->inflight;
+            uring_complete(e, b, res);
+        }
+    }
+}
+
+static void *
+uring_worker(void *const arg)
+{
+    struct io_shared *const sh = arg;
+    struct uring_engine e;
+
+    int err = uring_engine_init(&e, sh);
+    if (err == 0) {
+        err = uring_engine_run(&e);
+        add_stats(sh, &e.st);
+        uring_engine_fini(&e);
+    }
+    if (err != 0) {
+        // This ring is no use, but the files still need hashing
+        struct spooky_io_stats st = {0};
+        uint8_t *buf = NULL;
+        if (posix_memalign((void **)&buf, 4096, sh->opts.buffer_size) != 0) {
+            buf = NULL;
+        }
+        for (;;) {
+            size_t const i = __atomic_fetch_add(&sh->next, 1, __ATOMIC_RELAXED);
+            if (i >= sh->n) {
+                break;
+            }
+            struct spooky_io_result *const res = &sh->results[i];
+            res->err = buf ? pread_file(sh->paths[i], buf, sh->opts.buffer_size, &sh->opts, res, &st) : ENOMEM;
+        }
+        free(buf);
+        add_stats(sh, &st);
+    }
+    return NULL;
+}
+
+static bool
+uring_available(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int const fd = syscall(__NR_io_uring_setup, 1, &p);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+int
+spooky_hash_files(char const*const*const paths, size_t const n,
+    struct spooky_io_opts const*const opts, struct spooky_io_result *const results,
+    struct spooky_io_stats *const stats)
+{
+    struct io_shared sh = {
+        .paths = paths,
+        .n = n,
+        .next = 0,
+        .results = results,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    if (opts != NULL) {
+        sh.opts = *opts;
+    }
+    if (sh.opts.queue_depth == 0) {
+        sh.opts.queue_depth = SPOOKY_IO_QUEUE_DEPTH;
+    }
+    if (sh.opts.buffer_size == 0) {
+        sh.opts.buffer_size = SPOOKY_IO_BUFFER_SIZE;
+    }
+    // An SQE's length is 32 bits, and the kernel won't register a bigger
+    // buffer anyway
+    if (sh.opts.buffer_size > SPOOKY_IO_MAX_BUFFER_SIZE) {
+        sh.opts.buffer_size = SPOOKY_IO_MAX_BUFFER_SIZE;
+    }
+    if (sh.opts.nthreads == 0) {
+        long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        sh.opts.nthreads = ncpus > 0 ? ncpus : 1;
+    }
+    if (sh.opts.nthreads > n) {
+        sh.opts.nthreads = n ? n : 1;
+    }
+
+    enum spooky_io_engine engine = sh.opts.engine;
+    if (engine == SPOOKY_IO_AUTO || engine == SPOOKY_IO_URING) {
+        engine = uring_available() ? SPOOKY_IO_URING : SPOOKY_IO_PREAD;
+    }
+    void *(*const worker)(void *) = (engine == SPOOKY_IO_URING) ? uring_worker : pread_worker;
+
+    pthread_t *const threads = calloc(sh.opts.nthreads, sizeof(pthread_t));
+    if (threads == NULL) {
+        return -1;
+    }
+    unsigned nstarted = 0;
+    for (; nstarted + 1 < sh.opts.nthreads; ++nstarted) {
+        if (pthread_create(&threads[nstarted], NULL, worker, &sh) != 0) {
+            break;
+        }
+    }
+    // This thread is a worker too
+    worker(&sh);
+    for (unsigned i = 0; i < nstarted; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (stats != NULL) {
+        *stats = sh.stats;
+    }
+    return engine;
+}
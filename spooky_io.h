@@ -0,0 +1,57 @@
+#pragma once
+// Spooky Hash
+// Hashing whole files, with the reads done asynchronously through io_uring,
+// or by a pool of threads calling pread() where io_uring isn't available.
+// Either way a file is read until a read returns nothing, not just to its
+// st_size, so procfs files, pipes and files still being written hash whole.
+
+#include "spooky.h"
+
+enum spooky_io_engine {
+    // io_uring if the kernel lets us have it, otherwise pread
+    SPOOKY_IO_AUTO,
+    SPOOKY_IO_URING,
+    SPOOKY_IO_PREAD,
+};
+
+struct spooky_io_opts {
+    enum spooky_io_engine engine;
+    // Reads kept in flight by each io_uring thread, 0 for the default
+    unsigned queue_depth;
+    // Size of each read, and of each registered buffer, 0 for the default.
+    // Bigger than SPOOKY_IO_MAX_BUFFER_SIZE is taken as that.
+    size_t buffer_size;
+    // Worker threads, each with its own ring for io_uring. 0 is one per
+    // online CPU.
+    unsigned nthreads;
+    uint64_t seed0;
+    uint64_t seed1;
+};
+
+#define SPOOKY_IO_QUEUE_DEPTH 64
+#define SPOOKY_IO_BUFFER_SIZE (UINT64_C(128) << 10)
+#define SPOOKY_IO_MAX_BUFFER_SIZE (UINT64_C(1) << 30)
+
+struct spooky_io_result {
+    uint64_t h1;
+    uint64_t h2;
+    // 0, or the errno that stopped the file being hashed
+    int err;
+};
+
+// Summed over all worker threads
+struct spooky_io_stats {
+    uint64_t bytes;
+    // Time spent blocked waiting for reads to finish
+    uint64_t io_ns;
+    // Time spent in spooky_update
+    uint64_t hash_ns;
+};
+
+// Hash every file in paths with spooky_hash128 (through a spooky_context_t,
+// with opts->seed0 and opts->seed1) into results[i]. opts may be NULL for
+// the defaults, stats may be NULL. Returns the engine that did the work, or
+// -1 with errno set if it couldn't start at all, in which case results is
+// untouched.
+int spooky_hash_files(char const*const*paths, size_t n, struct spooky_io_opts const*opts,
+    struct spooky_io_result *results, struct spooky_io_stats *stats);
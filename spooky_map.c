@@ -0,0 +1,374 @@
+// Spooky Hash
+// Swiss-table style map. Slots are an array of (value, key) pairs, each with
+// a control byte in a separate array: EMPTY, DELETED, or the low 7 bits of
+// the key's hash when full. A key's probe sequence starts at the slot picked
+// by the rest of the hash and reads 16 control bytes at a time, comparing
+// them all with the key's tag in one SSE2 compare, so keys are only compared
+// where the tag already matches. The first 16 control bytes are mirrored
+// after the last so a group read never has to wrap.
+
+#include <stdlib.h>
+#include <string.h>
+#include "spooky_map.h"
+#include "spooky_inline.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SC_MAP_GROUP 16
+#define SC_MAP_EMPTY ((uint8_t)0x80)
+#define SC_MAP_DELETED ((uint8_t)0xFE)
+// Keys find_many hashes, prefetches and then probes at a time. Enough misses
+// in flight to keep the memory system busy, few enough that the first key's
+// lines are still in cache when it's probed.
+#define SC_MAP_BATCH 16
+
+struct spooky_map {
+    uint8_t *ctrl;
+    uint8_t *slots;
+    size_t mask;
+    size_t size;
+    size_t growth_left;
+    size_t key_width;
+    size_t slot_size;
+    uint64_t seed;
+};
+
+// Same as spooky_hash64, and so as spooky_hash64_keys. Common widths get a
+// constant length, so the inline short path folds down to the mix.
+static inline uint64_t
+map_hash(spooky_map_t const*const m, void const*const key)
+{
+    uint64_t h1 = m->seed;
+    uint64_t h2 = m->seed;
+    switch (m->key_width) {
+        case 4:
+            spooky_hash128_inline(key, 4, &h1, &h2);
+            break;
+        case 8:
+            spooky_hash128_inline(key, 8, &h1, &h2);
+            break;
+        case 16:
+            spooky_hash128_inline(key, 16, &h1, &h2);
+            break;
+        case 32:
+            spooky_hash128_inline(key, 32, &h1, &h2);
+            break;
+        default:
+            spooky_hash128(key, m->key_width, &h1, &h2);
+            break;
+    }
+    return h1;
+}
+
+static inline bool
+map_key_eq(spooky_map_t const*const m, uint8_t const*const a, uint8_t const*const b)
+{
+    switch (m->key_width) {
+        case 8:
+            return spooky_inline_rd64(a) == spooky_inline_rd64(b);
+        case 16:
+            return ((spooky_inline_rd64(a) ^ spooky_inline_rd64(b))
+                | (spooky_inline_rd64(a + 8) ^ spooky_inline_rd64(b + 8))) == 0;
+        default:
+            return memcmp(a, b, m->key_width) == 0;
+    }
+}
+
+static inline uint8_t
+map_tag(uint64_t const h)
+{
+    return h & 0x7F;
+}
+
+static inline size_t
+map_start(spooky_map_t const*const m, uint64_t const h)
+{
+    return (h >> 7) & m->mask;
+}
+
+static inline uint8_t *
+map_slot(spooky_map_t const*const m, size_t const i)
+{
+    return m->slots + i * m->slot_size;
+}
+
+// Bit i set where control byte i of the group is equal to c
+static inline unsigned
+group_match(uint8_t const*const group, uint8_t const c)
+{
+#ifdef __SSE2__
+    __m128i const g = _mm_loadu_si128((__m128i const*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < SC_MAP_GROUP; ++i) {
+        bits |= (unsigned)(group[i] == c) << i;
+    }
+    return bits;
+#endif
+}
+
+// Bit i set where control byte i is EMPTY or DELETED, the two with the top
+// bit set
+static inline unsigned
+group_match_free(uint8_t const*const group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i const*)group));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < SC_MAP_GROUP; ++i) {
+        bits |= (unsigned)(group[i] >> 7) << i;
+    }
+    return bits;
+#endif
+}
+
+static inline void
+map_set_ctrl(spooky_map_t *const m, size_t const i, uint8_t const c)
+{
+    m->ctrl[i] = c;
+    if (i < SC_MAP_GROUP) {
+        m->ctrl[m->mask + 1 + i] = c;
+    }
+}
+
+// Index of key's slot, or SIZE_MAX. Groups are probed at triangular offsets,
+// which visits every group of a power of two table before repeating, and the
+// table always has an EMPTY slot to stop at.
+static inline size_t
+map_lookup(spooky_map_t const*const m, void const*const key, uint64_t const h)
+{
+    uint8_t const tag = map_tag(h);
+    size_t pos = map_start(m, h);
+    for (size_t stride = SC_MAP_GROUP; ; stride += SC_MAP_GROUP) {
+        uint8_t const*const group = m->ctrl + pos;
+        for (unsigned bits = group_match(group, tag); bits != 0; bits &= bits - 1) {
+            size_t const i = (pos + __builtin_ctz(bits)) & m->mask;
+            if (map_key_eq(m, map_slot(m, i) + 8, key)) {
+                return i;
+            }
+        }
+        if (group_match(group, SC_MAP_EMPTY) != 0) {
+            return SIZE_MAX;
+        }
+        pos = (pos + stride) & m->mask;
+    }
+}
+
+// First EMPTY or DELETED slot on h's probe sequence
+static inline size_t
+map_find_free(spooky_map_t const*const m, uint64_t const h)
+{
+    size_t pos = map_start(m, h);
+    for (size_t stride = SC_MAP_GROUP; ; stride += SC_MAP_GROUP) {
+        unsigned const bits = group_match_free(m->ctrl + pos);
+        if (bits != 0) {
+            return (pos + __builtin_ctz(bits)) & m->mask;
+        }
+        pos = (pos + stride) & m->mask;
+    }
+}
+
+static bool
+map_alloc(spooky_map_t *const m, size_t const capacity)
+{
+    size_t const ctrl_size = (capacity + SC_MAP_GROUP + 63) & ~(size_t)63;
+    size_t slots_size;
+    if (__builtin_mul_overflow(capacity, m->slot_size, &slots_size)
+        || slots_size > SIZE_MAX - ctrl_size) {
+        return false;
+    }
+    uint8_t *const mem = aligned_alloc(64, ctrl_size + slots_size);
+    if (mem == NULL) {
+        return false;
+    }
+    memset(mem, SC_MAP_EMPTY, capacity + SC_MAP_GROUP);
+
+    m->ctrl = mem;
+    m->slots = mem + ctrl_size;
+    m->mask = capacity - 1;
+    m->growth_left = capacity - capacity / 8;
+    return true;
+}
+
+// Move every key into a fresh table of capacity slots, which also clears out
+// the tombstones
+static bool
+map_rehash(spooky_map_t *const m, size_t const capacity)
+{
+    spooky_map_t const old = *m;
+    if (!map_alloc(m, capacity)) {
+        *m = old;
+        return false;
+    }
+
+    for (size_t i = 0; i <= old.mask; ++i) {
+        if (old.ctrl[i] & 0x80) {
+            continue;
+        }
+        uint8_t const*const slot = map_slot(&old, i);
+        uint64_t const h = map_hash(m, slot + 8);
+        size_t const j = map_find_free(m, h);
+        map_set_ctrl(m, j, map_tag(h));
+        memcpy(map_slot(m, j), slot, m->slot_size);
+    }
+    m->growth_left -= m->size;
+
+    free(old.ctrl);
+    return true;
+}
+
+spooky_map_t *
+spooky_map_new(size_t const key_width, size_t const nkeys, uint64_t const seed)
+{
+    if (key_width == 0 || key_width > SIZE_MAX / 2) {
+        return NULL;
+    }
+
+    size_t capacity = SC_MAP_GROUP;
+    while (capacity - capacity / 8 < nkeys) {
+        if (capacity > SIZE_MAX / 4) {
+            return NULL;
+        }
+        capacity *= 2;
+    }
+
+    spooky_map_t *const m = malloc(sizeof(*m));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->size = 0;
+    m->key_width = key_width;
+    m->slot_size = 8 + ((key_width + 7) & ~(size_t)7);
+    m->seed = seed;
+    if (!map_alloc(m, capacity)) {
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+void
+spooky_map_free(spooky_map_t *const m)
+{
+    if (m != NULL) {
+        free(m->ctrl);
+        free(m);
+    }
+}
+
+size_t
+spooky_map_size(spooky_map_t const*const m)
+{
+    return m->size;
+}
+
+size_t
+spooky_map_capacity(spooky_map_t const*const m)
+{
+    return m->mask + 1;
+}
+
+bool
+spooky_map_insert(spooky_map_t *const m, void const*const key, uint64_t const value)
+{
+    uint64_t const h = map_hash(m, key);
+    size_t i = map_lookup(m, key, h);
+    if (i != SIZE_MAX) {
+        __builtin_memcpy(map_slot(m, i), &value, 8);
+        return true;
+    }
+
+    if (m->growth_left == 0) {
+        // Out of EMPTY slots. If tombstones hold at least 3/32 of them, a
+        // rehash at the same size frees those up, otherwise the table doubles.
+        size_t const capacity = m->mask + 1;
+        size_t const new_capacity = m->size > capacity / 32 * 25 ? 2 * capacity : capacity;
+        if (new_capacity < capacity || !map_rehash(m, new_capacity)) {
+            return false;
+        }
+    }
+
+    i = map_find_free(m, h);
+    if (m->ctrl[i] == SC_MAP_EMPTY) {
+        --m->growth_left;
+    }
+    map_set_ctrl(m, i, map_tag(h));
+    uint8_t *const slot = map_slot(m, i);
+    __builtin_memcpy(slot, &value, 8);
+    memcpy(slot + 8, key, m->key_width);
+    ++m->size;
+    return true;
+}
+
+bool
+spooky_map_find(spooky_map_t const*const m, void const*const key, uint64_t *const value)
+{
+    size_t const i = map_lookup(m, key, map_hash(m, key));
+    if (i == SIZE_MAX) {
+        return false;
+    }
+    if (value != NULL) {
+        __builtin_memcpy(value, map_slot(m, i), 8);
+    }
+    return true;
+}
+
+bool
+spooky_map_erase(spooky_map_t *const m, void const*const key)
+{
+    size_t const i = map_lookup(m, key, map_hash(m, key));
+    if (i == SIZE_MAX) {
+        return false;
+    }
+
+    // A probe only carries on past a group with no EMPTY slot. If slot i has
+    // never been inside such a window of 16, no probe went past it and it
+    // can go straight back to EMPTY instead of leaving a tombstone.
+    unsigned const empty_before = group_match(m->ctrl + ((i - SC_MAP_GROUP) & m->mask), SC_MAP_EMPTY);
+    unsigned const empty_after = group_match(m->ctrl + i, SC_MAP_EMPTY);
+    if (empty_before != 0 && empty_after != 0
+        && __builtin_ctz(empty_after) + __builtin_clz(empty_before << 16) < SC_MAP_GROUP) {
+        map_set_ctrl(m, i, SC_MAP_EMPTY);
+        ++m->growth_left;
+    } else {
+        map_set_ctrl(m, i, SC_MAP_DELETED);
+    }
+    --m->size;
+    return true;
+}
+
+size_t
+spooky_map_find_many(spooky_map_t const*const m, void const*const keys, size_t const nkeys,
+    uint64_t *const values, bool *const found)
+{
+    uint8_t const*const lkeys = keys;
+    size_t nfound = 0;
+
+    for (size_t first = 0; first < nkeys; first += SC_MAP_BATCH) {
+        size_t const left = nkeys - first;
+        size_t const count = left < SC_MAP_BATCH ? left : SC_MAP_BATCH;
+        uint8_t const*const batch = lkeys + first * m->key_width;
+        uint64_t h[SC_MAP_BATCH];
+
+        spooky_hash64_keys(batch, m->key_width, count, m->seed, h);
+        for (size_t k = 0; k < count; ++k) {
+            size_t const pos = map_start(m, h[k]);
+            __builtin_prefetch(m->ctrl + pos);
+            __builtin_prefetch(map_slot(m, pos));
+        }
+
+        for (size_t k = 0; k < count; ++k) {
+            size_t const i = map_lookup(m, batch + k * m->key_width, h[k]);
+            found[first + k] = i != SIZE_MAX;
+            if (i != SIZE_MAX) {
+                __builtin_memcpy(&values[first + k], map_slot(m, i), 8);
+                ++nfound;
+            }
+        }
+    }
+    return nfound;
+}
@@ -0,0 +1,44 @@
+#pragma once
+// Spooky Hash
+// An open-addressing hash map from fixed-width keys to uint64_t values, in
+// the style of a Swiss table: one control byte per slot holding 7 bits of the
+// key's spooky_hash64 (or empty/deleted), probed 16 at a time with SSE2, so
+// most lookups touch one group of control bytes and one slot.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct spooky_map spooky_map_t;
+
+// A map for keys of key_width bytes, with room for nkeys before it first has
+// to grow. Returns NULL if it can't be allocated.
+spooky_map_t *spooky_map_new(size_t key_width, size_t nkeys, uint64_t seed);
+void spooky_map_free(spooky_map_t *m);
+
+size_t spooky_map_size(spooky_map_t const*m);
+// Number of slots, the map grows once it's 7/8 full
+size_t spooky_map_capacity(spooky_map_t const*m);
+
+// Insert key, or replace its value if it's already there. Returns false, and
+// changes nothing, if the map needed to grow and couldn't.
+bool spooky_map_insert(spooky_map_t *m, void const*key, uint64_t value);
+// Returns whether key is in the map, and its value through value (which may
+// be NULL) if it is.
+bool spooky_map_find(spooky_map_t const*m, void const*key, uint64_t *value);
+// Returns whether key was there to erase
+bool spooky_map_erase(spooky_map_t *m, void const*key);
+
+// Look up nkeys keys stored back to back. found[i] says whether key i is in
+// the map, values[i] is its value if so. The keys are hashed together (with
+// the SIMD kernels of spooky_hash64_keys where there are some) and their
+// control bytes and slots prefetched before any of them is probed, so the
+// cache misses of a big map overlap. Returns the number found.
+size_t spooky_map_find_many(spooky_map_t const*m, void const*keys, size_t nkeys,
+    uint64_t *values, bool *found);
+
+#ifdef __cplusplus
+}
+#endif
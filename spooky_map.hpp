@@ -0,0 +1,70 @@
+#pragma once
+// Spooky Hash
+// spooky::flat_map<Key>, a C++ wrapper of the spooky_map_t C API. Keys are
+// stored and hashed as their bytes, so they have to be trivially copyable
+// with no padding; values are uint64_t, as in the C API.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+
+#include "spooky_map.h"
+
+namespace spooky {
+
+template <class Key>
+class flat_map {
+    static_assert(std::is_trivially_copyable_v<Key> && std::has_unique_object_representations_v<Key>,
+        "flat_map keys are hashed and compared as bytes");
+
+public:
+    explicit flat_map(std::size_t const nkeys = 0, std::uint64_t const seed = 0)
+        : m_map(spooky_map_new(sizeof(Key), nkeys, seed))
+    {
+        if (!m_map) {
+            throw std::bad_alloc();
+        }
+    }
+
+    std::size_t size() const noexcept { return spooky_map_size(m_map.get()); }
+    bool empty() const noexcept { return size() == 0; }
+    std::size_t capacity() const noexcept { return spooky_map_capacity(m_map.get()); }
+
+    // Insert or overwrite
+    void insert(Key const& key, std::uint64_t const value)
+    {
+        if (!spooky_map_insert(m_map.get(), &key, value)) {
+            throw std::bad_alloc();
+        }
+    }
+
+    std::optional<std::uint64_t> find(Key const& key) const noexcept
+    {
+        std::uint64_t value;
+        if (spooky_map_find(m_map.get(), &key, &value)) {
+            return value;
+        }
+        return std::nullopt;
+    }
+
+    bool contains(Key const& key) const noexcept { return spooky_map_find(m_map.get(), &key, nullptr); }
+    bool erase(Key const& key) noexcept { return spooky_map_erase(m_map.get(), &key); }
+
+    // See spooky_map_find_many
+    std::size_t find_many(Key const*const keys, std::size_t const nkeys, std::uint64_t *const values,
+        bool *const found) const noexcept
+    {
+        return spooky_map_find_many(m_map.get(), keys, nkeys, values, found);
+    }
+
+private:
+    struct deleter {
+        void operator()(spooky_map_t *const m) const noexcept { spooky_map_free(m); }
+    };
+    std::unique_ptr<spooky_map_t, deleter> m_map;
+};
+
+} // namespace spooky
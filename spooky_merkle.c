@@ -0,0 +1,387 @@
+// Spooky Hash
+// Merkle trees. The levels are stored bottom up in one array of (h1, h2)
+// pairs, so a node's two children are next to each other and are hashed
+// where they lie, 32 bytes at a time. A node without a right sibling is
+// carried up unchanged. Leaves are seeded (seed, seed) and interior nodes
+// (seed, ~seed), so a block can't pass for a pair of hashes.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "spooky_merkle.h"
+
+// Nodes hashed together with spooky_hash128_multi
+#define SC_MERKLE_BATCH 16
+#define SC_MERKLE_MAX_LEVELS 64
+#define SC_MERKLE_HEADER 28
+
+struct spooky_merkle {
+    uint64_t len;
+    size_t block_size;
+    uint64_t seed;
+    unsigned nlevels;
+    // Where each level starts in nodes, and how many nodes it has
+    size_t level_first[SC_MERKLE_MAX_LEVELS];
+    size_t level_n[SC_MERKLE_MAX_LEVELS];
+    uint64_t *nodes;
+};
+
+static void
+put_le64(uint8_t *const dst, uint64_t const v)
+{
+    for (int i = 0; i < 8; ++i) {
+        dst[i] = v >> (8 * i);
+    }
+}
+
+static uint64_t
+get_le64(uint8_t const*const src)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v |= (uint64_t)src[i] << (8 * i);
+    }
+    return v;
+}
+
+static inline uint64_t
+merkle_nblocks(uint64_t const len, uint64_t const block_size)
+{
+    return len == 0 ? 1 : (len - 1) / block_size + 1;
+}
+
+// A tree of the right shape with nothing hashed yet
+static spooky_merkle_t *
+merkle_alloc(uint64_t const len, size_t block_size, uint64_t const seed)
+{
+    if (block_size == 0) {
+        block_size = SPOOKY_MERKLE_BLOCK;
+    }
+    uint64_t const nblocks = merkle_nblocks(len, block_size);
+    if (nblocks > SIZE_MAX / (4 * sizeof(uint64_t))) {
+        return NULL;
+    }
+
+    spooky_merkle_t *const m = malloc(sizeof(*m));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->len = len;
+    m->block_size = block_size;
+    m->seed = seed;
+    m->nlevels = 0;
+
+    size_t total = 0;
+    for (size_t n = nblocks; ; n = (n + 1) / 2) {
+        m->level_first[m->nlevels] = total;
+        m->level_n[m->nlevels] = n;
+        ++m->nlevels;
+        total += n;
+        if (n == 1) {
+            break;
+        }
+    }
+
+    m->nodes = malloc(2 * total * sizeof(uint64_t));
+    if (m->nodes == NULL) {
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+static inline uint64_t *
+merkle_node(spooky_merkle_t const*const m, unsigned const level, size_t const i)
+{
+    return m->nodes + 2 * (m->level_first[level] + i);
+}
+
+// Hash blocks [first, last] of data into h1/h2[0..]
+static void
+merkle_hash_blocks(spooky_merkle_t const*const m, uint8_t const*const data, size_t const first,
+    size_t const last, uint64_t *const h1, uint64_t *const h2)
+{
+    void const*msgs[SC_MERKLE_BATCH];
+    size_t lens[SC_MERKLE_BATCH];
+
+    for (size_t b = first; b <= last; ++b) {
+        uint64_t const off = (uint64_t)b * m->block_size;
+        uint64_t const remaining = m->len - off;
+        msgs[b - first] = data + off;
+        lens[b - first] = remaining < m->block_size ? remaining : m->block_size;
+        h1[b - first] = m->seed;
+        h2[b - first] = m->seed;
+    }
+    spooky_hash128_multi(msgs, lens, last - first + 1, h1, h2);
+}
+
+// Rehash leaves [first, last] of data
+static void
+merkle_hash_leaves(spooky_merkle_t *const m, uint8_t const*const data, size_t const first,
+    size_t const last)
+{
+    for (size_t b = first; b <= last; b += SC_MERKLE_BATCH) {
+        size_t const end = last - b < SC_MERKLE_BATCH ? last : b + SC_MERKLE_BATCH - 1;
+        uint64_t h1[SC_MERKLE_BATCH];
+        uint64_t h2[SC_MERKLE_BATCH];
+        merkle_hash_blocks(m, data, b, end, h1, h2);
+        for (size_t i = b; i <= end; ++i) {
+            merkle_node(m, 0, i)[0] = h1[i - b];
+            merkle_node(m, 0, i)[1] = h2[i - b];
+        }
+    }
+}
+
+// Rehash every interior node above leaves [first, last]
+static void
+merkle_hash_interior(spooky_merkle_t *const m, size_t first, size_t last)
+{
+    for (unsigned level = 1; level < m->nlevels; ++level) {
+        first /= 2;
+        last /= 2;
+        size_t const nchildren = m->level_n[level - 1];
+
+        for (size_t p = first; p <= last; p += SC_MERKLE_BATCH) {
+            size_t const end = last - p < SC_MERKLE_BATCH ? last : p + SC_MERKLE_BATCH - 1;
+            void const*msgs[SC_MERKLE_BATCH];
+            size_t lens[SC_MERKLE_BATCH];
+            uint64_t h1[SC_MERKLE_BATCH];
+            uint64_t h2[SC_MERKLE_BATCH];
+            size_t count = 0;
+
+            for (size_t i = p; i <= end; ++i) {
+                if (2 * i + 1 < nchildren) {
+                    msgs[count] = merkle_node(m, level - 1, 2 * i);
+                    lens[count] = 4 * sizeof(uint64_t);
+                    h1[count] = m->seed;
+                    h2[count] = ~m->seed;
+                    ++count;
+                }
+            }
+            spooky_hash128_multi(msgs, lens, count, h1, h2);
+
+            count = 0;
+            for (size_t i = p; i <= end; ++i) {
+                uint64_t *const node = merkle_node(m, level, i);
+                if (2 * i + 1 < nchildren) {
+                    node[0] = h1[count];
+                    node[1] = h2[count];
+                    ++count;
+                } else {
+                    __builtin_memcpy(node, merkle_node(m, level - 1, 2 * i), 2 * sizeof(uint64_t));
+                }
+            }
+        }
+    }
+}
+
+spooky_merkle_t *
+spooky_merkle_new(void const*const data, uint64_t const len, size_t const block_size,
+    uint64_t const seed)
+{
+    spooky_merkle_t *const m = merkle_alloc(len, block_size, seed);
+    if (m != NULL) {
+        merkle_hash_leaves(m, data, 0, m->level_n[0] - 1);
+        merkle_hash_interior(m, 0, m->level_n[0] - 1);
+    }
+    return m;
+}
+
+void
+spooky_merkle_free(spooky_merkle_t *const m)
+{
+    if (m != NULL) {
+        free(m->nodes);
+        free(m);
+    }
+}
+
+uint64_t
+spooky_merkle_len(spooky_merkle_t const*const m)
+{
+    return m->len;
+}
+
+size_t
+spooky_merkle_nblocks(spooky_merkle_t const*const m)
+{
+    return m->level_n[0];
+}
+
+void
+spooky_merkle_root(spooky_merkle_t const*const m, uint64_t *const h1, uint64_t *const h2)
+{
+    uint64_t const*const top = merkle_node(m, m->nlevels - 1, 0);
+    uint64_t const words[4] = {top[0], top[1], m->len, m->block_size};
+    *h1 = m->seed;
+    *h2 = m->seed;
+    spooky_hash128(words, sizeof(words), h1, h2);
+}
+
+// The blocks [*first, *last] that bytes [offset, offset+len) touch. false
+// if the range is outside the tree or empty.
+static bool
+merkle_blocks_of(spooky_merkle_t const*const m, uint64_t const offset, uint64_t const len,
+    size_t *const first, size_t *const last)
+{
+    if (len == 0) {
+        return false;
+    }
+    *first = offset / m->block_size;
+    *last = (offset + len - 1) / m->block_size;
+    return true;
+}
+
+bool
+spooky_merkle_update_range(spooky_merkle_t *const m, void const*const data, uint64_t const offset,
+    uint64_t const len)
+{
+    if (offset > m->len || len > m->len - offset) {
+        return false;
+    }
+    size_t first;
+    size_t last;
+    if (merkle_blocks_of(m, offset, len, &first, &last)) {
+        merkle_hash_leaves(m, data, first, last);
+        merkle_hash_interior(m, first, last);
+    }
+    return true;
+}
+
+bool
+spooky_merkle_verify_range(spooky_merkle_t const*const m, void const*const data,
+    uint64_t const offset, uint64_t const len)
+{
+    if (offset > m->len || len > m->len - offset) {
+        return false;
+    }
+    size_t first;
+    size_t last;
+    if (!merkle_blocks_of(m, offset, len, &first, &last)) {
+        return true;
+    }
+
+    for (size_t b = first; b <= last; b += SC_MERKLE_BATCH) {
+        size_t const end = last - b < SC_MERKLE_BATCH ? last : b + SC_MERKLE_BATCH - 1;
+        uint64_t h1[SC_MERKLE_BATCH];
+        uint64_t h2[SC_MERKLE_BATCH];
+        merkle_hash_blocks(m, data, b, end, h1, h2);
+        for (size_t i = b; i <= end; ++i) {
+            uint64_t const*const leaf = merkle_node(m, 0, i);
+            if (leaf[0] != h1[i - b] || leaf[1] != h2[i - b]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool
+spooky_merkle_save(spooky_merkle_t const*const m, char const*const path)
+{
+    size_t const nblocks = m->level_n[0];
+    size_t const size = SC_MERKLE_HEADER + 16 * (nblocks + 1);
+    size_t const path_len = strlen(path);
+    char *const tmp = malloc(path_len + 5);
+    uint8_t *const buf = malloc(size);
+    bool ok = false;
+
+    if (tmp != NULL && buf != NULL) {
+        buf[0] = 'M';
+        buf[1] = SPOOKY_MERKLE_VERSION;
+        buf[2] = 0;
+        buf[3] = 0;
+        put_le64(buf + 4, m->len);
+        put_le64(buf + 12, m->block_size);
+        put_le64(buf + 20, m->seed);
+        for (size_t i = 0; i < 2 * nblocks; ++i) {
+            put_le64(buf + SC_MERKLE_HEADER + 8 * i, m->nodes[i]);
+        }
+        uint64_t h1;
+        uint64_t h2;
+        spooky_merkle_root(m, &h1, &h2);
+        put_le64(buf + size - 16, h1);
+        put_le64(buf + size - 8, h2);
+
+        memcpy(tmp, path, path_len);
+        memcpy(tmp + path_len, ".tmp", 5);
+        FILE *const f = fopen(tmp, "wb");
+        if (f != NULL) {
+            ok = fwrite(buf, 1, size, f) == size && fflush(f) == 0 && fsync(fileno(f)) == 0;
+            ok = fclose(f) == 0 && ok;
+            ok = ok && rename(tmp, path) == 0;
+            if (!ok) {
+                int const saved = errno;
+                unlink(tmp);
+                errno = saved;
+            }
+        }
+    } else {
+        errno = ENOMEM;
+    }
+
+    free(buf);
+    free(tmp);
+    return ok;
+}
+
+spooky_merkle_t *
+spooky_merkle_load(char const*const path)
+{
+    FILE *const f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    spooky_merkle_t *m = NULL;
+    uint8_t *buf = NULL;
+    uint8_t header[SC_MERKLE_HEADER];
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || fread(header, 1, sizeof(header), f) != sizeof(header)
+            || header[0] != 'M' || header[1] != SPOOKY_MERKLE_VERSION || header[2] != 0
+            || header[3] != 0) {
+        goto out;
+    }
+
+    uint64_t const len = get_le64(header + 4);
+    uint64_t const block_size = get_le64(header + 12);
+    // Check the size before trusting the header with any memory
+    if (block_size == 0 || block_size > SIZE_MAX
+            || (uint64_t)st.st_size < SC_MERKLE_HEADER + 16
+            || ((uint64_t)st.st_size - SC_MERKLE_HEADER) % 16 != 0
+            || ((uint64_t)st.st_size - SC_MERKLE_HEADER) / 16 - 1 != merkle_nblocks(len, block_size)) {
+        goto out;
+    }
+    m = merkle_alloc(len, block_size, get_le64(header + 20));
+    if (m == NULL) {
+        goto out;
+    }
+
+    size_t const size = 16 * (m->level_n[0] + 1);
+    buf = malloc(size);
+    if (buf == NULL || fread(buf, 1, size, f) != size) {
+        goto fail;
+    }
+    for (size_t i = 0; i < 2 * m->level_n[0]; ++i) {
+        m->nodes[i] = get_le64(buf + 8 * i);
+    }
+    // Rebuild the interior from the leaves, the root must come out the same
+    merkle_hash_interior(m, 0, m->level_n[0] - 1);
+    uint64_t h1;
+    uint64_t h2;
+    spooky_merkle_root(m, &h1, &h2);
+    if (h1 == get_le64(buf + size - 16) && h2 == get_le64(buf + size - 8)) {
+        goto out;
+    }
+
+fail:
+    spooky_merkle_free(m);
+    m = NULL;
+out:
+    free(buf);
+    fclose(f);
+    return m;
+}
@@ -0,0 +1,55 @@
+#pragma once
+// Spooky Hash
+// Merkle trees over fixed-size blocks, for data that is rewritten a little
+// at a time. Leaves are spooky_hash128 of each block and every interior node
+// is spooky_hash128 of its two children's 128-bit hashes, so after a write
+// only the blocks it touched and their ancestors are rehashed, not the whole
+// file. The tree doesn't keep the data, every call that reads it is passed
+// a pointer to all of it (typically a mapping of the file).
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOKY_MERKLE_BLOCK 4096
+
+typedef struct spooky_merkle spooky_merkle_t;
+
+// The tree of the len bytes at data, in block_size byte blocks (0 for
+// SPOOKY_MERKLE_BLOCK). The last block may be shorter, and empty data is one
+// empty block. NULL if it can't be allocated.
+spooky_merkle_t *spooky_merkle_new(void const*data, uint64_t len, size_t block_size, uint64_t seed);
+void spooky_merkle_free(spooky_merkle_t *m);
+
+uint64_t spooky_merkle_len(spooky_merkle_t const*m);
+size_t spooky_merkle_nblocks(spooky_merkle_t const*m);
+// spooky_hash128, with the tree's seed in both halves, of the top node's
+// hash as words h1, h2 followed by the words len and block_size. It depends
+// on the data, block size and seed only, never on the order of updates.
+void spooky_merkle_root(spooky_merkle_t const*m, uint64_t *h1, uint64_t *h2);
+
+// Bytes [offset, offset+len) of data have changed: rehash the blocks they
+// touch and the nodes above them. Returns false, changing nothing, if the
+// range isn't within the tree's length.
+bool spooky_merkle_update_range(spooky_merkle_t *m, void const*data, uint64_t offset, uint64_t len);
+// Whether the blocks that bytes [offset, offset+len) touch still match the
+// tree, without changing it. false for a range outside the tree's length.
+bool spooky_merkle_verify_range(spooky_merkle_t const*m, void const*data, uint64_t offset, uint64_t len);
+
+// Sidecar files hold a header ('M', version, 0, 0), the length, block size
+// and seed as little-endian uint64s, then the leaf hashes and lastly the
+// root, each as two little-endian uint64s: 16 bytes per block. Interior nodes
+// are rebuilt on load, and a file whose root doesn't match is rejected.
+// save writes a temporary file next to path and renames it over path, so a
+// crash leaves the old sidecar or the new one. It returns false, with errno
+// set, if it couldn't. load returns NULL if path can't be read or isn't a
+// valid sidecar of this version.
+#define SPOOKY_MERKLE_VERSION 1
+bool spooky_merkle_save(spooky_merkle_t const*m, char const*path);
+spooky_merkle_t *spooky_merkle_load(char const*path);
+
+#ifdef __cplusplus
+}
+#endif
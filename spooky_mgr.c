@@ -0,0 +1,241 @@
+// Spooky Hash
+// The job manager. A job's blocks are the ring's full block, if it has one,
+// the ring's partial block completed from the job's buffer, and then the
+// buffer's whole blocks in place. Once every lane has a job, or the oldest
+// has waited long enough, the lane kernel mixes them all at once, on copies
+// of the contexts' states, and whatever is left of each buffer becomes its
+// context's new partial block. That can mix a block spooky_update would have
+// left in the ring for later, which spooky_final doesn't notice.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spooky_internal.h"
+#include "spooky_mgr.h"
+
+// Most blocks a job takes through a lane. Longer jobs would keep the other
+// lanes waiting, and already hash well enough on their own.
+#define SC_MGR_LANE_BLOCKS 16
+
+struct mgr_job {
+    spooky_context_t *sc;
+    uint8_t const*buf;
+    size_t len;
+    void *job;
+};
+
+struct spooky_mgr {
+    spooky_mgr_done_fn *done;
+    void *arg;
+    uint64_t max_delay_ns;
+    // When the oldest waiting job was submitted
+    uint64_t first_ns;
+    size_t njobs;
+    struct mgr_job jobs[SC_MAX_LANES];
+};
+
+static uint64_t
+mgr_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+spooky_mgr_t *
+spooky_mgr_new(uint64_t const max_delay_ns, spooky_mgr_done_fn *const done, void *const arg)
+{
+    spooky_mgr_t *const m = malloc(sizeof(*m));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->done = done;
+    m->arg = arg;
+    m->max_delay_ns = max_delay_ns;
+    m->first_ns = 0;
+    m->njobs = 0;
+    return m;
+}
+
+void
+spooky_mgr_free(spooky_mgr_t *const m)
+{
+    if (m == NULL) {
+        return;
+    }
+    spooky_mgr_flush(m);
+    free(m);
+}
+
+// Up to nlanes jobs through the lane kernel, the lanes past n idle. The
+// callbacks are left to the caller.
+static void
+mgr_run_lanes(struct spooky_ops const*const ops, struct mgr_job const*const jobs, size_t const n)
+{
+    size_t const nlanes = ops->nlanes;
+    uint64_t *states[SC_MAX_LANES];
+    // The kernels want 12 words in an array, the context has 12 members
+    uint64_t lane_states[SC_MAX_LANES][SC_NUMVARS];
+    uint8_t const*blocks[(SC_MGR_LANE_BLOCKS + 1) * SC_MAX_LANES];
+    size_t nblocks[SC_MAX_LANES];
+    size_t used[SC_MAX_LANES];
+    uint64_t idle[SC_NUMVARS] = {0};
+
+    for (size_t i = 0; i < nlanes; ++i) {
+        if (i >= n) {
+            states[i] = idle;
+            nblocks[i] = 0;
+            continue;
+        }
+
+        spooky_context_t *const sc = jobs[i].sc;
+        uint8_t *const ring = (uint8_t *)sc->m_unhashed;
+        size_t head = sc->m_head;
+        size_t partial = sc->m_partial;
+        size_t nb = 0;
+        size_t u = 0;
+
+        if (partial >= SC_BLOCKSIZE) {
+            blocks[nb++ * nlanes + i] = ring + head;
+            head ^= SC_BLOCKSIZE;
+            partial -= SC_BLOCKSIZE;
+        }
+        if (partial > 0) {
+            u = SC_BLOCKSIZE - partial;
+            __builtin_memcpy(ring + head + partial, jobs[i].buf, u);
+            blocks[nb++ * nlanes + i] = ring + head;
+        }
+        for (; jobs[i].len - u >= SC_BLOCKSIZE; u += SC_BLOCKSIZE) {
+            blocks[nb++ * nlanes + i] = jobs[i].buf + u;
+        }
+
+        sc->m_use_short = false;
+        uint64_t *const st = lane_states[i];
+        st[0] = sc->s0;
+        st[1] = sc->s1;
+        st[2] = sc->s2;
+        st[3] = sc->s3;
+        st[4] = sc->s4;
+        st[5] = sc->s5;
+        st[6] = sc->s6;
+        st[7] = sc->s7;
+        st[8] = sc->s8;
+        st[9] = sc->s9;
+        st[10] = sc->s10;
+        st[11] = sc->s11;
+        states[i] = st;
+        nblocks[i] = nb;
+        used[i] = u;
+    }
+
+    ops->mix_lanes(states, blocks, nblocks);
+
+    for (size_t i = 0; i < n; ++i) {
+        spooky_context_t *const sc = jobs[i].sc;
+        uint64_t const*const st = lane_states[i];
+        sc->s0 = st[0];
+        sc->s1 = st[1];
+        sc->s2 = st[2];
+        sc->s3 = st[3];
+        sc->s4 = st[4];
+        sc->s5 = st[5];
+        sc->s6 = st[6];
+        sc->s7 = st[7];
+        sc->s8 = st[8];
+        sc->s9 = st[9];
+        sc->s10 = st[10];
+        sc->s11 = st[11];
+        sc->m_head = 0;
+        sc->m_partial = jobs[i].len - used[i];
+        __builtin_memcpy(sc->m_unhashed, jobs[i].buf + used[i], sc->m_partial);
+    }
+}
+
+// Complete every waiting job. They're taken off the manager first, and every
+// context is brought up to date before the first callback, so a callback
+// can submit again, to any context.
+static size_t
+mgr_run(spooky_mgr_t *const m)
+{
+    struct mgr_job jobs[SC_MAX_LANES];
+    size_t const n = m->njobs;
+    memcpy(jobs, m->jobs, n * sizeof(*jobs));
+    m->njobs = 0;
+
+    // The variant may have changed since the jobs were queued
+    struct spooky_ops const*const ops = spooky_current_ops();
+    if (ops->mix_lanes == NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            spooky_update(jobs[i].sc, jobs[i].buf, jobs[i].len);
+        }
+    } else {
+        for (size_t first = 0; first < n; first += ops->nlanes) {
+            size_t const count = n - first < ops->nlanes ? n - first : ops->nlanes;
+            mgr_run_lanes(ops, jobs + first, count);
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        m->done(m->arg, jobs[i].sc, jobs[i].job);
+    }
+    return n;
+}
+
+size_t
+spooky_mgr_submit(spooky_mgr_t *const m, spooky_context_t *const sc, void const*const buf,
+    size_t const len, void *const job)
+{
+    size_t ndone = 0;
+
+    // A context's jobs have to be done in order, and one at a time
+    for (size_t i = 0; i < m->njobs; ++i) {
+        if (m->jobs[i].sc == sc) {
+            ndone += mgr_run(m);
+            break;
+        }
+    }
+
+    struct spooky_ops const*const ops = spooky_current_ops();
+    size_t const nblocks = (sc->m_partial + len) / SC_BLOCKSIZE;
+    if (len < (size_t)(SC_BUFSIZE - sc->m_partial) || ops->mix_lanes == NULL
+            || nblocks > SC_MGR_LANE_BLOCKS) {
+        spooky_update(sc, buf, len);
+        m->done(m->arg, sc, job);
+        return ndone + 1;
+    }
+
+    m->jobs[m->njobs++] = (struct mgr_job){sc, buf, len, job};
+    if (m->njobs >= ops->nlanes) {
+        ndone += mgr_run(m);
+    } else if (m->max_delay_ns != 0) {
+        uint64_t const now = mgr_now();
+        if (m->njobs == 1) {
+            m->first_ns = now;
+        } else if (now - m->first_ns >= m->max_delay_ns) {
+            ndone += mgr_run(m);
+        }
+    }
+    return ndone;
+}
+
+size_t
+spooky_mgr_flush(spooky_mgr_t *const m)
+{
+    return mgr_run(m);
+}
+
+size_t
+spooky_mgr_poll(spooky_mgr_t *const m)
+{
+    if (m->njobs == 0 || m->max_delay_ns == 0 || mgr_now() - m->first_ns < m->max_delay_ns) {
+        return 0;
+    }
+    return mgr_run(m);
+}
+
+size_t
+spooky_mgr_pending(spooky_mgr_t const*const m)
+{
+    return m->njobs;
+}
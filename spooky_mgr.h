@@ -0,0 +1,48 @@
+#pragma once
+// Spooky Hash
+// A job manager for many streams that each arrive in small pieces, after the
+// multi-buffer managers of crypto libraries. spooky_update can only mix one
+// stream's blocks one after another. The manager holds on to a piece for each
+// of up to 4 or 8 contexts (as many as the CPU variant has lanes) and mixes
+// their blocks side by side, one context per SIMD lane.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct spooky_mgr spooky_mgr_t;
+
+// Called with the manager's arg once a job is done. sc has taken in all of
+// the job's buffer, exactly as after spooky_update, and sc and the buffer
+// belong to the caller again. job is the pointer given to submit.
+typedef void spooky_mgr_done_fn(void *arg, spooky_context_t *sc, void *job);
+
+// A job waits for the lanes to fill, for a flush, or until it has waited
+// max_delay_ns, checked on every submit and poll. 0 means no time limit.
+// NULL if the manager can't be allocated.
+spooky_mgr_t *spooky_mgr_new(uint64_t max_delay_ns, spooky_mgr_done_fn *done, void *arg);
+// Finishes any jobs still waiting first
+void spooky_mgr_free(spooky_mgr_t *m);
+
+// Hash len bytes at buf into sc, as spooky_update(sc, buf, len) would.
+// Neither sc nor buf may be touched until done is called for the job, which
+// may be during this call. Pieces that don't complete a block, that are
+// too long to be worth a lane, or that come when the CPU variant has no lane
+// kernel are done on the spot. Submitting to a context whose last job is
+// still waiting finishes that job first. Each function returns how many
+// jobs it completed.
+size_t spooky_mgr_submit(spooky_mgr_t *m, spooky_context_t *sc, void const*buf, size_t len,
+    void *job);
+// Complete every waiting job now, whether or not the lanes are full
+size_t spooky_mgr_flush(spooky_mgr_t *m);
+// Complete the waiting jobs if the oldest has waited max_delay_ns, for an
+// event loop to call when it has nothing new to submit
+size_t spooky_mgr_poll(spooky_mgr_t *m);
+// How many jobs are waiting
+size_t spooky_mgr_pending(spooky_mgr_t const*m);
+
+#ifdef __cplusplus
+}
+#endif
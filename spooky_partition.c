@@ -0,0 +1,303 @@
+// Spooky Hash
+// The partitioner. Each thread takes a contiguous run of rows, counts them
+// by partition in the first pass, and scatters them in the second, hashing
+// their keys again rather than keeping 8 bytes a row of hashes around. A
+// thread's slice of each partition starts after the slices of the threads
+// before it, which keeps rows in input order. Rows are gathered a cache line
+// at a time per partition. A full line that lies entirely inside the
+// thread's slice is streamed out in one go. The partial lines at either end
+// of a slice are shared with other slices, and only their own bytes are
+// copied out.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "spooky_partition.h"
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#define SC_PART_LINE 64
+// Keys hashed at a time
+#define SC_PART_BATCH 256
+// Fewest rows worth giving a thread of its own
+#define SC_PART_MIN_ROWS 65536
+
+struct part_job {
+    uint8_t const*rows;
+    size_t row_width;
+    size_t key_offset;
+    size_t key_width;
+    unsigned bits;
+    uint64_t seed;
+    uint8_t *out;
+};
+
+struct part_thread {
+    struct part_job const*job;
+    size_t first;
+    size_t last;
+    bool scatter;
+    // Rows per partition in the first pass, in the second the byte offset in
+    // out of the partition's next row
+    size_t *cursor;
+    // Where the thread's slice of each partition starts in out
+    size_t *begin;
+    // A cache line per partition
+    uint8_t *lines;
+    // The batch's keys back to back, unless they already are
+    uint8_t *keys;
+    pthread_t thread;
+    bool started;
+};
+
+static void
+part_hash(struct part_thread const*const t, size_t const first, size_t const count,
+    uint64_t *const hashes)
+{
+    struct part_job const*const job = t->job;
+    uint8_t const*keys = job->rows + first * job->row_width + job->key_offset;
+    if (t->keys != NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            __builtin_memcpy(t->keys + i * job->key_width, keys + i * job->row_width, job->key_width);
+        }
+        keys = t->keys;
+    }
+    spooky_hash64_keys(keys, job->key_width, count, job->seed, hashes);
+}
+
+// Write a full line of a partition out, past the cache where we can
+__attribute__((always_inline))
+static inline void
+part_stream_line(uint8_t *const dst, uint8_t const*const line)
+{
+#if defined(__x86_64__)
+    for (int i = 0; i < SC_PART_LINE; i += 16) {
+        _mm_stream_si128((__m128i *)(void *)(dst + i), _mm_load_si128((__m128i const*)(void const*)(line + i)));
+    }
+#else
+    __builtin_memcpy(dst, line, SC_PART_LINE);
+#endif
+}
+
+// The line of partition p ending at pos is full
+__attribute__((always_inline))
+static inline void
+part_line_done(struct part_thread const*const t, size_t const p, size_t const pos)
+{
+    uint8_t *const out = t->job->out;
+    uint8_t const*const line = t->lines + p * SC_PART_LINE;
+    size_t const line_pos = pos - SC_PART_LINE;
+    if (line_pos >= t->begin[p]) {
+        part_stream_line(out + line_pos, line);
+    } else {
+        __builtin_memcpy(out + t->begin[p], line + (t->begin[p] - line_pos), pos - t->begin[p]);
+    }
+}
+
+// Add a row of width bytes to partition p. width is a constant after
+// inlining, and a row that fits in what's left of the line is one copy.
+__attribute__((always_inline))
+static inline void
+part_append(struct part_thread *const t, size_t const p, uint8_t const*src, size_t const width)
+{
+    uint8_t *const line = t->lines + p * SC_PART_LINE;
+    size_t pos = t->cursor[p];
+    size_t off = ((uintptr_t)t->job->out + pos) % SC_PART_LINE;
+
+    if (off + width <= SC_PART_LINE) {
+        __builtin_memcpy(line + off, src, width);
+        pos += width;
+        if (off + width == SC_PART_LINE) {
+            part_line_done(t, p, pos);
+        }
+        t->cursor[p] = pos;
+        return;
+    }
+
+    for (size_t left = width; left > 0; off = 0) {
+        size_t const n = left < SC_PART_LINE - off ? left : SC_PART_LINE - off;
+        __builtin_memcpy(line + off, src, n);
+        pos += n;
+        src += n;
+        left -= n;
+        if (off + n == SC_PART_LINE) {
+            part_line_done(t, p, pos);
+        }
+    }
+    t->cursor[p] = pos;
+}
+
+__attribute__((always_inline))
+static inline void
+part_scatter(struct part_thread *const t, size_t const width)
+{
+    struct part_job const*const job = t->job;
+    unsigned const shift = 64 - job->bits;
+    uint64_t hashes[SC_PART_BATCH];
+
+    for (size_t first = t->first; first < t->last; first += SC_PART_BATCH) {
+        size_t const left = t->last - first;
+        size_t const count = left < SC_PART_BATCH ? left : SC_PART_BATCH;
+        part_hash(t, first, count, hashes);
+        uint8_t const*const rows = job->rows + first * width;
+        for (size_t i = 0; i < count; ++i) {
+            part_append(t, hashes[i] >> shift, rows + i * width, width);
+        }
+    }
+}
+
+static void *
+part_worker(void *const arg)
+{
+    struct part_thread *const t = arg;
+    struct part_job const*const job = t->job;
+    size_t const nparts = (size_t)1 << job->bits;
+    unsigned const shift = 64 - job->bits;
+
+    if (!t->scatter) {
+        uint64_t hashes[SC_PART_BATCH];
+        for (size_t first = t->first; first < t->last; first += SC_PART_BATCH) {
+            size_t const left = t->last - first;
+            size_t const count = left < SC_PART_BATCH ? left : SC_PART_BATCH;
+            part_hash(t, first, count, hashes);
+            for (size_t i = 0; i < count; ++i) {
+                t->cursor[hashes[i] >> shift]++;
+            }
+        }
+        return NULL;
+    }
+
+    switch (job->row_width) {
+        case 8:
+            part_scatter(t, 8);
+            break;
+        case 16:
+            part_scatter(t, 16);
+            break;
+        case 32:
+            part_scatter(t, 32);
+            break;
+        default:
+            part_scatter(t, job->row_width);
+            break;
+    }
+
+    // What's left in each line, only the slice's own bytes of it
+    for (size_t p = 0; p < nparts; ++p) {
+        size_t const pos = t->cursor[p];
+        size_t const off = ((uintptr_t)job->out + pos) % SC_PART_LINE;
+        if (off == 0) {
+            continue;
+        }
+        size_t const line_pos = pos - off;
+        size_t const from = line_pos > t->begin[p] ? line_pos : t->begin[p];
+        __builtin_memcpy(job->out + from, t->lines + p * SC_PART_LINE + (from - line_pos), pos - from);
+    }
+#if defined(__x86_64__)
+    // Streaming stores are weakly ordered, make them visible before the
+    // caller gets its partitions back
+    _mm_sfence();
+#endif
+    return NULL;
+}
+
+// One pass on every thread, the caller's included. A thread that can't be
+// started has its share done by the caller.
+static void
+part_pass(struct part_thread *const threads, unsigned const nthreads, bool const scatter)
+{
+    for (unsigned i = 0; i < nthreads; ++i) {
+        threads[i].scatter = scatter;
+    }
+    for (unsigned i = 1; i < nthreads; ++i) {
+        threads[i].started = pthread_create(&threads[i].thread, NULL, part_worker, &threads[i]) == 0;
+    }
+    part_worker(&threads[0]);
+    for (unsigned i = 1; i < nthreads; ++i) {
+        if (threads[i].started) {
+            pthread_join(threads[i].thread, NULL);
+        } else {
+            part_worker(&threads[i]);
+        }
+    }
+}
+
+static void
+part_free(struct part_thread *const threads, unsigned const nthreads)
+{
+    for (unsigned i = 0; i < nthreads; ++i) {
+        free(threads[i].cursor);
+        free(threads[i].lines);
+        free(threads[i].keys);
+    }
+    free(threads);
+}
+
+bool
+spooky_partition(void const*const rows, size_t const row_width, size_t const key_offset,
+    size_t const key_width, size_t const nrows, unsigned const bits, uint64_t const seed,
+    unsigned nthreads, void *const out, size_t *const starts)
+{
+    if (bits < 1 || bits > SPOOKY_PARTITION_MAX_BITS || row_width == 0 || key_offset > row_width
+            || key_width > row_width - key_offset) {
+        return false;
+    }
+    if (nthreads == 0) {
+        long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+    if (nthreads > nrows / SC_PART_MIN_ROWS) {
+        nthreads = nrows / SC_PART_MIN_ROWS > 0 ? nrows / SC_PART_MIN_ROWS : 1;
+    }
+
+    size_t const nparts = (size_t)1 << bits;
+    struct part_job const job = {
+        .rows = rows,
+        .row_width = row_width,
+        .key_offset = key_offset,
+        .key_width = key_width,
+        .bits = bits,
+        .seed = seed,
+        .out = out,
+    };
+    bool const gather = key_width != row_width;
+
+    struct part_thread *const threads = calloc(nthreads, sizeof(*threads));
+    if (threads == NULL) {
+        return false;
+    }
+    for (unsigned i = 0; i < nthreads; ++i) {
+        struct part_thread *const t = &threads[i];
+        t->job = &job;
+        t->first = nrows * i / nthreads;
+        t->last = nrows * (i + 1) / nthreads;
+        t->cursor = calloc(2 * nparts, sizeof(size_t));
+        t->lines = aligned_alloc(SC_PART_LINE, nparts * SC_PART_LINE);
+        t->keys = gather ? malloc(SC_PART_BATCH * key_width + 1) : NULL;
+        if (t->cursor == NULL || t->lines == NULL || (gather && t->keys == NULL)) {
+            part_free(threads, nthreads);
+            return false;
+        }
+        t->begin = t->cursor + nparts;
+    }
+
+    part_pass(threads, nthreads, false);
+
+    size_t total = 0;
+    for (size_t p = 0; p < nparts; ++p) {
+        starts[p] = total;
+        for (unsigned i = 0; i < nthreads; ++i) {
+            size_t const count = threads[i].cursor[p];
+            threads[i].begin[p] = total * row_width;
+            threads[i].cursor[p] = total * row_width;
+            total += count;
+        }
+    }
+    starts[nparts] = total;
+
+    part_pass(threads, nthreads, true);
+
+    part_free(threads, nthreads);
+    return true;
+}
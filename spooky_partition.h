@@ -0,0 +1,33 @@
+#pragma once
+// Spooky Hash
+// Radix partitioning by key hash, the first stage of a parallel hash join or
+// aggregation. Keys are hashed in batches with spooky_hash64_keys, a first
+// pass counts each partition's rows, and a second scatters the rows. Writes
+// go through a cache line buffer per partition and out to memory a whole
+// line at a time with non-temporal stores, so scattering to thousands of
+// partitions doesn't thrash the cache and TLB. Both passes split the rows
+// between threads. Each thread owns its own slice of every partition, so
+// they never write the same bytes.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOKY_PARTITION_MAX_BITS 16
+
+// Scatter nrows rows of row_width bytes from rows to out, grouped into
+// 2^bits partitions by the top bits of spooky_hash64(key, key_width, seed),
+// where the key is the key_width bytes at key_offset in each row. Partition
+// p is out rows [starts[p], starts[p + 1]), in their input order, and starts
+// has 2^bits + 1 entries. out must not overlap rows. nthreads of 0 uses
+// every online CPU. Returns false, with out untouched, if bits isn't 1 to
+// SPOOKY_PARTITION_MAX_BITS, the key isn't inside a row of at least a byte,
+// or memory is short.
+bool spooky_partition(void const*rows, size_t row_width, size_t key_offset, size_t key_width,
+    size_t nrows, unsigned bits, uint64_t seed, unsigned nthreads, void *out, size_t *starts);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,510 @@
+// Spooky Hash
+// The hashing service. Submitted requests go on one FIFO, and the tasks they
+// are cut into go on the deque of the worker that cut them: the owner pushes
+// and pops at the back, thieves take from the front, where the biggest
+// pieces of a split tree are. A worker mostly takes from the FIFO, so new
+// requests get started between the slices of a big one, now and then from
+// its own deque, and only steals when both are empty. Each deque has its own lock, the FIFO
+// and sleeping share the service's.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spooky_service.h"
+
+// How often a worker busy with new requests turns to its own deque instead
+#define SC_SVC_OWN_TURN 4
+
+enum svc_state {
+    SVC_QUEUED,
+    SVC_DONE,
+};
+
+enum svc_kind {
+    // Hash the whole request in one go
+    SVC_WHOLE,
+    // The next slice of a stream, from req->pos
+    SVC_STREAM,
+    // Set up a tree, then hash its chunks
+    SVC_TREE,
+    // Chunks [first, first+count) of a tree
+    SVC_CHUNKS,
+};
+
+struct svc_task {
+    enum svc_kind kind;
+    spooky_request_t *req;
+    size_t first;
+    size_t count;
+};
+
+struct svc_deque {
+    pthread_mutex_t lock;
+    struct svc_task *tasks;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+struct svc_worker {
+    spooky_service_t *s;
+    struct svc_deque dq;
+    pthread_t thread;
+    uint32_t rng;
+    unsigned turn;
+};
+
+struct spooky_service {
+    pthread_mutex_t lock;
+    // Workers with nothing to do, submitters waiting for room, and callers
+    // of spooky_service_wait
+    pthread_cond_t work;
+    pthread_cond_t room;
+    pthread_cond_t done;
+    spooky_request_t *fifo_head;
+    spooky_request_t *fifo_tail;
+    size_t max_pending;
+    size_t slice;
+    bool stopping;
+    // Touched without the lock
+    size_t nqueued;
+    size_t ntasks;
+    size_t inflight;
+    unsigned nsleeping;
+    unsigned nwaiting;
+    unsigned nworkers;
+    unsigned nstarted;
+    struct svc_worker *workers;
+};
+
+static bool
+dq_push(struct svc_deque *const dq, struct svc_task const*const task)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        // Slide what's left to the front, and grow if it takes up half
+        size_t const n = dq->tail - dq->head;
+        if (dq->head > 0) {
+            memmove(dq->tasks, dq->tasks + dq->head, n * sizeof(*dq->tasks));
+        }
+        dq->head = 0;
+        dq->tail = n;
+        if (n * 2 >= dq->cap) {
+            size_t const cap = dq->cap == 0 ? 64 : dq->cap * 2;
+            struct svc_task *const tasks = realloc(dq->tasks, cap * sizeof(*tasks));
+            if (tasks == NULL) {
+                pthread_mutex_unlock(&dq->lock);
+                return false;
+            }
+            dq->tasks = tasks;
+            dq->cap = cap;
+        }
+    }
+    dq->tasks[dq->tail++] = *task;
+    pthread_mutex_unlock(&dq->lock);
+    return true;
+}
+
+static bool
+dq_pop(struct svc_deque *const dq, bool const back, struct svc_task *const task)
+{
+    pthread_mutex_lock(&dq->lock);
+    bool const any = dq->head < dq->tail;
+    if (any) {
+        *task = back ? dq->tasks[--dq->tail] : dq->tasks[dq->head++];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return any;
+}
+
+static void
+svc_wake(spooky_service_t *const s)
+{
+    if (__atomic_load_n(&s->nsleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->work);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void svc_run(struct svc_worker *w, struct svc_task *task);
+
+// Queue a task for w, or for want of memory do it now
+static void
+svc_push(struct svc_worker *const w, struct svc_task *const task)
+{
+    spooky_service_t *const s = w->s;
+    if (!dq_push(&w->dq, task)) {
+        svc_run(w, task);
+        return;
+    }
+    __atomic_add_fetch(&s->ntasks, 1, __ATOMIC_SEQ_CST);
+    svc_wake(s);
+}
+
+static void
+svc_finish(spooky_service_t *const s, spooky_request_t *const req)
+{
+    if (req->done != NULL) {
+        req->done(req);
+        return;
+    }
+    __atomic_store_n(&req->state, SVC_DONE, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->nwaiting, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_broadcast(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void
+svc_complete(spooky_service_t *const s, spooky_request_t *const req)
+{
+    svc_finish(s, req);
+
+    pthread_mutex_lock(&s->lock);
+    size_t const inflight = __atomic_sub_fetch(&s->inflight, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&s->room);
+    if (inflight == 0 && s->stopping) {
+        pthread_cond_broadcast(&s->work);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void
+svc_run(struct svc_worker *const w, struct svc_task *const task)
+{
+    spooky_service_t *const s = w->s;
+    spooky_request_t *const req = task->req;
+    uint8_t const*const buf = req->buf;
+
+    switch (task->kind) {
+        case SVC_WHOLE:
+            if (req->tree) {
+                spooky_tree_hash128(buf, req->len, SPOOKY_TREE_CHUNK, 1, &req->h1, &req->h2);
+            } else {
+                spooky_hash128(buf, req->len, &req->h1, &req->h2);
+            }
+            svc_complete(s, req);
+            return;
+
+        case SVC_STREAM:
+            if (req->pos == 0) {
+                spooky_init(&req->sc, req->h1, req->h2);
+            }
+            for (;;) {
+                size_t const left = req->len - req->pos;
+                size_t const n = left < s->slice ? left : s->slice;
+                spooky_update(&req->sc, buf + req->pos, n);
+                req->pos += n;
+                if (req->pos == req->len) {
+                    spooky_final(&req->sc, &req->h1, &req->h2);
+                    svc_complete(s, req);
+                    return;
+                }
+                // Behind whatever's been submitted meanwhile
+                if (dq_push(&w->dq, task)) {
+                    __atomic_add_fetch(&s->ntasks, 1, __ATOMIC_SEQ_CST);
+                    svc_wake(s);
+                    return;
+                }
+            }
+
+        case SVC_TREE: {
+            size_t const nchunks = (req->len - 1) / SPOOKY_TREE_CHUNK + 1;
+            req->leaves = malloc((2 * nchunks + 2) * sizeof(uint64_t));
+            if (req->leaves == NULL) {
+                task->kind = SVC_WHOLE;
+                svc_run(w, task);
+                return;
+            }
+            req->pending = nchunks;
+            task->kind = SVC_CHUNKS;
+            task->first = 0;
+            task->count = nchunks;
+        }
+            // Fall through
+        case SVC_CHUNKS:
+            // Leave the other half of the range for whoever wants it
+            while (task->count > 1) {
+                size_t const half = task->count / 2;
+                struct svc_task rest = {SVC_CHUNKS, req, task->first + half, task->count - half};
+                task->count = half;
+                svc_push(w, &rest);
+            }
+            {
+                size_t const off = task->first * SPOOKY_TREE_CHUNK;
+                size_t const left = req->len - off;
+                uint64_t h1 = req->h1;
+                uint64_t h2 = req->h2;
+                spooky_hash128(buf + off, left < SPOOKY_TREE_CHUNK ? left : SPOOKY_TREE_CHUNK, &h1, &h2);
+                req->leaves[2 * task->first] = h1;
+                req->leaves[2 * task->first + 1] = h2;
+            }
+            if (__atomic_sub_fetch(&req->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+                size_t const nchunks = (req->len - 1) / SPOOKY_TREE_CHUNK + 1;
+                req->leaves[2 * nchunks] = req->len;
+                req->leaves[2 * nchunks + 1] = SPOOKY_TREE_CHUNK;
+                spooky_hash128(req->leaves, (2 * nchunks + 2) * sizeof(uint64_t), &req->h1, &req->h2);
+                free(req->leaves);
+                req->leaves = NULL;
+                svc_complete(s, req);
+            }
+            return;
+    }
+}
+
+// A new request off the FIFO, as its first task
+static bool
+svc_take_new(spooky_service_t *const s, struct svc_task *const task)
+{
+    if (__atomic_load_n(&s->nqueued, __ATOMIC_SEQ_CST) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    spooky_request_t *const req = s->fifo_head;
+    if (req != NULL) {
+        s->fifo_head = req->next;
+        if (s->fifo_head == NULL) {
+            s->fifo_tail = NULL;
+        }
+        __atomic_sub_fetch(&s->nqueued, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (req == NULL) {
+        return false;
+    }
+
+    task->req = req;
+    if (req->tree) {
+        task->kind = req->len > SPOOKY_TREE_CHUNK ? SVC_TREE : SVC_WHOLE;
+    } else {
+        task->kind = req->len > s->slice ? SVC_STREAM : SVC_WHOLE;
+    }
+    return true;
+}
+
+static bool
+svc_take_own(struct svc_worker *const w, struct svc_task *const task)
+{
+    if (!dq_pop(&w->dq, true, task)) {
+        return false;
+    }
+    __atomic_sub_fetch(&w->s->ntasks, 1, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+// The next task for w. New requests come first, but w's own work gets every
+// SC_SVC_OWN_TURN'th turn, so a flood of new requests can't hold up the rest
+// of the big ones for good. Failing both, steal.
+static bool
+svc_take(struct svc_worker *const w, struct svc_task *const task)
+{
+    spooky_service_t *const s = w->s;
+
+    if (++w->turn < SC_SVC_OWN_TURN) {
+        if (svc_take_new(s, task) || svc_take_own(w, task)) {
+            return true;
+        }
+    } else {
+        w->turn = 0;
+        if (svc_take_own(w, task) || svc_take_new(s, task)) {
+            return true;
+        }
+    }
+
+    if (__atomic_load_n(&s->ntasks, __ATOMIC_SEQ_CST) > 0) {
+        w->rng = w->rng * 1103515245 + 12345;
+        unsigned const start = (w->rng >> 16) % s->nworkers;
+        for (unsigned i = 0; i < s->nworkers; ++i) {
+            struct svc_worker *const victim = &s->workers[(start + i) % s->nworkers];
+            if (victim != w && dq_pop(&victim->dq, false, task)) {
+                __atomic_sub_fetch(&s->ntasks, 1, __ATOMIC_SEQ_CST);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void *
+svc_worker(void *const arg)
+{
+    struct svc_worker *const w = arg;
+    spooky_service_t *const s = w->s;
+
+    for (;;) {
+        struct svc_task task;
+        if (svc_take(w, &task)) {
+            svc_run(w, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        __atomic_add_fetch(&s->nsleeping, 1, __ATOMIC_SEQ_CST);
+        while (s->fifo_head == NULL && __atomic_load_n(&s->ntasks, __ATOMIC_SEQ_CST) == 0
+                && !(s->stopping && __atomic_load_n(&s->inflight, __ATOMIC_SEQ_CST) == 0)) {
+            pthread_cond_wait(&s->work, &s->lock);
+        }
+        __atomic_sub_fetch(&s->nsleeping, 1, __ATOMIC_SEQ_CST);
+        bool const stop = s->stopping && __atomic_load_n(&s->inflight, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&s->lock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+spooky_service_t *
+spooky_service_new(struct spooky_service_opts const*const opts)
+{
+    struct spooky_service_opts o = {0, 0, 0};
+    if (opts != NULL) {
+        o = *opts;
+    }
+    if (o.nthreads == 0) {
+        long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        o.nthreads = ncpus > 0 ? ncpus : 1;
+    }
+
+    spooky_service_t *const s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->workers = calloc(o.nthreads, sizeof(*s->workers));
+    if (s->workers == NULL) {
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->room, NULL);
+    pthread_cond_init(&s->done, NULL);
+    s->max_pending = o.max_pending != 0 ? o.max_pending : SPOOKY_SERVICE_MAX_PENDING;
+    s->slice = o.slice != 0 ? o.slice : SPOOKY_SERVICE_SLICE;
+
+    // Workers look at each other's deques, so they all have to exist before
+    // any of them starts. One whose thread didn't start just never has
+    // anything on its deque.
+    s->nworkers = o.nthreads;
+    for (unsigned i = 0; i < o.nthreads; ++i) {
+        struct svc_worker *const w = &s->workers[i];
+        w->s = s;
+        w->rng = i + 1;
+        pthread_mutex_init(&w->dq.lock, NULL);
+    }
+    for (; s->nstarted < o.nthreads; ++s->nstarted) {
+        struct svc_worker *const w = &s->workers[s->nstarted];
+        if (pthread_create(&w->thread, NULL, svc_worker, w) != 0) {
+            break;
+        }
+    }
+    if (s->nstarted == 0) {
+        spooky_service_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void
+spooky_service_free(spooky_service_t *const s)
+{
+    if (s == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->stopping = true;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+
+    for (unsigned i = 0; i < s->nworkers; ++i) {
+        if (i < s->nstarted) {
+            pthread_join(s->workers[i].thread, NULL);
+        }
+        free(s->workers[i].dq.tasks);
+        pthread_mutex_destroy(&s->workers[i].dq.lock);
+    }
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->room);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+    free(s->workers);
+    free(s);
+}
+
+static bool
+svc_submit(spooky_service_t *const s, spooky_request_t *const req, bool const wait)
+{
+    // Short messages cost less to hash than to hand over
+    if (req->len < SC_BUFSIZE) {
+        req->state = SVC_QUEUED;
+        if (req->tree) {
+            spooky_tree_hash128(req->buf, req->len, SPOOKY_TREE_CHUNK, 1, &req->h1, &req->h2);
+        } else {
+            spooky_hash128(req->buf, req->len, &req->h1, &req->h2);
+        }
+        svc_finish(s, req);
+        return true;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    while (__atomic_load_n(&s->inflight, __ATOMIC_SEQ_CST) >= s->max_pending) {
+        if (!wait) {
+            pthread_mutex_unlock(&s->lock);
+            return false;
+        }
+        pthread_cond_wait(&s->room, &s->lock);
+    }
+    req->state = SVC_QUEUED;
+    req->next = NULL;
+    req->pos = 0;
+    req->leaves = NULL;
+    if (s->fifo_tail != NULL) {
+        s->fifo_tail->next = req;
+    } else {
+        s->fifo_head = req;
+    }
+    s->fifo_tail = req;
+    __atomic_add_fetch(&s->inflight, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&s->nqueued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->nsleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_signal(&s->work);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return true;
+}
+
+void
+spooky_service_submit(spooky_service_t *const s, spooky_request_t *const req)
+{
+    svc_submit(s, req, true);
+}
+
+bool
+spooky_service_try_submit(spooky_service_t *const s, spooky_request_t *const req)
+{
+    return svc_submit(s, req, false);
+}
+
+bool
+spooky_request_is_done(spooky_request_t const*const req)
+{
+    return __atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == SVC_DONE;
+}
+
+void
+spooky_service_wait(spooky_service_t *const s, spooky_request_t *const req)
+{
+    if (spooky_request_is_done(req)) {
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    __atomic_add_fetch(&s->nwaiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&req->state, __ATOMIC_SEQ_CST) != SVC_DONE) {
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+    __atomic_sub_fetch(&s->nwaiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&s->lock);
+}
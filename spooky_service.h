@@ -0,0 +1,79 @@
+#pragma once
+// Spooky Hash
+// An asynchronous hashing service for a stream of buffers of very different
+// sizes. Requests are hashed by a pool of worker threads, each with its own
+// deque of tasks, and idle workers steal from the others. Short requests are
+// hashed by the caller on the spot. Big ones are cut into tasks of about
+// SPOOKY_SERVICE_SLICE bytes: slices of a stream, with new requests started
+// between them, or chunks of a tree hash, which any idle worker can take.
+// Either way a small request waits for a slice's worth of work on each
+// worker, never for a whole big one.
+
+#include "spooky.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOKY_SERVICE_MAX_PENDING 1024
+#define SPOOKY_SERVICE_SLICE (UINT64_C(1) << 20)
+
+struct spooky_service_opts {
+    // Worker threads, 0 is one per online CPU
+    unsigned nthreads;
+    // Requests in the service at once before submit waits (or try_submit
+    // refuses), 0 for SPOOKY_SERVICE_MAX_PENDING
+    size_t max_pending;
+    // Bytes hashed per stream task, 0 for SPOOKY_SERVICE_SLICE and
+    // SIZE_MAX for never splitting a stream
+    size_t slice;
+};
+
+typedef struct spooky_service spooky_service_t;
+typedef struct spooky_request spooky_request_t;
+
+// Called on whichever thread finished the request, the submitter's for a
+// short one. The service doesn't touch the request again after calling it.
+typedef void spooky_request_done_fn(spooky_request_t *req);
+
+// The caller owns requests and fills in the first part. It mustn't touch a
+// request, or its buffer, between submitting it and it being done.
+struct spooky_request {
+    void const*buf;
+    size_t len;
+    // Seeds on submit and the hash once done. It's spooky_hash128 of buf,
+    // or with tree set spooky_tree_hash128 with SPOOKY_TREE_CHUNK chunks.
+    uint64_t h1;
+    uint64_t h2;
+    bool tree;
+    // NULL to wait for the request with spooky_service_wait instead
+    spooky_request_done_fn *done;
+    void *arg;
+
+    // The rest belongs to the service
+    int state;
+    spooky_request_t *next;
+    size_t pos;
+    size_t pending;
+    uint64_t *leaves;
+    spooky_context_t sc;
+};
+
+// NULL if the threads or memory couldn't be had. opts may be NULL for the
+// defaults.
+spooky_service_t *spooky_service_new(struct spooky_service_opts const*opts);
+// Waits for every submitted request to be done first
+void spooky_service_free(spooky_service_t *s);
+
+// Start hashing req. Waits while max_pending requests are in the service.
+void spooky_service_submit(spooky_service_t *s, spooky_request_t *req);
+// The same, but returns false and leaves req alone rather than wait
+bool spooky_service_try_submit(spooky_service_t *s, spooky_request_t *req);
+// For a request without a done callback: whether it's done, and waiting
+// until it is
+bool spooky_request_is_done(spooky_request_t const*req);
+void spooky_service_wait(spooky_service_t *s, spooky_request_t *req);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,152 @@
+// Spooky Hash
+// Tree mode: fixed-size chunks hashed independently, on as many threads as
+// asked for, with the chunk hashes combined into one root hash. The layout is
+// documented with spooky_tree_hash128 in spooky.h, it must never depend on
+// how many threads did the work.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "spooky.h"
+
+// Chunks a worker claims at a time. Enough to fill every SIMD lane in
+// spooky_hash128_multi, few enough to keep the threads evenly loaded.
+#define SC_TREE_BATCH 16
+
+struct tree_job {
+    uint8_t const*msg;
+    size_t len;
+    size_t chunk_size;
+    size_t nchunks;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t *leaves;
+    size_t next;
+};
+
+// Hash chunks [first, first+count) into h1/h2
+static void
+tree_hash_chunks(struct tree_job const*const job, size_t const first, size_t const count,
+    uint64_t *const h1, uint64_t *const h2)
+{
+    void const*msgs[SC_TREE_BATCH];
+    size_t lens[SC_TREE_BATCH];
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t const off = (first + i) * job->chunk_size;
+        size_t const remaining = job->len - off;
+        msgs[i] = job->msg + off;
+        lens[i] = remaining < job->chunk_size ? remaining : job->chunk_size;
+        h1[i] = job->seed0;
+        h2[i] = job->seed1;
+    }
+
+    spooky_hash128_multi(msgs, lens, count, h1, h2);
+}
+
+static void *
+tree_worker(void *const arg)
+{
+    struct tree_job *const job = arg;
+
+    for (;;) {
+        size_t const first = __atomic_fetch_add(&job->next, SC_TREE_BATCH, __ATOMIC_RELAXED);
+        if (first >= job->nchunks) {
+            break;
+        }
+        size_t const left = job->nchunks - first;
+        size_t const count = left < SC_TREE_BATCH ? left : SC_TREE_BATCH;
+
+        uint64_t h1[SC_TREE_BATCH];
+        uint64_t h2[SC_TREE_BATCH];
+        tree_hash_chunks(job, first, count, h1, h2);
+        for (size_t i = 0; i < count; ++i) {
+            job->leaves[2*(first + i)] = h1[i];
+            job->leaves[2*(first + i) + 1] = h2[i];
+        }
+    }
+
+    return NULL;
+}
+
+void
+spooky_tree_hash128(void const*const msg, size_t const len, size_t chunk_size,
+    unsigned nthreads, uint64_t *const ph1, uint64_t *const ph2)
+{
+    if (chunk_size == 0) {
+        chunk_size = SPOOKY_TREE_CHUNK;
+    }
+    if (nthreads == 0) {
+        long const ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+
+    struct tree_job job = {
+        .msg = msg,
+        .len = len,
+        .chunk_size = chunk_size,
+        // An empty message is still one (empty) chunk
+        .nchunks = len == 0 ? 1 : (len - 1) / chunk_size + 1,
+        .seed0 = *ph1,
+        .seed1 = *ph2,
+        .leaves = NULL,
+        .next = 0,
+    };
+
+    size_t const nbatches = (job.nchunks - 1) / SC_TREE_BATCH + 1;
+    if (nthreads > nbatches) {
+        nthreads = nbatches;
+    }
+
+    uint64_t const trailer[2] = {len, chunk_size};
+
+    if (nthreads > 1) {
+        job.leaves = malloc((2 * job.nchunks + 2) * sizeof(uint64_t));
+    }
+
+    if (job.leaves != NULL) {
+        pthread_t *const threads = malloc((nthreads - 1) * sizeof(pthread_t));
+        unsigned nstarted = 0;
+        if (threads != NULL) {
+            for (; nstarted < nthreads - 1; ++nstarted) {
+                if (pthread_create(&threads[nstarted], NULL, tree_worker, &job) != 0) {
+                    // Whatever we did start, plus this thread, will get
+                    // through the chunks anyway.
+                    break;
+                }
+            }
+        }
+        tree_worker(&job);
+        for (unsigned i = 0; i < nstarted; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+
+        job.leaves[2 * job.nchunks] = trailer[0];
+        job.leaves[2 * job.nchunks + 1] = trailer[1];
+        spooky_hash128(job.leaves, (2 * job.nchunks + 2) * sizeof(uint64_t), ph1, ph2);
+        free(job.leaves);
+        return;
+    }
+
+    // Single threaded, or out of memory: stream the leaf hashes straight into
+    // the root instead of keeping them all.
+    spooky_context_t root;
+    spooky_init(&root, job.seed0, job.seed1);
+    for (size_t first = 0; first < job.nchunks; first += SC_TREE_BATCH) {
+        size_t const left = job.nchunks - first;
+        size_t const count = left < SC_TREE_BATCH ? left : SC_TREE_BATCH;
+
+        uint64_t h1[SC_TREE_BATCH];
+        uint64_t h2[SC_TREE_BATCH];
+        uint64_t leaves[2 * SC_TREE_BATCH];
+        tree_hash_chunks(&job, first, count, h1, h2);
+        for (size_t i = 0; i < count; ++i) {
+            leaves[2*i] = h1[i];
+            leaves[2*i + 1] = h2[i];
+        }
+        spooky_update(&root, leaves, count * 2 * sizeof(uint64_t));
+    }
+    spooky_update(&root, trailer, sizeof(trailer));
+    spooky_final(&root, ph1, ph2);
+}
@@ -0,0 +1,583 @@
+// spookysum: print or check 128-bit SpookyHash checksums of files, in the
+// style of md5sum. The checksum of a file is spooky_hash128 of its contents
+// with both seeds 0, printed as h1 then h2 in hex.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spooky.h"
+
+// Size of the aligned buffer each worker reads into
+#define READ_BUFSIZE (UINT64_C(4) << 20)
+// With --stats, mapped files are faulted in and hashed this much at a time so
+// the two can be timed separately.
+#define MAP_WINDOW (UINT64_C(8) << 20)
+
+struct file_job {
+    char *name;
+    // --check only
+    uint64_t expected[2];
+    uint64_t hash[2];
+    // 0 on success, otherwise the errno that stopped us
+    int err;
+    bool done;
+};
+
+struct stats {
+    uint64_t bytes;
+    uint64_t io_ns;
+    uint64_t hash_ns;
+};
+
+struct pool {
+    struct file_job *jobs;
+    size_t njobs;
+    size_t next;
+    bool use_mmap;
+    bool want_stats;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct stats stats;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static int
+hash_fd_read(int const fd, uint8_t *const buf, spooky_context_t *const sc, struct stats *const st)
+{
+    for (;;) {
+        uint64_t const t0 = now_ns();
+        ssize_t const n = read(fd, buf, READ_BUFSIZE);
+        uint64_t const t1 = now_ns();
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        spooky_update(sc, buf, n);
+        st->io_ns += t1 - t0;
+        st->hash_ns += now_ns() - t1;
+        st->bytes += n;
+    }
+}
+
+// Where a worker hashing a mapped file goes if the file is truncated under
+// it, and touching the pages past the new end raises SIGBUS
+static __thread sigjmp_buf *map_jmp;
+
+static void
+on_sigbus(int const sig)
+{
+    if (map_jmp != NULL) {
+        siglongjmp(*map_jmp, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Returns -1 if the file can't be mapped, or shrank while it was being
+// hashed, and has to be read instead
+static int
+hash_fd_mmap(int const fd, size_t const size, bool const want_stats,
+    spooky_context_t *const sc, struct stats *const st)
+{
+    uint8_t *const map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    sigjmp_buf jmp;
+    if (sigsetjmp(jmp, 1) != 0) {
+        map_jmp = NULL;
+        munmap(map, size);
+        spooky_init(sc, 0, 0);
+        return -1;
+    }
+    map_jmp = &jmp;
+    // Both are hints only, and MADV_HUGEPAGE is refused by most filesystems
+    madvise(map, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    if (!want_stats) {
+        uint64_t const t0 = now_ns();
+        spooky_update(sc, map, size);
+        st->hash_ns += now_ns() - t0;
+    } else {
+        long const pagesize = sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size; off += MAP_WINDOW) {
+            size_t const len = (size - off) < MAP_WINDOW ? (size - off) : MAP_WINDOW;
+
+            // Touch every page of the window so that waiting on the disk
+            // shows up as I/O time and not as hashing time.
+            uint64_t const t0 = now_ns();
+            uint8_t volatile sink = 0;
+            for (size_t p = 0; p < len; p += pagesize) {
+                sink += map[off + p];
+            }
+            (void)sink;
+            uint64_t const t1 = now_ns();
+            spooky_update(sc, map + off, len);
+            st->io_ns += t1 - t0;
+            st->hash_ns += now_ns() - t1;
+        }
+    }
+    map_jmp = NULL;
+    st->bytes += size;
+
+    munmap(map, size);
+    return 0;
+}
+
+static void
+hash_file(struct pool const*const pool, struct file_job *const job, uint8_t *const buf,
+    struct stats *const st)
+{
+    bool const is_stdin = strcmp(job->name, "-") == 0;
+    int const fd = is_stdin ? STDIN_FILENO : open(job->name, O_RDONLY);
+    if (fd < 0) {
+        job->err = errno;
+        return;
+    }
+
+    spooky_context_t sc;
+    spooky_init(&sc, 0, 0);
+
+    // Files that say they're empty are read anyway, procfs and sysfs files
+    // report a size of 0 whatever they hold
+    int err = -1;
+    struct stat sb;
+    if (pool->use_mmap && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        err = hash_fd_mmap(fd, sb.st_size, pool->want_stats, &sc, st);
+    }
+    if (err < 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        err = hash_fd_read(fd, buf, &sc, st);
+    }
+
+    if (!is_stdin) {
+        close(fd);
+    }
+
+    job->err = err;
+    if (err == 0) {
+        spooky_final(&sc, &job->hash[0], &job->hash[1]);
+    }
+}
+
+static void *
+worker(void *const arg)
+{
+    struct pool *const pool = arg;
+    struct stats st = {0};
+
+    uint8_t *buf = NULL;
+    if (posix_memalign((void **)&buf, 4096, READ_BUFSIZE) != 0) {
+        buf = NULL;
+    }
+
+    for (;;) {
+        size_t const i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->njobs) {
+            break;
+        }
+        struct file_job *const job = &pool->jobs[i];
+
+        if (buf == NULL) {
+            job->err = ENOMEM;
+        } else {
+            hash_file(pool, job, buf, &st);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.bytes += st.bytes;
+    pool->stats.io_ns += st.io_ns;
+    pool->stats.hash_ns += st.hash_ns;
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void
+wait_for(struct pool *const pool, struct file_job const*const job)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done) {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// File names with backslashes or newlines are escaped the way md5sum does it,
+// and their lines marked with a leading backslash.
+static bool
+needs_escape(char const*const name)
+{
+    return strpbrk(name, "\\\n") != NULL;
+}
+
+static void
+print_name(char const*name)
+{
+    for (; *name != '\0'; ++name) {
+        if (*name == '\\') {
+            fputs("\\\\", stdout);
+        } else if (*name == '\n') {
+            fputs("\\n", stdout);
+        } else {
+            putchar(*name);
+        }
+    }
+}
+
+static bool
+unescape_name(char *const name)
+{
+    char *out = name;
+    for (char const*in = name; *in != '\0'; ++in) {
+        if (*in != '\\') {
+            *out++ = *in;
+            continue;
+        }
+        ++in;
+        if (*in == '\\') {
+            *out++ = '\\';
+        } else if (*in == 'n') {
+            *out++ = '\n';
+        } else {
+            return false;
+        }
+    }
+    *out = '\0';
+    return true;
+}
+
+static bool
+parse_hex64(char const*const s, uint64_t *const out)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 16; ++i) {
+        char const c = s[i];
+        unsigned d;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            d = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            d = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        v = (v << 4) | d;
+    }
+    *out = v;
+    return true;
+}
+
+// Append the "hash  name" lines of a checksum file to jobs. Returns the
+// number of lines that couldn't be parsed, or -1 if the file can't be read.
+// A file with no lines that parse is an error, which the caller spots by
+// njobs not growing.
+static long
+read_checkfile(char const*const path, struct file_job **const jobs, size_t *const njobs,
+    size_t *const cap)
+{
+    FILE *const f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    long bad = 0;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &linecap, f)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+
+        char *p = line;
+        bool const escaped = (*p == '\\');
+        if (escaped) {
+            ++p;
+        }
+
+        uint64_t h1;
+        uint64_t h2;
+        // 32 hex digits, a space, then a space or '*' for binary mode
+        if (strlen(p) < 35 || !parse_hex64(p, &h1) || !parse_hex64(p + 16, &h2)
+            || p[32] != ' ' || (p[33] != ' ' && p[33] != '*')) {
+            ++bad;
+            continue;
+        }
+        char *const name = strdup(p + 34);
+        if (name == NULL || (escaped && !unescape_name(name))) {
+            free(name);
+            ++bad;
+            continue;
+        }
+
+        if (*njobs == *cap) {
+            *cap = *cap ? 2 * *cap : 64;
+            *jobs = realloc(*jobs, *cap * sizeof(**jobs));
+            if (*jobs == NULL) {
+                perror("spookysum");
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*jobs)[(*njobs)++] = (struct file_job){
+            .name = name,
+            .expected = {h1, h2},
+        };
+    }
+
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+    return bad;
+}
+
+static void
+usage(FILE *const out)
+{
+    fprintf(out,
+        "Usage: spookysum [OPTION]... [FILE]...\n"
+        "Print or check 128-bit SpookyHash checksums.\n"
+        "With no FILE, or when FILE is -, read standard input.\n"
+        "\n"
+        "  -c, --check      read checksums from the FILEs and check them\n"
+        "  -j, --jobs=N     hash up to N files at once (default: one per CPU)\n"
+        "      --read       read files instead of mapping them\n"
+        "      --stats      report throughput and the I/O / hashing time split\n"
+        "                   on standard error\n"
+        "  -h, --help       display this help and exit\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    enum { OPT_READ = 256, OPT_STATS };
+    static struct option const longopts[] = {
+        {"check", no_argument, NULL, 'c'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"read", no_argument, NULL, OPT_READ},
+        {"stats", no_argument, NULL, OPT_STATS},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    bool check = false;
+    long njobs_opt = 0;
+    struct pool pool = {
+        .use_mmap = true,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "cj:h", longopts, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                check = true;
+                break;
+            case 'j':
+                njobs_opt = strtol(optarg, NULL, 0);
+                if (njobs_opt <= 0) {
+                    fprintf(stderr, "spookysum: invalid number of jobs '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_READ:
+                pool.use_mmap = false;
+                break;
+            case OPT_STATS:
+                pool.want_stats = true;
+                break;
+            case 'h':
+                usage(stdout);
+                return EXIT_SUCCESS;
+            default:
+                usage(stderr);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char *stdin_name[] = {"-"};
+    char **files = argv + optind;
+    int nfiles = argc - optind;
+    if (nfiles == 0) {
+        files = stdin_name;
+        nfiles = 1;
+    }
+
+    int status = EXIT_SUCCESS;
+    size_t cap = 0;
+    if (check) {
+        for (int i = 0; i < nfiles; ++i) {
+            size_t const before = pool.njobs;
+            long const bad = read_checkfile(files[i], &pool.jobs, &pool.njobs, &cap);
+            if (bad < 0) {
+                fprintf(stderr, "spookysum: %s: %s\n", files[i], strerror(errno));
+                status = EXIT_FAILURE;
+            } else if (pool.njobs == before) {
+                fprintf(stderr, "spookysum: %s: no properly formatted checksum lines found\n",
+                    files[i]);
+                status = EXIT_FAILURE;
+            } else if (bad > 0) {
+                fprintf(stderr, "spookysum: WARNING: %ld line%s improperly formatted in %s\n",
+                    bad, bad == 1 ? " is" : "s are", files[i]);
+            }
+        }
+    } else {
+        pool.jobs = calloc(nfiles, sizeof(*pool.jobs));
+        if (pool.jobs == NULL) {
+            perror("spookysum");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < nfiles; ++i) {
+            pool.jobs[i].name = files[i];
+        }
+        pool.njobs = nfiles;
+    }
+
+    if (njobs_opt == 0) {
+        njobs_opt = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    size_t nworkers = njobs_opt > 0 ? (size_t)njobs_opt : 1;
+    if (nworkers > pool.njobs) {
+        nworkers = pool.njobs;
+    }
+
+    // The handler only jumps for a worker in the middle of a mapped file
+    struct sigaction sa = {.sa_handler = on_sigbus};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+
+    uint64_t const start = now_ns();
+
+    pthread_t *const threads = calloc(nworkers ? nworkers : 1, sizeof(pthread_t));
+    size_t nstarted = 0;
+    for (; threads != NULL && nstarted < nworkers; ++nstarted) {
+        if (pthread_create(&threads[nstarted], NULL, worker, &pool) != 0) {
+            break;
+        }
+    }
+    if (nstarted == 0 && pool.njobs > 0) {
+        fprintf(stderr, "spookysum: unable to start any worker threads\n");
+        return EXIT_FAILURE;
+    }
+
+    // Print in the order the files were given, whichever order the workers
+    // finish them in.
+    size_t nmismatch = 0;
+    size_t nunreadable = 0;
+    for (size_t i = 0; i < pool.njobs; ++i) {
+        struct file_job *const job = &pool.jobs[i];
+        wait_for(&pool, job);
+
+        if (job->err != 0) {
+            fprintf(stderr, "spookysum: %s: %s\n", job->name, strerror(job->err));
+            if (check) {
+                if (needs_escape(job->name)) {
+                    putchar('\\');
+                }
+                print_name(job->name);
+                printf(": FAILED open or read\n");
+            }
+            ++nunreadable;
+            continue;
+        }
+
+        if (needs_escape(job->name)) {
+            putchar('\\');
+        }
+        if (check) {
+            bool const ok = job->hash[0] == job->expected[0] && job->hash[1] == job->expected[1];
+            print_name(job->name);
+            printf(": %s\n", ok ? "OK" : "FAILED");
+            nmismatch += !ok;
+        } else {
+            printf("%016" PRIx64 "%016" PRIx64 "  ", job->hash[0], job->hash[1]);
+            print_name(job->name);
+            putchar('\n');
+        }
+    }
+
+    for (size_t i = 0; i < nstarted; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    uint64_t const wall_ns = now_ns() - start;
+
+    if (nunreadable > 0) {
+        if (check) {
+            fprintf(stderr, "spookysum: WARNING: %zu listed file%s could not be read\n",
+                nunreadable, nunreadable == 1 ? "" : "s");
+        }
+        status = EXIT_FAILURE;
+    }
+    if (nmismatch > 0) {
+        fprintf(stderr, "spookysum: WARNING: %zu computed checksum%s did NOT match\n",
+            nmismatch, nmismatch == 1 ? "" : "s");
+        status = EXIT_FAILURE;
+    }
+
+    if (pool.want_stats) {
+        fflush(stdout);
+        struct stats const*const st = &pool.stats;
+        uint64_t const busy_ns = st->io_ns + st->hash_ns;
+        fprintf(stderr, "files:      %zu\n", pool.njobs);
+        fprintf(stderr, "workers:    %zu\n", nstarted);
+        fprintf(stderr, "bytes:      %" PRIu64 "\n", st->bytes);
+        fprintf(stderr, "wall time:  %.3f s\n", wall_ns / 1e9);
+        fprintf(stderr, "throughput: %.3f MB/s\n", wall_ns ? st->bytes * 1e3 / wall_ns : 0.0);
+        fprintf(stderr, "I/O wait:   %.3f s (%.1f%% of worker time)\n",
+            st->io_ns / 1e9, busy_ns ? 100.0 * st->io_ns / busy_ns : 0.0);
+        fprintf(stderr, "hashing:    %.3f s (%.1f%% of worker time, %.3f MB/s per worker)\n",
+            st->hash_ns / 1e9, busy_ns ? 100.0 * st->hash_ns / busy_ns : 0.0,
+            st->hash_ns ? st->bytes * 1e3 / st->hash_ns : 0.0);
+    }
+
+    if (check) {
+        for (size_t i = 0; i < pool.njobs; ++i) {
+            free(pool.jobs[i].name);
+        }
+    }
+    free(pool.jobs);
+
+    return status;
+}
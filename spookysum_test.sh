@@ -0,0 +1,60 @@
+#!/bin/sh
+# Checks for spookysum: hashing through every path, --check round trips,
+# escaped names and the error exits. Run from the directory spookysum was
+# built in, or pass its path as $1.
+
+SPOOKYSUM=$(realpath "${1:-./spookysum}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "SPOOKYSUM TEST FAILED: $*"
+    exit 1
+}
+
+empty=232706fc6bf509198b72ee65b4e851c7
+
+# Mapped, read and piped, and empty files, all hash the same
+head -c 100000 /dev/urandom > data
+: > empty
+mapped=$("$SPOOKYSUM" data | cut -c1-32)
+read=$("$SPOOKYSUM" --read data | cut -c1-32)
+piped=$(cat data | "$SPOOKYSUM" | cut -c1-32)
+[ "$mapped" = "$read" ] && [ "$mapped" = "$piped" ] || fail "data hashes differ"
+[ "$mapped" != "$empty" ] || fail "data hashed as empty"
+[ "$("$SPOOKYSUM" empty | cut -c1-32)" = "$empty" ] || fail "empty file"
+
+# procfs files say they're empty, but aren't
+proc=$("$SPOOKYSUM" /proc/version | cut -c1-32)
+[ "$proc" = "$(cat /proc/version | "$SPOOKYSUM" | cut -c1-32)" ] || fail "procfs file"
+[ "$proc" != "$empty" ] || fail "procfs file hashed as empty"
+
+# Names with a backslash or a newline are escaped, and the line marked
+nl='new
+line'
+cp data 'back\slash'
+cp data "$nl"
+line=$("$SPOOKYSUM" 'back\slash')
+[ "$line" = "\\$mapped  back\\\\slash" ] || fail "escaped name: $line"
+
+# Round trip through --check, then with one file changed
+"$SPOOKYSUM" data empty 'back\slash' "$nl" > sums || fail "hashing for --check"
+"$SPOOKYSUM" -c sums > out || fail "--check of unchanged files"
+[ "$(grep -c ': OK$' out)" = 4 ] || fail "--check output: $(cat out)"
+echo x >> data
+"$SPOOKYSUM" -c sums > out 2> /dev/null && fail "--check passed a changed file"
+grep -qx 'data: FAILED' out || fail "--check didn't name the changed file"
+
+# Missing files fail, and the --check line escapes the name
+"$SPOOKYSUM" missing > /dev/null 2>&1 && fail "missing file"
+rm "$nl"
+"$SPOOKYSUM" -c sums > out 2> /dev/null && fail "--check passed a missing file"
+grep -qx '\\new\\nline: FAILED open or read' out || fail "missing file line: $(cat out)"
+
+# A checkfile with nothing to check is an error, not a pass
+printf 'garbage\n' > bad
+"$SPOOKYSUM" -c bad > /dev/null 2>&1 && fail "--check of a file with no checksums"
+"$SPOOKYSUM" -c missing > /dev/null 2>&1 && fail "--check of a missing file"
+
+echo "SPOOKYSUM TEST PASSED!"